@@ -0,0 +1,64 @@
+-- Large binary benchmark for erlang_cnode
+-- Run with: psql -d testdb -f bench_binary.sql
+-- Make sure an Erlang node is running with: erl -sname testnode -setcookie cookie123
+
+\echo '=== Large binary throughput ==='
+CREATE EXTENSION IF NOT EXISTS erlang_cnode;
+
+\set node_name 'testnode@127.0.1.1'
+\set cookie 'cookie123'
+
+SELECT erlang_connect(:'node_name', :'cookie');
+
+CREATE OR REPLACE FUNCTION pg_temp.bench_binary(node text, size integer, iterations integer)
+RETURNS void AS $$
+DECLARE
+    payload bytea := convert_to(repeat('x', size), 'UTF8');
+    etf bytea := '\x836d'::bytea || int4send(size) || payload;
+    started timestamptz;
+    decode_s double precision;
+    send_s double precision;
+    receive_s double precision;
+    mb double precision := size::double precision * iterations / 1048576;
+    result jsonb;
+BEGIN
+    -- Decode only: ETF binary -> jsonb string, no network
+    started := clock_timestamp();
+    FOR i IN 1..iterations LOOP
+        result := erlang_etf_to_jsonb(etf);
+    END LOOP;
+    decode_s := extract(epoch FROM clock_timestamp() - started);
+
+    -- bytea argument -> Erlang binary
+    started := clock_timestamp();
+    FOR i IN 1..iterations LOOP
+        result := erlang_call_with_binary(node, 'erlang', 'byte_size', '[]'::jsonb, payload, 30000);
+    END LOOP;
+    send_s := extract(epoch FROM clock_timestamp() - started);
+    IF result <> to_jsonb(size) THEN
+        RAISE EXCEPTION 'byte_size returned %, expected %', result, size;
+    END IF;
+
+    -- Erlang binary result -> jsonb string
+    started := clock_timestamp();
+    FOR i IN 1..iterations LOOP
+        result := erlang_call(node, 'binary', 'copy', jsonb_build_array('{"$type": "binary", "data": "x"}'::jsonb, size), 30000);
+    END LOOP;
+    receive_s := extract(epoch FROM clock_timestamp() - started);
+    IF length(result #>> '{}') <> size THEN
+        RAISE EXCEPTION 'binary:copy returned % bytes, expected %', length(result #>> '{}'), size;
+    END IF;
+
+    RAISE NOTICE '% x %: decode % MB/s, send % MB/s, receive % MB/s',
+        lpad(pg_size_pretty(size::bigint), 8), iterations,
+        round((mb / greatest(decode_s, 1e-6))::numeric, 1),
+        round((mb / greatest(send_s, 1e-6))::numeric, 1),
+        round((mb / greatest(receive_s, 1e-6))::numeric, 1);
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pg_temp.bench_binary(:'node_name', 1024, 1000);
+SELECT pg_temp.bench_binary(:'node_name', 1024 * 1024, 50);
+SELECT pg_temp.bench_binary(:'node_name', 64 * 1024 * 1024, 3);
+
+SELECT erlang_disconnect(:'node_name');
@@ -0,0 +1,67 @@
+-- ETF decode benchmark for erlang_cnode
+-- Run with: psql -d testdb -f bench_etf_decode.sql
+-- No Erlang node is needed; terms are built in SQL and decoded in-process.
+
+\echo '=== ETF decode throughput ==='
+CREATE EXTENSION IF NOT EXISTS erlang_cnode;
+
+-- Decode etf `iterations` times and report MB/s of ETF consumed
+CREATE OR REPLACE FUNCTION pg_temp.bench_etf_decode(label text, etf bytea, iterations integer)
+RETURNS void AS $$
+DECLARE
+    started timestamptz;
+    elapsed double precision;
+    result jsonb;
+BEGIN
+    started := clock_timestamp();
+    FOR i IN 1..iterations LOOP
+        result := erlang_etf_to_jsonb(etf);
+    END LOOP;
+    elapsed := extract(epoch FROM clock_timestamp() - started);
+    RAISE NOTICE '% % bytes x %: % s, % MB/s',
+        rpad(label, 24), length(etf), iterations, round(elapsed::numeric, 3),
+        round((length(etf)::numeric * iterations / 1048576) / greatest(elapsed, 1e-6)::numeric, 1);
+END;
+$$ LANGUAGE plpgsql;
+
+-- [0, 1, ..., 255, 0, ...]: 100k small integers
+SELECT pg_temp.bench_etf_decode('100k small integers',
+    '\x836c'::bytea || int4send(100000)
+        || (SELECT string_agg('\x61'::bytea || set_byte('\x00'::bytea, 0, i % 256), ''::bytea)
+            FROM generate_series(1, 100000) i)
+        || '\x6a'::bytea,
+    20);
+
+-- [<<"0000000000000001">>, ...]: 100k 16-byte binaries
+SELECT pg_temp.bench_etf_decode('100k binaries',
+    '\x836c'::bytea || int4send(100000)
+        || (SELECT string_agg('\x6d'::bytea || int4send(16) || convert_to(lpad(i::text, 16, '0'), 'UTF8'), ''::bytea)
+            FROM generate_series(1, 100000) i)
+        || '\x6a'::bytea,
+    20);
+
+-- [{row, I, 'ok'}, ...]: 50k tuples of integer and atom
+SELECT pg_temp.bench_etf_decode('50k tuples',
+    '\x836c'::bytea || int4send(50000)
+        || (SELECT string_agg('\x68037703726f77'::bytea || '\x62'::bytea || int4send(i) || '\x77026f6b'::bytea, ''::bytea)
+            FROM generate_series(1, 50000) i)
+        || '\x6a'::bytea,
+    20);
+
+-- [#{id => I, name => <<"user_I">>}, ...]: 20k maps
+SELECT pg_temp.bench_etf_decode('20k maps',
+    '\x836c'::bytea || int4send(20000)
+        || (SELECT string_agg('\x740000000277026964'::bytea || '\x62'::bytea || int4send(i)
+                              || '\x77046e616d65'::bytea || '\x6d'::bytea || int4send(length('user_' || i))
+                              || convert_to('user_' || i, 'UTF8'), ''::bytea)
+            FROM generate_series(1, 20000) i)
+        || '\x6a'::bytea,
+    20);
+
+-- Deeply nested: [[[...[]...]]] 1000 levels
+SELECT pg_temp.bench_etf_decode('1000-deep nested lists',
+    '\x83'::bytea
+        || (SELECT string_agg('\x6c00000001'::bytea, ''::bytea) FROM generate_series(1, 1000))
+        || '\x6a'::bytea
+        || (SELECT string_agg('\x6a'::bytea, ''::bytea) FROM generate_series(1, 1000)),
+    200);
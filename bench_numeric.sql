@@ -0,0 +1,58 @@
+-- Numeric conversion benchmark for erlang_cnode
+-- Run with: psql -d testdb -f bench_numeric.sql
+-- Reports the per-value cost of encoding jsonb numbers to ETF and decoding
+-- them back, next to the numeric -> float8 conversion the encoder used to do
+-- for every number.
+
+\echo '=== Numeric conversion cost per value ==='
+CREATE EXTENSION IF NOT EXISTS erlang_cnode;
+
+CREATE OR REPLACE FUNCTION pg_temp.bench_numeric(label text, doc jsonb, iterations integer)
+RETURNS void AS $$
+DECLARE
+    n integer := jsonb_array_length(doc);
+    etf bytea;
+    started timestamptz;
+    encode_s double precision;
+    decode_s double precision;
+    float8_s double precision;
+    total double precision;
+BEGIN
+    started := clock_timestamp();
+    FOR i IN 1..iterations LOOP
+        etf := erlang_jsonb_to_etf(doc);
+    END LOOP;
+    encode_s := extract(epoch FROM clock_timestamp() - started);
+
+    started := clock_timestamp();
+    FOR i IN 1..iterations LOOP
+        PERFORM erlang_etf_to_jsonb(etf);
+    END LOOP;
+    decode_s := extract(epoch FROM clock_timestamp() - started);
+
+    -- Former encoder path: one numeric -> float8 conversion per number
+    started := clock_timestamp();
+    FOR i IN 1..iterations LOOP
+        SELECT sum((v::numeric)::float8) INTO total FROM jsonb_array_elements_text(doc) v;
+    END LOOP;
+    float8_s := extract(epoch FROM clock_timestamp() - started);
+
+    RAISE NOTICE '% encode % ns/value, decode % ns/value, numeric_float8 alone % ns/value',
+        rpad(label, 20),
+        round((encode_s * 1e9 / (n::double precision * iterations))::numeric, 1),
+        round((decode_s * 1e9 / (n::double precision * iterations))::numeric, 1),
+        round((float8_s * 1e9 / (n::double precision * iterations))::numeric, 1);
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pg_temp.bench_numeric('small integers',
+    (SELECT jsonb_agg(i % 1000) FROM generate_series(1, 100000) i), 10);
+
+SELECT pg_temp.bench_numeric('snowflake IDs',
+    (SELECT jsonb_agg(1152921504606846976::int8 + i * 4194304) FROM generate_series(1, 100000) i), 10);
+
+SELECT pg_temp.bench_numeric('128-bit integers',
+    (SELECT jsonb_agg(340282366920938463463374607431768211455::numeric - i) FROM generate_series(1, 100000) i), 10);
+
+SELECT pg_temp.bench_numeric('decimals',
+    (SELECT jsonb_agg(i / 7.0) FROM generate_series(1, 100000) i), 10);
@@ -0,0 +1,401 @@
+/*
+ * Shared result cache
+ * Replies of erlang_call for the Module:Function pairs listed in
+ * erlang_cnode.cache_functions are kept in a shared hash for the listed
+ * TTL, keyed by node (or node group), Module:Function and the jsonb
+ * arguments, so every backend answers repeated lookups without a round
+ * trip. Entries are fixed-size slots of erlang_cnode.cache_entry_size bytes
+ * holding the arguments and the result; larger results are not cached.
+ * Invalidation bumps a generation counter so that a reply fetched before
+ * an invalidation is never stored after it. Requires erlang_cnode in
+ * shared_preload_libraries; otherwise nothing is cached.
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "access/htup_details.h"
+#include "common/hashfn.h"
+#include "port/atomics.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/jsonb.h"
+#include "utils/timestamp.h"
+#include "utils/varlena.h"
+#include "erlang_cnode.h"
+
+typedef struct {
+    char node_name[MAX_NODE_NAME];
+    char module[MAX_MFA_NAME];
+    char function[MAX_MFA_NAME];
+    uint64 args_hash;
+    uint32 args_len;
+} ErlangCacheKey;
+
+typedef struct {
+    ErlangCacheKey key;
+    TimestampTz expires_at;
+    uint32 result_len;
+    char data[FLEXIBLE_ARRAY_MEMBER];  // Arguments (jsonb), then the result (jsonb)
+} ErlangCacheEntry;
+
+typedef struct {
+    LWLock *lock;
+    uint64 generation;      // Bumped by every invalidation
+    pg_atomic_uint64 hits;  // Updated without the lock
+    pg_atomic_uint64 misses;
+    int64 stores;           // The rest under the exclusive lock
+    int64 evictions;
+    int64 invalidations;
+} ErlangCacheShared;
+
+// One erlang_cnode.cache_functions entry; function "*" matches the whole module
+typedef struct {
+    char module[MAX_MFA_NAME];
+    char function[MAX_MFA_NAME];
+    int ttl_ms;
+} ErlangCacheRule;
+
+typedef struct {
+    int nrules;
+    ErlangCacheRule rules[FLEXIBLE_ARRAY_MEMBER];
+} ErlangCacheRules;
+
+static int erlang_cache_max = 1000;
+static int erlang_cache_entry_size = 8192;
+static char *erlang_cache_functions = NULL;
+static ErlangCacheRules *erlang_cache_rules = NULL;
+static ErlangCacheShared *erlang_cache = NULL;
+static HTAB *erlang_cache_hash = NULL;
+
+static Size erlang_cache_entry_bytes(void) {
+    return MAXALIGN(offsetof(ErlangCacheEntry, data) + erlang_cache_entry_size);
+}
+
+static Size erlang_cache_shmem_size(void) {
+    return add_size(MAXALIGN(sizeof(ErlangCacheShared)),
+                    hash_estimate_size(erlang_cache_max, erlang_cache_entry_bytes()));
+}
+
+static void erlang_cache_shmem_request(void) {
+    if (erlang_cache_max > 0) {
+        RequestAddinShmemSpace(erlang_cache_shmem_size());
+        RequestNamedLWLockTranche("erlang_cnode cache", 1);
+    }
+}
+
+// Called from the shmem startup hook with AddinShmemInitLock held
+static void erlang_cache_shmem_init(void) {
+    HASHCTL info;
+    bool found;
+
+    if (erlang_cache_max == 0) {
+        return;
+    }
+    erlang_cache = ShmemInitStruct("erlang_cnode cache", sizeof(ErlangCacheShared), &found);
+    if (!found) {
+        memset(erlang_cache, 0, sizeof(ErlangCacheShared));
+        pg_atomic_init_u64(&erlang_cache->hits, 0);
+        pg_atomic_init_u64(&erlang_cache->misses, 0);
+        erlang_cache->lock = &(GetNamedLWLockTranche("erlang_cnode cache"))->lock;
+    }
+
+    memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(ErlangCacheKey);
+    info.entrysize = erlang_cache_entry_bytes();
+    erlang_cache_hash = ShmemInitHash("erlang_cnode cache hash", erlang_cache_max, erlang_cache_max,
+                                      &info, HASH_ELEM | HASH_BLOBS);
+}
+
+/*
+ * Parse erlang_cnode.cache_functions, e.g. "config:get=5s, flags:*=500".
+ * The parsed rules are handed to the assign hook as the GUC's extra.
+ */
+static bool erlang_check_cache_functions(char **newval, void **extra, GucSource source) {
+    char *rawstring = pstrdup(*newval);
+    List *entries;
+    ListCell *lc;
+    ErlangCacheRules *rules;
+    bool ok = SplitGUCList(rawstring, ',', &entries);
+
+    if (!ok) {
+        GUC_check_errdetail("List syntax is invalid.");
+        list_free(entries);
+        pfree(rawstring);
+        return false;
+    }
+
+    // GUC extras must be malloc'd; the GUC machinery frees them
+    rules = malloc(offsetof(ErlangCacheRules, rules) + sizeof(ErlangCacheRule) * Max(list_length(entries), 1));
+    if (rules == NULL) {
+        list_free(entries);
+        pfree(rawstring);
+        return false;
+    }
+    rules->nrules = 0;
+    foreach(lc, entries) {
+        char *entry = (char *) lfirst(lc);
+        char *colon = strchr(entry, ':');
+        char *eq = strchr(entry, '=');
+        ErlangCacheRule *rule = &rules->rules[rules->nrules];
+        const char *hintmsg = NULL;
+
+        if (colon == NULL || eq == NULL || colon == entry || eq < colon + 2 ||
+            colon - entry >= MAX_MFA_NAME || eq - colon - 1 >= MAX_MFA_NAME) {
+            GUC_check_errdetail("Entry \"%s\" is not Module:Function=TTL or Module:*=TTL.", entry);
+            ok = false;
+            break;
+        }
+        if (!parse_int(eq + 1, &rule->ttl_ms, GUC_UNIT_MS, &hintmsg) || rule->ttl_ms <= 0) {
+            GUC_check_errdetail("Entry \"%s\" does not have a positive TTL.", entry);
+            ok = false;
+            break;
+        }
+        strlcpy(rule->module, entry, colon - entry + 1);
+        strlcpy(rule->function, colon + 1, eq - colon);
+        rules->nrules++;
+    }
+    list_free(entries);
+    pfree(rawstring);
+
+    if (!ok) {
+        free(rules);
+        return false;
+    }
+    *extra = rules;
+    return true;
+}
+
+static void erlang_assign_cache_functions(const char *newval, void *extra) {
+    erlang_cache_rules = (ErlangCacheRules *) extra;
+}
+
+// TTL of Module:Function in milliseconds, or 0 if its results are not cached
+static int erlang_cache_ttl(const char *module, const char *function) {
+    int i;
+
+    if (erlang_cache == NULL || erlang_cache_rules == NULL) {
+        return 0;
+    }
+    for (i = 0; i < erlang_cache_rules->nrules; i++) {
+        ErlangCacheRule *rule = &erlang_cache_rules->rules[i];
+
+        if (strcmp(rule->module, module) == 0 &&
+            (strcmp(rule->function, "*") == 0 || strcmp(rule->function, function) == 0)) {
+            return rule->ttl_ms;
+        }
+    }
+    return 0;
+}
+
+static void erlang_cache_key(ErlangCacheKey *key, const char *node_name, const char *module,
+                             const char *function, Jsonb *args) {
+    memset(key, 0, sizeof(ErlangCacheKey));
+    strlcpy(key->node_name, node_name, MAX_NODE_NAME);
+    strlcpy(key->module, module, MAX_MFA_NAME);
+    strlcpy(key->function, function, MAX_MFA_NAME);
+    key->args_len = VARSIZE(args) - VARHDRSZ;
+    key->args_hash = hash_bytes_extended((const unsigned char *) VARDATA(args), key->args_len, 0);
+}
+
+/*
+ * Cached result of a call, or NULL on a miss. *generation is set for a
+ * later erlang_cache_store of the fetched result.
+ */
+static Jsonb *erlang_cache_lookup(const char *node_name, const char *module, const char *function,
+                                  Jsonb *args, uint64 *generation) {
+    ErlangCacheKey key;
+    ErlangCacheEntry *entry;
+    Jsonb *result = NULL;
+
+    erlang_cache_key(&key, node_name, module, function, args);
+
+    LWLockAcquire(erlang_cache->lock, LW_SHARED);
+    *generation = erlang_cache->generation;
+    entry = (ErlangCacheEntry *) hash_search(erlang_cache_hash, &key, HASH_FIND, NULL);
+    if (entry != NULL && entry->expires_at > GetCurrentTimestamp() &&
+        memcmp(entry->data, VARDATA(args), key.args_len) == 0) {
+        result = (Jsonb *) palloc(VARHDRSZ + entry->result_len);
+        SET_VARSIZE(result, VARHDRSZ + entry->result_len);
+        memcpy(VARDATA(result), entry->data + key.args_len, entry->result_len);
+    }
+    LWLockRelease(erlang_cache->lock);
+
+    pg_atomic_fetch_add_u64(result != NULL ? &erlang_cache->hits : &erlang_cache->misses, 1);
+    return result;
+}
+
+// Make room for one entry: drop expired entries, else the one closest to expiry
+static void erlang_cache_evict(void) {
+    HASH_SEQ_STATUS seq;
+    ErlangCacheEntry *entry;
+    ErlangCacheEntry *victim = NULL;
+    TimestampTz now = GetCurrentTimestamp();
+    bool freed = false;
+
+    hash_seq_init(&seq, erlang_cache_hash);
+    while ((entry = (ErlangCacheEntry *) hash_seq_search(&seq)) != NULL) {
+        if (entry->expires_at <= now) {
+            hash_search(erlang_cache_hash, &entry->key, HASH_REMOVE, NULL);
+            erlang_cache->evictions++;
+            freed = true;
+        } else if (victim == NULL || entry->expires_at < victim->expires_at) {
+            victim = entry;
+        }
+    }
+    if (!freed && victim != NULL) {
+        hash_search(erlang_cache_hash, &victim->key, HASH_REMOVE, NULL);
+        erlang_cache->evictions++;
+    }
+}
+
+// True for a {badrpc, Reason} result, which decodes to ["badrpc", Reason]
+static bool erlang_cache_is_badrpc(Jsonb *result) {
+    JsonbValue *first;
+
+    if (!JB_ROOT_IS_ARRAY(result) || JB_ROOT_IS_SCALAR(result) || JB_ROOT_COUNT(result) != 2) {
+        return false;
+    }
+    first = getIthJsonbValueFromContainer(&result->root, 0);
+    return first != NULL && first->type == jbvString && first->val.string.len == 6 &&
+           memcmp(first->val.string.val, "badrpc", 6) == 0;
+}
+
+// Keep a result for ttl_ms unless an invalidation happened since the lookup; errors are not kept
+static void erlang_cache_store(const char *node_name, const char *module, const char *function,
+                               Jsonb *args, Jsonb *result, int ttl_ms, uint64 generation) {
+    ErlangCacheKey key;
+    ErlangCacheEntry *entry;
+    uint32 result_len = VARSIZE(result) - VARHDRSZ;
+
+    if ((Size) (VARSIZE(args) - VARHDRSZ) + result_len > (Size) erlang_cache_entry_size ||
+        erlang_cache_is_badrpc(result)) {
+        return;
+    }
+    erlang_cache_key(&key, node_name, module, function, args);
+
+    LWLockAcquire(erlang_cache->lock, LW_EXCLUSIVE);
+    if (erlang_cache->generation == generation) {
+        if (hash_get_num_entries(erlang_cache_hash) >= erlang_cache_max &&
+            hash_search(erlang_cache_hash, &key, HASH_FIND, NULL) == NULL) {
+            erlang_cache_evict();
+        }
+        entry = (ErlangCacheEntry *) hash_search(erlang_cache_hash, &key, HASH_ENTER_NULL, NULL);
+        if (entry != NULL) {
+            entry->expires_at = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), ttl_ms);
+            entry->result_len = result_len;
+            memcpy(entry->data, VARDATA(args), key.args_len);
+            memcpy(entry->data + key.args_len, VARDATA(result), result_len);
+            erlang_cache->stores++;
+        }
+    }
+    LWLockRelease(erlang_cache->lock);
+}
+
+// Drop the cached results of Module:Function (every function if function is NULL)
+static int64 erlang_cache_drop(const char *module, const char *function) {
+    HASH_SEQ_STATUS seq;
+    ErlangCacheEntry *entry;
+    int64 removed = 0;
+
+    LWLockAcquire(erlang_cache->lock, LW_EXCLUSIVE);
+    erlang_cache->generation++;
+    erlang_cache->invalidations++;
+    hash_seq_init(&seq, erlang_cache_hash);
+    while ((entry = (ErlangCacheEntry *) hash_seq_search(&seq)) != NULL) {
+        if ((module == NULL || strcmp(entry->key.module, module) == 0) &&
+            (function == NULL || strcmp(entry->key.function, function) == 0)) {
+            hash_search(erlang_cache_hash, &entry->key, HASH_REMOVE, NULL);
+            removed++;
+        }
+    }
+    LWLockRelease(erlang_cache->lock);
+    return removed;
+}
+
+/*
+ * Apply an invalidation pushed from Erlang to the ingest node:
+ * {erlang_cache_invalidate, Module, Function}, with '_' for every function,
+ * or {erlang_cache_invalidate, Module}. Returns false for any other message.
+ */
+static bool erlang_cache_invalidation_message(ei_x_buff *buf) {
+    char tag[MAXATOMLEN];
+    char module[MAXATOMLEN];
+    char function[MAXATOMLEN];
+    int index = 0;
+    int version;
+    int arity;
+
+    if (ei_decode_version(buf->buff, &index, &version) < 0) {
+        index = 0;
+    }
+    if (ei_decode_tuple_header(buf->buff, &index, &arity) < 0 || (arity != 2 && arity != 3) ||
+        ei_decode_atom(buf->buff, &index, tag) < 0 || strcmp(tag, "erlang_cache_invalidate") != 0 ||
+        ei_decode_atom(buf->buff, &index, module) < 0) {
+        return false;
+    }
+    if (arity == 3 && ei_decode_atom(buf->buff, &index, function) < 0) {
+        return false;
+    }
+    if (erlang_cache != NULL) {
+        int64 removed = erlang_cache_drop(module, arity == 3 && strcmp(function, "_") != 0 ? function : NULL);
+
+        elog(DEBUG1, "erlang_cnode cache: %s:%s invalidated from Erlang, %ld entries dropped",
+             module, arity == 3 ? function : "_", (long) removed);
+    }
+    return true;
+}
+
+static void erlang_cache_require(void) {
+    if (erlang_cache == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("erlang_cnode must be loaded via shared_preload_libraries to cache results"),
+                 errhint("erlang_cnode.cache_max_entries must also be above zero.")));
+    }
+}
+
+// Drop cached results; a NULL function means the whole module
+PG_FUNCTION_INFO_V1(erlang_cache_invalidate);
+Datum erlang_cache_invalidate(PG_FUNCTION_ARGS) {
+    char *module;
+    char *function = NULL;
+
+    erlang_cache_require();
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_INT64(erlang_cache_drop(NULL, NULL));
+    }
+    module = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    if (!PG_ARGISNULL(1)) {
+        function = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    }
+    PG_RETURN_INT64(erlang_cache_drop(module, function));
+}
+
+// Cache size and counters since startup
+PG_FUNCTION_INFO_V1(erlang_cache_stats);
+Datum erlang_cache_stats(PG_FUNCTION_ARGS) {
+    TupleDesc tupdesc;
+    Datum values[6];
+    bool nulls[6];
+
+    erlang_cache_require();
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR, (errmsg("return type must be a row type")));
+    }
+
+    memset(nulls, 0, sizeof(nulls));
+    LWLockAcquire(erlang_cache->lock, LW_SHARED);
+    values[0] = Int64GetDatum(hash_get_num_entries(erlang_cache_hash));
+    values[1] = Int64GetDatum((int64) pg_atomic_read_u64(&erlang_cache->hits));
+    values[2] = Int64GetDatum((int64) pg_atomic_read_u64(&erlang_cache->misses));
+    values[3] = Int64GetDatum(erlang_cache->stores);
+    values[4] = Int64GetDatum(erlang_cache->evictions);
+    values[5] = Int64GetDatum(erlang_cache->invalidations);
+    LWLockRelease(erlang_cache->lock);
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
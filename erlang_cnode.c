@@ -5,8 +5,20 @@
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
 #include "miscadmin.h"
+#include "storage/ipc.h"
+#include "utils/guc.h"
 #include "erlang_cnode.h"
 #include "utils/json.h"
+#include "catalog/pg_type.h"
+#include "funcapi.h"
+#include "utils/array.h"
+#include "utils/timestamp.h"
+#include "utils/varlena.h"
+#include "storage/fd.h"
+#include "common/pg_prng.h"
+#include "access/parallel.h"
+#include "executor/executor.h"
+#include "storage/dsm.h"
 
 // Forward declaration for jsonb_erlang_converter functions  
 static Jsonb *erlang_term_to_jsonb(ei_x_buff *buf);
@@ -19,7 +31,10 @@ static Jsonb *erlang_term_to_jsonb(ei_x_buff *buf);
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <ctype.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #ifndef ETIMEDOUT
 #define ETIMEDOUT 110
 #endif
@@ -29,8 +44,118 @@ PG_MODULE_MAGIC;
 // Global connection map
 static HTAB *connection_map = NULL;
 
+// Nodes, cookie and cookie file used when connecting without erlang_connect
+static char *erlang_nodes = NULL;
+static char *erlang_cookie = NULL;
+static char *erlang_cookie_file = NULL;
+static bool erlang_preconnect = false;
+
+/*
+ * Nodes connected to with erlang_connect, one node=cookie per line. The list
+ * is kept in session memory, so a rollback does not lose it, and is handed
+ * to parallel workers in a DSM segment; only the segment's handle goes into
+ * the hidden erlang_cnode.session_segment setting, never a cookie.
+ */
+static char *erlang_session_list = NULL;
+static dsm_segment *erlang_session_seg = NULL;
+static char erlang_session_handle[16] = "";
+static char *erlang_session_segment = NULL;
+static ExecutorStart_hook_type prev_ExecutorStart_hook = NULL;
+
+// Node groups, calls that may be retried on another node, and reconnect backoff
+static char *erlang_node_groups = NULL;
+static char *erlang_idempotent_functions = NULL;
+static int erlang_reconnect_backoff_ms = 100;
+static int erlang_reconnect_backoff_max_ms = 10000;
+
+// Terms from erlang_jsonb_to_etf at least this many bytes long are compressed; zero never compresses
+static int erlang_compress_threshold = 0;
+
+// Reconnect state of a node this backend has connected to (or tried to)
+typedef struct {
+    char node_name[MAX_NODE_NAME];
+    char cookie[MAX_COOKIE];    // Cookie given to erlang_connect, empty for the default
+    int failures;               // Consecutive lost connections and failed attempts
+    TimestampTz retry_at;       // No reconnect attempt before this
+} ErlangNodeHealth;
+
+static HTAB *node_health_map = NULL;
+
+// Limits on requests sent with erlang_send_async
+typedef enum {
+    ERLANG_ASYNC_OVERFLOW_ERROR,
+    ERLANG_ASYNC_OVERFLOW_WAIT
+} ErlangAsyncOverflow;
+
+static const struct config_enum_entry erlang_async_overflow_options[] = {
+    {"error", ERLANG_ASYNC_OVERFLOW_ERROR, false},
+    {"wait", ERLANG_ASYNC_OVERFLOW_WAIT, false},
+    {NULL, 0, false}
+};
+
+static int erlang_max_async_requests = MAX_PENDING_REQUESTS;
+static int erlang_async_request_ttl = 300000;
+static int erlang_async_memory_limit = 65536;
+static int erlang_async_overflow = ERLANG_ASYNC_OVERFLOW_ERROR;
+
+// This backend's C-node identity, shared by all of its direct connections
+static ei_cnode erlang_local_cnode;
+static char erlang_local_cookie[MAX_COOKIE];
+static bool erlang_local_cnode_ready = false;
+
+// Pre-encoded $gen_call/$gen_cast envelopes
+#include "erlang_envelope.c"
+
+// Per node and Module:Function call statistics (pg_stat_erlang_calls)
+#include "erlang_stats.c"
+
+// Shared cache of call results
+#include "erlang_cache.c"
+
+// Latch-aware, non-blocking receive of distribution frames
+#include "erlang_frame.c"
+
+// Shared connection pool (background worker + shm_mq transport)
+#include "erlang_pool.c"
+
+// Inbound message ingestion worker
+#include "erlang_ingest.c"
+
+// The erlang_term type: ETF stored as is, Erlang literal text form, accessors
+#include "erlang_term.c"
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
 // Forward declarations
 static Datum erlang_call_internal(PG_FUNCTION_ARGS, int timeout_ms);
+static bool erlang_check_nodes(char **newval, void **extra, GucSource source);
+static bool erlang_check_node_groups(char **newval, void **extra, GucSource source);
+static bool erlang_check_idempotent_functions(char **newval, void **extra, GucSource source);
+static void erlang_preconnect_nodes(void);
+static void erlang_executor_start(QueryDesc *queryDesc, int eflags);
+
+// Reserve shared memory for the pool, the call statistics and the result cache
+static void erlang_cnode_shmem_request(void) {
+    if (prev_shmem_request_hook) {
+        prev_shmem_request_hook();
+    }
+    erlang_pool_shmem_request();
+    erlang_stats_shmem_request();
+    erlang_cache_shmem_request();
+}
+
+// Attach to (or create) the shared memory areas
+static void erlang_cnode_shmem_startup(void) {
+    if (prev_shmem_startup_hook) {
+        prev_shmem_startup_hook();
+    }
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    erlang_pool_shmem_init();
+    erlang_stats_shmem_init();
+    erlang_cache_shmem_init();
+    LWLockRelease(AddinShmemInitLock);
+}
 
 // Initialize the extension
 void _PG_init(void) {
@@ -45,274 +170,2235 @@ void _PG_init(void) {
     ctl.keysize = MAX_NODE_NAME;
     ctl.entrysize = sizeof(ErlangConnection);
     ctl.hcxt = TopMemoryContext;
-    connection_map = hash_create("ErlangConnections", 16, &ctl, HASH_ELEM | HASH_CONTEXT);
+    connection_map = hash_create("ErlangConnections", 16, &ctl, HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+
+    DefineCustomBoolVariable("erlang_cnode.use_pool",
+                             "Route erlang_call and erlang_cast through the shared connection pool.",
+                             "Requires erlang_cnode in shared_preload_libraries.",
+                             &erlang_use_pool,
+                             false,
+                             PGC_USERSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.pool_slots",
+                            "Maximum number of backends attached to the connection pool at once.",
+                            NULL,
+                            &erlang_pool_slots,
+                            64,
+                            1, MAX_BACKENDS,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.stats_max",
+                            "Maximum number of node and Module:Function pairs tracked in pg_stat_erlang_calls.",
+                            NULL,
+                            &erlang_stats_max,
+                            1000,
+                            16, INT_MAX / 2,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.cache_max_entries",
+                            "Maximum number of call results kept in the shared result cache.",
+                            "Zero disables the cache.",
+                            &erlang_cache_max,
+                            1000,
+                            0, INT_MAX / 2,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.cache_entry_size",
+                            "Space for the arguments and result of one cached call; larger results are not cached.",
+                            NULL,
+                            &erlang_cache_entry_size,
+                            8192,
+                            256, 1024 * 1024,
+                            PGC_POSTMASTER,
+                            GUC_UNIT_BYTE,
+                            NULL, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.cache_functions",
+                               "Module:Function=TTL pairs whose erlang_call results are cached, e.g. config:get=5s.",
+                               "Module:*=TTL caches every function of a module.",
+                               &erlang_cache_functions,
+                               "",
+                               PGC_SUSET,
+                               GUC_LIST_INPUT,
+                               erlang_check_cache_functions, erlang_assign_cache_functions, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.nodes",
+                               "Comma-separated Erlang nodes that are connected to on first use.",
+                               "With erlang_cnode.preconnect they are connected to when the library is loaded.",
+                               &erlang_nodes,
+                               "",
+                               PGC_SUSET,
+                               GUC_LIST_INPUT,
+                               erlang_check_nodes, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.cookie",
+                               "Cookie for connections opened without an explicit one.",
+                               NULL,
+                               &erlang_cookie,
+                               "",
+                               PGC_SUSET,
+                               GUC_SUPERUSER_ONLY,
+                               NULL, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.cookie_file",
+                               "File holding the cookie when erlang_cnode.cookie is empty.",
+                               "Empty uses ~/.erlang.cookie of the server's operating system user.",
+                               &erlang_cookie_file,
+                               "",
+                               PGC_SUSET,
+                               0,
+                               NULL, NULL, NULL);
+
+    DefineCustomBoolVariable("erlang_cnode.preconnect",
+                             "Connect to erlang_cnode.nodes as soon as a backend loads the library.",
+                             "Use with session_preload_libraries.",
+                             &erlang_preconnect,
+                             false,
+                             PGC_SUSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.session_segment",
+                               "Shared memory segment listing the nodes connected to with erlang_connect.",
+                               "Maintained by erlang_connect and erlang_disconnect so parallel workers can connect too.",
+                               &erlang_session_segment,
+                               "",
+                               PGC_SUSET,
+                               GUC_NO_SHOW_ALL | GUC_NOT_IN_SAMPLE | GUC_DISALLOW_IN_FILE | GUC_SUPERUSER_ONLY,
+                               NULL, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.node_groups",
+                               "Logical node names mapped to replica nodes, as name=node1|node2, ...",
+                               "A group name can be used wherever a node name is expected.",
+                               &erlang_node_groups,
+                               "",
+                               PGC_SUSET,
+                               GUC_LIST_INPUT,
+                               erlang_check_node_groups, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.idempotent_functions",
+                               "Module:Function pairs that may be retried on another node after a lost connection.",
+                               "Module:* marks every function of a module.",
+                               &erlang_idempotent_functions,
+                               "",
+                               PGC_USERSET,
+                               GUC_LIST_INPUT,
+                               erlang_check_idempotent_functions, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.reconnect_backoff_ms",
+                            "Delay before reconnecting to a node after a failed attempt; doubles on each failure.",
+                            NULL,
+                            &erlang_reconnect_backoff_ms,
+                            100,
+                            0, 3600000,
+                            PGC_USERSET,
+                            GUC_UNIT_MS,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.reconnect_backoff_max_ms",
+                            "Longest delay between reconnect attempts to a node.",
+                            NULL,
+                            &erlang_reconnect_backoff_max_ms,
+                            10000,
+                            0, 3600000,
+                            PGC_USERSET,
+                            GUC_UNIT_MS,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.compress_threshold",
+                            "Size from which erlang_jsonb_to_etf returns a compressed term, as term_to_binary(T, [compressed]) would.",
+                            "Zero disables compression.",
+                            &erlang_compress_threshold,
+                            0,
+                            0, INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_BYTE,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.max_async_requests",
+                            "Maximum number of erlang_send_async requests awaiting a reply per session.",
+                            NULL,
+                            &erlang_max_async_requests,
+                            MAX_PENDING_REQUESTS,
+                            1, INT_MAX / 2,
+                            PGC_USERSET,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomEnumVariable("erlang_cnode.async_overflow",
+                             "What erlang_send_async does when erlang_cnode.max_async_requests are awaiting a reply.",
+                             "error fails the call; wait blocks until a reply arrives or a request expires.",
+                             &erlang_async_overflow,
+                             ERLANG_ASYNC_OVERFLOW_ERROR,
+                             erlang_async_overflow_options,
+                             PGC_USERSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.async_request_ttl",
+                            "Time after which an uncollected erlang_send_async request and its reply are discarded.",
+                            NULL,
+                            &erlang_async_request_ttl,
+                            300000,
+                            1000, INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_MS,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.async_memory_limit",
+                            "Memory for uncollected erlang_send_async replies per session; the oldest are evicted beyond it.",
+                            NULL,
+                            &erlang_async_memory_limit,
+                            65536,
+                            64, MAX_KILOBYTES,
+                            PGC_USERSET,
+                            GUC_UNIT_KB,
+                            NULL, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.ingest_node",
+                               "Node name under which the ingest worker accepts messages from Erlang.",
+                               "Empty disables the ingest worker. Requires erlang_cnode in shared_preload_libraries.",
+                               &erlang_ingest_node,
+                               "",
+                               PGC_POSTMASTER,
+                               0,
+                               NULL, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.ingest_cookie",
+                               "Cookie Erlang nodes must present to the ingest worker.",
+                               "Empty uses ~/.erlang.cookie of the server's operating system user.",
+                               &erlang_ingest_cookie,
+                               "",
+                               PGC_POSTMASTER,
+                               GUC_SUPERUSER_ONLY,
+                               NULL, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.ingest_database",
+                               "Database the ingest worker writes to.",
+                               NULL,
+                               &erlang_ingest_database,
+                               "postgres",
+                               PGC_POSTMASTER,
+                               0,
+                               NULL, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.ingest_table",
+                               "Table that receives ingested messages, optionally schema-qualified.",
+                               NULL,
+                               &erlang_ingest_table,
+                               "erlang_ingest",
+                               PGC_SIGHUP,
+                               0,
+                               NULL, NULL, NULL);
+
+    DefineCustomStringVariable("erlang_cnode.ingest_column",
+                               "jsonb column of erlang_cnode.ingest_table that receives each message.",
+                               NULL,
+                               &erlang_ingest_column,
+                               "payload",
+                               PGC_SIGHUP,
+                               0,
+                               NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.ingest_batch_size",
+                            "Messages written per INSERT by the ingest worker.",
+                            NULL,
+                            &erlang_ingest_batch_size,
+                            1000,
+                            1, 1000000,
+                            PGC_SIGHUP,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("erlang_cnode.ingest_flush_ms",
+                            "Longest time a received message waits before its batch is written.",
+                            NULL,
+                            &erlang_ingest_flush_ms,
+                            200,
+                            1, 3600000,
+                            PGC_SIGHUP,
+                            GUC_UNIT_MS,
+                            NULL, NULL, NULL);
+
+    MarkGUCPrefixReserved("erlang_cnode");
+
+    prev_ExecutorStart_hook = ExecutorStart_hook;
+    ExecutorStart_hook = erlang_executor_start;
+
+    if (process_shared_preload_libraries_in_progress) {
+        prev_shmem_request_hook = shmem_request_hook;
+        shmem_request_hook = erlang_cnode_shmem_request;
+        prev_shmem_startup_hook = shmem_startup_hook;
+        shmem_startup_hook = erlang_cnode_shmem_startup;
+        erlang_pool_register_worker();
+        erlang_ingest_register_worker();
+    } else if (erlang_preconnect && IsUnderPostmaster && MyBackendType == B_BACKEND) {
+        erlang_preconnect_nodes();
+    }
 }
 
-// Connect to an Erlang node
-PG_FUNCTION_INFO_V1(erlang_connect);
-Datum erlang_connect(PG_FUNCTION_ARGS) {
-    text *node_name_text;
-    text *cookie_text;
-    char *node_name;
-    char *cookie;
+// True if node_name is listed in erlang_cnode.nodes
+static bool erlang_node_configured(const char *node_name) {
+    char *rawstring;
+    List *nodes;
+    ListCell *lc;
+    bool result = false;
+
+    if (erlang_nodes == NULL || erlang_nodes[0] == '\0') {
+        return false;
+    }
+    rawstring = pstrdup(erlang_nodes);
+    if (SplitGUCList(rawstring, ',', &nodes)) {
+        foreach(lc, nodes) {
+            if (strcmp((char *) lfirst(lc), node_name) == 0) {
+                result = true;
+                break;
+            }
+        }
+    }
+    list_free(nodes);
+    pfree(rawstring);
+    return result;
+}
+
+// In a parallel worker, copy the leader's node list out of its segment on first use
+static void erlang_session_load(void) {
+    static bool loaded = false;
+    dsm_segment *seg;
     MemoryContext oldcontext;
-    MemoryContext tmpcontext;
-    ei_cnode ec;
-    int fd = -1;
-    char cnode_name[256];
-    bool found;
-    ErlangConnection *conn;
 
-    node_name_text = PG_GETARG_TEXT_PP(0);
-    cookie_text = PG_GETARG_TEXT_PP(1);
-    node_name = text_to_cstring(node_name_text);
-    cookie = text_to_cstring(cookie_text);
-    oldcontext = CurrentMemoryContext;
-    tmpcontext = AllocSetContextCreate(CurrentMemoryContext, "ErlangCNodeTemp", ALLOCSET_DEFAULT_SIZES);
-    MemoryContextSwitchTo(tmpcontext);
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+    if (erlang_session_segment == NULL || erlang_session_segment[0] == '\0') {
+        return;
+    }
+    seg = dsm_attach((dsm_handle) strtoul(erlang_session_segment, NULL, 10));
+    if (seg == NULL) {
+        return;
+    }
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    erlang_session_list = pnstrdup(dsm_segment_address(seg), dsm_segment_map_length(seg));
+    MemoryContextSwitchTo(oldcontext);
+    dsm_detach(seg);
+}
 
-    snprintf(cnode_name, sizeof(cnode_name), "pgcnode_%d_%ld@127.0.1.1", getpid(), (long)time(NULL));
-    
-    // Debug: Print the HOME environment variable
-    {
-        char *home = getenv("HOME");
-        if (home) {
-            char cookie_path[512];
-            ereport(NOTICE, (errmsg("C-Node HOME: %s", home)));
-            // Debug: Check if the cookie file exists
-        snprintf(cookie_path, sizeof(cookie_path), "%s/.erlang.cookie", home);
-        ereport(NOTICE, (errmsg("C-Node looking for cookie at: %s", cookie_path)));
-        
-        FILE *f = fopen(cookie_path, "r");
-        if (f) {
-            ereport(NOTICE, (errmsg("Cookie file exists and is readable")));
-            fclose(f);
-        } else {
-            int err = errno;
-            ereport(NOTICE, (errmsg("Cookie file not found or not readable: %s", strerror(err))));
+/*
+ * Point erlang_cnode.session_segment at the current segment. Setting it is
+ * transactional, so this is repeated whenever a rollback has reverted it.
+ */
+static void erlang_session_sync(void) {
+    const char *current = erlang_session_segment != NULL ? erlang_session_segment : "";
+
+    if (strcmp(current, erlang_session_handle) != 0) {
+        SetConfigOption("erlang_cnode.session_segment", erlang_session_handle, PGC_SUSET, PGC_S_SESSION);
+    }
+}
+
+// Republish the node list before a plan can start parallel workers
+static void erlang_executor_start(QueryDesc *queryDesc, int eflags) {
+    if (!IsParallelWorker() && !IsInParallelMode()) {
+        erlang_session_sync();
+    }
+    if (prev_ExecutorStart_hook) {
+        prev_ExecutorStart_hook(queryDesc, eflags);
+    } else {
+        standard_ExecutorStart(queryDesc, eflags);
+    }
+}
+
+/*
+ * Cookie node_name was connected to with by erlang_connect in this session,
+ * or in the leader of this parallel worker ("" for the default); NULL if
+ * it was not.
+ */
+static char *erlang_session_node(const char *node_name) {
+    size_t len = strlen(node_name);
+    const char *line;
+
+    if (IsParallelWorker()) {
+        erlang_session_load();
+    }
+    line = erlang_session_list;
+    while (line != NULL && *line != '\0') {
+        const char *end = strchr(line, '\n');
+
+        if (strncmp(line, node_name, len) == 0 && line[len] == '=') {
+            const char *cookie = line + len + 1;
+
+            return pnstrdup(cookie, end != NULL ? end - cookie : strlen(cookie));
         }
-        } else {
-            ereport(NOTICE, (errmsg("C-Node HOME: not set")));
+        line = end != NULL ? end + 1 : NULL;
+    }
+    return NULL;
+}
+
+// Record node_name in the session's node list, or drop it with a NULL cookie, and republish the list
+static void erlang_set_session_node(const char *node_name, const char *cookie) {
+    StringInfoData buf;
+    size_t len = strlen(node_name);
+    const char *line = erlang_session_list;
+    dsm_segment *seg = NULL;
+
+    initStringInfo(&buf);
+    while (line != NULL && *line != '\0') {
+        const char *end = strchr(line, '\n');
+
+        if (strncmp(line, node_name, len) != 0 || line[len] != '=') {
+            appendBinaryStringInfo(&buf, line, end != NULL ? end - line : strlen(line));
+            appendStringInfoChar(&buf, '\n');
         }
+        line = end != NULL ? end + 1 : NULL;
     }
-    
-    // Try to initialize the C-Node with more detailed error reporting
-    ereport(NOTICE, (errmsg("Attempting to initialize C-Node as: %s", cnode_name)));
-    
-    // Initialize C-Node first
-    snprintf(cnode_name, sizeof(cnode_name), "pgcnode_%d@127.0.1.1", getpid());
-    ereport(NOTICE, (errmsg("Initializing C-Node as: %s", cnode_name)));
-    
-    // Initialize the ei_cnode structure
-    memset(&ec, 0, sizeof(ei_cnode));
-    
-    // Try to set some environment variables that might help
-    setenv("EI_TRACELEVEL", "5", 1);
-    setenv("ERL_EPMD_PORT", "4369", 1);
-    
-    // Initialize the C-Node (old method - removed)
-    
-    ereport(NOTICE, (errmsg("C-Node initialized, now trying connection to: %s", node_name)));
-    
-    // Check if epmd is running and accessible
-    ereport(NOTICE, (errmsg("Checking epmd connectivity...")));
-    
-    // Initialize the C-Node first
-    char *hostname = "127.0.1.1";
-    char *alive = "pgcnode";
-    int creation = 0;
-    
-    int init_result = ei_connect_xinit(&ec, hostname, alive, cnode_name, NULL, cookie, creation);
-    ereport(NOTICE, (errmsg("ei_connect_xinit returned: %d", init_result)));
-    if (init_result < 0) {
-        int err = errno;
-        ereport(ERROR, (errmsg("ei_connect_xinit failed with return value %d: %s (errno: %d)", init_result, strerror(err), err)));
+    if (cookie != NULL) {
+        appendStringInfo(&buf, "%s=%s\n", node_name, cookie);
     }
-    
-    // Now connect to the target node
-    fd = ei_connect(&ec, node_name);
-    ereport(NOTICE, (errmsg("ei_connect returned fd: %d", fd)));
-    if (fd < 0) {
+
+    // The segment lives as long as the session or until the list changes again
+    if (buf.len > 0) {
+        seg = dsm_create(buf.len + 1, 0);
+        dsm_pin_mapping(seg);
+        memcpy(dsm_segment_address(seg), buf.data, buf.len + 1);
+    }
+    if (erlang_session_seg != NULL) {
+        dsm_detach(erlang_session_seg);
+    }
+    erlang_session_seg = seg;
+    if (seg != NULL) {
+        snprintf(erlang_session_handle, sizeof(erlang_session_handle), "%u", dsm_segment_handle(seg));
+    } else {
+        erlang_session_handle[0] = '\0';
+    }
+    if (erlang_session_list != NULL) {
+        pfree(erlang_session_list);
+    }
+    erlang_session_list = MemoryContextStrdup(TopMemoryContext, buf.data);
+    pfree(buf.data);
+    erlang_session_sync();
+}
+
+/*
+ * Cookie for connections made without an explicit one: erlang_cnode.cookie,
+ * else the contents of erlang_cnode.cookie_file, else NULL so that ei reads
+ * ~/.erlang.cookie. Returns false (after reporting at elevel) if the cookie
+ * file cannot be read.
+ */
+static bool erlang_default_cookie(const char **cookie, int elevel) {
+    static char file_cookie[MAX_COOKIE];
+    FILE *f;
+    size_t len;
+
+    *cookie = NULL;
+    if (erlang_cookie != NULL && erlang_cookie[0] != '\0') {
+        *cookie = erlang_cookie;
+        return true;
+    }
+    if (erlang_cookie_file == NULL || erlang_cookie_file[0] == '\0') {
+        return true;
+    }
+
+    f = AllocateFile(erlang_cookie_file, "r");
+    if (f == NULL) {
+        ereport(elevel,
+                (errcode_for_file_access(),
+                 errmsg("could not open Erlang cookie file \"%s\": %m", erlang_cookie_file)));
+        return false;
+    }
+    len = fread(file_cookie, 1, sizeof(file_cookie) - 1, f);
+    FreeFile(f);
+    while (len > 0 && isspace((unsigned char) file_cookie[len - 1])) {
+        len--;
+    }
+    file_cookie[len] = '\0';
+    *cookie = file_cookie;
+    return true;
+}
+
+// The C-node identity this backend connects as; rebuilt only when the cookie changes
+static ei_cnode *erlang_local_identity(const char *cookie, int elevel) {
+    const char *key = cookie != NULL ? cookie : "";
+    char cnode_name[MAX_NODE_NAME];
+
+    if (erlang_local_cnode_ready && strcmp(erlang_local_cookie, key) == 0) {
+        return &erlang_local_cnode;
+    }
+
+    snprintf(cnode_name, sizeof(cnode_name), "pgcnode_%d@127.0.1.1", MyProcPid);
+    memset(&erlang_local_cnode, 0, sizeof(ei_cnode));
+    erlang_local_cnode_ready = false;
+    if (ei_connect_xinit(&erlang_local_cnode, "127.0.1.1", "pgcnode", cnode_name, NULL, (char *) cookie, 0) < 0) {
         int err = errno;
-        ereport(ERROR, (errmsg("ei_connect failed with return value %d: %s (errno: %d)", fd, strerror(err), err)));
+        ereport(elevel, (errmsg("ei_connect_xinit failed for %s: %s", cnode_name, strerror(err))));
+        return NULL;
     }
-    
-    ereport(NOTICE, (errmsg("Connection established successfully")));
+    strlcpy(erlang_local_cookie, key, MAX_COOKIE);
+    erlang_local_cnode_ready = true;
+    return &erlang_local_cnode;
+}
 
-    conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_FIND, &found);
-    if (found) {
-        ereport(NOTICE, (errmsg("Connection already exists with fd: %d, reusing", conn->fd)));
-        MemoryContextSwitchTo(oldcontext);
-        MemoryContextDelete(tmpcontext);
-        pfree(node_name);
-        pfree(cookie);
-        PG_RETURN_BOOL(true);
+// Reconnect state of node_name; NULL if this backend never connected to it
+static ErlangNodeHealth *erlang_node_health(const char *node_name, bool create) {
+    ErlangNodeHealth *health;
+    bool found;
+
+    if (node_health_map == NULL) {
+        HASHCTL ctl;
+
+        if (!create) {
+            return NULL;
+        }
+        MemSet(&ctl, 0, sizeof(ctl));
+        ctl.keysize = MAX_NODE_NAME;
+        ctl.entrysize = sizeof(ErlangNodeHealth);
+        ctl.hcxt = TopMemoryContext;
+        node_health_map = hash_create("ErlangNodeHealth", 16, &ctl, HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
     }
-    
-    // Create new connection entry
-    conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_ENTER, &found);
-    strlcpy(conn->node_name, node_name, MAX_NODE_NAME);
-    strlcpy(conn->cookie, cookie, MAX_COOKIE);
-    conn->fd = fd;
-    ereport(NOTICE, (errmsg("Stored connection fd: %d", conn->fd)));
-    memcpy(&conn->ec, &ec, sizeof(ei_cnode));
+    health = (ErlangNodeHealth *) hash_search(node_health_map, node_name, create ? HASH_ENTER : HASH_FIND, &found);
+    if (create && !found) {
+        strlcpy(health->node_name, node_name, MAX_NODE_NAME);
+        health->cookie[0] = '\0';
+        health->failures = 0;
+        health->retry_at = 0;
+    }
+    return health;
+}
 
-    MemoryContextSwitchTo(oldcontext);
-    MemoryContextDelete(tmpcontext);
-    pfree(node_name);
-    pfree(cookie);
-    PG_RETURN_BOOL(true);
+/*
+ * Count a lost connection or failed attempt. The first reconnect is
+ * immediate so a single dropped connection is invisible to callers; after
+ * that the delay doubles up to erlang_cnode.reconnect_backoff_max_ms. The
+ * delay is drawn from [delay/2, delay] so that backends which lost the same
+ * node do not all come back at the same moment.
+ */
+static void erlang_node_failed(const char *node_name) {
+    ErlangNodeHealth *health = erlang_node_health(node_name, true);
+    int64 delay = 0;
+
+    health->failures++;
+    if (health->failures > 1 && erlang_reconnect_backoff_ms > 0) {
+        int shift = Min(health->failures - 2, 30);
+
+        delay = Min((int64) erlang_reconnect_backoff_ms << shift, (int64) erlang_reconnect_backoff_max_ms);
+        delay = (int64) pg_prng_uint64_range(&pg_global_prng_state, delay / 2, delay);
+    }
+    health->retry_at = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), delay);
+    elog(DEBUG1, "node %s failed %d times, next attempt in %ldms", node_name, health->failures, (long) delay);
 }
 
-// Call a remote Erlang function (original, uses default timeout)
-PG_FUNCTION_INFO_V1(erlang_call);
-Datum erlang_call(PG_FUNCTION_ARGS) {
-    // Call the timeout version with default 5000ms timeout
-    return erlang_call_internal(fcinfo, 5000);
+// Remember a working connection and the cookie it was opened with
+static void erlang_node_recovered(const char *node_name, const char *cookie) {
+    ErlangNodeHealth *health = erlang_node_health(node_name, true);
+
+    strlcpy(health->cookie, cookie != NULL ? cookie : "", MAX_COOKIE);
+    health->failures = 0;
+    health->retry_at = 0;
 }
 
-// Call a remote Erlang function with custom timeout
-PG_FUNCTION_INFO_V1(erlang_call_with_timeout);
-Datum erlang_call_with_timeout(PG_FUNCTION_ARGS) {
-    int32 timeout_ms = PG_GETARG_INT32(4);
-    
-    // Enforce maximum timeout of 30 seconds
-    if (timeout_ms > 30000) {
-        timeout_ms = 30000;
-        ereport(NOTICE, (errmsg("Timeout capped at maximum 30000ms")));
+/*
+ * Close a direct connection that failed and forget it, so the next call to
+ * the node reconnects. The node enters reconnect backoff.
+ */
+static void erlang_drop_connection(ErlangConnection *conn) {
+    char node_name[MAX_NODE_NAME];
+
+    strlcpy(node_name, conn->node_name, MAX_NODE_NAME);
+    if (!conn->pooled) {
+        close(conn->fd);
+        erlang_frame_reset(&conn->reader);
+        conn->fd = -1;
     }
-    if (timeout_ms <= 0) {
-        timeout_ms = 5000;
-        ereport(NOTICE, (errmsg("Invalid timeout, using default 5000ms")));
+    hash_search(connection_map, node_name, HASH_REMOVE, NULL);
+    erlang_node_failed(node_name);
+}
+
+// False if the peer has closed the connection (detected without blocking or consuming data)
+static bool erlang_connection_alive(ErlangConnection *conn) {
+    char c;
+    ssize_t n;
+
+    if (conn->pooled) {
+        return true;
     }
-    
-    return erlang_call_internal(fcinfo, timeout_ms);
+    n = recv(conn->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0) {
+        return false;
+    }
+    return n > 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
 }
 
-// Internal implementation with timeout support and non-blocking I/O
-static Datum erlang_call_internal(PG_FUNCTION_ARGS, int timeout_ms) {
-    text *node_name_text;
-    text *module_text;
-    text *function_text;
-    Jsonb *args_json;
-    char *node_name;
-    char *module;
-    char *function;
-    MemoryContext oldcontext;
-    MemoryContext tmpcontext;
-    bool found;
+// The open connection to node_name, dropping it if it has died; NULL if there is none
+static ErlangConnection *erlang_live_connection(const char *node_name) {
+    ErlangConnection *conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_FIND, NULL);
+
+    if (conn != NULL && !erlang_connection_alive(conn)) {
+        elog(DEBUG1, "connection to %s was closed by the peer", node_name);
+        erlang_drop_connection(conn);
+        conn = NULL;
+    }
+    return conn;
+}
+
+/*
+ * Connect to node_name, or reuse the open connection. With
+ * erlang_cnode.use_pool the pool worker connects instead. cookie may be
+ * NULL for the configured default. Failures are reported at elevel; below
+ * ERROR the result is then NULL.
+ */
+static ErlangConnection *erlang_establish(const char *node_name, const char *cookie, int elevel) {
+    const char *explicit_cookie = cookie;
     ErlangConnection *conn;
-    ei_x_buff send_buf;
-    ei_x_buff recv_buf;
-    Jsonb *result;
-    erlang_msg msg;
-    
-    node_name_text = PG_GETARG_TEXT_PP(0);
-    module_text = PG_GETARG_TEXT_PP(1);
-    function_text = PG_GETARG_TEXT_PP(2);
-    args_json = PG_GETARG_JSONB_P(3);
-    node_name = text_to_cstring(node_name_text);
-    module = text_to_cstring(module_text);
-    function = text_to_cstring(function_text);
-    oldcontext = CurrentMemoryContext;
-    tmpcontext = AllocSetContextCreate(CurrentMemoryContext, "ErlangCNodeTemp", ALLOCSET_DEFAULT_SIZES);
-    MemoryContextSwitchTo(tmpcontext);
+    ei_cnode *ec;
+    bool found;
+    int fd;
 
-    conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_FIND, &found);
-    if (!found) {
-        MemoryContextSwitchTo(oldcontext);
-        MemoryContextDelete(tmpcontext);
-        pfree(node_name);
-        pfree(module);
-        pfree(function);
-        ereport(ERROR, (errmsg("No connection to node: %s", node_name)));
+    if (cookie == NULL && !erlang_default_cookie(&cookie, elevel)) {
+        return NULL;
     }
-    ereport(NOTICE, (errmsg("Found connection with fd: %d, using timeout: %dms", conn->fd, timeout_ms)));
 
-    // Initialize buffers
-    ei_x_new_with_version(&send_buf);
-    ei_x_new(&recv_buf);
-    
-    ereport(NOTICE, (errmsg("Using MANUAL RPC implementation for %s:%s with timeout %dms", module, function, timeout_ms)));
-    ereport(NOTICE, (errmsg("DEBUG: About to start manual RPC message construction")));
-    
-    // Manual RPC message construction
-    // Format: {'$gen_call', {FromPid, Ref}, {call, Module, Function, Args, user}}
-    ei_x_encode_tuple_header(&send_buf, 3);
-    ei_x_encode_atom(&send_buf, "$gen_call");
-    
-    // {FromPid, Ref}
-    ei_x_encode_tuple_header(&send_buf, 2);
-    ei_x_encode_pid(&send_buf, ei_self(&conn->ec));
-    ei_x_encode_ulong(&send_buf, (unsigned long)time(NULL)); // Simple ref
-    
-    // {call, Module, Function, Args, user}
-    ei_x_encode_tuple_header(&send_buf, 5);
-    ei_x_encode_atom(&send_buf, "call");
-    ei_x_encode_atom(&send_buf, module);
-    ei_x_encode_atom(&send_buf, function);
-    
-    // Encode actual args from JSONB
-    if (jsonb_to_erlang_args(&send_buf, args_json) < 0) {
-        ei_x_free(&send_buf);
-        ei_x_free(&recv_buf);
-        MemoryContextSwitchTo(oldcontext);
-        MemoryContextDelete(tmpcontext);
-        pfree(node_name);
-        pfree(module);
-        pfree(function);
-        ereport(ERROR, (errmsg("Failed to encode function arguments")));
+    // Pooled: the shared worker owns the distribution connection
+    if (erlang_use_pool) {
+        erlang_pool_connect(node_name, cookie != NULL ? cookie : "");
+        conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_ENTER, &found);
+        if (!found || !conn->pooled) {
+            if (found) {
+                close(conn->fd);
+                erlang_frame_reset(&conn->reader);
+            }
+            strlcpy(conn->node_name, node_name, MAX_NODE_NAME);
+            strlcpy(conn->cookie, cookie != NULL ? cookie : "", MAX_COOKIE);
+            conn->fd = -1;
+            conn->pooled = true;
+            memset(&conn->reader, 0, sizeof(ErlangFrameReader));
+            memset(&conn->writer, 0, sizeof(ErlangFrameWriter));
+        }
+        return conn;
     }
-    
-    ei_x_encode_atom(&send_buf, "user");  // Group leader
-    
-    ereport(NOTICE, (errmsg("Sending manual RPC message to rex process...")));
-    
-    // Send to rex process
-    int send_status = ei_reg_send(&conn->ec, conn->fd, "rex", send_buf.buff, send_buf.index);
-    
-    if (send_status < 0) {
-        int err = errno;
-        ei_x_free(&send_buf);
-        ei_x_free(&recv_buf);
-        MemoryContextSwitchTo(oldcontext);
-        MemoryContextDelete(tmpcontext);
-        pfree(node_name);
-        pfree(module);
-        pfree(function);
-        ereport(ERROR, (errmsg("Manual RPC send failed: %s (error: %d)", strerror(err), err)));
+
+    conn = erlang_live_connection(node_name);
+    if (conn != NULL && !conn->pooled) {
+        elog(DEBUG1, "reusing connection to %s (fd %d)", node_name, conn->fd);
+        return conn;
     }
-    
-    ereport(NOTICE, (errmsg("Manual RPC message sent, waiting for response...")));
-    
-    // Receive the response
-    int recv_status = ei_receive_msg_tmo(conn->fd, &msg, &recv_buf, timeout_ms);
-    if (recv_status < 0) {
+
+    ec = erlang_local_identity(cookie, elevel);
+    if (ec == NULL) {
+        return NULL;
+    }
+    fd = ei_connect_tmo(ec, (char *) node_name, 5000);
+    if (fd < 0) {
         int err = errno;
-        ei_x_free(&send_buf);
-        ei_x_free(&recv_buf);
-        MemoryContextSwitchTo(oldcontext);
-        MemoryContextDelete(tmpcontext);
-        pfree(node_name);
-        pfree(module);
-        pfree(function);
-        ereport(ERROR, (errmsg("Manual RPC receive failed: %s (error: %d)", strerror(err), err)));
+        erlang_node_failed(node_name);
+        ereport(elevel,
+                (errcode(ERRCODE_CONNECTION_FAILURE),
+                 errmsg("Could not connect to Erlang node %s: %s (errno: %d)", node_name, strerror(err), err)));
+        return NULL;
+    }
+    erlang_node_recovered(node_name, explicit_cookie);
+
+    conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_ENTER, &found);
+    strlcpy(conn->node_name, node_name, MAX_NODE_NAME);
+    strlcpy(conn->cookie, cookie != NULL ? cookie : "", MAX_COOKIE);
+    conn->fd = fd;
+    conn->pooled = false;
+    memset(&conn->reader, 0, sizeof(ErlangFrameReader));
+    memset(&conn->writer, 0, sizeof(ErlangFrameWriter));
+    memcpy(&conn->ec, ec, sizeof(ei_cnode));
+    elog(DEBUG1, "connected to %s as %s (fd %d)", node_name, ei_thisnodename(ec), fd);
+    return conn;
+}
+
+// Reconnect to a node unless it is still backing off; reported at elevel
+static ErlangConnection *erlang_reconnect(const char *node_name, int elevel) {
+    ErlangNodeHealth *health = erlang_node_health(node_name, false);
+    const char *cookie = NULL;
+
+    if (health != NULL) {
+        TimestampTz now = GetCurrentTimestamp();
+
+        if (health->retry_at > now) {
+            ereport(elevel,
+                    (errcode(ERRCODE_CONNECTION_FAILURE),
+                     errmsg("Erlang node %s is unreachable", node_name),
+                     errdetail("%d consecutive connection failures; next attempt in %ldms.", health->failures,
+                               TimestampDifferenceMilliseconds(now, health->retry_at))));
+            return NULL;
+        }
+        if (health->cookie[0] != '\0') {
+            cookie = pstrdup(health->cookie);
+        }
+    }
+    return erlang_establish(node_name, cookie, elevel);
+}
+
+// Open a connection to every node in erlang_cnode.nodes; failures are only warnings
+static void erlang_preconnect_nodes(void) {
+    char *rawstring;
+    List *nodes;
+    ListCell *lc;
+
+    // The pool worker keeps its own connections warm
+    if (erlang_use_pool || erlang_nodes == NULL || erlang_nodes[0] == '\0') {
+        return;
+    }
+    rawstring = pstrdup(erlang_nodes);
+    if (SplitGUCList(rawstring, ',', &nodes)) {
+        foreach(lc, nodes) {
+            erlang_establish((char *) lfirst(lc), NULL, WARNING);
+        }
+    }
+    list_free(nodes);
+    pfree(rawstring);
+}
+
+// Reject erlang_cnode.nodes values that are not a comma-separated list
+static bool erlang_check_nodes(char **newval, void **extra, GucSource source) {
+    char *rawstring = pstrdup(*newval);
+    List *nodes;
+    bool ok = SplitGUCList(rawstring, ',', &nodes);
+
+    if (!ok) {
+        GUC_check_errdetail("List syntax is invalid.");
+    }
+    list_free(nodes);
+    pfree(rawstring);
+    return ok;
+}
+
+// Strip leading and trailing whitespace in place
+static char *erlang_trim(char *str) {
+    char *end;
+
+    while (isspace((unsigned char) *str)) {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char) end[-1])) {
+        *--end = '\0';
+    }
+    return str;
+}
+
+/*
+ * Members of a node group in erlang_cnode.node_groups, e.g.
+ * "orders=orders1@db1|orders2@db2, billing=billing@db3"; NIL if group_name
+ * is not a group. Also used to validate the setting: returns false if it is
+ * malformed.
+ */
+static bool erlang_parse_node_groups(const char *value, const char *group_name, List **members) {
+    char *rawstring = pstrdup(value);
+    List *groups;
+    ListCell *lc;
+    bool ok;
+
+    *members = NIL;
+    ok = SplitGUCList(rawstring, ',', &groups);
+    foreach(lc, ok ? groups : NIL) {
+        char *item = (char *) lfirst(lc);
+        char *eq = strchr(item, '=');
+        char *member;
+        char *next;
+
+        if (eq == NULL) {
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        item = erlang_trim(item);
+        if (*item == '\0') {
+            ok = false;
+            break;
+        }
+        if (group_name != NULL && strcmp(item, group_name) != 0) {
+            continue;
+        }
+        for (member = eq + 1; member != NULL; member = next) {
+            next = strchr(member, '|');
+            if (next != NULL) {
+                *next++ = '\0';
+            }
+            member = erlang_trim(member);
+            if (*member == '\0' || strlen(member) >= MAX_NODE_NAME) {
+                ok = false;
+                break;
+            }
+            if (group_name != NULL) {
+                *members = lappend(*members, pstrdup(member));
+            }
+        }
+        if (group_name != NULL) {
+            break;
+        }
+    }
+    list_free(groups);
+    pfree(rawstring);
+    return ok;
+}
+
+static List *erlang_group_members(const char *group_name) {
+    List *members;
+
+    if (erlang_node_groups == NULL || erlang_node_groups[0] == '\0' ||
+        !erlang_parse_node_groups(erlang_node_groups, group_name, &members)) {
+        return NIL;
+    }
+    return members;
+}
+
+// Reject malformed erlang_cnode.node_groups values
+static bool erlang_check_node_groups(char **newval, void **extra, GucSource source) {
+    List *members;
+
+    if (!erlang_parse_node_groups(*newval, NULL, &members)) {
+        GUC_check_errdetail("Expected a comma-separated list of name=node1|node2 entries.");
+        return false;
+    }
+    return true;
+}
+
+// True if module:function (or module:*) is listed in erlang_cnode.idempotent_functions
+static bool erlang_function_idempotent(const char *module, const char *function) {
+    char *rawstring;
+    List *entries;
+    ListCell *lc;
+    bool result = false;
+
+    if (erlang_idempotent_functions == NULL || erlang_idempotent_functions[0] == '\0') {
+        return false;
+    }
+    rawstring = pstrdup(erlang_idempotent_functions);
+    if (SplitGUCList(rawstring, ',', &entries)) {
+        size_t module_len = strlen(module);
+
+        foreach(lc, entries) {
+            char *entry = (char *) lfirst(lc);
+
+            if (strncmp(entry, module, module_len) == 0 && entry[module_len] == ':' &&
+                (strcmp(entry + module_len + 1, "*") == 0 || strcmp(entry + module_len + 1, function) == 0)) {
+                result = true;
+                break;
+            }
+        }
+    }
+    list_free(entries);
+    pfree(rawstring);
+    return result;
+}
+
+// Reject erlang_cnode.idempotent_functions entries that are not Module:Function
+static bool erlang_check_idempotent_functions(char **newval, void **extra, GucSource source) {
+    char *rawstring = pstrdup(*newval);
+    List *entries;
+    ListCell *lc;
+    bool ok = SplitGUCList(rawstring, ',', &entries);
+
+    if (!ok) {
+        GUC_check_errdetail("List syntax is invalid.");
+    }
+    foreach(lc, ok ? entries : NIL) {
+        char *entry = (char *) lfirst(lc);
+        char *colon = strchr(entry, ':');
+
+        if (colon == NULL || colon == entry || colon[1] == '\0') {
+            GUC_check_errdetail("Entry \"%s\" is not Module:Function or Module:*.", entry);
+            ok = false;
+            break;
+        }
+    }
+    list_free(entries);
+    pfree(rawstring);
+    return ok;
+}
+
+// Connect to an Erlang node; without a cookie the configured default is used
+PG_FUNCTION_INFO_V1(erlang_connect);
+Datum erlang_connect(PG_FUNCTION_ARGS) {
+    char *node_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *cookie = PG_NARGS() > 1 ? text_to_cstring(PG_GETARG_TEXT_PP(1)) : NULL;
+
+    if (cookie != NULL && strchr(cookie, '\n') != NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("Erlang cookie must not contain a newline")));
+    }
+    erlang_establish(node_name, cookie, ERROR);
+    erlang_set_session_node(node_name, cookie != NULL ? cookie : "");
+    pfree(node_name);
+    if (cookie != NULL) {
+        pfree(cookie);
+    }
+    PG_RETURN_BOOL(true);
+}
+
+// Global request tracking
+static HTAB *async_request_map = NULL;
+static HTAB *async_ref_map = NULL;
+static int64 next_request_id = 1;
+
+// erlang_send_async requests awaiting a reply, and bytes held by uncollected replies
+static int async_inflight = 0;
+static int64 async_bytes = 0;
+static TimestampTz async_next_expiry = DT_NOEND;
+
+// Maps the Erlang reference of an in-flight request back to its ID
+typedef struct {
+    ErlangRefKey key;
+    int64 request_id;
+} AsyncRefEntry;
+
+// Initialize async request tracking
+static void init_async_requests(void) {
+    if (async_request_map == NULL) {
+        HASHCTL ctl;
+        MemSet(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(int64);
+        ctl.entrysize = sizeof(ErlangRequest);
+        ctl.hcxt = TopMemoryContext;
+        async_request_map = hash_create("AsyncRequests", 32, &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+        MemSet(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(ErlangRefKey);
+        ctl.entrysize = sizeof(AsyncRefEntry);
+        ctl.hcxt = TopMemoryContext;
+        async_ref_map = hash_create("AsyncRequestRefs", 32, &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    }
+}
+
+/*
+ * Look up a live connection. A node listed in erlang_cnode.nodes, or one
+ * whose connection was lost, is (re)connected to, subject to backoff; NULL
+ * if there is none.
+ */
+static ErlangConnection *erlang_find_connection(const char *node_name, int elevel) {
+    ErlangConnection *conn = erlang_live_connection(node_name);
+    char *cookie;
+
+    if (conn != NULL) {
+        return conn;
+    }
+    if (erlang_node_health(node_name, false) != NULL || erlang_node_configured(node_name)) {
+        return erlang_reconnect(node_name, elevel);
+    }
+    // A parallel worker connects under its own name to the nodes its leader connected to
+    cookie = erlang_session_node(node_name);
+    if (cookie != NULL) {
+        return erlang_establish(node_name, cookie[0] != '\0' ? cookie : NULL, elevel);
+    }
+    return NULL;
+}
+
+/*
+ * Pick a member of a node group. Each backend starts at a different member
+ * to spread the load; members that have failed are only tried once every
+ * healthy one has been, and members still backing off are skipped.
+ */
+static ErlangConnection *erlang_group_connection(const char *group_name, List *members) {
+    int nmembers = list_length(members);
+    int start = MyProcPid % nmembers;
+    int pass;
+    int i;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < nmembers; i++) {
+            const char *member = (const char *) list_nth(members, (start + i) % nmembers);
+            ErlangNodeHealth *health = erlang_node_health(member, false);
+            bool healthy = health == NULL || health->failures == 0;
+            ErlangConnection *conn;
+
+            if (healthy != (pass == 0)) {
+                continue;
+            }
+            conn = erlang_live_connection(member);
+            if (conn == NULL) {
+                conn = erlang_reconnect(member, DEBUG1);
+            }
+            if (conn != NULL) {
+                return conn;
+            }
+        }
+    }
+    ereport(ERROR,
+            (errcode(ERRCODE_CONNECTION_FAILURE),
+             errmsg("No reachable node in group %s", group_name)));
+    return NULL;
+}
+
+// Look up (or lazily open) a connection to a node or node group, or fail
+static ErlangConnection *erlang_lookup_connection(const char *node_name) {
+    List *members = erlang_group_members(node_name);
+    ErlangConnection *conn;
+
+    if (members != NIL) {
+        return erlang_group_connection(node_name, members);
+    }
+    conn = erlang_find_connection(node_name, ERROR);
+    if (conn == NULL) {
+        ereport(ERROR, (errmsg("No connection to node: %s", node_name)));
+    }
+    return conn;
+}
+
+// Register a new in-flight request tagged with a fresh Erlang reference
+static ErlangRequest *erlang_new_request(ErlangConnection *conn) {
+    ErlangRequest *request;
+    AsyncRefEntry *entry;
+    ErlangRefKey key;
+    int64 request_id;
+    bool found;
+
+    init_async_requests();
+
+    request_id = next_request_id++;
+    request = (ErlangRequest *) hash_search(async_request_map, &request_id, HASH_ENTER, &found);
+    request->request_id = request_id;
+    strlcpy(request->node_name, conn->node_name, MAX_NODE_NAME);
+    if (ei_make_ref(&conn->ec, &request->ref) < 0) {
+        hash_search(async_request_map, &request_id, HASH_REMOVE, NULL);
+        ereport(ERROR, (errmsg("Failed to create Erlang reference")));
+    }
+    request->timestamp = time(NULL);
+    request->completed = false;
+    ei_x_new(&request->response);
+    request->module[0] = '\0';
+    request->function[0] = '\0';
+    request->sent_at = 0;
+    request->bytes_sent = 0;
+    request->recorded = false;
+    request->async = false;
+    request->evicted = false;
+    request->expires_at = 0;
+
+    erlang_ref_key(&request->ref, &key);
+    entry = (AsyncRefEntry *) hash_search(async_ref_map, &key, HASH_ENTER, &found);
+    entry->request_id = request_id;
+
+    return request;
+}
+
+// Drop a request and its buffered response
+static void erlang_forget_request(ErlangRequest *request) {
+    ErlangRefKey key;
+    int64 request_id = request->request_id;
+
+    if (request->async) {
+        if (!request->completed) {
+            async_inflight--;
+        } else if (!request->evicted) {
+            async_bytes -= request->response.buffsz;
+        }
+    }
+    erlang_ref_key(&request->ref, &key);
+    hash_search(async_ref_map, &key, HASH_REMOVE, NULL);
+    ei_x_free(&request->response);
+    hash_search(async_request_map, &request_id, HASH_REMOVE, NULL);
+}
+
+// Count a sent request in the call statistics, once
+static void erlang_stats_request(ErlangRequest *request, ErlangStatsOutcome outcome, int64 bytes_received) {
+    if (request->recorded || request->sent_at == 0) {
+        return;
+    }
+    request->recorded = true;
+    erlang_stats_record(request->node_name, request->module, request->function, outcome,
+                        request->bytes_sent, bytes_received, request->sent_at);
+}
+
+/*
+ * A call is {'$gen_call', {Self, Ref}, Request} sent to a registered name;
+ * the server answers {Ref, Reply}. erlang_begin_gen_call encodes everything
+ * up to Request and names the request for the call statistics; the caller
+ * appends Request and erlang_send_request sends it. A failed send drops the
+ * request and the connection and returns the errno so fan-out callers can
+ * carry on with other nodes.
+ */
+static void erlang_begin_gen_call(ei_x_buff *send_buf, ErlangConnection *conn, ErlangRequest *request,
+                                  const char *module, const char *function) {
+    ei_x_new_with_version(send_buf);
+    erlang_encode_gen_call_head(send_buf);
+    ei_x_encode_pid(send_buf, ei_self(&conn->ec));
+    ei_x_encode_ref(send_buf, &request->ref);
+    strlcpy(request->module, module, MAX_MFA_NAME);
+    strlcpy(request->function, function, MAX_MFA_NAME);
+}
+
+static int erlang_send_request(ei_x_buff *send_buf, ErlangConnection *conn, ErlangRequest *request,
+                               const char *regname) {
+    request->sent_at = GetCurrentTimestamp();
+    request->bytes_sent = send_buf->index;
+    if (ei_reg_send(&conn->ec, conn->fd, (char *) regname, send_buf->buff, send_buf->index) < 0) {
+        int err = errno;
+        ei_x_free(send_buf);
+        erlang_stats_request(request, ERLANG_STATS_ERROR, 0);
+        erlang_forget_request(request);
+        erlang_drop_connection(conn);
+        return err != 0 ? err : EIO;
+    }
+    ei_x_free(send_buf);
+    return 0;
+}
+
+// Calls to rex carry {call, Module, Function, Args, user}; the caller appends Args in between
+static void erlang_begin_rpc(ei_x_buff *send_buf, ErlangConnection *conn, ErlangRequest *request,
+                             const char *module, const char *function) {
+    erlang_begin_gen_call(send_buf, conn, request, module, function);
+    erlang_encode_call_header(send_buf, module, function);
+}
+
+static int erlang_finish_rpc(ei_x_buff *send_buf, ErlangConnection *conn, ErlangRequest *request) {
+    ei_x_encode_atom(send_buf, "user");  // Group leader
+    return erlang_send_request(send_buf, conn, request, "rex");
+}
+
+// Send a call with JSONB arguments; argument encoding errors are raised
+static int erlang_try_send_rpc(ErlangConnection *conn, ErlangRequest *request,
+                               const char *module, const char *function, Jsonb *args_json) {
+    ei_x_buff send_buf;
+
+    erlang_begin_rpc(&send_buf, conn, request, module, function);
+    if (jsonb_to_erlang_args(&send_buf, args_json) < 0) {
+        ei_x_free(&send_buf);
+        erlang_forget_request(request);
+        ereport(ERROR, (errmsg("Failed to encode function arguments")));
+    }
+    return erlang_finish_rpc(&send_buf, conn, request);
+}
+
+// As above, but a failed send is an error
+static void erlang_send_rpc(ErlangConnection *conn, ErlangRequest *request,
+                            const char *module, const char *function, Jsonb *args_json) {
+    int err = erlang_try_send_rpc(conn, request, module, function, args_json);
+
+    if (err != 0) {
+        ereport(ERROR, (errmsg("Manual RPC send failed: %s (error: %d)", strerror(err), err)));
+    }
+}
+
+/*
+ * Drop the oldest uncollected async replies until the rest fit in
+ * erlang_cnode.async_memory_limit. The requests stay in the table so that
+ * erlang_receive_async can report them as evicted.
+ */
+static void erlang_evict_responses(void) {
+    while (async_bytes > (int64) erlang_async_memory_limit * 1024) {
+        HASH_SEQ_STATUS seq;
+        ErlangRequest *request;
+        ErlangRequest *oldest = NULL;
+
+        hash_seq_init(&seq, async_request_map);
+        while ((request = (ErlangRequest *) hash_seq_search(&seq)) != NULL) {
+            if (request->async && request->completed && !request->evicted &&
+                (oldest == NULL || request->request_id < oldest->request_id)) {
+                oldest = request;
+            }
+        }
+        if (oldest == NULL) {
+            break;
+        }
+        async_bytes -= oldest->response.buffsz;
+        ei_x_free(&oldest->response);
+        oldest->evicted = true;
+        elog(DEBUG1, "evicted reply to async request " INT64_FORMAT " (%ld bytes still held)",
+             oldest->request_id, (long) async_bytes);
+    }
+}
+
+// Discard async requests past their expiry, collected or not
+static void erlang_reap_requests(void) {
+    HASH_SEQ_STATUS seq;
+    ErlangRequest *request;
+    TimestampTz now;
+    TimestampTz next_expiry = DT_NOEND;
+
+    now = GetCurrentTimestamp();
+    if (async_request_map == NULL || now < async_next_expiry) {
+        return;
+    }
+    hash_seq_init(&seq, async_request_map);
+    while ((request = (ErlangRequest *) hash_seq_search(&seq)) != NULL) {
+        if (!request->async) {
+            continue;
+        }
+        if (request->expires_at <= now) {
+            elog(DEBUG1, "async request " INT64_FORMAT " expired", request->request_id);
+            erlang_stats_request(request, ERLANG_STATS_TIMEOUT, 0);
+            erlang_forget_request(request);
+        } else if (request->expires_at < next_expiry) {
+            next_expiry = request->expires_at;
+        }
+    }
+    async_next_expiry = next_expiry;
+}
+
+// File a received {Ref, Reply} message under the request it answers
+static void erlang_demux_file(ei_x_buff *buf) {
+    int index = 0;
+    int version;
+    int arity;
+    erlang_ref ref;
+    ErlangRefKey key;
+    AsyncRefEntry *entry;
+    ErlangRequest *request;
+    bool found;
+
+    if (ei_decode_version(buf->buff, &index, &version) < 0 ||
+        ei_decode_tuple_header(buf->buff, &index, &arity) < 0 || arity != 2 ||
+        ei_decode_ref(buf->buff, &index, &ref) < 0) {
+        // Not a reply to one of our requests
+        ei_x_free(buf);
+        return;
+    }
+
+    init_async_requests();
+    erlang_ref_key(&ref, &key);
+    entry = (AsyncRefEntry *) hash_search(async_ref_map, &key, HASH_FIND, &found);
+    if (!found) {
+        // Late reply for a request that was already dropped
+        ei_x_free(buf);
+        return;
+    }
+    request = (ErlangRequest *) hash_search(async_request_map, &entry->request_id, HASH_FIND, &found);
+    if (!found || request->completed) {
+        ei_x_free(buf);
+        return;
+    }
+    ei_x_free(&request->response);
+    request->response = *buf;
+    request->completed = true;
+    erlang_stats_request(request, erlang_stats_is_badrpc(buf) ? ERLANG_STATS_ERROR : ERLANG_STATS_OK, buf->index);
+    if (request->async) {
+        async_inflight--;
+        async_bytes += buf->buffsz;
+        if (async_bytes > (int64) erlang_async_memory_limit * 1024) {
+            erlang_evict_responses();
+        }
+    }
+}
+
+/*
+ * Read one message from the connection and file it by reference.
+ * Waits up to timeout_ms (interruptibly) if nothing complete is buffered.
+ * Returns ERL_MSG/ERL_TICK, ERL_TIMEOUT when nothing complete arrived in
+ * time, or ERL_ERROR when the connection failed.
+ */
+static int erlang_demux_receive(ErlangConnection *conn, int timeout_ms) {
+    ei_x_buff buf;
+    int status;
+
+    status = erlang_frame_read(conn, &buf);
+    if (status == ERL_TIMEOUT && erlang_frame_wait(conn->fd, timeout_ms)) {
+        status = erlang_frame_read(conn, &buf);
+    }
+    if (status == ERL_MSG) {
+        erlang_demux_file(&buf);
+    }
+    return status;
+}
+
+/*
+ * Make room for one more async request to be sent over conn. At
+ * erlang_cnode.max_async_requests either fail or, with async_overflow =
+ * wait, read replies from conn until one arrives or a request expires.
+ */
+static void erlang_reserve_async_slot(ErlangConnection *conn) {
+    erlang_reap_requests();
+    while (async_inflight >= erlang_max_async_requests) {
+        long timeout;
+
+        if (erlang_async_overflow == ERLANG_ASYNC_OVERFLOW_ERROR) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+                     errmsg("too many asynchronous Erlang requests awaiting a reply (%d)", async_inflight),
+                     errhint("Collect replies with erlang_receive_async, raise erlang_cnode.max_async_requests, "
+                             "or set erlang_cnode.async_overflow to wait.")));
+        }
+        timeout = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), async_next_expiry);
+        if (erlang_demux_receive(conn, (int) Min(timeout, 1000)) == ERL_ERROR) {
+            int err = errno;
+
+            erlang_drop_connection(conn);
+            ereport(ERROR,
+                    (errcode(ERRCODE_CONNECTION_FAILURE),
+                     errmsg("Connection lost while waiting for asynchronous replies: %s (error: %d)",
+                            strerror(err), err)));
+        }
+        erlang_reap_requests();
+    }
+}
+
+/*
+ * Read and file messages until the request has its reply or the timeout
+ * expires. If the connection fails it is dropped; then *lost is set, or
+ * with lost NULL an error is raised.
+ */
+static bool erlang_await_request(ErlangConnection *conn, ErlangRequest *request, int timeout_ms, bool *lost) {
+    TimestampTz deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeout_ms);
+
+    while (!request->completed) {
+        long remaining = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+        int status;
+
+        status = erlang_demux_receive(conn, (int) remaining);
+        if (status == ERL_ERROR) {
+            int err = errno;
+
+            erlang_drop_connection(conn);
+            if (lost != NULL) {
+                *lost = true;
+                return false;
+            }
+            ereport(ERROR,
+                    (errcode(ERRCODE_CONNECTION_FAILURE),
+                     errmsg("Manual RPC receive failed: %s (error: %d)", strerror(err), err)));
+        }
+        if (status == ERL_TIMEOUT && remaining <= 0) {
+            break;
+        }
+    }
+    return request->completed;
+}
+
+/*
+ * Wait for the reply to a synchronous call. If the wait is cancelled the
+ * request is dropped, so a late reply is discarded instead of being filed;
+ * the same happens when the connection is lost and lost is not NULL.
+ */
+static bool erlang_await_call(ErlangConnection *conn, ErlangRequest *request, int timeout_ms, bool *lost) {
+    volatile bool completed = false;
+
+    PG_TRY();
+    {
+        completed = erlang_await_request(conn, request, timeout_ms, lost);
+        if (lost != NULL && *lost) {
+            erlang_stats_request(request, ERLANG_STATS_ERROR, 0);
+            erlang_forget_request(request);
+        }
+    }
+    PG_CATCH();
+    {
+        erlang_stats_request(request, ERLANG_STATS_ERROR, 0);
+        erlang_forget_request(request);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    return completed;
+}
+
+// Call a remote Erlang function (original, uses default timeout)
+PG_FUNCTION_INFO_V1(erlang_call);
+Datum erlang_call(PG_FUNCTION_ARGS) {
+    // Call the timeout version with default 5000ms timeout
+    return erlang_call_internal(fcinfo, 5000);
+}
+
+// Enforce the 30 second maximum and fall back to the 5 second default
+static int erlang_effective_timeout(int32 timeout_ms) {
+    if (timeout_ms > 30000) {
+        timeout_ms = 30000;
+        ereport(NOTICE, (errmsg("Timeout capped at maximum 30000ms")));
+    }
+    if (timeout_ms <= 0) {
+        timeout_ms = 5000;
+        ereport(NOTICE, (errmsg("Invalid timeout, using default 5000ms")));
+    }
+    return timeout_ms;
+}
+
+// Call a remote Erlang function with custom timeout
+PG_FUNCTION_INFO_V1(erlang_call_with_timeout);
+Datum erlang_call_with_timeout(PG_FUNCTION_ARGS) {
+    int32 timeout_ms = erlang_effective_timeout(PG_GETARG_INT32(4));
+    
+    return erlang_call_internal(fcinfo, timeout_ms);
+}
+
+/*
+ * Make a call and leave the raw reply in *reply (freed with ei_x_free).
+ * Replies are matched by reference. If the connection turns out to be dead
+ * the call is sent again over a fresh connection (to another member when
+ * node_name is a group). A failed send never reached the node and is always
+ * retried; a call whose reply was lost with the connection is only retried
+ * when it is listed in erlang_cnode.idempotent_functions. All attempts share
+ * the one timeout.
+ */
+static void erlang_call_reply(const char *node_name, const char *module, const char *function,
+                              Jsonb *args_json, int timeout_ms, ei_x_buff *reply) {
+    ErlangConnection *conn;
+    ErlangRequest *request;
+    List *members;
+    TimestampTz deadline;
+    int attempts;
+    int attempt;
+
+    conn = erlang_lookup_connection(node_name);
+
+    if (conn->pooled) {
+        erlang_pool_call_reply(conn->node_name, module, function, args_json, timeout_ms, reply);
+        return;
+    }
+
+    // One attempt per group member; a single node gets one reconnect
+    members = erlang_group_members(node_name);
+    attempts = Max(list_length(members), 2);
+    deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeout_ms);
+
+    for (attempt = 1;; attempt++) {
+        long remaining = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+        char lost_node[MAX_NODE_NAME];
+        bool lost = false;
+        int err;
+
+        elog(DEBUG1, "erlang_call %s:%s on %s (fd %d, timeout %ldms)", module, function, conn->node_name, conn->fd,
+             remaining);
+        strlcpy(lost_node, conn->node_name, MAX_NODE_NAME);
+
+        // Every call carries its own reference; other replies read meanwhile are filed for their owners
+        request = erlang_new_request(conn);
+        err = erlang_try_send_rpc(conn, request, module, function, args_json);
+        if (err == 0) {
+            if (erlang_await_call(conn, request, (int) remaining, &lost)) {
+                break;
+            }
+            if (!lost) {
+                erlang_stats_request(request, ERLANG_STATS_TIMEOUT, 0);
+                erlang_forget_request(request);
+                ereport(ERROR, (errmsg("Manual RPC to %s timed out after %dms", node_name, timeout_ms)));
+            }
+        }
+
+        // The connection is gone (and already dropped)
+        if (attempt >= attempts || (lost && !erlang_function_idempotent(module, function)) ||
+            TimestampDifferenceExceeds(deadline, GetCurrentTimestamp(), 0)) {
+            if (lost) {
+                ereport(ERROR,
+                        (errcode(ERRCODE_CONNECTION_FAILURE),
+                         errmsg("Connection to %s lost while waiting for %s:%s", lost_node, module, function),
+                         errhint("The call may have run. List it in erlang_cnode.idempotent_functions "
+                                 "to retry it automatically.")));
+            }
+            ereport(ERROR,
+                    (errcode(ERRCODE_CONNECTION_FAILURE),
+                     errmsg("Manual RPC send failed: %s (error: %d)", strerror(err), err)));
+        }
+        conn = erlang_lookup_connection(node_name);
+        ereport(LOG,
+                (errmsg("retrying %s:%s on %s after losing the connection to %s",
+                        module, function, conn->node_name, lost_node)));
+    }
+
+    // Take the reply over from the request
+    *reply = request->response;
+    memset(&request->response, 0, sizeof(ei_x_buff));
+    erlang_forget_request(request);
+}
+
+// Internal implementation with timeout support and the result cache
+static Datum erlang_call_internal(PG_FUNCTION_ARGS, int timeout_ms) {
+    text *node_name_text;
+    text *module_text;
+    text *function_text;
+    Jsonb *args_json;
+    char *node_name;
+    char *module;
+    char *function;
+    ei_x_buff reply;
+    Jsonb *result;
+    uint64 cache_generation = 0;
+    int cache_ttl;
+    
+    node_name_text = PG_GETARG_TEXT_PP(0);
+    module_text = PG_GETARG_TEXT_PP(1);
+    function_text = PG_GETARG_TEXT_PP(2);
+    args_json = PG_GETARG_JSONB_P(3);
+    node_name = text_to_cstring(node_name_text);
+    module = text_to_cstring(module_text);
+    function = text_to_cstring(function_text);
+
+    // Cached by the name the caller used, so a group shares one entry across its members.
+    // Only a session that can reach the node itself may see results cached by others.
+    cache_ttl = erlang_cache_ttl(module, function);
+    if (cache_ttl > 0) {
+        (void) erlang_lookup_connection(node_name);
+        result = erlang_cache_lookup(node_name, module, function, args_json, &cache_generation);
+        if (result != NULL) {
+            PG_RETURN_JSONB_P(result);
+        }
+    }
+
+    erlang_call_reply(node_name, module, function, args_json, timeout_ms, &reply);
+    result = erlang_term_to_jsonb(&reply);
+    ei_x_free(&reply);
+    if (cache_ttl > 0) {
+        erlang_cache_store(node_name, module, function, args_json, result, cache_ttl, cache_generation);
+    }
+
+    pfree(node_name);
+    pfree(module);
+    pfree(function);
+    
+    PG_RETURN_JSONB_P(result);
+}
+
+/*
+ * Call with arguments and result in raw external term format.
+ * args_etf is term_to_binary(Args) for an argument list; the reply comes
+ * back as term_to_binary(Result). Only the $gen_call envelope is added and
+ * removed, so terms pass through losslessly and without JSONB conversion.
+ */
+PG_FUNCTION_INFO_V1(erlang_call_etf);
+Datum erlang_call_etf(PG_FUNCTION_ARGS) {
+    char *node_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *module = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    char *function = text_to_cstring(PG_GETARG_TEXT_PP(2));
+    bytea *args_etf = PG_GETARG_BYTEA_PP(3);
+    int timeout_ms = erlang_effective_timeout(PG_GETARG_INT32(4));
+    ErlangConnection *conn;
+    ErlangRequest *request;
+    ei_x_buff send_buf;
+    bytea *result;
+    int err;
+
+    conn = erlang_lookup_connection(node_name);
+
+    if (conn->pooled) {
+        ei_x_buff reply;
+
+        erlang_pool_begin_call(&send_buf, module, function);
+        if (etf_append_args(&send_buf, args_etf) < 0) {
+            ei_x_free(&send_buf);
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("args_etf must be the external term format of a list")));
+        }
+        erlang_pool_call_body(conn->node_name, module, function, &send_buf, timeout_ms, &reply);
+        result = erlang_term_to_etf(&reply);
+        ei_x_free(&reply);
+        PG_RETURN_BYTEA_P(result);
+    }
+
+    request = erlang_new_request(conn);
+    erlang_begin_rpc(&send_buf, conn, request, module, function);
+    if (etf_append_args(&send_buf, args_etf) < 0) {
+        ei_x_free(&send_buf);
+        erlang_forget_request(request);
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("args_etf must be the external term format of a list")));
+    }
+    err = erlang_finish_rpc(&send_buf, conn, request);
+    if (err != 0) {
+        ereport(ERROR, (errmsg("Manual RPC send failed: %s (error: %d)", strerror(err), err)));
+    }
+
+    if (!erlang_await_call(conn, request, timeout_ms, NULL)) {
+        erlang_stats_request(request, ERLANG_STATS_TIMEOUT, 0);
+        erlang_forget_request(request);
+        ereport(ERROR, (errmsg("Manual RPC to %s timed out after %dms", node_name, timeout_ms)));
+    }
+
+    result = erlang_term_to_etf(&request->response);
+    erlang_forget_request(request);
+
+    PG_RETURN_BYTEA_P(result);
+}
+
+/*
+ * Call with a bytea appended to the arguments as an Erlang binary.
+ * The payload is copied once, straight into the send buffer, instead of
+ * being spelled out inside the JSONB arguments.
+ */
+PG_FUNCTION_INFO_V1(erlang_call_with_binary);
+Datum erlang_call_with_binary(PG_FUNCTION_ARGS) {
+    char *node_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *module = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    char *function = text_to_cstring(PG_GETARG_TEXT_PP(2));
+    Jsonb *args_json = PG_GETARG_JSONB_P(3);
+    bytea *payload = PG_GETARG_BYTEA_PP(4);
+    int timeout_ms = erlang_effective_timeout(PG_GETARG_INT32(5));
+    ErlangConnection *conn;
+    ErlangRequest *request;
+    ei_x_buff send_buf;
+    Jsonb *result;
+    int err;
+
+    conn = erlang_lookup_connection(node_name);
+
+    if (conn->pooled) {
+        ei_x_buff reply;
+
+        erlang_pool_begin_call(&send_buf, module, function);
+        if (jsonb_to_erlang_args_with_binary(&send_buf, args_json, VARDATA_ANY(payload),
+                                             VARSIZE_ANY_EXHDR(payload)) < 0) {
+            ei_x_free(&send_buf);
+            ereport(ERROR, (errmsg("Failed to encode function arguments")));
+        }
+        erlang_pool_call_body(conn->node_name, module, function, &send_buf, timeout_ms, &reply);
+        result = erlang_term_to_jsonb(&reply);
+        ei_x_free(&reply);
+        PG_RETURN_JSONB_P(result);
+    }
+
+    request = erlang_new_request(conn);
+    erlang_begin_rpc(&send_buf, conn, request, module, function);
+    if (jsonb_to_erlang_args_with_binary(&send_buf, args_json, VARDATA_ANY(payload),
+                                         VARSIZE_ANY_EXHDR(payload)) < 0) {
+        ei_x_free(&send_buf);
+        erlang_forget_request(request);
+        ereport(ERROR, (errmsg("Failed to encode function arguments")));
+    }
+    err = erlang_finish_rpc(&send_buf, conn, request);
+    if (err != 0) {
+        ereport(ERROR, (errmsg("Manual RPC send failed: %s (error: %d)", strerror(err), err)));
+    }
+
+    if (!erlang_await_call(conn, request, timeout_ms, NULL)) {
+        erlang_stats_request(request, ERLANG_STATS_TIMEOUT, 0);
+        erlang_forget_request(request);
+        ereport(ERROR, (errmsg("Manual RPC to %s timed out after %dms", node_name, timeout_ms)));
+    }
+
+    result = erlang_term_to_jsonb(&request->response);
+    erlang_forget_request(request);
+
+    PG_RETURN_JSONB_P(result);
+}
+
+// Hold back (or release) partial TCP segments so a burst of sends leaves as one flight
+static void erlang_cork(int fd, bool cork) {
+#ifdef TCP_CORK
+    int on = cork ? 1 : 0;
+    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
+}
+
+// Fetch a string field of a batch entry as a C string
+static char *erlang_batch_string(JsonbValue *v, int entry, const char *field) {
+    if (v == NULL || v->type != jbvString) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("erlang_call_batch entry %d: %s must be a string", entry, field)));
+    }
+    return pnstrdup(v->val.string.val, v->val.string.len);
+}
+
+/*
+ * Parse one batch entry, either {"module": M, "function": F, "args": [...]}
+ * or [M, F, [...]]. Missing args mean an empty argument list.
+ */
+static void erlang_parse_batch_call(JsonbValue *entry, int i, char **module, char **function, Jsonb **args) {
+    JsonbContainer *container;
+    JsonbValue *args_val = NULL;
+
+    if (entry->type != jbvBinary) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("erlang_call_batch entry %d must be an object or an array", i)));
+    }
+    container = entry->val.binary.data;
+
+    if (JsonContainerIsObject(container)) {
+        JsonbValue key;
+
+        key.type = jbvString;
+        key.val.string.val = "module";
+        key.val.string.len = 6;
+        *module = erlang_batch_string(findJsonbValueFromContainer(container, JB_FOBJECT, &key), i, "module");
+        key.val.string.val = "function";
+        key.val.string.len = 8;
+        *function = erlang_batch_string(findJsonbValueFromContainer(container, JB_FOBJECT, &key), i, "function");
+        key.val.string.val = "args";
+        key.val.string.len = 4;
+        args_val = findJsonbValueFromContainer(container, JB_FOBJECT, &key);
+    } else {
+        *module = erlang_batch_string(getIthJsonbValueFromContainer(container, 0), i, "module");
+        *function = erlang_batch_string(getIthJsonbValueFromContainer(container, 1), i, "function");
+        args_val = getIthJsonbValueFromContainer(container, 2);
+    }
+
+    if (args_val == NULL) {
+        JsonbValue empty;
+
+        empty.type = jbvArray;
+        empty.val.array.nElems = 0;
+        empty.val.array.rawScalar = false;
+        *args = JsonbValueToJsonb(&empty);
+    } else {
+        *args = JsonbValueToJsonb(args_val);
+    }
+}
+
+// Append a decoded result to the array being built
+static void erlang_push_result(JsonbParseState **state, Jsonb *result) {
+    JsonbValue v;
+
+    v.type = jbvBinary;
+    v.val.binary.data = &result->root;
+    v.val.binary.len = VARSIZE(result) - VARHDRSZ;
+    pushJsonbValue(state, WJB_ELEM, &v);
+}
+
+/*
+ * Run several heterogeneous calls in one round trip.
+ * All requests are written back to back before any reply is awaited; rex
+ * runs each in its own process, and the replies are matched by reference
+ * and returned as a JSON array in call order.
+ */
+PG_FUNCTION_INFO_V1(erlang_call_batch);
+Datum erlang_call_batch(PG_FUNCTION_ARGS) {
+    text *node_name_text;
+    Jsonb *calls_json;
+    int32 timeout_ms;
+    char *node_name;
+    ErlangConnection *conn;
+    JsonbIterator *it;
+    JsonbValue v;
+    JsonbParseState *state = NULL;
+    JsonbValue *result;
+    JsonbIteratorToken tok;
+    int64 *request_ids;
+    int ncalls;
+    volatile int nsent = 0;
+    int i;
+
+    node_name_text = PG_GETARG_TEXT_PP(0);
+    calls_json = PG_GETARG_JSONB_P(1);
+    timeout_ms = erlang_effective_timeout(PG_GETARG_INT32(2));
+    node_name = text_to_cstring(node_name_text);
+
+    if (!JB_ROOT_IS_ARRAY(calls_json) || JB_ROOT_IS_SCALAR(calls_json)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("erlang_call_batch expects a JSON array of calls")));
+    }
+    ncalls = JB_ROOT_COUNT(calls_json);
+    conn = erlang_lookup_connection(node_name);
+
+    pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
+
+    // Pooled connections have no local socket to pipeline on; run the calls in turn
+    if (conn->pooled) {
+        i = 0;
+        it = JsonbIteratorInit(&calls_json->root);
+        while ((tok = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+            char *module;
+            char *function;
+            Jsonb *args;
+
+            if (tok != WJB_ELEM) {
+                continue;
+            }
+            erlang_parse_batch_call(&v, i++, &module, &function, &args);
+            erlang_push_result(&state, erlang_pool_call(conn->node_name, module, function, args, timeout_ms));
+        }
+        result = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
+        pfree(node_name);
+        PG_RETURN_JSONB_P(JsonbValueToJsonb(result));
+    }
+
+    request_ids = palloc(sizeof(int64) * Max(ncalls, 1));
+
+    PG_TRY();
+    {
+        TimestampTz deadline;
+
+        erlang_cork(conn->fd, true);
+        it = JsonbIteratorInit(&calls_json->root);
+        while ((tok = JsonbIteratorNext(&it, &v, true)) != WJB_DONE) {
+            char *module;
+            char *function;
+            Jsonb *args;
+            ErlangRequest *request;
+
+            if (tok != WJB_ELEM) {
+                continue;
+            }
+            erlang_parse_batch_call(&v, nsent, &module, &function, &args);
+            request = erlang_new_request(conn);
+            request_ids[nsent++] = request->request_id;
+            erlang_send_rpc(conn, request, module, function, args);
+            pfree(module);
+            pfree(function);
+            pfree(args);
+        }
+        erlang_cork(conn->fd, false);
+
+        deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeout_ms);
+        for (i = 0; i < nsent; i++) {
+            ErlangRequest *request;
+            long remaining;
+
+            request = (ErlangRequest *) hash_search(async_request_map, &request_ids[i], HASH_FIND, NULL);
+            remaining = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+            if (!erlang_await_request(conn, request, (int) remaining, NULL)) {
+                int j;
+
+                for (j = i; j < nsent; j++) {
+                    ErlangRequest *pending = (ErlangRequest *) hash_search(async_request_map, &request_ids[j],
+                                                                         HASH_FIND, NULL);
+
+                    erlang_stats_request(pending, ERLANG_STATS_TIMEOUT, 0);
+                }
+                ereport(ERROR, (errmsg("Batched RPC to %s timed out after %dms (%d of %d replies received)",
+                                       node_name, timeout_ms, i, nsent)));
+            }
+            erlang_push_result(&state, erlang_term_to_jsonb(&request->response));
+            erlang_forget_request(request);
+        }
+    }
+    PG_CATCH();
+    {
+        erlang_cork(conn->fd, false);
+        for (i = 0; i < nsent; i++) {
+            ErlangRequest *request;
+
+            request = (ErlangRequest *) hash_search(async_request_map, &request_ids[i], HASH_FIND, NULL);
+            if (request != NULL) {
+                erlang_forget_request(request);
+            }
+        }
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    result = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
+    pfree(request_ids);
+    pfree(node_name);
+    PG_RETURN_JSONB_P(JsonbValueToJsonb(result));
+}
+
+/*
+ * State of erlang_call_agg: one call per input row, with up to window of
+ * them in flight on the connection at once. Replies are collected oldest
+ * first, so results come out in input order. A request ID of 0 stands for
+ * a row with a NULL argument, whose result is a JSON null.
+ */
+typedef struct {
+    char node_name[MAX_NODE_NAME];
+    char *target;
+    bool pooled;
+    int window;
+    int timeout_ms;
+    int64 *inflight;
+    int head;
+    int ninflight;
+    List *results;
+    MemoryContext context;
+} ErlangCallAggState;
+
+// Forget requests still in flight when the aggregate is abandoned, e.g. by an error
+static void erlang_call_agg_cleanup(void *arg) {
+    ErlangCallAggState *agg = (ErlangCallAggState *) arg;
+
+    for (; agg->ninflight > 0; agg->ninflight--) {
+        ErlangRequest *request;
+
+        request = (ErlangRequest *) hash_search(async_request_map, &agg->inflight[agg->head], HASH_FIND, NULL);
+        if (request != NULL) {
+            erlang_forget_request(request);
+        }
+        agg->head = (agg->head + 1) % agg->window;
+    }
+}
+
+// Wait for the oldest call in flight and append its result
+static void erlang_call_agg_collect(ErlangCallAggState *agg) {
+    int64 request_id = agg->inflight[agg->head];
+    Jsonb *result = NULL;
+    MemoryContext oldcontext;
+
+    if (request_id != 0) {
+        ErlangRequest *request = (ErlangRequest *) hash_search(async_request_map, &request_id, HASH_FIND, NULL);
+        ErlangConnection *conn = (ErlangConnection *) hash_search(connection_map, agg->node_name, HASH_FIND, NULL);
+
+        if (request == NULL || conn == NULL) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_CONNECTION_FAILURE),
+                     errmsg("Connection to %s lost during erlang_call_agg", agg->node_name)));
+        }
+        if (!erlang_await_request(conn, request, agg->timeout_ms, NULL)) {
+            erlang_stats_request(request, ERLANG_STATS_TIMEOUT, 0);
+            ereport(ERROR, (errmsg("erlang_call_agg call to %s timed out after %dms", agg->node_name,
+                                   agg->timeout_ms)));
+        }
+        oldcontext = MemoryContextSwitchTo(agg->context);
+        result = erlang_term_to_jsonb(&request->response);
+        MemoryContextSwitchTo(oldcontext);
+        erlang_forget_request(request);
+    }
+
+    oldcontext = MemoryContextSwitchTo(agg->context);
+    agg->results = lappend(agg->results, result);
+    MemoryContextSwitchTo(oldcontext);
+    agg->head = (agg->head + 1) % agg->window;
+    agg->ninflight--;
+}
+
+/*
+ * erlang_call_agg(node, module, function, args, batch_size [, timeout_ms])
+ * calls the function once per row without a round trip per row: up to
+ * batch_size calls are written before the oldest reply is awaited, each
+ * for at most timeout_ms. The node, batch size and timeout of the first
+ * row apply to the whole group.
+ */
+PG_FUNCTION_INFO_V1(erlang_call_agg_transfn);
+Datum erlang_call_agg_transfn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    MemoryContext oldcontext;
+    ErlangCallAggState *agg;
+    char *node_name;
+    char *module;
+    char *function;
+    ErlangConnection *conn;
+    ErlangRequest *request;
+    int64 request_id = 0;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "erlang_call_agg_transfn called in non-aggregate context");
+    }
+    if (PG_ARGISNULL(1)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                 errmsg("erlang_call_agg node name must not be null")));
+    }
+    node_name = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+    if (PG_ARGISNULL(0)) {
+        int32 window = PG_ARGISNULL(5) ? 1 : PG_GETARG_INT32(5);
+        int32 timeout_ms = PG_NARGS() > 6 && !PG_ARGISNULL(6) ? PG_GETARG_INT32(6) : 5000;
+        MemoryContextCallback *callback;
+
+        if (window < 1 || window > 10000) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("erlang_call_agg batch size must be between 1 and 10000")));
+        }
+        timeout_ms = erlang_effective_timeout(timeout_ms);
+        conn = erlang_lookup_connection(node_name);
+
+        oldcontext = MemoryContextSwitchTo(aggcontext);
+        agg = palloc0(sizeof(ErlangCallAggState));
+        strlcpy(agg->node_name, conn->node_name, MAX_NODE_NAME);
+        agg->target = pstrdup(node_name);
+        agg->pooled = conn->pooled;
+        agg->window = window;
+        agg->timeout_ms = timeout_ms;
+        agg->inflight = palloc(sizeof(int64) * window);
+        agg->context = aggcontext;
+        callback = palloc(sizeof(MemoryContextCallback));
+        callback->func = erlang_call_agg_cleanup;
+        callback->arg = agg;
+        MemoryContextRegisterResetCallback(aggcontext, callback);
+        MemoryContextSwitchTo(oldcontext);
+    } else {
+        agg = (ErlangCallAggState *) PG_GETARG_POINTER(0);
+        if (strcmp(agg->target, node_name) != 0) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("erlang_call_agg node must be the same for every row of a group")));
+        }
+    }
+
+    if (agg->ninflight == agg->window) {
+        erlang_call_agg_collect(agg);
+    }
+
+    // A row with a NULL argument keeps its place with a JSON null, like a strict function
+    if (PG_ARGISNULL(2) || PG_ARGISNULL(3) || PG_ARGISNULL(4)) {
+        agg->inflight[(agg->head + agg->ninflight++) % agg->window] = 0;
+        PG_RETURN_POINTER(agg);
+    }
+    module = text_to_cstring(PG_GETARG_TEXT_PP(2));
+    function = text_to_cstring(PG_GETARG_TEXT_PP(3));
+
+    // Pooled connections have no local socket to pipeline on; run the calls in turn
+    if (agg->pooled) {
+        Jsonb *result;
+
+        while (agg->ninflight > 0) {
+            erlang_call_agg_collect(agg);
+        }
+        // The per-row context is reset before the final function runs, so keep a copy
+        result = erlang_pool_call(agg->node_name, module, function, PG_GETARG_JSONB_P(4), agg->timeout_ms);
+        oldcontext = MemoryContextSwitchTo(aggcontext);
+        agg->results = lappend(agg->results, pg_detoast_datum_copy((struct varlena *) result));
+        MemoryContextSwitchTo(oldcontext);
+    } else {
+        conn = (ErlangConnection *) hash_search(connection_map, agg->node_name, HASH_FIND, NULL);
+        if (conn == NULL) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_CONNECTION_FAILURE),
+                     errmsg("Connection to %s lost during erlang_call_agg", agg->node_name)));
+        }
+        request = erlang_new_request(conn);
+        request_id = request->request_id;
+        erlang_send_rpc(conn, request, module, function, PG_GETARG_JSONB_P(4));
+        agg->inflight[(agg->head + agg->ninflight++) % agg->window] = request_id;
+    }
+
+    pfree(node_name);
+    pfree(module);
+    pfree(function);
+    PG_RETURN_POINTER(agg);
+}
+
+// Collect the calls still in flight and return all results as a JSON array in input order
+PG_FUNCTION_INFO_V1(erlang_call_agg_finalfn);
+Datum erlang_call_agg_finalfn(PG_FUNCTION_ARGS) {
+    ErlangCallAggState *agg;
+    JsonbParseState *state = NULL;
+    JsonbValue *result;
+    ListCell *lc;
+
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();
+    }
+    agg = (ErlangCallAggState *) PG_GETARG_POINTER(0);
+    while (agg->ninflight > 0) {
+        erlang_call_agg_collect(agg);
+    }
+
+    pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
+    foreach(lc, agg->results) {
+        if (lfirst(lc) == NULL) {
+            JsonbValue null_value;
+
+            null_value.type = jbvNull;
+            pushJsonbValue(&state, WJB_ELEM, &null_value);
+        } else {
+            erlang_push_result(&state, (Jsonb *) lfirst(lc));
+        }
+    }
+    result = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
+    PG_RETURN_JSONB_P(JsonbValueToJsonb(result));
+}
+
+// Per-node state of a multicall
+typedef struct {
+    char *node_name;
+    ErlangConnection *conn;
+    int64 request_id;
+    TimestampTz sent_at;
+    bool done;
+} ErlangMulticallTarget;
+
+// Emit one (node, status, result, latency_ms) row
+static void erlang_multicall_row(Tuplestorestate *tupstore, TupleDesc tupdesc, const char *node_name,
+                                 const char *status, Jsonb *result, TimestampTz sent_at) {
+    Datum values[4];
+    bool nulls[4] = {false, false, false, false};
+
+    values[0] = CStringGetTextDatum(node_name);
+    values[1] = CStringGetTextDatum(status);
+    if (result != NULL) {
+        values[2] = JsonbPGetDatum(result);
+    } else {
+        nulls[2] = true;
+    }
+    if (sent_at != 0) {
+        long secs;
+        int usecs;
+
+        TimestampDifference(sent_at, GetCurrentTimestamp(), &secs, &usecs);
+        values[3] = Float8GetDatum(secs * 1000.0 + usecs / 1000.0);
+    } else {
+        nulls[3] = true;
+    }
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+}
+
+/*
+ * Call the same function on many nodes at once.
+ * Requests go out to every connected node first, then all sockets are
+ * waited on together and a row is produced per node as its reply arrives, so
+ * the total latency is that of the slowest node rather than the sum.
+ */
+PG_FUNCTION_INFO_V1(erlang_multicall);
+Datum erlang_multicall(PG_FUNCTION_ARGS) {
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    ArrayType *nodes_array;
+    char *module;
+    char *function;
+    Jsonb *args_json;
+    int32 timeout_ms;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    Datum *node_datums;
+    bool *node_nulls;
+    int nnodes;
+    ErlangMulticallTarget *targets;
+    int ntargets = 0;
+    int npending = 0;
+    WaitEvent *events;
+    TimestampTz deadline;
+    int i;
+    int j;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("erlang_multicall must be called in a context that accepts a set")));
+    }
+
+    nodes_array = PG_GETARG_ARRAYTYPE_P(0);
+    module = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    function = text_to_cstring(PG_GETARG_TEXT_PP(2));
+    args_json = PG_GETARG_JSONB_P(3);
+    timeout_ms = erlang_effective_timeout(PG_GETARG_INT32(4));
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR, (errmsg("return type must be a row type")));
+    }
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    deconstruct_array(nodes_array, TEXTOID, -1, false, TYPALIGN_INT, &node_datums, &node_nulls, &nnodes);
+    targets = palloc0(sizeof(ErlangMulticallTarget) * Max(nnodes, 1));
+
+    // Fan out: send to every connected node before waiting on any of them
+    for (i = 0; i < nnodes; i++) {
+        ErlangMulticallTarget *target;
+        char *node_name;
+        bool duplicate = false;
+
+        if (node_nulls[i]) {
+            continue;
+        }
+        node_name = TextDatumGetCString(node_datums[i]);
+        for (j = 0; j < ntargets; j++) {
+            if (strcmp(targets[j].node_name, node_name) == 0) {
+                duplicate = true;
+                break;
+            }
+        }
+        if (duplicate) {
+            continue;
+        }
+
+        target = &targets[ntargets++];
+        target->node_name = node_name;
+        target->conn = erlang_find_connection(node_name, WARNING);
+        if (target->conn == NULL) {
+            erlang_multicall_row(tupstore, tupdesc, node_name, "not_connected", NULL, 0);
+            target->done = true;
+            continue;
+        }
+
+        target->sent_at = GetCurrentTimestamp();
+        if (target->conn->pooled) {
+            // The pool worker owns the socket; fall back to a synchronous call
+            Jsonb *result = NULL;
+            int status = erlang_pool_try_call(target->conn->node_name, module, function, args_json, timeout_ms,
+                                              &result);
+
+            erlang_multicall_row(tupstore, tupdesc, node_name,
+                                 status == ERLANG_POOL_OK ? "ok" : status == ERLANG_POOL_TIMEOUT ? "timeout" : "error",
+                                 result, target->sent_at);
+            target->done = true;
+            continue;
+        }
+
+        {
+            ErlangRequest *request = erlang_new_request(target->conn);
+            int err;
+
+            target->request_id = request->request_id;
+            err = erlang_try_send_rpc(target->conn, request, module, function, args_json);
+            if (err != 0) {
+                erlang_multicall_row(tupstore, tupdesc, node_name, "send_failed", NULL, 0);
+                target->done = true;
+                continue;
+            }
+        }
+        npending++;
+    }
+
+    // Fan in: wait on all sockets at once and emit rows in arrival order
+    events = palloc(sizeof(WaitEvent) * Max(ntargets, 1));
+    deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeout_ms);
+    while (npending > 0) {
+        long remaining = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+        WaitEventSet *set;
+        int nevents;
+
+        if (remaining <= 0) {
+            break;
+        }
+        set = erlang_create_wait_event_set(2 + npending);
+        AddWaitEventToSet(set, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+        AddWaitEventToSet(set, WL_EXIT_ON_PM_DEATH, PGINVALID_SOCKET, NULL, NULL);
+        for (i = 0; i < ntargets; i++) {
+            if (!targets[i].done) {
+                AddWaitEventToSet(set, WL_SOCKET_READABLE, targets[i].conn->fd, NULL, &targets[i]);
+            }
+        }
+        nevents = WaitEventSetWait(set, remaining, events, Max(ntargets, 1), PG_WAIT_EXTENSION);
+        FreeWaitEventSet(set);
+
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+
+        for (i = 0; i < nevents; i++) {
+            ErlangMulticallTarget *target = (ErlangMulticallTarget *) events[i].user_data;
+            ErlangRequest *request;
+
+            if (!(events[i].events & WL_SOCKET_READABLE) || target->done) {
+                continue;
+            }
+
+            if (erlang_demux_receive(target->conn, 0) == ERL_ERROR) {
+                request = (ErlangRequest *) hash_search(async_request_map, &target->request_id, HASH_FIND, NULL);
+                if (request != NULL) {
+                    erlang_stats_request(request, ERLANG_STATS_ERROR, 0);
+                    erlang_forget_request(request);
+                }
+                erlang_multicall_row(tupstore, tupdesc, target->node_name, "connection_lost", NULL, target->sent_at);
+                erlang_drop_connection(target->conn);
+                target->conn = NULL;
+                target->done = true;
+                npending--;
+                continue;
+            }
+
+            request = (ErlangRequest *) hash_search(async_request_map, &target->request_id, HASH_FIND, NULL);
+            if (request != NULL && request->completed) {
+                erlang_multicall_row(tupstore, tupdesc, target->node_name, "ok",
+                                     erlang_term_to_jsonb(&request->response), target->sent_at);
+                erlang_forget_request(request);
+                target->done = true;
+                npending--;
+            }
+        }
     }
-    
-    ereport(NOTICE, (errmsg("Manual RPC response received, buffer size: %d", recv_buf.index)));
-    
-    // Parse the response
-    result = erlang_term_to_jsonb(&recv_buf);
-    
-    ei_x_free(&send_buf);
-    ei_x_free(&recv_buf);
-    MemoryContextSwitchTo(oldcontext);
-    MemoryContextDelete(tmpcontext);
-    pfree(node_name);
-    pfree(module);
-    pfree(function);
-    
-    PG_RETURN_JSONB_P(result);
+
+    // Whatever is left did not answer in time
+    for (i = 0; i < ntargets; i++) {
+        ErlangMulticallTarget *target = &targets[i];
+        ErlangRequest *request;
+
+        if (target->done) {
+            continue;
+        }
+        request = (ErlangRequest *) hash_search(async_request_map, &target->request_id, HASH_FIND, NULL);
+        if (request != NULL) {
+            erlang_stats_request(request, ERLANG_STATS_TIMEOUT, 0);
+            erlang_forget_request(request);
+        }
+        erlang_multicall_row(tupstore, tupdesc, target->node_name, "timeout", NULL, target->sent_at);
+    }
+
+    return (Datum) 0;
 }
 
 // Test basic connectivity using RPC to erlang:is_alive()
@@ -382,29 +2468,21 @@ Datum erlang_disconnect(PG_FUNCTION_ARGS) {
     node_name_text = PG_GETARG_TEXT_PP(0);
     node_name = text_to_cstring(node_name_text);
     conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_REMOVE, &found);
-    if (found) {
+    if (found && !conn->pooled) {
         close(conn->fd);
+        erlang_frame_reset(&conn->reader);
+    }
+    // A node disconnected on purpose is not reconnected to behind the caller's back
+    if (node_health_map != NULL) {
+        hash_search(node_health_map, node_name, HASH_REMOVE, NULL);
+    }
+    if (erlang_session_node(node_name) != NULL) {
+        erlang_set_session_node(node_name, NULL);
     }
     pfree(node_name);
     PG_RETURN_BOOL(found);
 }
 
-// Global request tracking
-static HTAB *async_request_map = NULL;
-static int64 next_request_id = 1;
-
-// Initialize async request tracking
-static void init_async_requests(void) {
-    if (async_request_map == NULL) {
-        HASHCTL ctl;
-        MemSet(&ctl, 0, sizeof(ctl));
-        ctl.keysize = sizeof(int64);
-        ctl.entrysize = sizeof(AsyncRequest);
-        ctl.hcxt = TopMemoryContext;
-        async_request_map = hash_create("AsyncRequests", 32, &ctl, HASH_ELEM | HASH_CONTEXT);
-    }
-}
-
 // Send async RPC request, returns request ID immediately
 PG_FUNCTION_INFO_V1(erlang_send_async);
 Datum erlang_send_async(PG_FUNCTION_ARGS) {
@@ -415,14 +2493,9 @@ Datum erlang_send_async(PG_FUNCTION_ARGS) {
     char *node_name;
     char *module;
     char *function;
-    bool found;
     ErlangConnection *conn;
-    AsyncRequest *request;
-    ei_x_buff send_buf;
+    ErlangRequest *request;
     int64 request_id;
-    unsigned long ref;
-    
-    init_async_requests();
     
     node_name_text = PG_GETARG_TEXT_PP(0);
     module_text = PG_GETARG_TEXT_PP(1);
@@ -434,70 +2507,24 @@ Datum erlang_send_async(PG_FUNCTION_ARGS) {
     function = text_to_cstring(function_text);
     
     // Find connection
-    conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_FIND, &found);
-    if (!found) {
-        pfree(node_name);
-        pfree(module);
-        pfree(function);
-        ereport(ERROR, (errmsg("No connection to node: %s", node_name)));
-    }
-    
-    // Generate unique request ID and reference
-    request_id = next_request_id++;
-    ref = (unsigned long)request_id;  // Use request_id as ref for simplicity
-    
-    // Create async request entry
-    request = (AsyncRequest *) hash_search(async_request_map, &request_id, HASH_ENTER, &found);
-    request->request_id = request_id;
-    strlcpy(request->node_name, node_name, MAX_NODE_NAME);
-    request->ref = ref;
-    request->timestamp = time(NULL);
-    request->completed = false;
-    ei_x_new(&request->response);
-    
-    // Build and send RPC message
-    ei_x_new_with_version(&send_buf);
-    
-    // Format: {'$gen_call', {FromPid, Ref}, {call, Module, Function, Args, user}}
-    ei_x_encode_tuple_header(&send_buf, 3);
-    ei_x_encode_atom(&send_buf, "$gen_call");
-    
-    // {FromPid, Ref}
-    ei_x_encode_tuple_header(&send_buf, 2);
-    ei_x_encode_pid(&send_buf, ei_self(&conn->ec));
-    ei_x_encode_ulong(&send_buf, ref);
-    
-    // {call, Module, Function, Args, user}
-    ei_x_encode_tuple_header(&send_buf, 5);
-    ei_x_encode_atom(&send_buf, "call");
-    ei_x_encode_atom(&send_buf, module);
-    ei_x_encode_atom(&send_buf, function);
-    
-    // Encode actual args from JSONB
-    if (jsonb_to_erlang_args(&send_buf, args_json) < 0) {
-        ei_x_free(&send_buf);
-        ei_x_free(&request->response);
-        hash_search(async_request_map, &request_id, HASH_REMOVE, NULL);
-        pfree(node_name);
-        pfree(module);
-        pfree(function);
-        ereport(ERROR, (errmsg("Failed to encode function arguments")));
+    conn = erlang_lookup_connection(node_name);
+    if (conn->pooled) {
+        ereport(ERROR,
+                (errmsg("Asynchronous requests are not supported on pooled connections"),
+                 errhint("Reconnect with erlang_cnode.use_pool = off.")));
     }
     
-    ei_x_encode_atom(&send_buf, "user");
-    
-    // Send to rex process
-    if (ei_reg_send(&conn->ec, conn->fd, "rex", send_buf.buff, send_buf.index) < 0) {
-        ei_x_free(&send_buf);
-        ei_x_free(&request->response);
-        hash_search(async_request_map, &request_id, HASH_REMOVE, NULL);
-        pfree(node_name);
-        pfree(module);
-        pfree(function);
-        ereport(ERROR, (errmsg("Failed to send async RPC request")));
-    }
+    erlang_reserve_async_slot(conn);
+
+    // The request is tagged with a unique reference so its reply can be matched out of order
+    request = erlang_new_request(conn);
+    request_id = request->request_id;
+    request->async = true;
+    request->expires_at = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), erlang_async_request_ttl);
+    async_next_expiry = Min(async_next_expiry, request->expires_at);
+    async_inflight++;
+    erlang_send_rpc(conn, request, module, function, args_json);
     
-    ei_x_free(&send_buf);
     pfree(node_name);
     pfree(module);
     pfree(function);
@@ -505,97 +2532,234 @@ Datum erlang_send_async(PG_FUNCTION_ARGS) {
     PG_RETURN_INT64(request_id);
 }
 
-// Receive async RPC response
+// Build {"status": <status>} for requests without a reply yet
+static Jsonb *erlang_status_jsonb(const char *status) {
+    JsonbParseState *state = NULL;
+    JsonbValue key;
+    JsonbValue val;
+    JsonbValue *result;
+
+    pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
+
+    key.type = jbvString;
+    key.val.string.val = "status";
+    key.val.string.len = 6;
+    pushJsonbValue(&state, WJB_KEY, &key);
+
+    val.type = jbvString;
+    val.val.string.val = (char *) status;
+    val.val.string.len = strlen(status);
+    pushJsonbValue(&state, WJB_VALUE, &val);
+
+    result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
+    return JsonbValueToJsonb(result);
+}
+
+/*
+ * Receive async RPC response. A reply is handed out once: the request is
+ * then forgotten, as are requests past erlang_cnode.async_request_ttl.
+ */
 PG_FUNCTION_INFO_V1(erlang_receive_async);
 Datum erlang_receive_async(PG_FUNCTION_ARGS) {
     int64 request_id;
     int32 timeout_ms;
     bool found;
-    AsyncRequest *request;
+    ErlangRequest *request;
     ErlangConnection *conn;
-    erlang_msg msg;
-    ei_x_buff recv_buf;
     Jsonb *result;
-    JsonbParseState *state = NULL;
-    JsonbValue *jbv_result;
-    JsonbValue key_status;
-    JsonbValue val_pending;
-    JsonbValue val_error;
-    int recv_status;
     
     init_async_requests();
+    erlang_reap_requests();
     
     request_id = PG_GETARG_INT64(0);
     timeout_ms = PG_GETARG_INT32(1);
     
     // Find the request
-    request = (AsyncRequest *) hash_search(async_request_map, &request_id, HASH_FIND, &found);
+    request = (ErlangRequest *) hash_search(async_request_map, &request_id, HASH_FIND, &found);
     if (!found) {
-        ereport(ERROR, (errmsg("Request ID %ld not found", request_id)));
+        ereport(ERROR,
+                (errmsg("Request ID %ld not found", request_id),
+                 errdetail("It was never sent, has already been received, or expired.")));
     }
-    
-    // If already completed, return cached response
-    if (request->completed) {
-        result = erlang_term_to_jsonb(&request->response);
-        PG_RETURN_JSONB_P(result);
+    if (request->evicted) {
+        erlang_forget_request(request);
+        PG_RETURN_JSONB_P(erlang_status_jsonb("evicted"));
     }
     
-    // Find connection
-    conn = (ErlangConnection *) hash_search(connection_map, request->node_name, HASH_FIND, &found);
-    if (!found) {
-        ereport(ERROR, (errmsg("Connection lost for request %ld", request_id)));
+    // Possibly filed while waiting on another request
+    if (!request->completed) {
+        conn = (ErlangConnection *) hash_search(connection_map, request->node_name, HASH_FIND, &found);
+        if (!found) {
+            ereport(ERROR, (errmsg("Connection lost for request %ld", request_id)));
+        }
+        if (!erlang_await_request(conn, request, timeout_ms, NULL)) {
+            PG_RETURN_JSONB_P(erlang_status_jsonb(timeout_ms == 0 ? "pending" : "timeout"));
+        }
     }
-    
-    // Try to receive response with timeout
-    ei_x_new(&recv_buf);
-    recv_status = ei_receive_msg_tmo(conn->fd, &msg, &recv_buf, timeout_ms);
-    
-    if (recv_status == ERL_MSG) {
-        // Store response and mark as completed
-        ei_x_free(&request->response);
-        request->response = recv_buf;
-        request->completed = true;
-        
-        result = erlang_term_to_jsonb(&request->response);
-        PG_RETURN_JSONB_P(result);
-    } else if (recv_status == ERL_TICK) {
-        // Got a tick, request still pending
-        ei_x_free(&recv_buf);
-        
-        // Return JSON indicating pending status
-        pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-        
-        key_status.type = jbvString;
-        key_status.val.string.val = "status";
-        key_status.val.string.len = 6;
-        pushJsonbValue(&state, WJB_KEY, &key_status);
-        
-        val_pending.type = jbvString;
-        val_pending.val.string.val = "pending";
-        val_pending.val.string.len = 7;
-        pushJsonbValue(&state, WJB_VALUE, &val_pending);
-        
-        jbv_result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
-        PG_RETURN_JSONB_P(JsonbValueToJsonb(jbv_result));
-    } else {
-        // Error or timeout
-        ei_x_free(&recv_buf);
-        
-        pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-        
-        key_status.type = jbvString;
-        key_status.val.string.val = "status";
-        key_status.val.string.len = 6;
-        pushJsonbValue(&state, WJB_KEY, &key_status);
-        
-        val_error.type = jbvString;
-        val_error.val.string.val = "timeout";
-        val_error.val.string.len = 7;
-        pushJsonbValue(&state, WJB_VALUE, &val_error);
-        
-        jbv_result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
-        PG_RETURN_JSONB_P(JsonbValueToJsonb(jbv_result));
+
+    result = erlang_term_to_jsonb(&request->response);
+    erlang_forget_request(request);
+    PG_RETURN_JSONB_P(result);
+}
+
+/*
+ * Emit a row for every listed request that has finished, up to limit rows,
+ * forgetting each one. IDs that are unknown (already received or expired)
+ * are skipped. The connections the remaining requests wait on are collected
+ * in conns.
+ */
+static int erlang_receive_any_ready(Tuplestorestate *tupstore, TupleDesc tupdesc, int64 *ids, int nids,
+                                    int limit, ErlangConnection **conns, int *nconns) {
+    int nrows = 0;
+    int i;
+    int j;
+
+    *nconns = 0;
+    for (i = 0; i < nids && nrows < limit; i++) {
+        ErlangRequest *request = (ErlangRequest *) hash_search(async_request_map, &ids[i], HASH_FIND, NULL);
+        ErlangConnection *conn;
+        Jsonb *result = NULL;
+        Datum values[2];
+        bool nulls[2] = {false, false};
+        bool known = false;
+
+        if (request == NULL) {
+            continue;
+        }
+        if (request->evicted) {
+            result = erlang_status_jsonb("evicted");
+        } else if (request->completed) {
+            result = erlang_term_to_jsonb(&request->response);
+        } else {
+            conn = (ErlangConnection *) hash_search(connection_map, request->node_name, HASH_FIND, NULL);
+            if (conn == NULL) {
+                erlang_stats_request(request, ERLANG_STATS_ERROR, 0);
+                result = erlang_status_jsonb("connection_lost");
+            } else {
+                for (j = 0; j < *nconns; j++) {
+                    known = known || conns[j] == conn;
+                }
+                if (!known) {
+                    conns[(*nconns)++] = conn;
+                }
+                continue;
+            }
+        }
+
+        values[0] = Int64GetDatum(request->request_id);
+        values[1] = JsonbPGetDatum(result);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+        erlang_forget_request(request);
+        nrows++;
+    }
+    return nrows;
+}
+
+/*
+ * Wait for any of several async requests, like epoll for RPCs. Rows of
+ * (request_id, result) are returned as soon as at least one request has
+ * finished, for at most max_results requests (0 for all that are ready);
+ * no rows means none finished within timeout_ms. Returned requests are
+ * forgotten and unknown IDs are ignored, so the same array can be passed
+ * again until no requests are left.
+ */
+PG_FUNCTION_INFO_V1(erlang_receive_any);
+Datum erlang_receive_any(PG_FUNCTION_ARGS) {
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    ArrayType *ids_array = PG_GETARG_ARRAYTYPE_P(0);
+    int32 timeout_ms = PG_GETARG_INT32(1);
+    int32 max_results = PG_GETARG_INT32(2);
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    Datum *id_datums;
+    bool *id_nulls;
+    int64 *ids;
+    int nids = 0;
+    int ndatums;
+    ErlangConnection **conns;
+    WaitEvent *events;
+    TimestampTz deadline;
+    bool last_pass = false;
+    int limit = max_results > 0 ? max_results : INT_MAX;
+    int nrows = 0;
+    int i;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("erlang_receive_any must be called in a context that accepts a set")));
+    }
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR, (errmsg("return type must be a row type")));
+    }
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    deconstruct_array(ids_array, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, TYPALIGN_DOUBLE,
+                      &id_datums, &id_nulls, &ndatums);
+    ids = palloc(sizeof(int64) * Max(ndatums, 1));
+    for (i = 0; i < ndatums; i++) {
+        if (!id_nulls[i]) {
+            ids[nids++] = DatumGetInt64(id_datums[i]);
+        }
+    }
+    conns = palloc(sizeof(ErlangConnection *) * Max(nids, 1));
+    events = palloc(sizeof(WaitEvent) * Max(nids, 1));
+
+    init_async_requests();
+    erlang_reap_requests();
+    deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), Max(timeout_ms, 0));
+
+    for (;;) {
+        long remaining;
+        WaitEventSet *set;
+        int nconns;
+        int nevents;
+
+        nrows += erlang_receive_any_ready(tupstore, tupdesc, ids, nids, limit - nrows, conns, &nconns);
+        if (nrows > 0 || nconns == 0 || last_pass) {
+            break;
+        }
+
+        // Sleep on every connection at once; a timeout of 0 just polls them
+        remaining = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+        last_pass = remaining <= 0;
+        set = erlang_create_wait_event_set(2 + nconns);
+        AddWaitEventToSet(set, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+        AddWaitEventToSet(set, WL_EXIT_ON_PM_DEATH, PGINVALID_SOCKET, NULL, NULL);
+        for (i = 0; i < nconns; i++) {
+            AddWaitEventToSet(set, WL_SOCKET_READABLE, conns[i]->fd, NULL, conns[i]);
+        }
+        nevents = WaitEventSetWait(set, Max(remaining, 0), events, nconns, PG_WAIT_EXTENSION);
+        FreeWaitEventSet(set);
+
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+
+        // File everything that has arrived; requests on a failed connection are reported next pass
+        for (i = 0; i < nevents; i++) {
+            ErlangConnection *conn = (ErlangConnection *) events[i].user_data;
+            int status;
+
+            if (!(events[i].events & WL_SOCKET_READABLE)) {
+                continue;
+            }
+            do {
+                status = erlang_demux_receive(conn, 0);
+            } while (status == ERL_MSG || status == ERL_TICK);
+            if (status == ERL_ERROR) {
+                erlang_drop_connection(conn);
+            }
+        }
     }
+
+    return (Datum) 0;
 }
 
 // Fire-and-forget cast (no response expected)
@@ -608,7 +2772,6 @@ Datum erlang_cast(PG_FUNCTION_ARGS) {
     char *node_name;
     char *module;
     char *function;
-    bool found;
     ErlangConnection *conn;
     ei_x_buff send_buf;
     
@@ -621,26 +2784,19 @@ Datum erlang_cast(PG_FUNCTION_ARGS) {
     module = text_to_cstring(module_text);
     function = text_to_cstring(function_text);
     
-    // Find connection
-    conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_FIND, &found);
-    if (!found) {
+    conn = erlang_lookup_connection(node_name);
+
+    if (conn->pooled) {
+        erlang_pool_cast(conn->node_name, module, function, args_json);
         pfree(node_name);
         pfree(module);
         pfree(function);
-        ereport(ERROR, (errmsg("No connection to node: %s", node_name)));
+        PG_RETURN_BOOL(true);
     }
     
-    // Build cast message
+    // Build cast message: {'$gen_cast', {cast, Module, Function, Args}}
     ei_x_new_with_version(&send_buf);
-    
-    // Format: {'$gen_cast', {cast, Module, Function, Args}}
-    ei_x_encode_tuple_header(&send_buf, 2);
-    ei_x_encode_atom(&send_buf, "$gen_cast");
-    
-    ei_x_encode_tuple_header(&send_buf, 4);
-    ei_x_encode_atom(&send_buf, "cast");
-    ei_x_encode_atom(&send_buf, module);
-    ei_x_encode_atom(&send_buf, function);
+    erlang_encode_cast_header(&send_buf, module, function);
     
     // Encode actual args from JSONB
     if (jsonb_to_erlang_args(&send_buf, args_json) < 0) {
@@ -654,11 +2810,13 @@ Datum erlang_cast(PG_FUNCTION_ARGS) {
     // Send to rex process
     if (ei_reg_send(&conn->ec, conn->fd, "rex", send_buf.buff, send_buf.index) < 0) {
         ei_x_free(&send_buf);
+        erlang_drop_connection(conn);
         pfree(node_name);
         pfree(module);
         pfree(function);
         ereport(ERROR, (errmsg("Failed to send cast message")));
     }
+    erlang_stats_record(conn->node_name, module, function, ERLANG_STATS_CAST, send_buf.index, 0, 0);
     
     ei_x_free(&send_buf);
     pfree(node_name);
@@ -668,6 +2826,144 @@ Datum erlang_cast(PG_FUNCTION_ARGS) {
     PG_RETURN_BOOL(true);
 }
 
+// Fire-and-forget cast with arguments in raw external term format
+PG_FUNCTION_INFO_V1(erlang_cast_etf);
+Datum erlang_cast_etf(PG_FUNCTION_ARGS) {
+    char *node_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *module = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    char *function = text_to_cstring(PG_GETARG_TEXT_PP(2));
+    bytea *args_etf = PG_GETARG_BYTEA_PP(3);
+    ErlangConnection *conn;
+    ei_x_buff send_buf;
+
+    conn = erlang_lookup_connection(node_name);
+
+    if (conn->pooled) {
+        ei_x_new(&send_buf);
+    } else {
+        ei_x_new_with_version(&send_buf);
+    }
+    erlang_encode_cast_header(&send_buf, module, function);
+    if (etf_append_args(&send_buf, args_etf) < 0) {
+        ei_x_free(&send_buf);
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("args_etf must be the external term format of a list")));
+    }
+
+    if (conn->pooled) {
+        erlang_pool_cast_body(conn->node_name, module, function, &send_buf);
+        PG_RETURN_BOOL(true);
+    }
+
+    if (ei_reg_send(&conn->ec, conn->fd, "rex", send_buf.buff, send_buf.index) < 0) {
+        ei_x_free(&send_buf);
+        erlang_drop_connection(conn);
+        ereport(ERROR, (errmsg("Failed to send cast message")));
+    }
+    erlang_stats_record(conn->node_name, module, function, ERLANG_STATS_CAST, send_buf.index, 0, 0);
+    ei_x_free(&send_buf);
+
+    PG_RETURN_BOOL(true);
+}
+
+/*
+ * Call a gen_server (or any process speaking the gen protocol) by its
+ * registered name. The request goes straight to the server as
+ * {'$gen_call', {Self, Ref}, Request}, skipping the rpc worker that rex
+ * would spawn. Counted in the statistics as Name:'$gen_call'.
+ */
+PG_FUNCTION_INFO_V1(erlang_gen_call);
+Datum erlang_gen_call(PG_FUNCTION_ARGS) {
+    char *node_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *regname = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    Jsonb *request_json = PG_GETARG_JSONB_P(2);
+    int timeout_ms = erlang_effective_timeout(PG_GETARG_INT32(3));
+    ErlangConnection *conn;
+    ErlangRequest *request;
+    ei_x_buff send_buf;
+    Jsonb *result;
+    int err;
+
+    conn = erlang_lookup_connection(node_name);
+
+    if (conn->pooled) {
+        ei_x_buff reply;
+
+        ei_x_new(&send_buf);
+        if (jsonb_to_erlang_term(&send_buf, request_json) < 0) {
+            ei_x_free(&send_buf);
+            ereport(ERROR, (errmsg("Failed to encode request")));
+        }
+        erlang_pool_call_to(conn->node_name, regname, regname, "$gen_call", &send_buf, timeout_ms, &reply);
+        result = erlang_term_to_jsonb(&reply);
+        ei_x_free(&reply);
+        PG_RETURN_JSONB_P(result);
+    }
+
+    request = erlang_new_request(conn);
+    erlang_begin_gen_call(&send_buf, conn, request, regname, "$gen_call");
+    if (jsonb_to_erlang_term(&send_buf, request_json) < 0) {
+        ei_x_free(&send_buf);
+        erlang_forget_request(request);
+        ereport(ERROR, (errmsg("Failed to encode request")));
+    }
+    err = erlang_send_request(&send_buf, conn, request, regname);
+    if (err != 0) {
+        ereport(ERROR, (errmsg("gen_call to %s on %s failed: %s (error: %d)", regname, node_name, strerror(err), err)));
+    }
+
+    if (!erlang_await_call(conn, request, timeout_ms, NULL)) {
+        erlang_stats_request(request, ERLANG_STATS_TIMEOUT, 0);
+        erlang_forget_request(request);
+        ereport(ERROR, (errmsg("gen_call to %s on %s timed out after %dms", regname, node_name, timeout_ms)));
+    }
+
+    result = erlang_term_to_jsonb(&request->response);
+    erlang_forget_request(request);
+    PG_RETURN_JSONB_P(result);
+}
+
+// Send a message to a registered process (Name ! Msg); counted as Name:'!'
+PG_FUNCTION_INFO_V1(erlang_send);
+Datum erlang_send(PG_FUNCTION_ARGS) {
+    char *node_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *regname = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    Jsonb *msg_json = PG_GETARG_JSONB_P(2);
+    ErlangConnection *conn;
+    ei_x_buff send_buf;
+
+    conn = erlang_lookup_connection(node_name);
+
+    if (conn->pooled) {
+        ei_x_new(&send_buf);
+    } else {
+        ei_x_new_with_version(&send_buf);
+    }
+    if (jsonb_to_erlang_term(&send_buf, msg_json) < 0) {
+        ei_x_free(&send_buf);
+        ereport(ERROR, (errmsg("Failed to encode message")));
+    }
+
+    if (conn->pooled) {
+        erlang_pool_send_to(conn->node_name, regname, regname, "!", &send_buf);
+        PG_RETURN_BOOL(true);
+    }
+
+    if (ei_reg_send(&conn->ec, conn->fd, regname, send_buf.buff, send_buf.index) < 0) {
+        int err = errno;
+
+        ei_x_free(&send_buf);
+        erlang_stats_record(conn->node_name, regname, "!", ERLANG_STATS_ERROR, 0, 0, 0);
+        erlang_drop_connection(conn);
+        ereport(ERROR, (errmsg("Send to %s on %s failed: %s (error: %d)", regname, node_name, strerror(err), err)));
+    }
+    erlang_stats_record(conn->node_name, regname, "!", ERLANG_STATS_CAST, send_buf.index, 0, 0);
+    ei_x_free(&send_buf);
+
+    PG_RETURN_BOOL(true);
+}
+
 // Check connection health
 PG_FUNCTION_INFO_V1(erlang_check_connection);
 Datum erlang_check_connection(PG_FUNCTION_ARGS) {
@@ -675,8 +2971,6 @@ Datum erlang_check_connection(PG_FUNCTION_ARGS) {
     char *node_name;
     bool found;
     ErlangConnection *conn;
-    erlang_msg msg;
-    ei_x_buff test_buf;
     int result;
     
     node_name_text = PG_GETARG_TEXT_PP(0);
@@ -687,18 +2981,26 @@ Datum erlang_check_connection(PG_FUNCTION_ARGS) {
         pfree(node_name);
         PG_RETURN_BOOL(false);
     }
-    
-    // Check if connection is still alive by trying to receive with 0 timeout
-    ei_x_new(&test_buf);
-    result = ei_receive_msg_tmo(conn->fd, &msg, &test_buf, 0);
-    ei_x_free(&test_buf);
-    
-    if (result == ERL_ERROR && errno != EAGAIN && errno != ETIMEDOUT) {
-        // Connection is dead, remove it
-        close(conn->fd);
-        hash_search(connection_map, node_name, HASH_REMOVE, NULL);
+
+    // The pool worker keeps its own connections alive
+    if (conn->pooled) {
         pfree(node_name);
-        PG_RETURN_BOOL(false);
+        PG_RETURN_BOOL(true);
+    }
+    
+    // Check if connection is still alive: drain whatever is readable right now,
+    // filing any replies for their requests
+    for (;;) {
+        result = erlang_demux_receive(conn, 0);
+        if (result == ERL_ERROR) {
+            // Connection is dead, remove it; the next call reconnects
+            erlang_drop_connection(conn);
+            pfree(node_name);
+            PG_RETURN_BOOL(false);
+        }
+        if (result == ERL_TIMEOUT) {
+            break;
+        }
     }
     
     pfree(node_name);
@@ -709,14 +3011,15 @@ Datum erlang_check_connection(PG_FUNCTION_ARGS) {
 PG_FUNCTION_INFO_V1(erlang_pending_requests);
 Datum erlang_pending_requests(PG_FUNCTION_ARGS) {
     HASH_SEQ_STATUS seq;
-    AsyncRequest *request;
+    ErlangRequest *request;
     int32 pending_count = 0;
     
     init_async_requests();
+    erlang_reap_requests();
     
     if (async_request_map != NULL) {
         hash_seq_init(&seq, async_request_map);
-        while ((request = (AsyncRequest *) hash_seq_search(&seq)) != NULL) {
+        while ((request = (ErlangRequest *) hash_seq_search(&seq)) != NULL) {
             if (!request->completed) {
                 pending_count++;
             }
@@ -724,4 +3027,105 @@ Datum erlang_pending_requests(PG_FUNCTION_ARGS) {
     }
     
     PG_RETURN_INT32(pending_count);
-} 
\ No newline at end of file
+}
+
+// List this session's asynchronous requests with the memory their replies hold
+PG_FUNCTION_INFO_V1(erlang_async_requests);
+Datum erlang_async_requests(PG_FUNCTION_ARGS) {
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    HASH_SEQ_STATUS seq;
+    ErlangRequest *request;
+    TimestampTz now;
+
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("erlang_async_requests must be called in a context that accepts a set")));
+    }
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR, (errmsg("return type must be a row type")));
+    }
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    init_async_requests();
+    erlang_reap_requests();
+    now = GetCurrentTimestamp();
+
+    hash_seq_init(&seq, async_request_map);
+    while ((request = (ErlangRequest *) hash_seq_search(&seq)) != NULL) {
+        Datum values[7];
+        bool nulls[7] = {false, false, false, false, false, false, false};
+
+        if (!request->async) {
+            continue;
+        }
+        values[0] = Int64GetDatum(request->request_id);
+        values[1] = CStringGetTextDatum(request->node_name);
+        values[2] = CStringGetTextDatum(request->module);
+        values[3] = CStringGetTextDatum(request->function);
+        values[4] = CStringGetTextDatum(request->evicted ? "evicted" : request->completed ? "completed" : "pending");
+        values[5] = Float8GetDatum((double) Max(request->expires_at - now, 0) / 1000.0);
+        values[6] = Int64GetDatum(request->completed && !request->evicted ? request->response.buffsz : 0);
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    return (Datum) 0;
+}
+// Decode a raw external-term-format binary (as from term_to_binary/1) to JSONB
+PG_FUNCTION_INFO_V1(erlang_etf_to_jsonb);
+Datum erlang_etf_to_jsonb(PG_FUNCTION_ARGS) {
+    bytea *etf = PG_GETARG_BYTEA_PP(0);
+    const char *data = VARDATA_ANY(etf);
+    int len = VARSIZE_ANY_EXHDR(etf);
+    int index = 0;
+
+    if (len > 0 && (uint8) data[0] == ETF_VERSION_MAGIC) {
+        index = 1;
+    }
+
+    PG_RETURN_JSONB_P(etf_decode_jsonb(data, len, index));
+}
+
+// Encode JSONB as external term format, the inverse of erlang_etf_to_jsonb
+PG_FUNCTION_INFO_V1(erlang_jsonb_to_etf);
+Datum erlang_jsonb_to_etf(PG_FUNCTION_ARGS) {
+    Jsonb *json = PG_GETARG_JSONB_P(0);
+    ei_x_buff buf;
+    bytea *result;
+
+    ei_x_new_with_version(&buf);
+    if (jsonb_to_erlang_term(&buf, json) < 0) {
+        ei_x_free(&buf);
+        ereport(ERROR, (errmsg("Failed to encode JSONB as an Erlang term")));
+    }
+
+    if (erlang_compress_threshold > 0 && buf.index - 1 >= erlang_compress_threshold) {
+        result = etf_compress(buf.buff + 1, buf.index - 1);
+        if (result != NULL) {
+            ei_x_free(&buf);
+            PG_RETURN_BYTEA_P(result);
+        }
+    }
+
+    result = (bytea *) palloc(VARHDRSZ + buf.index);
+    SET_VARSIZE(result, VARHDRSZ + buf.index);
+    memcpy(VARDATA(result), buf.buff, buf.index);
+    ei_x_free(&buf);
+
+    PG_RETURN_BYTEA_P(result);
+}
+
+// Foreign data wrapper; built on the request and connection helpers above
+#include "erlang_fdw.c"
+
+// Typed call variants; built on erlang_call's request path above
+#include "erlang_typed.c"
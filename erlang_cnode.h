@@ -5,44 +5,139 @@
 #include "fmgr.h"
 #include <ei.h>
 #include <ei_connect.h>
+#include "datatype/timestamp.h"
+#include "storage/latch.h"
+#include "utils/resowner.h"
 
 #define MAX_NODE_NAME 256
 #define MAX_COOKIE 256
+#define MAX_MFA_NAME 128
 #define MAX_PENDING_REQUESTS 1000
+#define ERLANG_POOL_QUEUE_SIZE (64 * 1024)
 
 // Structure to store connection state
+// Distribution frame being read without blocking (see erlang_frame.c)
+typedef struct {
+    char header[4];   // 4-byte big-endian frame length
+    int header_got;
+    char *body;       // malloc'd, handed to an ei_x_buff once complete
+    int body_len;
+    int body_got;
+} ErlangFrameReader;
+
+// Frames queued for a socket that is written without blocking (pool worker only)
+typedef struct {
+    char *buf;        // malloc'd
+    int size;
+    int len;          // Bytes queued
+    int sent;         // Bytes of buf already written
+    bool queued;      // Tick replies go through buf too, so they never split a frame
+} ErlangFrameWriter;
+
 typedef struct {
     char node_name[MAX_NODE_NAME];
     char cookie[MAX_COOKIE];
     int fd; // File descriptor for the Erlang connection
     ei_cnode ec; // Store the ei_cnode struct
+    bool pooled; // Calls are routed through the shared pool worker
+    ErlangFrameReader reader; // Partially received frame
+    ErlangFrameWriter writer; // Unsent frames, when sends must not block
 } ErlangConnection;
 
+// Hash key identifying an in-flight request by its Erlang reference
+typedef struct {
+    unsigned int n[3];
+} ErlangRefKey;
+
 // Structure to track async requests
 typedef struct {
     int64 request_id;          // Unique request ID
     char node_name[MAX_NODE_NAME];
-    unsigned long ref;          // Erlang reference for matching response
+    erlang_ref ref;             // Erlang reference for matching response
     time_t timestamp;           // When request was sent
     bool completed;             // Whether response has been received
     ei_x_buff response;         // Buffer to store response
-} AsyncRequest;
+    char module[MAX_MFA_NAME];  // Called function, for call statistics
+    char function[MAX_MFA_NAME];
+    TimestampTz sent_at;        // 0 until the request is on the wire
+    int bytes_sent;
+    bool recorded;              // Already counted in call statistics
+    bool async;                 // Sent by erlang_send_async; bounded, expires and may be evicted
+    bool evicted;               // Response dropped to stay within erlang_cnode.async_memory_limit
+    TimestampTz expires_at;     // Async requests are reaped after this
+} ErlangRequest;
 
 // Function declarations
 Datum erlang_connect(PG_FUNCTION_ARGS);
 Datum erlang_call(PG_FUNCTION_ARGS);
 Datum erlang_call_with_timeout(PG_FUNCTION_ARGS);
+Datum erlang_call_batch(PG_FUNCTION_ARGS);
+Datum erlang_call_agg_transfn(PG_FUNCTION_ARGS);
+Datum erlang_call_agg_finalfn(PG_FUNCTION_ARGS);
+Datum erlang_call_etf(PG_FUNCTION_ARGS);
+Datum erlang_call_with_binary(PG_FUNCTION_ARGS);
+Datum erlang_call_int8(PG_FUNCTION_ARGS);
+Datum erlang_call_float8(PG_FUNCTION_ARGS);
+Datum erlang_call_text(PG_FUNCTION_ARGS);
+Datum erlang_call_bool(PG_FUNCTION_ARGS);
+Datum erlang_call_int8_array(PG_FUNCTION_ARGS);
+Datum erlang_call_float8_array(PG_FUNCTION_ARGS);
+Datum erlang_call_bytea_array(PG_FUNCTION_ARGS);
+Datum erlang_multicall(PG_FUNCTION_ARGS);
 Datum erlang_ping(PG_FUNCTION_ARGS);
 Datum erlang_disconnect(PG_FUNCTION_ARGS);
 
 // Async function declarations
 Datum erlang_send_async(PG_FUNCTION_ARGS);
 Datum erlang_receive_async(PG_FUNCTION_ARGS);
+Datum erlang_receive_any(PG_FUNCTION_ARGS);
 Datum erlang_cast(PG_FUNCTION_ARGS);
+Datum erlang_cast_etf(PG_FUNCTION_ARGS);
+Datum erlang_gen_call(PG_FUNCTION_ARGS);
+Datum erlang_send(PG_FUNCTION_ARGS);
 Datum erlang_check_connection(PG_FUNCTION_ARGS);
 Datum erlang_pending_requests(PG_FUNCTION_ARGS);
+Datum erlang_async_requests(PG_FUNCTION_ARGS);
+Datum erlang_etf_to_jsonb(PG_FUNCTION_ARGS);
+Datum erlang_jsonb_to_etf(PG_FUNCTION_ARGS);
+Datum erlang_stat_calls(PG_FUNCTION_ARGS);
+Datum erlang_stat_reset(PG_FUNCTION_ARGS);
+Datum erlang_cache_invalidate(PG_FUNCTION_ARGS);
+Datum erlang_cache_stats(PG_FUNCTION_ARGS);
+Datum erlang_fdw_handler(PG_FUNCTION_ARGS);
+Datum erlang_fdw_validator(PG_FUNCTION_ARGS);
+
+// erlang_term type declarations
+Datum erlang_term_in(PG_FUNCTION_ARGS);
+Datum erlang_term_out(PG_FUNCTION_ARGS);
+Datum erlang_term_recv(PG_FUNCTION_ARGS);
+Datum erlang_term_send(PG_FUNCTION_ARGS);
+Datum erlang_term_from_etf(PG_FUNCTION_ARGS);
+Datum erlang_term_jsonb(PG_FUNCTION_ARGS);
+Datum erlang_term_from_jsonb(PG_FUNCTION_ARGS);
+Datum erlang_term_element(PG_FUNCTION_ARGS);
+Datum erlang_term_element_text(PG_FUNCTION_ARGS);
+Datum erlang_term_field(PG_FUNCTION_ARGS);
+Datum erlang_term_field_text(PG_FUNCTION_ARGS);
 
 // JSONB conversion function declarations
 int jsonb_to_erlang_args(ei_x_buff *buf, Jsonb *args_json);
+int jsonb_to_erlang_term(ei_x_buff *buf, Jsonb *json);
+int jsonb_to_erlang_args_with_binary(ei_x_buff *buf, Jsonb *args_json, const char *data, long len);
+
+// Connection pool background worker
+PGDLLEXPORT void erlang_pool_main(Datum main_arg);
+
+// Inbound message ingestion background worker
+PGDLLEXPORT void erlang_ingest_main(Datum main_arg);
+
+// WaitEventSet creation changed signature in PostgreSQL 17
+static inline WaitEventSet *erlang_create_wait_event_set(int nevents) {
+#if PG_VERSION_NUM >= 170000
+    return CreateWaitEventSet(CurrentResourceOwner, nevents);
+#else
+    return CreateWaitEventSet(CurrentMemoryContext, nevents);
+#endif
+}
 
 #endif 
\ No newline at end of file
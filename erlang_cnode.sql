@@ -2,20 +2,105 @@ CREATE FUNCTION erlang_connect(node_name text, cookie text) RETURNS boolean
 AS 'MODULE_PATHNAME', 'erlang_connect'
 LANGUAGE C STRICT;
 
+CREATE FUNCTION erlang_connect(node_name text) RETURNS boolean
+AS 'MODULE_PATHNAME', 'erlang_connect'
+LANGUAGE C STRICT;
+
 -- Original function signature for backward compatibility
 CREATE FUNCTION erlang_call(node_name text, module text, function text, args jsonb) RETURNS jsonb
 AS 'MODULE_PATHNAME', 'erlang_call'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL SAFE;
 
 -- Overloaded function with timeout parameter (in milliseconds, max 30000ms/30s)
 CREATE FUNCTION erlang_call(node_name text, module text, function text, args jsonb, timeout_ms integer DEFAULT 5000) RETURNS jsonb
 AS 'MODULE_PATHNAME', 'erlang_call_with_timeout'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL SAFE;
+
+-- Batched RPC: one round trip for a JSON array of {"module", "function", "args"} calls
+CREATE FUNCTION erlang_call_batch(node_name text, calls jsonb, timeout_ms integer DEFAULT 5000) RETURNS jsonb
+AS 'MODULE_PATHNAME', 'erlang_call_batch'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+-- Per-row calls pipelined batch_size at a time; results as a JSON array in input (ORDER BY) order
+CREATE FUNCTION erlang_call_agg_transfn(internal, text, text, text, jsonb, integer) RETURNS internal
+AS 'MODULE_PATHNAME', 'erlang_call_agg_transfn'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE FUNCTION erlang_call_agg_finalfn(internal) RETURNS jsonb
+AS 'MODULE_PATHNAME', 'erlang_call_agg_finalfn'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE AGGREGATE erlang_call_agg(node_name text, module text, function text, args jsonb, batch_size integer) (
+    SFUNC = erlang_call_agg_transfn,
+    STYPE = internal,
+    FINALFUNC = erlang_call_agg_finalfn,
+    FINALFUNC_MODIFY = READ_WRITE,
+    PARALLEL = SAFE
+);
+
+-- As above, waiting at most timeout_ms for each reply (aggregates take no defaults)
+CREATE FUNCTION erlang_call_agg_transfn(internal, text, text, text, jsonb, integer, integer) RETURNS internal
+AS 'MODULE_PATHNAME', 'erlang_call_agg_transfn'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE AGGREGATE erlang_call_agg(node_name text, module text, function text, args jsonb, batch_size integer,
+                                 timeout_ms integer) (
+    SFUNC = erlang_call_agg_transfn,
+    STYPE = internal,
+    FINALFUNC = erlang_call_agg_finalfn,
+    FINALFUNC_MODIFY = READ_WRITE,
+    PARALLEL = SAFE
+);
+
+-- Raw ETF RPC: term_to_binary(Args) in, term_to_binary(Result) out, no JSONB conversion
+CREATE FUNCTION erlang_call_etf(node_name text, module text, function text, args_etf bytea, timeout_ms integer DEFAULT 5000) RETURNS bytea
+AS 'MODULE_PATHNAME', 'erlang_call_etf'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+-- Typed RPC: the result is converted straight from the external term format, without JSONB
+CREATE FUNCTION erlang_call_int8(node_name text, module text, function text, args jsonb, timeout_ms integer DEFAULT 5000) RETURNS bigint
+AS 'MODULE_PATHNAME', 'erlang_call_int8'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION erlang_call_float8(node_name text, module text, function text, args jsonb, timeout_ms integer DEFAULT 5000) RETURNS double precision
+AS 'MODULE_PATHNAME', 'erlang_call_float8'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION erlang_call_text(node_name text, module text, function text, args jsonb, timeout_ms integer DEFAULT 5000) RETURNS text
+AS 'MODULE_PATHNAME', 'erlang_call_text'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION erlang_call_bool(node_name text, module text, function text, args jsonb, timeout_ms integer DEFAULT 5000) RETURNS boolean
+AS 'MODULE_PATHNAME', 'erlang_call_bool'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION erlang_call_int8_array(node_name text, module text, function text, args jsonb, timeout_ms integer DEFAULT 5000) RETURNS bigint[]
+AS 'MODULE_PATHNAME', 'erlang_call_int8_array'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION erlang_call_float8_array(node_name text, module text, function text, args jsonb, timeout_ms integer DEFAULT 5000) RETURNS double precision[]
+AS 'MODULE_PATHNAME', 'erlang_call_float8_array'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION erlang_call_bytea_array(node_name text, module text, function text, args jsonb, timeout_ms integer DEFAULT 5000) RETURNS bytea[]
+AS 'MODULE_PATHNAME', 'erlang_call_bytea_array'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+-- RPC with a bytea appended to the arguments as an Erlang binary
+CREATE FUNCTION erlang_call_with_binary(node_name text, module text, function text, args jsonb, payload bytea, timeout_ms integer DEFAULT 5000) RETURNS jsonb
+AS 'MODULE_PATHNAME', 'erlang_call_with_binary'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+-- Parallel multicall: one row per node, produced as replies arrive
+CREATE FUNCTION erlang_multicall(nodes text[], module text, function text, args jsonb, timeout_ms integer DEFAULT 5000)
+RETURNS TABLE(node text, status text, result jsonb, latency_ms double precision)
+AS 'MODULE_PATHNAME', 'erlang_multicall'
+LANGUAGE C STRICT PARALLEL SAFE;
 
 -- Test basic connectivity without RPC
 CREATE FUNCTION erlang_ping(node_name text) RETURNS text
 AS 'MODULE_PATHNAME', 'erlang_ping'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL RESTRICTED;
 
 CREATE FUNCTION erlang_disconnect(node_name text) RETURNS boolean
 AS 'MODULE_PATHNAME', 'erlang_disconnect'
@@ -24,20 +109,173 @@ LANGUAGE C STRICT;
 -- Async RPC functions
 CREATE FUNCTION erlang_send_async(node_name text, module text, function text, args jsonb) RETURNS bigint
 AS 'MODULE_PATHNAME', 'erlang_send_async'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL RESTRICTED;
 
 CREATE FUNCTION erlang_receive_async(request_id bigint, timeout_ms integer DEFAULT 0) RETURNS jsonb
 AS 'MODULE_PATHNAME', 'erlang_receive_async'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL RESTRICTED;
+
+CREATE FUNCTION erlang_receive_any(request_ids bigint[], timeout_ms integer DEFAULT 5000, max_results integer DEFAULT 0)
+RETURNS TABLE(request_id bigint, result jsonb)
+AS 'MODULE_PATHNAME', 'erlang_receive_any'
+LANGUAGE C STRICT VOLATILE PARALLEL RESTRICTED;
 
 CREATE FUNCTION erlang_cast(node_name text, module text, function text, args jsonb) RETURNS boolean
 AS 'MODULE_PATHNAME', 'erlang_cast'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION erlang_cast_etf(node_name text, module text, function text, args_etf bytea) RETURNS boolean
+AS 'MODULE_PATHNAME', 'erlang_cast_etf'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION erlang_gen_call(node_name text, regname text, request jsonb, timeout_ms integer DEFAULT 5000) RETURNS jsonb
+AS 'MODULE_PATHNAME', 'erlang_gen_call'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+CREATE FUNCTION erlang_send(node_name text, regname text, msg jsonb) RETURNS boolean
+AS 'MODULE_PATHNAME', 'erlang_send'
+LANGUAGE C STRICT PARALLEL SAFE;
 
 CREATE FUNCTION erlang_check_connection(node_name text) RETURNS boolean
 AS 'MODULE_PATHNAME', 'erlang_check_connection'
-LANGUAGE C STRICT;
+LANGUAGE C STRICT PARALLEL RESTRICTED;
 
 CREATE FUNCTION erlang_pending_requests() RETURNS integer
 AS 'MODULE_PATHNAME', 'erlang_pending_requests'
-LANGUAGE C STRICT; 
\ No newline at end of file
+LANGUAGE C STRICT PARALLEL RESTRICTED;
+
+CREATE FUNCTION erlang_async_requests(
+    OUT request_id bigint, OUT node text, OUT module text, OUT function text,
+    OUT status text, OUT expires_in_ms double precision, OUT bytes bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'erlang_async_requests'
+LANGUAGE C STRICT VOLATILE PARALLEL RESTRICTED;
+
+-- Call statistics (requires erlang_cnode in shared_preload_libraries)
+CREATE FUNCTION erlang_stat_calls(
+    OUT node text, OUT module text, OUT function text,
+    OUT calls bigint, OUT casts bigint, OUT errors bigint, OUT timeouts bigint,
+    OUT bytes_sent bigint, OUT bytes_received bigint,
+    OUT total_time_ms double precision, OUT mean_time_ms double precision,
+    OUT p50_ms double precision, OUT p99_ms double precision, OUT p999_ms double precision)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'erlang_stat_calls'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+CREATE VIEW pg_stat_erlang_calls AS SELECT * FROM erlang_stat_calls();
+
+CREATE FUNCTION erlang_stat_reset() RETURNS void
+AS 'MODULE_PATHNAME', 'erlang_stat_reset'
+LANGUAGE C STRICT VOLATILE;
+
+REVOKE ALL ON FUNCTION erlang_stat_reset() FROM PUBLIC;
+
+-- Shared result cache (requires erlang_cnode in shared_preload_libraries)
+CREATE FUNCTION erlang_cache_invalidate(module text DEFAULT NULL, function text DEFAULT NULL) RETURNS bigint
+AS 'MODULE_PATHNAME', 'erlang_cache_invalidate'
+LANGUAGE C VOLATILE;
+
+REVOKE ALL ON FUNCTION erlang_cache_invalidate(text, text) FROM PUBLIC;
+
+CREATE FUNCTION erlang_cache_stats(
+    OUT entries bigint, OUT hits bigint, OUT misses bigint, OUT stores bigint,
+    OUT evictions bigint, OUT invalidations bigint)
+RETURNS record
+AS 'MODULE_PATHNAME', 'erlang_cache_stats'
+LANGUAGE C STRICT VOLATILE PARALLEL SAFE;
+
+-- Decode term_to_binary/1 output to JSONB
+CREATE FUNCTION erlang_etf_to_jsonb(etf bytea) RETURNS jsonb
+AS 'MODULE_PATHNAME', 'erlang_etf_to_jsonb'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- Encode JSONB the way RPC arguments are encoded (binary_to_term/1 input)
+CREATE FUNCTION erlang_jsonb_to_etf(value jsonb) RETURNS bytea
+AS 'MODULE_PATHNAME', 'erlang_jsonb_to_etf'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- erlang_term: one Erlang term, stored as term_to_binary/1 output; Erlang literal syntax as text
+CREATE TYPE erlang_term;
+
+CREATE FUNCTION erlang_term_in(cstring) RETURNS erlang_term
+AS 'MODULE_PATHNAME', 'erlang_term_in'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION erlang_term_out(erlang_term) RETURNS cstring
+AS 'MODULE_PATHNAME', 'erlang_term_out'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION erlang_term_recv(internal) RETURNS erlang_term
+AS 'MODULE_PATHNAME', 'erlang_term_recv'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION erlang_term_send(erlang_term) RETURNS bytea
+AS 'MODULE_PATHNAME', 'erlang_term_send'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE TYPE erlang_term (
+    INPUT = erlang_term_in,
+    OUTPUT = erlang_term_out,
+    RECEIVE = erlang_term_recv,
+    SEND = erlang_term_send,
+    INTERNALLENGTH = VARIABLE,
+    STORAGE = extended
+);
+
+CREATE FUNCTION erlang_term_from_etf(etf bytea) RETURNS erlang_term
+AS 'MODULE_PATHNAME', 'erlang_term_from_etf'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION erlang_term_to_jsonb(term erlang_term) RETURNS jsonb
+AS 'MODULE_PATHNAME', 'erlang_term_jsonb'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION erlang_term_from_jsonb(value jsonb) RETURNS erlang_term
+AS 'MODULE_PATHNAME', 'erlang_term_from_jsonb'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+-- The stored form is term_to_binary/1 output, so erlang_term to bytea needs no conversion
+CREATE CAST (erlang_term AS bytea) WITHOUT FUNCTION;
+CREATE CAST (bytea AS erlang_term) WITH FUNCTION erlang_term_from_etf(bytea);
+CREATE CAST (erlang_term AS jsonb) WITH FUNCTION erlang_term_to_jsonb(erlang_term);
+CREATE CAST (jsonb AS erlang_term) WITH FUNCTION erlang_term_from_jsonb(jsonb);
+
+-- Accessors: element of a tuple or list (from 1), or the value under a map key; NULL if absent
+CREATE FUNCTION erlang_term_element(term erlang_term, n integer) RETURNS erlang_term
+AS 'MODULE_PATHNAME', 'erlang_term_element'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION erlang_term_element_text(term erlang_term, n integer) RETURNS text
+AS 'MODULE_PATHNAME', 'erlang_term_element_text'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION erlang_term_field(term erlang_term, key text) RETURNS erlang_term
+AS 'MODULE_PATHNAME', 'erlang_term_field'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION erlang_term_field_text(term erlang_term, key text) RETURNS text
+AS 'MODULE_PATHNAME', 'erlang_term_field_text'
+LANGUAGE C STRICT IMMUTABLE PARALLEL SAFE;
+
+CREATE OPERATOR -> (LEFTARG = erlang_term, RIGHTARG = integer, FUNCTION = erlang_term_element);
+CREATE OPERATOR ->> (LEFTARG = erlang_term, RIGHTARG = integer, FUNCTION = erlang_term_element_text);
+CREATE OPERATOR -> (LEFTARG = erlang_term, RIGHTARG = text, FUNCTION = erlang_term_field);
+CREATE OPERATOR ->> (LEFTARG = erlang_term, RIGHTARG = text, FUNCTION = erlang_term_field_text);
+
+-- RPC on erlang_term values: the argument list and the result never go through JSONB
+CREATE FUNCTION erlang_call_term(node_name text, module text, function text, args erlang_term, timeout_ms integer DEFAULT 5000) RETURNS erlang_term
+AS 'MODULE_PATHNAME', 'erlang_call_etf'
+LANGUAGE C STRICT PARALLEL SAFE;
+
+-- Foreign data wrapper: Erlang tables (ETS or ets:select/3-style modules) as foreign tables
+CREATE FUNCTION erlang_fdw_handler() RETURNS fdw_handler
+AS 'MODULE_PATHNAME', 'erlang_fdw_handler'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION erlang_fdw_validator(text[], oid) RETURNS void
+AS 'MODULE_PATHNAME', 'erlang_fdw_validator'
+LANGUAGE C STRICT;
+
+CREATE FOREIGN DATA WRAPPER erlang_fdw
+    HANDLER erlang_fdw_handler
+    VALIDATOR erlang_fdw_validator;
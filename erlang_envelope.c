@@ -0,0 +1,145 @@
+/*
+ * Pre-encoded message envelopes
+ * Every call to rex starts with the same {'$gen_call', { head and every
+ * call or cast of a given Module:Function repeats the same atoms. Those
+ * bytes are encoded once per backend and then appended verbatim, so the hot
+ * path only encodes the pid, the reference and the arguments.
+ */
+
+#include "postgres.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "erlang_cnode.h"
+#include <ei.h>
+
+// Most Module:Function pairs kept per backend; later ones are encoded each time
+#define ERLANG_ENVELOPE_CACHE_SIZE 1024
+
+// Longest "module:function" key (atoms are at most 255 characters)
+#define ERLANG_ENVELOPE_KEY_LEN (2 * 4 * 255 + 2)
+
+typedef struct {
+    char key[ERLANG_ENVELOPE_KEY_LEN];  // "module:function"
+    char *call_prefix;                  // {call, Module, Function,
+    int call_len;
+    char *cast_prefix;                  // {'$gen_cast', {cast, Module, Function,
+    int cast_len;
+} ErlangEnvelope;
+
+static HTAB *envelope_cache = NULL;
+static char gen_call_head[32];
+static int gen_call_head_len = 0;
+
+// Copy what was encoded into buf to a long-lived chunk
+static char *erlang_envelope_keep(ei_x_buff *buf, int *len) {
+    char *bytes = MemoryContextAlloc(TopMemoryContext, buf->index);
+
+    memcpy(bytes, buf->buff, buf->index);
+    *len = buf->index;
+    ei_x_free(buf);
+    return bytes;
+}
+
+// Cached envelope for Module:Function, or NULL if it cannot be cached
+static ErlangEnvelope *erlang_envelope_lookup(const char *module, const char *function) {
+    char key[ERLANG_ENVELOPE_KEY_LEN];
+    ErlangEnvelope *envelope;
+    ei_x_buff buf;
+    char *call_prefix;
+    char *cast_prefix;
+    int call_len;
+    int cast_len;
+    bool found;
+
+    if (strlen(module) + strlen(function) + 2 > ERLANG_ENVELOPE_KEY_LEN) {
+        return NULL;
+    }
+    snprintf(key, sizeof(key), "%s:%s", module, function);
+
+    if (envelope_cache == NULL) {
+        HASHCTL ctl;
+
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize = ERLANG_ENVELOPE_KEY_LEN;
+        ctl.entrysize = sizeof(ErlangEnvelope);
+        ctl.hcxt = TopMemoryContext;
+        envelope_cache = hash_create("Erlang envelope cache", 64, &ctl,
+                                     HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+    }
+
+    envelope = (ErlangEnvelope *) hash_search(envelope_cache, key, HASH_FIND, NULL);
+    if (envelope != NULL) {
+        return envelope;
+    }
+    if (hash_get_num_entries(envelope_cache) >= ERLANG_ENVELOPE_CACHE_SIZE) {
+        return NULL;
+    }
+
+    ei_x_new(&buf);
+    ei_x_encode_tuple_header(&buf, 5);
+    ei_x_encode_atom(&buf, "call");
+    ei_x_encode_atom(&buf, module);
+    ei_x_encode_atom(&buf, function);
+    call_prefix = erlang_envelope_keep(&buf, &call_len);
+
+    ei_x_new(&buf);
+    ei_x_encode_tuple_header(&buf, 2);
+    ei_x_encode_atom(&buf, "$gen_cast");
+    ei_x_encode_tuple_header(&buf, 4);
+    ei_x_encode_atom(&buf, "cast");
+    ei_x_encode_atom(&buf, module);
+    ei_x_encode_atom(&buf, function);
+    cast_prefix = erlang_envelope_keep(&buf, &cast_len);
+
+    // Only publish the entry once both prefixes exist
+    envelope = (ErlangEnvelope *) hash_search(envelope_cache, key, HASH_ENTER, &found);
+    envelope->call_prefix = call_prefix;
+    envelope->call_len = call_len;
+    envelope->cast_prefix = cast_prefix;
+    envelope->cast_len = cast_len;
+
+    return envelope;
+}
+
+// Encode {'$gen_call', { ; the caller follows with the pid and reference
+static void erlang_encode_gen_call_head(ei_x_buff *buf) {
+    if (gen_call_head_len == 0) {
+        int index = 0;
+
+        ei_encode_tuple_header(gen_call_head, &index, 3);
+        ei_encode_atom(gen_call_head, &index, "$gen_call");
+        ei_encode_tuple_header(gen_call_head, &index, 2);
+        gen_call_head_len = index;
+    }
+    ei_x_append_buf(buf, gen_call_head, gen_call_head_len);
+}
+
+// Encode {call, Module, Function, ; the caller follows with Args and the group leader
+static void erlang_encode_call_header(ei_x_buff *buf, const char *module, const char *function) {
+    ErlangEnvelope *envelope = erlang_envelope_lookup(module, function);
+
+    if (envelope != NULL) {
+        ei_x_append_buf(buf, envelope->call_prefix, envelope->call_len);
+        return;
+    }
+    ei_x_encode_tuple_header(buf, 5);
+    ei_x_encode_atom(buf, "call");
+    ei_x_encode_atom(buf, module);
+    ei_x_encode_atom(buf, function);
+}
+
+// Encode {'$gen_cast', {cast, Module, Function, ; the caller follows with Args
+static void erlang_encode_cast_header(ei_x_buff *buf, const char *module, const char *function) {
+    ErlangEnvelope *envelope = erlang_envelope_lookup(module, function);
+
+    if (envelope != NULL) {
+        ei_x_append_buf(buf, envelope->cast_prefix, envelope->cast_len);
+        return;
+    }
+    ei_x_encode_tuple_header(buf, 2);
+    ei_x_encode_atom(buf, "$gen_cast");
+    ei_x_encode_tuple_header(buf, 4);
+    ei_x_encode_atom(buf, "cast");
+    ei_x_encode_atom(buf, module);
+    ei_x_encode_atom(buf, function);
+}
@@ -0,0 +1,951 @@
+/*
+ * Foreign data wrapper over Erlang tables
+ * A foreign table names a table on an Erlang node and is read a page at a
+ * time with the contract of ets:select/3 and ets:select/1:
+ * Module:Function(Table, MatchSpec, Limit) returns {Rows, Continuation} or
+ * '$end_of_table', and Module:Function(Continuation) returns the next page.
+ * ETS tables work as they are; Mnesia or anything else needs a module with
+ * the same two calls. Each row is a tuple whose leading elements are the
+ * columns, or a map keyed by column name.
+ *
+ * Comparisons of a column with a constant become match spec guards, and are
+ * rechecked locally, so a guard only has to be no stricter than its SQL
+ * counterpart. When every condition became a guard, a LIMIT caps the page
+ * size. The continuations of ets:select/1 keep the limit of the first call,
+ * so that applies to every page; with a condition left to check locally,
+ * rejected rows would then cost a round trip each, and pages stay full.
+ * Scans are async-capable, so an Append over partitions on several nodes
+ * fetches them concurrently.
+ */
+
+#include "postgres.h"
+#include "access/reloptions.h"
+#include "access/transam.h"
+#include "catalog/pg_foreign_server.h"
+#include "catalog/pg_foreign_table.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "commands/explain.h"
+#if PG_VERSION_NUM >= 180000
+#include "commands/explain_format.h"
+#endif
+#include "executor/execAsync.h"
+#include "foreign/fdwapi.h"
+#include "foreign/foreign.h"
+#include "nodes/makefuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/planmain.h"
+#include "optimizer/restrictinfo.h"
+#include "utils/builtins.h"
+#include "utils/jsonb.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "erlang_cnode.h"
+
+// Result of moving a scan to its next row
+#define ERLANG_FDW_ROW 0
+#define ERLANG_FDW_EOF 1
+#define ERLANG_FDW_PENDING 2
+
+// Planner cost of one page round trip
+#define ERLANG_FDW_PAGE_COST 100.0
+
+// Server and table options, table options winning
+typedef struct {
+    char *node;
+    char *module;
+    char *function;
+    char *table;
+    int page_size;
+    int timeout_ms;
+    double rows;
+    bool async_capable;
+} ErlangFdwOptions;
+
+typedef struct {
+    const char *name;
+    bool server;
+    bool table;
+} ErlangFdwOption;
+
+static const ErlangFdwOption erlang_fdw_valid_options[] = {
+    {"node", true, true},
+    {"table", false, true},
+    {"module", false, true},
+    {"function", false, true},
+    {"page_size", true, true},
+    {"timeout_ms", true, true},
+    {"rows", false, true},
+    {"async_capable", true, true},
+    {NULL, false, false}
+};
+
+typedef struct {
+    ErlangFdwOptions opts;
+    char node_name[MAX_NODE_NAME];  // Resolved node (a member when opts.node is a group)
+    bool pooled;
+    bool async;                     // Run under an async Append
+    bool prefetch;                  // Ask for the next page as soon as one arrives
+    List *guards;                   // (attno, Erlang operator, Const) triples from the planner
+    int first_page;
+
+    // Column conversion
+    int natts;
+    int *colpos;                    // Tuple element of each column, -1 if dropped
+    char **colnames;
+    Oid *typids;
+    FmgrInfo *in_functions;
+    Oid *typioparams;
+    int32 *typmods;
+
+    // Paging
+    bool started;
+    bool eof;                       // No further pages to ask for
+    int64 request_id;               // Page request in flight, 0 if none
+    char *page;                     // Current page, in page_context
+    int page_len;
+    int page_rows;                  // Rows of the page not yet returned
+    int row_index;                  // Offset of the next row within page
+    char *cont;                     // Continuation term within page, NULL on the last page
+    int cont_len;
+    MemoryContext page_context;
+    MemoryContext row_context;
+} ErlangFdwScanState;
+
+// Sockets already added to the Append's wait set this round; each may be added once
+static WaitEventSet *erlang_fdw_wait_set = NULL;
+static List *erlang_fdw_wait_fds = NIL;
+
+static const ErlangFdwOption *erlang_fdw_option(const char *name) {
+    const ErlangFdwOption *option;
+
+    for (option = erlang_fdw_valid_options; option->name != NULL; option++) {
+        if (strcmp(option->name, name) == 0) {
+            return option;
+        }
+    }
+    return NULL;
+}
+
+static int erlang_fdw_positive_int(DefElem *def) {
+    char *value = defGetString(def);
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(value, &end, 10);
+    if (errno != 0 || *end != '\0' || n <= 0 || n > INT_MAX) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_INVALID_ATTRIBUTE_VALUE),
+                 errmsg("erlang_fdw option \"%s\" must be a positive integer", def->defname)));
+    }
+    return (int) n;
+}
+
+static void erlang_fdw_options(Oid foreigntableid, ErlangFdwOptions *opts) {
+    ForeignTable *table = GetForeignTable(foreigntableid);
+    ForeignServer *server = GetForeignServer(table->serverid);
+    List *options = list_concat(list_copy(server->options), table->options);
+    ListCell *lc;
+
+    opts->node = NULL;
+    opts->module = "ets";
+    opts->function = "select";
+    opts->table = NULL;
+    opts->page_size = 1000;
+    opts->timeout_ms = 5000;
+    opts->rows = 1000;
+    opts->async_capable = true;
+
+    foreach(lc, options) {
+        DefElem *def = (DefElem *) lfirst(lc);
+
+        if (strcmp(def->defname, "node") == 0) {
+            opts->node = defGetString(def);
+        } else if (strcmp(def->defname, "table") == 0) {
+            opts->table = defGetString(def);
+        } else if (strcmp(def->defname, "module") == 0) {
+            opts->module = defGetString(def);
+        } else if (strcmp(def->defname, "function") == 0) {
+            opts->function = defGetString(def);
+        } else if (strcmp(def->defname, "page_size") == 0) {
+            opts->page_size = erlang_fdw_positive_int(def);
+        } else if (strcmp(def->defname, "timeout_ms") == 0) {
+            opts->timeout_ms = erlang_fdw_positive_int(def);
+        } else if (strcmp(def->defname, "rows") == 0) {
+            opts->rows = erlang_fdw_positive_int(def);
+        } else if (strcmp(def->defname, "async_capable") == 0) {
+            opts->async_capable = defGetBoolean(def);
+        }
+    }
+
+    if (opts->node == NULL || opts->table == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+                 errmsg("erlang_fdw foreign table \"%s\" needs the node and table options",
+                        get_rel_name(foreigntableid))));
+    }
+}
+
+// Check the options of a server or foreign table
+PG_FUNCTION_INFO_V1(erlang_fdw_validator);
+Datum erlang_fdw_validator(PG_FUNCTION_ARGS) {
+    List *options = untransformRelOptions(PG_GETARG_DATUM(0));
+    Oid catalog = PG_GETARG_OID(1);
+    ListCell *lc;
+
+    foreach(lc, options) {
+        DefElem *def = (DefElem *) lfirst(lc);
+        const ErlangFdwOption *option = erlang_fdw_option(def->defname);
+
+        if (option == NULL ||
+            (catalog == ForeignServerRelationId && !option->server) ||
+            (catalog == ForeignTableRelationId && !option->table) ||
+            (catalog != ForeignServerRelationId && catalog != ForeignTableRelationId)) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                     errmsg("invalid erlang_fdw option \"%s\"", def->defname),
+                     errhint("Servers take node, page_size, timeout_ms and async_capable; foreign tables "
+                             "also take table, module, function and rows.")));
+        }
+        if (strcmp(def->defname, "page_size") == 0 || strcmp(def->defname, "timeout_ms") == 0 ||
+            strcmp(def->defname, "rows") == 0) {
+            (void) erlang_fdw_positive_int(def);
+        } else if (strcmp(def->defname, "async_capable") == 0) {
+            (void) defGetBoolean(def);
+        } else if (strlen(defGetString(def)) >= (strcmp(def->defname, "node") == 0 ? MAX_NODE_NAME : MAXATOMLEN)) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_STRING_LENGTH_OR_BUFFER_LENGTH),
+                     errmsg("erlang_fdw option \"%s\" is too long", def->defname)));
+        }
+    }
+    PG_RETURN_VOID();
+}
+
+static void erlang_fdw_get_rel_size(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid) {
+    ErlangFdwOptions *opts = palloc(sizeof(ErlangFdwOptions));
+
+    erlang_fdw_options(foreigntableid, opts);
+    baserel->fdw_private = opts;
+    baserel->rows = clamp_row_est(opts->rows * clauselist_selectivity(root, baserel->baserestrictinfo, 0,
+                                                                      JOIN_INNER, NULL));
+}
+
+static void erlang_fdw_get_paths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid) {
+    ErlangFdwOptions *opts = (ErlangFdwOptions *) baserel->fdw_private;
+    Cost startup_cost = ERLANG_FDW_PAGE_COST;
+    Cost total_cost = startup_cost + baserel->rows * cpu_tuple_cost +
+                      ceil(baserel->rows / opts->page_size) * ERLANG_FDW_PAGE_COST;
+    ForeignPath *path;
+
+#if PG_VERSION_NUM >= 180000
+    path = create_foreignscan_path(root, baserel, NULL, baserel->rows, 0, startup_cost, total_cost, NIL,
+                                   baserel->lateral_relids, NULL, NIL, NIL);
+#elif PG_VERSION_NUM >= 170000
+    path = create_foreignscan_path(root, baserel, NULL, baserel->rows, startup_cost, total_cost, NIL,
+                                   baserel->lateral_relids, NULL, NIL, NIL);
+#else
+    path = create_foreignscan_path(root, baserel, NULL, baserel->rows, startup_cost, total_cost, NIL,
+                                   baserel->lateral_relids, NULL, NIL);
+#endif
+    add_path(baserel, (Path *) path);
+}
+
+static bool erlang_fdw_async_capable(ForeignPath *path) {
+    return ((ErlangFdwOptions *) path->path.parent->fdw_private)->async_capable;
+}
+
+// Skip binary-compatible casts such as varchar to text
+static Node *erlang_fdw_strip(Node *node) {
+    while (node != NULL && IsA(node, RelabelType)) {
+        node = (Node *) ((RelabelType *) node)->arg;
+    }
+    return node;
+}
+
+static bool erlang_fdw_numeric_type(Oid type) {
+    return type == INT2OID || type == INT4OID || type == INT8OID || type == FLOAT4OID || type == FLOAT8OID;
+}
+
+static bool erlang_fdw_text_type(Oid type) {
+    return type == TEXTOID || type == VARCHAROID;
+}
+
+/*
+ * Turn "column op constant" into an (attno, Erlang operator, Const) triple,
+ * or NIL if the clause cannot become a guard. Only built-in operators on
+ * numbers, booleans and text qualify; text only for equality, since
+ * Erlang orders binaries bytewise rather than by collation.
+ */
+static List *erlang_fdw_guard(RelOptInfo *baserel, Expr *clause) {
+    static const char *const ops[][3] = {
+        {"=", "==", "=="}, {"<>", "/=", "/="}, {"<", "<", ">"},
+        {"<=", "=<", ">="}, {">", ">", "<"}, {">=", ">=", "=<"}
+    };
+    OpExpr *op;
+    Node *left;
+    Node *right;
+    Var *var;
+    Const *value;
+    bool commuted = false;
+    char *opname;
+    int i;
+
+    if (!IsA(clause, OpExpr) || list_length(((OpExpr *) clause)->args) != 2) {
+        return NIL;
+    }
+    op = (OpExpr *) clause;
+    if (op->opno >= FirstNormalObjectId) {
+        return NIL;
+    }
+    left = erlang_fdw_strip(linitial(op->args));
+    right = erlang_fdw_strip(lsecond(op->args));
+    if (IsA(left, Const) && IsA(right, Var)) {
+        Node *tmp = left;
+
+        left = right;
+        right = tmp;
+        commuted = true;
+    }
+    if (!IsA(left, Var) || !IsA(right, Const)) {
+        return NIL;
+    }
+    var = (Var *) left;
+    value = (Const *) right;
+    if (var->varno != baserel->relid || var->varlevelsup != 0 || var->varattno <= 0 || value->constisnull) {
+        return NIL;
+    }
+
+    opname = get_opname(op->opno);
+    if (opname == NULL) {
+        return NIL;
+    }
+    for (i = 0; i < lengthof(ops); i++) {
+        if (strcmp(opname, ops[i][0]) == 0) {
+            break;
+        }
+    }
+    if (i == lengthof(ops)) {
+        return NIL;
+    }
+    if (erlang_fdw_numeric_type(var->vartype) && erlang_fdw_numeric_type(value->consttype)) {
+        // Any comparison
+    } else if ((var->vartype == BOOLOID && value->consttype == BOOLOID) ||
+               (erlang_fdw_text_type(var->vartype) && erlang_fdw_text_type(value->consttype))) {
+        if (i > 1) {
+            return NIL;
+        }
+    } else {
+        return NIL;
+    }
+
+    return list_make3(makeInteger(var->varattno), makeString(pstrdup(ops[i][commuted ? 2 : 1])),
+                      copyObject(value));
+}
+
+static ForeignScan *erlang_fdw_get_plan(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid,
+                                        ForeignPath *best_path, List *tlist, List *scan_clauses,
+                                        Plan *outer_plan) {
+    ErlangFdwOptions *opts = (ErlangFdwOptions *) baserel->fdw_private;
+    List *guards = NIL;
+    int first_page = opts->page_size;
+    ListCell *lc;
+
+    foreach(lc, scan_clauses) {
+        RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+        List *guard = erlang_fdw_guard(baserel, rinfo->clause);
+
+        if (guard != NIL) {
+            guards = lappend(guards, guard);
+        }
+    }
+
+    /*
+     * Paging goes on if the first page falls short, so a LIMIT only needs to
+     * be a hint. Continuations keep the page size, though, so it is taken
+     * only when no condition is left to reject rows locally.
+     */
+    if (root->limit_tuples > 0 && root->limit_tuples < first_page &&
+        bms_membership(root->all_baserels) == BMS_SINGLETON &&
+        list_length(guards) == list_length(scan_clauses)) {
+        first_page = (int) root->limit_tuples;
+    }
+
+    return make_foreignscan(tlist, extract_actual_clauses(scan_clauses, false), baserel->relid, NIL,
+                            list_make2(makeInteger(first_page), guards), NIL, NIL, outer_plan);
+}
+
+static void erlang_fdw_explain(ForeignScanState *node, ExplainState *es) {
+    ForeignScan *plan = (ForeignScan *) node->ss.ps.plan;
+    ErlangFdwOptions opts;
+
+    erlang_fdw_options(RelationGetRelid(node->ss.ss_currentRelation), &opts);
+    ExplainPropertyText("Erlang Call",
+                        psprintf("%s:%s(%s) on %s", opts.module, opts.function, opts.table, opts.node), es);
+    ExplainPropertyInteger("Pushed Guards", NULL, list_length((List *) lsecond(plan->fdw_private)), es);
+    // Continuations keep the limit of the first call, so this is the size of every page
+    ExplainPropertyInteger("Page Size", NULL, intVal(linitial(plan->fdw_private)), es);
+}
+
+// Encode a string constant as a binary, a string or an atom
+static void erlang_fdw_encode_text(ei_x_buff *buf, const char *str, int kind) {
+    ei_x_encode_tuple_header(buf, 2);
+    ei_x_encode_atom(buf, "const");
+    if (kind == 0) {
+        ei_x_encode_binary(buf, str, strlen(str));
+    } else if (kind == 1) {
+        ei_x_encode_string(buf, str);
+    } else {
+        ei_x_encode_atom(buf, str);
+    }
+}
+
+// A column's value in a guard, {element, N, '$_'}; a row too short or not a tuple fails the guard
+static void erlang_fdw_encode_column(ei_x_buff *buf, ErlangFdwScanState *st, int attno) {
+    ei_x_encode_tuple_header(buf, 3);
+    ei_x_encode_atom(buf, "element");
+    ei_x_encode_long(buf, st->colpos[attno - 1] + 1);
+    ei_x_encode_atom(buf, "$_");
+}
+
+/*
+ * Encode one guard, {Op, Column, {const, Value}}. Text may be stored as a
+ * binary, a string or an atom, so = matches any of them and <> none.
+ */
+static void erlang_fdw_encode_guard(ei_x_buff *buf, ErlangFdwScanState *st, List *guard) {
+    int attno = intVal(linitial(guard));
+    const char *op = strVal(lsecond(guard));
+    Const *value = (Const *) lthird(guard);
+
+    if (erlang_fdw_text_type(value->consttype)) {
+        char *str = TextDatumGetCString(value->constvalue);
+        const char *join = strcmp(op, "==") == 0 ? "orelse" : "andalso";
+        int kinds = strlen(str) < MAXATOMLEN ? 3 : 2;
+        int kind;
+
+        for (kind = 0; kind < kinds; kind++) {
+            if (kind < kinds - 1) {
+                ei_x_encode_tuple_header(buf, 3);
+                ei_x_encode_atom(buf, join);
+            }
+            ei_x_encode_tuple_header(buf, 3);
+            ei_x_encode_atom(buf, op);
+            erlang_fdw_encode_column(buf, st, attno);
+            erlang_fdw_encode_text(buf, str, kind);
+        }
+        return;
+    }
+
+    ei_x_encode_tuple_header(buf, 3);
+    ei_x_encode_atom(buf, op);
+    erlang_fdw_encode_column(buf, st, attno);
+    ei_x_encode_tuple_header(buf, 2);
+    ei_x_encode_atom(buf, "const");
+    switch (value->consttype) {
+        case INT2OID:
+            ei_x_encode_longlong(buf, DatumGetInt16(value->constvalue));
+            break;
+        case INT4OID:
+            ei_x_encode_longlong(buf, DatumGetInt32(value->constvalue));
+            break;
+        case INT8OID:
+            ei_x_encode_longlong(buf, DatumGetInt64(value->constvalue));
+            break;
+        case FLOAT4OID:
+            ei_x_encode_double(buf, DatumGetFloat4(value->constvalue));
+            break;
+        case FLOAT8OID:
+            ei_x_encode_double(buf, DatumGetFloat8(value->constvalue));
+            break;
+        default:
+            ei_x_encode_atom(buf, DatumGetBool(value->constvalue) ? "true" : "false");
+            break;
+    }
+}
+
+// Start a match spec clause {'_', Guards, ['$_']}; the caller encodes the guards and, if any, the list tail
+static void erlang_fdw_encode_clause_head(ei_x_buff *buf, int nguards) {
+    ei_x_encode_tuple_header(buf, 3);
+    ei_x_encode_atom(buf, "_");
+    ei_x_encode_list_header(buf, nguards);
+}
+
+static void erlang_fdw_encode_clause_tail(ei_x_buff *buf) {
+    ei_x_encode_list_header(buf, 1);
+    ei_x_encode_atom(buf, "$_");
+    ei_x_encode_empty_list(buf);
+}
+
+/*
+ * The match spec. The head is always '_', so tuples wider than the
+ * foreign table match as well. Guards reach columns with element/2, which
+ * only works on tuples; maps are let through by a second clause and
+ * filtered by the local recheck.
+ */
+static void erlang_fdw_encode_match_spec(ei_x_buff *buf, ErlangFdwScanState *st) {
+    ListCell *lc;
+
+    if (st->guards == NIL) {
+        ei_x_encode_list_header(buf, 1);
+        erlang_fdw_encode_clause_head(buf, 0);
+        erlang_fdw_encode_clause_tail(buf);
+        ei_x_encode_empty_list(buf);
+        return;
+    }
+
+    ei_x_encode_list_header(buf, 2);
+    erlang_fdw_encode_clause_head(buf, list_length(st->guards));
+    foreach(lc, st->guards) {
+        erlang_fdw_encode_guard(buf, st, (List *) lfirst(lc));
+    }
+    ei_x_encode_empty_list(buf);
+    erlang_fdw_encode_clause_tail(buf);
+
+    erlang_fdw_encode_clause_head(buf, 1);
+    ei_x_encode_tuple_header(buf, 2);
+    ei_x_encode_atom(buf, "is_map");
+    ei_x_encode_atom(buf, "$_");
+    ei_x_encode_empty_list(buf);
+    erlang_fdw_encode_clause_tail(buf);
+    ei_x_encode_empty_list(buf);
+}
+
+// Take a page reply: {Rows, Continuation} or '$end_of_table'
+static void erlang_fdw_load_page(ErlangFdwScanState *st, ei_x_buff *reply) {
+    int index = etf_reply_index(reply);
+    int len = reply->index - index;
+    char atom[MAXATOMLEN];
+    char *buff;
+    int arity;
+    int tmp = 0;
+    int i;
+
+    MemoryContextReset(st->page_context);
+    buff = MemoryContextAlloc(st->page_context, Max(len, 1));
+    memcpy(buff, reply->buff + index, len);
+    st->page = buff;
+    st->page_len = len;
+    st->page_rows = 0;
+    st->cont = NULL;
+
+    if (ei_decode_atom(buff, &tmp, atom) == 0 && strcmp(atom, "$end_of_table") == 0) {
+        st->eof = true;
+        return;
+    }
+    tmp = 0;
+    if (ei_decode_tuple_header(buff, &tmp, &arity) < 0 || arity != 2 ||
+        ei_decode_list_header(buff, &tmp, &st->page_rows) < 0) {
+        ereport(ERROR,
+                (errmsg("erlang_fdw: %s:%s on %s returned an unexpected reply",
+                        st->opts.module, st->opts.function, st->node_name),
+                 errdetail("%s", JsonbToCString(NULL, &etf_decode_jsonb(buff, len, 0)->root, len))));
+    }
+    st->row_index = tmp;
+    for (i = 0; i < st->page_rows; i++) {
+        if (ei_skip_term(buff, &tmp) < 0) {
+            etf_truncated();
+        }
+    }
+    if (st->page_rows > 0 && ei_decode_list_header(buff, &tmp, &arity) < 0) {
+        etf_truncated();
+    }
+
+    // The continuation goes back as it came; '$end_of_table' means this was the last page
+    i = tmp;
+    if (ei_skip_term(buff, &tmp) < 0 || tmp != len) {
+        etf_truncated();
+    }
+    st->cont = buff + i;
+    st->cont_len = len - i;
+    if (ei_decode_atom(buff, &i, atom) == 0 && strcmp(atom, "$end_of_table") == 0) {
+        st->cont = NULL;
+        st->eof = true;
+    }
+}
+
+// Ask for the first page, or the one after the current continuation
+static void erlang_fdw_send_page(ErlangFdwScanState *st) {
+    ErlangConnection *conn = erlang_lookup_connection(st->node_name);
+    ErlangRequest *request = NULL;
+    ei_x_buff send_buf;
+    int err;
+
+    if (conn->pooled) {
+        erlang_pool_begin_call(&send_buf, st->opts.module, st->opts.function);
+    } else {
+        request = erlang_new_request(conn);
+        erlang_begin_rpc(&send_buf, conn, request, st->opts.module, st->opts.function);
+    }
+
+    if (!st->started) {
+        ei_x_encode_list_header(&send_buf, 3);
+        ei_x_encode_atom(&send_buf, st->opts.table);
+        erlang_fdw_encode_match_spec(&send_buf, st);
+        ei_x_encode_long(&send_buf, st->first_page);
+        st->started = true;
+    } else {
+        ei_x_encode_list_header(&send_buf, 1);
+        ei_x_append_buf(&send_buf, st->cont, st->cont_len);
+    }
+    ei_x_encode_empty_list(&send_buf);
+
+    // The pool answers synchronously, so there is never a page in flight
+    if (conn->pooled) {
+        ei_x_buff reply;
+
+        erlang_pool_call_body(conn->node_name, st->opts.module, st->opts.function, &send_buf,
+                              st->opts.timeout_ms, &reply);
+        erlang_fdw_load_page(st, &reply);
+        ei_x_free(&reply);
+        return;
+    }
+
+    err = erlang_finish_rpc(&send_buf, conn, request);
+    if (err != 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_CONNECTION_FAILURE),
+                 errmsg("erlang_fdw: request to %s failed: %s", st->node_name, strerror(err))));
+    }
+    st->request_id = request->request_id;
+}
+
+// Drop the page request in flight, if any
+static void erlang_fdw_forget(ErlangFdwScanState *st) {
+    if (st->request_id != 0) {
+        ErlangRequest *request;
+
+        request = (ErlangRequest *) hash_search(async_request_map, &st->request_id, HASH_FIND, NULL);
+        if (request != NULL) {
+            erlang_forget_request(request);
+        }
+        st->request_id = 0;
+    }
+}
+
+static void erlang_fdw_cleanup(void *arg) {
+    erlang_fdw_forget((ErlangFdwScanState *) arg);
+}
+
+/*
+ * Make sure a row is ready, fetching pages as needed. Without wait a page
+ * still on its way gives ERLANG_FDW_PENDING instead of blocking.
+ */
+static int erlang_fdw_advance(ErlangFdwScanState *st, bool wait) {
+    for (;;) {
+        ErlangRequest *request;
+        ErlangConnection *conn;
+
+        if (st->page_rows > 0) {
+            return ERLANG_FDW_ROW;
+        }
+        if (st->eof) {
+            return ERLANG_FDW_EOF;
+        }
+        if (st->request_id == 0) {
+            erlang_fdw_send_page(st);
+            continue;
+        }
+
+        request = (ErlangRequest *) hash_search(async_request_map, &st->request_id, HASH_FIND, NULL);
+        conn = (ErlangConnection *) hash_search(connection_map, st->node_name, HASH_FIND, NULL);
+        if (request == NULL || conn == NULL) {
+            st->request_id = 0;
+            ereport(ERROR,
+                    (errcode(ERRCODE_CONNECTION_FAILURE),
+                     errmsg("erlang_fdw: connection to %s lost", st->node_name)));
+        }
+        if (!request->completed) {
+            if (!wait) {
+                return ERLANG_FDW_PENDING;
+            }
+            if (!erlang_await_call(conn, request, st->opts.timeout_ms, NULL)) {
+                erlang_stats_request(request, ERLANG_STATS_TIMEOUT, 0);
+                erlang_fdw_forget(st);
+                ereport(ERROR,
+                        (errmsg("erlang_fdw: page from %s timed out after %dms", st->node_name,
+                                st->opts.timeout_ms)));
+            }
+        }
+
+        erlang_fdw_load_page(st, &request->response);
+        erlang_fdw_forget(st);
+        if (st->prefetch && !st->eof) {
+            erlang_fdw_send_page(st);
+        }
+    }
+}
+
+// Convert one element of a row to the column's type
+static Datum erlang_fdw_datum(ErlangFdwScanState *st, int i, JsonbValue *v, bool *isnull) {
+    char *str;
+
+    if (v == NULL || v->type == jbvNull) {
+        *isnull = true;
+        return (Datum) 0;
+    }
+    *isnull = false;
+    if (st->typids[i] == JSONBOID) {
+        return JsonbPGetDatum(JsonbValueToJsonb(v));
+    }
+
+    switch (v->type) {
+        case jbvString:
+            str = pnstrdup(v->val.string.val, v->val.string.len);
+            break;
+        case jbvNumeric:
+            str = DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(v->val.numeric)));
+            break;
+        case jbvBool:
+            str = v->val.boolean ? "true" : "false";
+            break;
+        default:
+            str = JsonbToCString(NULL, v->val.binary.data, v->val.binary.len);
+            break;
+    }
+    return InputFunctionCall(&st->in_functions[i], str, st->typioparams[i], st->typmods[i]);
+}
+
+// Decode the next row of the page into the slot
+static void erlang_fdw_store_row(ErlangFdwScanState *st, TupleTableSlot *slot) {
+    MemoryContext oldcontext;
+    Jsonb *row;
+    bool positional;
+    int i;
+
+    MemoryContextReset(st->row_context);
+    oldcontext = MemoryContextSwitchTo(st->row_context);
+
+    row = etf_decode_jsonb(st->page, st->page_len, st->row_index);
+    if (ei_skip_term(st->page, &st->row_index) < 0) {
+        etf_truncated();
+    }
+    st->page_rows--;
+
+    positional = JB_ROOT_IS_ARRAY(row) && !JB_ROOT_IS_SCALAR(row);
+    if (!positional && !JB_ROOT_IS_OBJECT(row)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+                 errmsg("erlang_fdw: rows of %s must be tuples or maps", st->opts.table)));
+    }
+
+    for (i = 0; i < st->natts; i++) {
+        JsonbValue *v = NULL;
+
+        if (st->colpos[i] < 0) {
+            slot->tts_isnull[i] = true;
+            continue;
+        }
+        if (positional) {
+            v = getIthJsonbValueFromContainer(&row->root, st->colpos[i]);
+        } else {
+            JsonbValue key;
+
+            key.type = jbvString;
+            key.val.string.val = st->colnames[i];
+            key.val.string.len = strlen(st->colnames[i]);
+            v = findJsonbValueFromContainer(&row->root, JB_FOBJECT, &key);
+        }
+        slot->tts_values[i] = erlang_fdw_datum(st, i, v, &slot->tts_isnull[i]);
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+    ExecStoreVirtualTuple(slot);
+}
+
+static void erlang_fdw_begin(ForeignScanState *node, int eflags) {
+    ForeignScan *plan = (ForeignScan *) node->ss.ps.plan;
+    EState *estate = node->ss.ps.state;
+    TupleDesc tupdesc = RelationGetDescr(node->ss.ss_currentRelation);
+    ErlangFdwScanState *st;
+    ErlangConnection *conn;
+    MemoryContextCallback *callback;
+    int pos = 0;
+    int i;
+
+    if (eflags & EXEC_FLAG_EXPLAIN_ONLY) {
+        return;
+    }
+
+    st = palloc0(sizeof(ErlangFdwScanState));
+    erlang_fdw_options(RelationGetRelid(node->ss.ss_currentRelation), &st->opts);
+    st->first_page = intVal(linitial(plan->fdw_private));
+    st->guards = (List *) lsecond(plan->fdw_private);
+    st->async = node->ss.ps.async_capable;
+
+    st->natts = tupdesc->natts;
+    st->colpos = palloc(sizeof(int) * st->natts);
+    st->colnames = palloc(sizeof(char *) * st->natts);
+    st->typids = palloc(sizeof(Oid) * st->natts);
+    st->in_functions = palloc(sizeof(FmgrInfo) * st->natts);
+    st->typioparams = palloc(sizeof(Oid) * st->natts);
+    st->typmods = palloc(sizeof(int32) * st->natts);
+    for (i = 0; i < st->natts; i++) {
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+        Oid infunc;
+
+        st->colpos[i] = attr->attisdropped ? -1 : pos++;
+        st->colnames[i] = pstrdup(NameStr(attr->attname));
+        st->typids[i] = attr->atttypid;
+        st->typmods[i] = attr->atttypmod;
+        getTypeInputInfo(attr->atttypid, &infunc, &st->typioparams[i]);
+        fmgr_info(infunc, &st->in_functions[i]);
+    }
+
+    conn = erlang_lookup_connection(st->opts.node);
+    strlcpy(st->node_name, conn->node_name, MAX_NODE_NAME);
+    st->pooled = conn->pooled;
+    // With a LIMIT every condition was pushed down, so the next page is likely not needed
+    st->prefetch = !st->pooled && st->first_page == st->opts.page_size;
+
+    st->page_context = AllocSetContextCreate(estate->es_query_cxt, "erlang_fdw page", ALLOCSET_DEFAULT_SIZES);
+    st->row_context = AllocSetContextCreate(estate->es_query_cxt, "erlang_fdw row", ALLOCSET_SMALL_SIZES);
+
+    // A page still in flight when the query fails is dropped with the query's memory
+    callback = palloc(sizeof(MemoryContextCallback));
+    callback->func = erlang_fdw_cleanup;
+    callback->arg = st;
+    MemoryContextRegisterResetCallback(estate->es_query_cxt, callback);
+
+    node->fdw_state = st;
+}
+
+static TupleTableSlot *erlang_fdw_iterate(ForeignScanState *node) {
+    ErlangFdwScanState *st = (ErlangFdwScanState *) node->fdw_state;
+    TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+
+    ExecClearTuple(slot);
+    // Under an async Append new pages are fetched by erlang_fdw_produce
+    if (st->async ? st->page_rows == 0 : erlang_fdw_advance(st, true) != ERLANG_FDW_ROW) {
+        return slot;
+    }
+    erlang_fdw_store_row(st, slot);
+    return slot;
+}
+
+static void erlang_fdw_rescan(ForeignScanState *node) {
+    ErlangFdwScanState *st = (ErlangFdwScanState *) node->fdw_state;
+
+    erlang_fdw_forget(st);
+    MemoryContextReset(st->page_context);
+    st->started = false;
+    st->eof = false;
+    st->page_rows = 0;
+    st->cont = NULL;
+}
+
+static void erlang_fdw_end(ForeignScanState *node) {
+    ErlangFdwScanState *st = (ErlangFdwScanState *) node->fdw_state;
+
+    if (st != NULL) {
+        erlang_fdw_forget(st);
+    }
+}
+
+/*
+ * Hand the requestor a row, or end of scan, or leave the request pending
+ * while the next page is on its way. Rows go through ExecProcNode so that
+ * local quals and projection still apply.
+ */
+static void erlang_fdw_produce(AsyncRequest *areq) {
+    ForeignScanState *node = (ForeignScanState *) areq->requestee;
+    ErlangFdwScanState *st = (ErlangFdwScanState *) node->fdw_state;
+
+    for (;;) {
+        TupleTableSlot *result = ExecProcNode((PlanState *) node);
+
+        if (!TupIsNull(result)) {
+            ExecAsyncRequestDone(areq, result);
+            return;
+        }
+        switch (erlang_fdw_advance(st, false)) {
+            case ERLANG_FDW_EOF:
+                ExecAsyncRequestDone(areq, result);
+                return;
+            case ERLANG_FDW_PENDING:
+                ExecAsyncRequestPending(areq);
+                return;
+            default:
+                break;
+        }
+    }
+}
+
+static void erlang_fdw_async_request(AsyncRequest *areq) {
+    erlang_fdw_produce(areq);
+}
+
+static void erlang_fdw_async_configure_wait(AsyncRequest *areq) {
+    ForeignScanState *node = (ForeignScanState *) areq->requestee;
+    ErlangFdwScanState *st = (ErlangFdwScanState *) node->fdw_state;
+    WaitEventSet *set = ((AppendState *) areq->requestor)->as_eventset;
+    ErlangConnection *conn;
+    ErlangRequest *request;
+    MemoryContext oldcontext;
+
+    // The page may already have been filed while another scan read the connection
+    request = (ErlangRequest *) hash_search(async_request_map, &st->request_id, HASH_FIND, NULL);
+    conn = (ErlangConnection *) hash_search(connection_map, st->node_name, HASH_FIND, NULL);
+    if (request == NULL || request->completed || conn == NULL) {
+        areq->callback_pending = false;
+        erlang_fdw_produce(areq);
+        ExecAsyncResponse(areq);
+        return;
+    }
+
+    // Scans of partitions on the same node share its socket; the first one waits for all
+    if (set != erlang_fdw_wait_set || GetNumRegisteredWaitEvents(set) == 1) {
+        list_free(erlang_fdw_wait_fds);
+        erlang_fdw_wait_fds = NIL;
+        erlang_fdw_wait_set = set;
+    }
+    if (list_member_int(erlang_fdw_wait_fds, conn->fd)) {
+        return;
+    }
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    erlang_fdw_wait_fds = lappend_int(erlang_fdw_wait_fds, conn->fd);
+    MemoryContextSwitchTo(oldcontext);
+
+    AddWaitEventToSet(set, WL_SOCKET_READABLE, conn->fd, NULL, areq);
+}
+
+// File everything that has arrived on the socket, then carry on with this scan
+static void erlang_fdw_async_notify(AsyncRequest *areq) {
+    ForeignScanState *node = (ForeignScanState *) areq->requestee;
+    ErlangFdwScanState *st = (ErlangFdwScanState *) node->fdw_state;
+    ErlangConnection *conn = (ErlangConnection *) hash_search(connection_map, st->node_name, HASH_FIND, NULL);
+
+    if (conn != NULL) {
+        int status;
+
+        do {
+            status = erlang_demux_receive(conn, 0);
+        } while (status == ERL_MSG || status == ERL_TICK);
+        if (status == ERL_ERROR) {
+            erlang_drop_connection(conn);
+        }
+    }
+    erlang_fdw_produce(areq);
+}
+
+PG_FUNCTION_INFO_V1(erlang_fdw_handler);
+Datum erlang_fdw_handler(PG_FUNCTION_ARGS) {
+    FdwRoutine *routine = makeNode(FdwRoutine);
+
+    routine->GetForeignRelSize = erlang_fdw_get_rel_size;
+    routine->GetForeignPaths = erlang_fdw_get_paths;
+    routine->GetForeignPlan = erlang_fdw_get_plan;
+    routine->ExplainForeignScan = erlang_fdw_explain;
+    routine->BeginForeignScan = erlang_fdw_begin;
+    routine->IterateForeignScan = erlang_fdw_iterate;
+    routine->ReScanForeignScan = erlang_fdw_rescan;
+    routine->EndForeignScan = erlang_fdw_end;
+
+    routine->IsForeignPathAsyncCapable = erlang_fdw_async_capable;
+    routine->ForeignAsyncRequest = erlang_fdw_async_request;
+    routine->ForeignAsyncConfigureWait = erlang_fdw_async_configure_wait;
+    routine->ForeignAsyncNotify = erlang_fdw_async_notify;
+
+    PG_RETURN_POINTER(routine);
+}
@@ -0,0 +1,304 @@
+/*
+ * Interruptible receive path
+ * ei_receive_msg_tmo sits in read() until a whole message has arrived, so a
+ * slow node keeps the backend deaf to cancels, statement_timeout and
+ * postmaster death. Instead the socket is waited on with WaitLatchOrSocket
+ * and whatever bytes are available are read with MSG_DONTWAIT into a
+ * per-connection frame. The socket itself stays blocking for ei's send
+ * functions; the pool worker, which must never block, queues its frames in
+ * an ErlangFrameWriter instead and writes them as the socket accepts them.
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/pg_bswap.h"
+#include "storage/latch.h"
+#include "utils/memutils.h"
+#include "erlang_cnode.h"
+#include <ei.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+// Every distribution message is a pass-through frame: 'p', control, payload
+#define ERLANG_PASS_THROUGH 'p'
+
+// Control messages that carry a payload for us (newer nodes may send *_SENDER)
+#ifndef ERL_SEND_SENDER
+#define ERL_SEND_SENDER 22
+#endif
+#ifndef ERL_SEND_SENDER_TT
+#define ERL_SEND_SENDER_TT 23
+#endif
+
+// Drop a partially received frame
+static void erlang_frame_reset(ErlangFrameReader *reader) {
+    if (reader->body != NULL) {
+        free(reader->body);
+    }
+    memset(reader, 0, sizeof(ErlangFrameReader));
+}
+
+// Drop unsent frames
+static void erlang_frame_writer_reset(ErlangFrameWriter *writer) {
+    if (writer->buf != NULL) {
+        free(writer->buf);
+    }
+    memset(writer, 0, sizeof(ErlangFrameWriter));
+}
+
+// Append bytes to the writer; false with errno set when they do not fit
+static bool erlang_frame_queue(ErlangFrameWriter *writer, const char *data, int len) {
+    if (writer->sent > 0) {
+        memmove(writer->buf, writer->buf + writer->sent, writer->len - writer->sent);
+        writer->len -= writer->sent;
+        writer->sent = 0;
+    }
+    if (len > INT_MAX / 2 - writer->len) {
+        errno = EMSGSIZE;
+        return false;
+    }
+    if (writer->len + len > writer->size) {
+        int size = Max(writer->size * 2, Max(writer->len + len, 1024));
+        char *buf = realloc(writer->buf, size);
+
+        if (buf == NULL) {
+            errno = ENOMEM;
+            return false;
+        }
+        writer->buf = buf;
+        writer->size = size;
+    }
+    memcpy(writer->buf + writer->len, data, len);
+    writer->len += len;
+    return true;
+}
+
+/*
+ * Queue a REG_SEND frame carrying payload (a term with its version byte) to
+ * the process registered as regname. False with errno set on failure, after
+ * which the connection must be dropped.
+ */
+static bool erlang_frame_queue_reg_send(ErlangConnection *conn, const char *regname,
+                                        const char *payload, int len) {
+    static const char pass_through = ERLANG_PASS_THROUGH;
+    ei_x_buff control;
+    uint32 frame_len;
+    bool ok;
+
+    // {REG_SEND, FromPid, Unused, ToName}
+    ei_x_new_with_version(&control);
+    ei_x_encode_tuple_header(&control, 4);
+    ei_x_encode_long(&control, ERL_REG_SEND);
+    ei_x_encode_pid(&control, ei_self(&conn->ec));
+    ei_x_encode_atom(&control, "");
+    ei_x_encode_atom(&control, regname);
+
+    if (len > INT_MAX / 2 - control.index) {
+        ei_x_free(&control);
+        errno = EMSGSIZE;
+        return false;
+    }
+    frame_len = pg_hton32((uint32) (1 + control.index + len));
+    ok = erlang_frame_queue(&conn->writer, (const char *) &frame_len, 4) &&
+         erlang_frame_queue(&conn->writer, &pass_through, 1) &&
+         erlang_frame_queue(&conn->writer, control.buff, control.index) &&
+         erlang_frame_queue(&conn->writer, payload, len);
+    ei_x_free(&control);
+    return ok;
+}
+
+// Write queued frames without blocking; 1 when all are out, 0 when the socket is full, -1 on error
+static int erlang_frame_flush(ErlangConnection *conn) {
+    ErlangFrameWriter *writer = &conn->writer;
+
+    while (writer->sent < writer->len) {
+        ssize_t n = send(conn->fd, writer->buf + writer->sent, writer->len - writer->sent, MSG_DONTWAIT);
+
+        if (n > 0) {
+            writer->sent += (int) n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return -1;
+        }
+    }
+    writer->len = 0;
+    writer->sent = 0;
+    return 1;
+}
+
+// Frames are waiting for the socket to accept them
+static bool erlang_frame_pending(ErlangConnection *conn) {
+    return conn->writer.sent < conn->writer.len;
+}
+
+// Read until want bytes are in dst; 1 when complete, 0 when the socket ran dry, -1 on error
+static int erlang_frame_fill(int fd, char *dst, int want, int *got) {
+    while (*got < want) {
+        ssize_t n = recv(fd, dst + *got, want - *got, MSG_DONTWAIT);
+
+        if (n > 0) {
+            *got += (int) n;
+        } else if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// zlib's deflate never compresses by more than this factor
+#define ERLANG_FRAME_MAX_INFLATE_RATIO 1032
+
+/*
+ * Replace a payload that a proxy recompressed on the way with the plain term,
+ * so every reader sees ordinary ETF. False if the stream is corrupt. The
+ * claimed size comes off the wire, so it is checked against what the
+ * compressed bytes could hold before anything is allocated.
+ */
+static bool erlang_frame_inflate(ei_x_buff *msg) {
+    uint32 size;
+    char *plain;
+
+    memcpy(&size, msg->buff + 2, 4);
+    size = pg_ntoh32(size);
+    if (size > MaxAllocSize - 1 || (int64) size > (int64) (msg->index - 6) * ERLANG_FRAME_MAX_INFLATE_RATIO) {
+        return false;
+    }
+    plain = malloc((size_t) size + 1);
+    if (plain == NULL) {
+        return false;
+    }
+    plain[0] = (char) ETF_VERSION_MAGIC;
+    if (etf_inflate(msg->buff + 6, msg->index - 6, plain + 1, size) < 0) {
+        free(plain);
+        return false;
+    }
+    free(msg->buff);
+    msg->buff = plain;
+    msg->buffsz = (int) size + 1;
+    msg->index = (int) size + 1;
+    return true;
+}
+
+/*
+ * Read from the connection without blocking.
+ * Returns ERL_MSG with the message payload in msg (freed by the caller),
+ * ERL_TICK after answering a keepalive, ERL_TIMEOUT when no complete
+ * message is available yet, or ERL_ERROR with errno set.
+ */
+static int erlang_frame_read(ErlangConnection *conn, ei_x_buff *msg) {
+    ErlangFrameReader *reader = &conn->reader;
+
+    for (;;) {
+        char *body;
+        int len;
+        int index;
+        int version;
+        int arity;
+        long op;
+        int rc;
+
+        if (reader->header_got < 4) {
+            uint32 frame_len;
+
+            rc = erlang_frame_fill(conn->fd, reader->header, 4, &reader->header_got);
+            if (rc <= 0) {
+                return rc < 0 ? ERL_ERROR : ERL_TIMEOUT;
+            }
+            memcpy(&frame_len, reader->header, 4);
+            frame_len = pg_ntoh32(frame_len);
+            if (frame_len == 0) {
+                // Net tick: answer with an empty frame of our own
+                static const char tock[4] = {0, 0, 0, 0};
+
+                reader->header_got = 0;
+                if (conn->writer.queued) {
+                    if (!erlang_frame_queue(&conn->writer, tock, sizeof(tock)) || erlang_frame_flush(conn) < 0) {
+                        return ERL_ERROR;
+                    }
+                } else if (send(conn->fd, tock, sizeof(tock), 0) != sizeof(tock)) {
+                    return ERL_ERROR;
+                }
+                return ERL_TICK;
+            }
+            if (frame_len > (uint32) INT_MAX) {
+                errno = EMSGSIZE;
+                return ERL_ERROR;
+            }
+            reader->body = malloc(frame_len);
+            if (reader->body == NULL) {
+                errno = ENOMEM;
+                return ERL_ERROR;
+            }
+            reader->body_len = (int) frame_len;
+            reader->body_got = 0;
+        }
+
+        rc = erlang_frame_fill(conn->fd, reader->body, reader->body_len, &reader->body_got);
+        if (rc <= 0) {
+            return rc < 0 ? ERL_ERROR : ERL_TIMEOUT;
+        }
+
+        // A whole frame has arrived; take it and start the next one
+        body = reader->body;
+        len = reader->body_len;
+        reader->body = NULL;
+        reader->header_got = 0;
+
+        index = 1;
+        if (body[0] != ERLANG_PASS_THROUGH ||
+            ei_decode_version(body, &index, &version) < 0 ||
+            ei_decode_tuple_header(body, &index, &arity) < 0 || arity < 1 ||
+            ei_decode_long(body, &index, &op) < 0) {
+            free(body);
+            continue;
+        }
+        if (op != ERL_SEND && op != ERL_REG_SEND && op != ERL_SEND_TT && op != ERL_REG_SEND_TT &&
+            op != ERL_SEND_SENDER && op != ERL_SEND_SENDER_TT) {
+            // Links, exits and monitors are never set up by this node
+            free(body);
+            continue;
+        }
+
+        // Skip the control tuple; the payload is a complete external term
+        index = 1;
+        if (ei_decode_version(body, &index, &version) < 0 || ei_skip_term(body, &index) < 0 || index >= len) {
+            free(body);
+            continue;
+        }
+        memmove(body, body + index, len - index);
+        msg->buff = body;
+        msg->buffsz = len;
+        msg->index = len - index;
+        if (msg->index > 6 && (uint8) body[0] == ETF_VERSION_MAGIC && (uint8) body[1] == ETF_COMPRESSED_EXT &&
+            !erlang_frame_inflate(msg)) {
+            free(msg->buff);
+            continue;
+        }
+        return ERL_MSG;
+    }
+}
+
+/*
+ * Sleep until fd is readable, the latch is set or timeout_ms passes, then
+ * service interrupts. Returns true if the socket is readable.
+ */
+static bool erlang_frame_wait(int fd, long timeout_ms) {
+    int rc;
+
+    rc = WaitLatchOrSocket(MyLatch, WL_LATCH_SET | WL_SOCKET_READABLE | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                           fd, Max(timeout_ms, 0), PG_WAIT_EXTENSION);
+    if (rc & WL_LATCH_SET) {
+        ResetLatch(MyLatch);
+    }
+    CHECK_FOR_INTERRUPTS();
+    return (rc & WL_SOCKET_READABLE) != 0;
+}
@@ -0,0 +1,433 @@
+/*
+ * Inbound message ingestion
+ * A background worker registers itself with epmd as a named C-node and
+ * accepts distribution connections from Erlang nodes. Every message sent
+ * to it ({any, 'pgingest@host'} ! Term) is decoded to JSONB and queued; the
+ * queue is written to a table with one multi-row INSERT per batch, after
+ * erlang_cnode.ingest_batch_size messages or erlang_cnode.ingest_flush_ms
+ * milliseconds, whichever comes first. Neither a bad message nor a failed
+ * INSERT stops the worker: the first is skipped, the second retried.
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+#include "erlang_cnode.h"
+
+// Most Erlang nodes connected to the ingest node at once
+#define ERLANG_INGEST_MAX_PEERS 64
+
+static char *erlang_ingest_node = NULL;
+static char *erlang_ingest_cookie = NULL;
+static char *erlang_ingest_database = NULL;
+static char *erlang_ingest_table = NULL;
+static char *erlang_ingest_column = NULL;
+static int erlang_ingest_batch_size = 1000;
+static int erlang_ingest_flush_ms = 200;
+
+// Worker state
+static ErlangConnection erlang_ingest_peers[ERLANG_INGEST_MAX_PEERS];
+static MemoryContext erlang_ingest_batch_context = NULL;
+static List *erlang_ingest_batch = NIL;
+static TimestampTz erlang_ingest_batch_started = 0;
+static int erlang_ingest_failures = 0;             // Failed attempts to write the current batch
+static TimestampTz erlang_ingest_retry_at = 0;      // Next attempt, 0 unless the last one failed
+
+// Register the ingest worker if a node name is configured
+static void erlang_ingest_register_worker(void) {
+    BackgroundWorker worker;
+
+    if (erlang_ingest_node == NULL || erlang_ingest_node[0] == '\0') {
+        return;
+    }
+
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+    worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+    worker.bgw_restart_time = 5;
+    snprintf(worker.bgw_library_name, BGW_MAXLEN, "erlang_cnode");
+    snprintf(worker.bgw_function_name, BGW_MAXLEN, "erlang_ingest_main");
+    snprintf(worker.bgw_name, BGW_MAXLEN, "erlang_cnode ingest %s", erlang_ingest_node);
+    snprintf(worker.bgw_type, BGW_MAXLEN, "erlang_cnode ingest");
+    RegisterBackgroundWorker(&worker);
+}
+
+// Log the error being handled, then clear it
+static void erlang_ingest_log_error(MemoryContext context, const char *what) {
+    ErrorData *edata;
+
+    MemoryContextSwitchTo(context);
+    edata = CopyErrorData();
+    FlushErrorState();
+    ereport(LOG, (errmsg("erlang_cnode ingest: %s: %s", what, edata->message)));
+    FreeErrorData(edata);
+}
+
+// INSERT count messages within the current transaction
+static void erlang_ingest_insert(const char *sql, Datum *values, int count) {
+    Oid argtypes[1] = {JSONBARRAYOID};
+    Datum args[1];
+    int ret;
+
+    args[0] = PointerGetDatum(construct_array(values, count, JSONBOID, -1, false, TYPALIGN_INT));
+    ret = SPI_execute_with_args(sql, 1, argtypes, args, NULL, false, 0);
+    if (ret != SPI_OK_INSERT) {
+        elog(ERROR, "INSERT into %s failed: %s", erlang_ingest_table, SPI_result_code_string(ret));
+    }
+}
+
+// INSERT one message in a subtransaction; false if it was rejected (logged when log is set)
+static bool erlang_ingest_insert_one(const char *sql, Datum value, bool log) {
+    MemoryContext context = CurrentMemoryContext;
+    ResourceOwner owner = CurrentResourceOwner;
+    volatile bool ok = true;
+
+    BeginInternalSubTransaction(NULL);
+    MemoryContextSwitchTo(context);
+    PG_TRY();
+    {
+        erlang_ingest_insert(sql, &value, 1);
+        ReleaseCurrentSubTransaction();
+    }
+    PG_CATCH();
+    {
+        if (log) {
+            erlang_ingest_log_error(context, "message rejected");
+        } else {
+            MemoryContextSwitchTo(context);
+            FlushErrorState();
+        }
+        RollbackAndReleaseCurrentSubTransaction();
+        ok = false;
+    }
+    PG_END_TRY();
+    MemoryContextSwitchTo(context);
+    CurrentResourceOwner = owner;
+    return ok;
+}
+
+/*
+ * Write the batch in one transaction: with a single INSERT, or with each
+ * message on its own so that only the ones that fail are left out.
+ * Returns how many messages were committed.
+ */
+static int erlang_ingest_write(const char *sql, Datum *values, int count, bool each) {
+    MemoryContext context = CurrentMemoryContext;
+    volatile int written = 0;
+
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+    PG_TRY();
+    {
+        int i;
+
+        SPI_connect();
+        PushActiveSnapshot(GetTransactionSnapshot());
+        if (!each) {
+            erlang_ingest_insert(sql, values, count);
+            written = count;
+        } else {
+            // Only the first rejection is logged, not one line per message of a doomed batch
+            for (i = 0; i < count; i++) {
+                written += erlang_ingest_insert_one(sql, values[i], written == i) ? 1 : 0;
+            }
+        }
+        SPI_finish();
+        PopActiveSnapshot();
+        CommitTransactionCommand();
+    }
+    PG_CATCH();
+    {
+        erlang_ingest_log_error(context, each ? "writing messages one by one failed" : "batch INSERT failed");
+        AbortCurrentTransaction();
+        written = 0;
+    }
+    PG_END_TRY();
+    MemoryContextSwitchTo(context);
+    return written;
+}
+
+/*
+ * Write the queued messages with one INSERT and commit. If that fails they
+ * are written one by one and those that still fail are dropped. If none
+ * can be written (the table is missing, say) the batch is kept and retried
+ * with backoff, and false is returned.
+ */
+static bool erlang_ingest_flush(void) {
+    int count = list_length(erlang_ingest_batch);
+    Datum *values;
+    StringInfoData sql;
+    ListCell *lc;
+    int written;
+    int i = 0;
+
+    if (count == 0) {
+        return true;
+    }
+
+    initStringInfo(&sql);
+    appendStringInfo(&sql, "INSERT INTO %s (%s) SELECT unnest($1)",
+                     erlang_ingest_table, quote_identifier(erlang_ingest_column));
+    values = palloc(sizeof(Datum) * count);
+    foreach(lc, erlang_ingest_batch) {
+        values[i++] = PointerGetDatum(lfirst(lc));
+    }
+
+    pgstat_report_activity(STATE_RUNNING, sql.data);
+    written = erlang_ingest_write(sql.data, values, count, false);
+    if (written == 0 && count > 1) {
+        written = erlang_ingest_write(sql.data, values, count, true);
+    }
+    pgstat_report_stat(false);
+    pgstat_report_activity(STATE_IDLE, NULL);
+    pfree(values);
+    pfree(sql.data);
+
+    if (written == 0) {
+        int64 delay = Min((int64) erlang_ingest_flush_ms << Min(erlang_ingest_failures, 8), 30000);
+
+        erlang_ingest_failures++;
+        erlang_ingest_retry_at = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), delay);
+        elog(LOG, "erlang_cnode ingest: could not write %d messages to %s, retrying in %ldms",
+             count, erlang_ingest_table, (long) delay);
+        return false;
+    }
+    if (written < count) {
+        elog(LOG, "erlang_cnode ingest: dropped %d of %d messages that %s rejected",
+             count - written, count, erlang_ingest_table);
+    }
+    elog(DEBUG1, "erlang_cnode ingest: wrote %d messages to %s", written, erlang_ingest_table);
+
+    MemoryContextReset(erlang_ingest_batch_context);
+    erlang_ingest_batch = NIL;
+    erlang_ingest_batch_started = 0;
+    erlang_ingest_failures = 0;
+    erlang_ingest_retry_at = 0;
+    return true;
+}
+
+// A batch that could not be written is full; stop reading until it is
+static bool erlang_ingest_paused(void) {
+    return erlang_ingest_retry_at != 0 && list_length(erlang_ingest_batch) >= erlang_ingest_batch_size;
+}
+
+/*
+ * Decode a received message and queue it for the next batch; cache
+ * invalidations are applied instead. A message that cannot be decoded is
+ * logged and skipped.
+ */
+static void erlang_ingest_queue(ErlangConnection *conn, ei_x_buff *buf) {
+    MemoryContext oldcontext = CurrentMemoryContext;
+    int index = buf->index > 0 && (uint8) buf->buff[0] == ETF_VERSION_MAGIC ? 1 : 0;
+    volatile bool queued = false;
+
+    PG_TRY();
+    {
+        if (!erlang_cache_invalidation_message(buf)) {
+            Jsonb *value;
+
+            MemoryContextSwitchTo(erlang_ingest_batch_context);
+            value = etf_decode_jsonb(buf->buff, buf->index, index);
+            erlang_ingest_batch = lappend(erlang_ingest_batch, value);
+            MemoryContextSwitchTo(oldcontext);
+            queued = true;
+        }
+    }
+    PG_CATCH();
+    {
+        MemoryContextSwitchTo(oldcontext);
+        erlang_ingest_log_error(oldcontext, psprintf("skipping a message from %s", conn->node_name));
+    }
+    PG_END_TRY();
+    ei_x_free(buf);
+
+    if (!queued) {
+        return;
+    }
+    if (erlang_ingest_batch_started == 0) {
+        erlang_ingest_batch_started = GetCurrentTimestamp();
+    }
+    // A batch waiting to be retried is written when its retry is due
+    if (erlang_ingest_retry_at == 0 && list_length(erlang_ingest_batch) >= erlang_ingest_batch_size) {
+        (void) erlang_ingest_flush();
+    }
+}
+
+// Accept a connecting Erlang node
+static void erlang_ingest_accept(ei_cnode *ec, int listen_fd) {
+    ErlConnect peer;
+    int fd;
+    int i;
+
+    // The handshake is a few round trips; bound it so a silent peer cannot stall the worker
+    fd = ei_accept_tmo(ec, listen_fd, &peer, 1000);
+    if (fd < 0) {
+        elog(LOG, "erlang_cnode ingest: accept failed: %s", strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < ERLANG_INGEST_MAX_PEERS; i++) {
+        ErlangConnection *conn = &erlang_ingest_peers[i];
+
+        if (conn->fd < 0) {
+            strlcpy(conn->node_name, peer.nodename, MAX_NODE_NAME);
+            conn->fd = fd;
+            conn->pooled = false;
+            memset(&conn->reader, 0, sizeof(ErlangFrameReader));
+            memset(&conn->writer, 0, sizeof(ErlangFrameWriter));
+            memcpy(&conn->ec, ec, sizeof(ei_cnode));
+            elog(LOG, "erlang_cnode ingest: %s connected", peer.nodename);
+            return;
+        }
+    }
+
+    elog(LOG, "erlang_cnode ingest: refusing %s, already %d nodes connected", peer.nodename, ERLANG_INGEST_MAX_PEERS);
+    close(fd);
+}
+
+// Queue every complete message waiting on a peer connection
+static void erlang_ingest_read(ErlangConnection *conn) {
+    for (;;) {
+        ei_x_buff buf;
+        int status = erlang_frame_read(conn, &buf);
+
+        if (status == ERL_MSG) {
+            erlang_ingest_queue(conn, &buf);
+            if (erlang_ingest_paused()) {
+                return;
+            }
+        } else if (status == ERL_ERROR) {
+            elog(LOG, "erlang_cnode ingest: %s disconnected", conn->node_name);
+            close(conn->fd);
+            erlang_frame_reset(&conn->reader);
+            conn->fd = -1;
+            return;
+        } else if (status == ERL_TIMEOUT) {
+            return;
+        }
+    }
+}
+
+// Background worker entry point
+void erlang_ingest_main(Datum main_arg) {
+    ei_cnode ec;
+    char alive[MAX_NODE_NAME];
+    char node_name[MAX_NODE_NAME];
+    const char *host;
+    char *at;
+    int port = 0;
+    int listen_fd;
+    int epmd_fd;
+    int i;
+
+    // SIGTERM is handled in the main loop so the last batch is written before exiting
+    pqsignal(SIGHUP, SignalHandlerForConfigReload);
+    pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+    BackgroundWorkerUnblockSignals();
+
+    BackgroundWorkerInitializeConnection(erlang_ingest_database, NULL, 0);
+
+    // "alive@host"; the host defaults to the one used for outgoing connections
+    strlcpy(alive, erlang_ingest_node, sizeof(alive));
+    at = strchr(alive, '@');
+    if (at != NULL) {
+        *at = '\0';
+        host = at + 1;
+    } else {
+        host = "127.0.1.1";
+    }
+    snprintf(node_name, sizeof(node_name), "%s@%s", alive, host);
+
+    memset(&ec, 0, sizeof(ei_cnode));
+    if (ei_connect_xinit(&ec, host, alive, node_name, NULL,
+                         erlang_ingest_cookie[0] != '\0' ? erlang_ingest_cookie : NULL, 0) < 0) {
+        elog(ERROR, "erlang_cnode ingest: ei_connect_xinit failed for %s: %s", node_name, strerror(errno));
+    }
+    listen_fd = ei_listen(&ec, &port, 16);
+    if (listen_fd < 0) {
+        elog(ERROR, "erlang_cnode ingest: listen failed: %s", strerror(errno));
+    }
+    // epmd keeps the name registered for as long as this socket stays open
+    epmd_fd = ei_publish(&ec, port);
+    if (epmd_fd < 0) {
+        elog(ERROR, "erlang_cnode ingest: could not register %s with epmd: %s", node_name, strerror(errno));
+    }
+
+    for (i = 0; i < ERLANG_INGEST_MAX_PEERS; i++) {
+        erlang_ingest_peers[i].fd = -1;
+    }
+    erlang_ingest_batch_context = AllocSetContextCreate(TopMemoryContext, "ErlangIngestBatch",
+                                                        ALLOCSET_DEFAULT_SIZES);
+
+    elog(LOG, "erlang_cnode ingest: %s listening on port %d, writing to %s", node_name, port,
+         erlang_ingest_table);
+
+    for (;;) {
+        WaitEventSet *set;
+        WaitEvent events[ERLANG_INGEST_MAX_PEERS + 3];
+        long timeout = -1;
+        int nevents;
+
+        if (erlang_ingest_batch_started != 0) {
+            TimestampTz deadline = erlang_ingest_retry_at != 0 ? erlang_ingest_retry_at :
+                TimestampTzPlusMilliseconds(erlang_ingest_batch_started, erlang_ingest_flush_ms);
+
+            timeout = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+            if (timeout <= 0) {
+                timeout = erlang_ingest_flush() ? -1 :
+                    TimestampDifferenceMilliseconds(GetCurrentTimestamp(), erlang_ingest_retry_at);
+            }
+        }
+
+        set = erlang_create_wait_event_set(ERLANG_INGEST_MAX_PEERS + 3);
+        AddWaitEventToSet(set, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+        AddWaitEventToSet(set, WL_EXIT_ON_PM_DEATH, PGINVALID_SOCKET, NULL, NULL);
+        AddWaitEventToSet(set, WL_SOCKET_READABLE, listen_fd, NULL, NULL);
+        // While a full batch cannot be written, unread messages wait in the peers' sockets
+        for (i = 0; i < ERLANG_INGEST_MAX_PEERS && !erlang_ingest_paused(); i++) {
+            if (erlang_ingest_peers[i].fd >= 0) {
+                AddWaitEventToSet(set, WL_SOCKET_READABLE, erlang_ingest_peers[i].fd, NULL, &erlang_ingest_peers[i]);
+            }
+        }
+        nevents = WaitEventSetWait(set, timeout, events, lengthof(events), PG_WAIT_EXTENSION);
+        FreeWaitEventSet(set);
+
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+
+        if (ShutdownRequestPending) {
+            if (!erlang_ingest_flush()) {
+                elog(LOG, "erlang_cnode ingest: %d unwritten messages are lost", list_length(erlang_ingest_batch));
+            }
+            proc_exit(0);
+        }
+        if (ConfigReloadPending) {
+            ConfigReloadPending = false;
+            ProcessConfigFile(PGC_SIGHUP);
+        }
+
+        for (i = 0; i < nevents; i++) {
+            if (!(events[i].events & WL_SOCKET_READABLE)) {
+                continue;
+            }
+            if (events[i].user_data == NULL) {
+                erlang_ingest_accept(&ec, listen_fd);
+            } else {
+                erlang_ingest_read((ErlangConnection *) events[i].user_data);
+            }
+        }
+    }
+}
@@ -0,0 +1,1235 @@
+/*
+ * Shared Erlang connection pool
+ * A background worker owns one distribution connection per Erlang node and
+ * serves erlang_call/erlang_cast for every backend through shm_mq queues.
+ * Backends attach lazily: the first pooled request creates a DSM segment with
+ * a request/response queue pair and registers it in a shared slot array.
+ *
+ * The worker never blocks on a node: connection handshakes run in a forked
+ * helper process that hands the socket back, and frames are queued and
+ * written as the socket accepts them. Backends wait for the worker no
+ * longer than their call's timeout.
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "erlang_cnode.h"
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Request kinds sent from a backend to the pool worker
+#define ERLANG_POOL_CONNECT 1
+#define ERLANG_POOL_CALL    2
+#define ERLANG_POOL_CAST    3
+
+// Response status codes sent back to the backend
+#define ERLANG_POOL_OK      0
+#define ERLANG_POOL_ERROR   1
+#define ERLANG_POOL_TIMEOUT 2
+
+// Handshake time allowed to a connect helper, and how long past a request's
+// own timeout a backend keeps waiting for the worker to answer
+#define ERLANG_POOL_CONNECT_TIMEOUT_MS 5000
+#define ERLANG_POOL_GRACE_MS 1000
+
+// Header of every backend -> worker message, followed by the encoded body
+typedef struct {
+    uint64 seq;
+    int32 kind;
+    int32 timeout_ms;
+    char node_name[MAX_NODE_NAME];
+    char cookie[MAX_COOKIE];
+    char regname[MAX_MFA_NAME];     // Registered process that receives the message
+} ErlangPoolRequest;
+
+// Header of every worker -> backend message, followed by the reply or error text
+typedef struct {
+    uint64 seq;
+    int32 status;
+} ErlangPoolResponse;
+
+// One registered backend queue pair
+typedef struct {
+    pid_t backend_pid;      // 0 when the slot is free
+    uint32 generation;      // Bumped on every registration
+    dsm_handle handle;
+} ErlangPoolSlot;
+
+typedef struct {
+    slock_t mutex;
+    Latch *worker_latch;
+    pid_t worker_pid;
+    int nslots;
+    ErlangPoolSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} ErlangPoolShared;
+
+// Worker-side state for an attached backend
+typedef struct {
+    uint32 generation;
+    dsm_segment *seg;
+    shm_mq_handle *inq;     // backend -> worker
+    shm_mq_handle *outq;    // worker -> backend
+    List *outbox;           // Responses not yet accepted by the queue
+} ErlangPoolClient;
+
+// Worker-side state for an in-flight call, keyed by its Erlang reference
+typedef struct {
+    ErlangRefKey key;
+    int slot;
+    uint32 generation;
+    uint64 seq;
+    char node_name[MAX_NODE_NAME];
+    TimestampTz deadline;
+} ErlangPoolCall;
+
+// A backend waiting for a connection attempt
+typedef struct {
+    int slot;
+    uint32 generation;
+    uint64 seq;
+} ErlangPoolWaiter;
+
+// Connection attempt running in a forked helper, keyed by node name
+typedef struct {
+    char node_name[MAX_NODE_NAME];
+    char cookie[MAX_COOKIE];
+    ei_cnode ec;
+    pid_t pid;
+    int sock;               // Our end of the socketpair the helper reports on
+    TimestampTz deadline;
+    List *waiters;          // ErlangPoolWaiter for every CONNECT asking for the node
+} ErlangPoolConnect;
+
+// What a connect helper sends back, with the socket attached on success
+typedef struct {
+    int status;             // 0 on success
+    int err;                // errno of the failed connect
+} ErlangPoolConnectResult;
+
+// A queued response (header and payload in one chunk)
+typedef struct {
+    char *data;
+    Size len;
+} ErlangPoolMessage;
+
+// GUC variables
+static bool erlang_use_pool = false;
+static int erlang_pool_slots = 64;
+
+// Shared state, set up by the shmem startup hook when preloaded
+static ErlangPoolShared *erlang_pool = NULL;
+
+// Backend-local attachment
+static int erlang_pool_slot_index = -1;
+static uint32 erlang_pool_generation = 0;
+static dsm_segment *erlang_pool_seg = NULL;
+static shm_mq_handle *erlang_pool_out = NULL;
+static shm_mq_handle *erlang_pool_in = NULL;
+static uint64 erlang_pool_next_seq = 1;
+
+// Worker-local state
+static ErlangPoolClient *erlang_pool_clients = NULL;
+static HTAB *erlang_pool_calls = NULL;
+static HTAB *erlang_pool_connects = NULL;
+
+// Build a hash key from an Erlang reference
+static void erlang_ref_key(const erlang_ref *ref, ErlangRefKey *key) {
+    int i;
+
+    memset(key, 0, sizeof(ErlangRefKey));
+    for (i = 0; i < ref->len && i < 3; i++) {
+        key->n[i] = ref->n[i];
+    }
+}
+
+static Size erlang_pool_shmem_size(void) {
+    return add_size(offsetof(ErlangPoolShared, slots),
+                    mul_size(erlang_pool_slots, sizeof(ErlangPoolSlot)));
+}
+
+// Called from the shmem request hook
+static void erlang_pool_shmem_request(void) {
+    RequestAddinShmemSpace(erlang_pool_shmem_size());
+}
+
+// Called from the shmem startup hook with AddinShmemInitLock held
+static void erlang_pool_shmem_init(void) {
+    bool found;
+
+    erlang_pool = ShmemInitStruct("erlang_cnode pool", erlang_pool_shmem_size(), &found);
+    if (!found) {
+        memset(erlang_pool, 0, erlang_pool_shmem_size());
+        SpinLockInit(&erlang_pool->mutex);
+        erlang_pool->nslots = erlang_pool_slots;
+    }
+}
+
+// Register the pool worker; only possible from shared_preload_libraries
+static void erlang_pool_register_worker(void) {
+    BackgroundWorker worker;
+
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+    worker.bgw_start_time = BgWorkerStart_ConsistentState;
+    worker.bgw_restart_time = 5;
+    snprintf(worker.bgw_library_name, BGW_MAXLEN, "erlang_cnode");
+    snprintf(worker.bgw_function_name, BGW_MAXLEN, "erlang_pool_main");
+    snprintf(worker.bgw_name, BGW_MAXLEN, "erlang_cnode connection pool");
+    snprintf(worker.bgw_type, BGW_MAXLEN, "erlang_cnode connection pool");
+    RegisterBackgroundWorker(&worker);
+}
+
+/*
+ * Backend side
+ */
+
+// Release our slot at backend exit
+static void erlang_pool_release_slot(int code, Datum arg) {
+    ErlangPoolSlot *slot;
+
+    if (erlang_pool == NULL || erlang_pool_slot_index < 0) {
+        return;
+    }
+    slot = &erlang_pool->slots[erlang_pool_slot_index];
+    SpinLockAcquire(&erlang_pool->mutex);
+    if (slot->backend_pid == MyProcPid && slot->generation == erlang_pool_generation) {
+        slot->backend_pid = 0;
+    }
+    SpinLockRelease(&erlang_pool->mutex);
+    erlang_pool_slot_index = -1;
+}
+
+// Drop our queues, e.g. after the worker restarted
+static void erlang_pool_detach(void) {
+    erlang_pool_release_slot(0, (Datum) 0);
+    if (erlang_pool_seg != NULL) {
+        dsm_detach(erlang_pool_seg);
+    }
+    erlang_pool_seg = NULL;
+    erlang_pool_out = NULL;
+    erlang_pool_in = NULL;
+}
+
+// Create our queue pair and hand it to the worker
+static void erlang_pool_attach(void) {
+    static bool exit_callback_registered = false;
+    MemoryContext oldcontext;
+    dsm_segment *seg;
+    char *base;
+    shm_mq *to_worker;
+    shm_mq *from_worker;
+    int i;
+    int index = -1;
+
+    if (erlang_pool_seg != NULL) {
+        return;
+    }
+    if (erlang_pool == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("erlang_cnode connection pool is not available"),
+                 errhint("Add erlang_cnode to shared_preload_libraries.")));
+    }
+
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+    seg = dsm_create(2 * ERLANG_POOL_QUEUE_SIZE, 0);
+    dsm_pin_mapping(seg);
+    base = dsm_segment_address(seg);
+    to_worker = shm_mq_create(base, ERLANG_POOL_QUEUE_SIZE);
+    from_worker = shm_mq_create(base + ERLANG_POOL_QUEUE_SIZE, ERLANG_POOL_QUEUE_SIZE);
+    shm_mq_set_sender(to_worker, MyProc);
+    shm_mq_set_receiver(from_worker, MyProc);
+
+    SpinLockAcquire(&erlang_pool->mutex);
+    for (i = 0; i < erlang_pool->nslots; i++) {
+        if (erlang_pool->slots[i].backend_pid == 0) {
+            index = i;
+            erlang_pool->slots[i].backend_pid = MyProcPid;
+            erlang_pool->slots[i].generation++;
+            erlang_pool->slots[i].handle = dsm_segment_handle(seg);
+            erlang_pool_generation = erlang_pool->slots[i].generation;
+            break;
+        }
+    }
+    SpinLockRelease(&erlang_pool->mutex);
+
+    if (index < 0) {
+        dsm_detach(seg);
+        MemoryContextSwitchTo(oldcontext);
+        ereport(ERROR,
+                (errcode(ERRCODE_TOO_MANY_CONNECTIONS),
+                 errmsg("no free erlang_cnode connection pool slots"),
+                 errhint("Increase erlang_cnode.pool_slots.")));
+    }
+
+    erlang_pool_seg = seg;
+    erlang_pool_slot_index = index;
+    erlang_pool_out = shm_mq_attach(to_worker, seg, NULL);
+    erlang_pool_in = shm_mq_attach(from_worker, seg, NULL);
+    MemoryContextSwitchTo(oldcontext);
+
+    if (!exit_callback_registered) {
+        on_shmem_exit(erlang_pool_release_slot, (Datum) 0);
+        exit_callback_registered = true;
+    }
+
+    SpinLockAcquire(&erlang_pool->mutex);
+    if (erlang_pool->worker_latch != NULL) {
+        SetLatch(erlang_pool->worker_latch);
+    }
+    SpinLockRelease(&erlang_pool->mutex);
+}
+
+// Sleep until the latch is set or deadline passes; false once it has passed
+static bool erlang_pool_wait(TimestampTz deadline) {
+    long remaining = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+
+    if (remaining <= 0) {
+        return false;
+    }
+    (void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH, remaining, PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+    CHECK_FOR_INTERRUPTS();
+    return true;
+}
+
+/*
+ * Send one request to the worker and wait for its response, for at most
+ * timeout_ms plus a grace period in which the worker reports the timeout
+ * itself. On ERLANG_POOL_OK the response payload is appended to reply (if
+ * given); otherwise the error text is returned in *errmsg_out.
+ */
+static int erlang_pool_request(int kind, const char *node_name, const char *cookie,
+                               const char *regname, ei_x_buff *body, int timeout_ms,
+                               ei_x_buff *reply, char **errmsg_out) {
+    ErlangPoolRequest header;
+    shm_mq_iovec iov[2];
+    shm_mq_result res;
+    TimestampTz deadline;
+    uint64 seq;
+
+    erlang_pool_attach();
+
+    // Calls and casts prove the cookie our own connection was opened with
+    if (cookie == NULL) {
+        ErlangConnection *conn = (ErlangConnection *) hash_search(connection_map, node_name, HASH_FIND, NULL);
+
+        cookie = conn != NULL ? conn->cookie : "";
+    }
+
+    memset(&header, 0, sizeof(header));
+    seq = erlang_pool_next_seq++;
+    header.seq = seq;
+    header.kind = kind;
+    header.timeout_ms = timeout_ms;
+    strlcpy(header.node_name, node_name, MAX_NODE_NAME);
+    strlcpy(header.cookie, cookie, MAX_COOKIE);
+    if (regname != NULL) {
+        strlcpy(header.regname, regname, MAX_MFA_NAME);
+    }
+
+    iov[0].data = (const char *) &header;
+    iov[0].len = sizeof(header);
+    if (body != NULL) {
+        iov[1].data = body->buff;
+        iov[1].len = body->index;
+    }
+
+    deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), (int64) timeout_ms + ERLANG_POOL_GRACE_MS);
+    for (;;) {
+        res = shm_mq_sendv(erlang_pool_out, iov, body != NULL ? 2 : 1, true, true);
+        if (res == SHM_MQ_SUCCESS) {
+            break;
+        }
+        if (res == SHM_MQ_DETACHED) {
+            erlang_pool_detach();
+            ereport(ERROR, (errmsg("erlang_cnode connection pool worker went away")));
+        }
+        if (!erlang_pool_wait(deadline)) {
+            // Part of the message may be in the queue, so the pair cannot be used again
+            erlang_pool_detach();
+            ereport(ERROR, (errmsg("erlang_cnode connection pool worker is not accepting requests")));
+        }
+    }
+
+    for (;;) {
+        Size nbytes;
+        void *data;
+        ErlangPoolResponse *response;
+
+        res = shm_mq_receive(erlang_pool_in, &nbytes, &data, true);
+        if (res == SHM_MQ_WOULD_BLOCK) {
+            if (!erlang_pool_wait(deadline)) {
+                // A late response is recognised as stale by its sequence number
+                if (errmsg_out != NULL) {
+                    *errmsg_out = pstrdup("no response from the connection pool worker");
+                }
+                return ERLANG_POOL_TIMEOUT;
+            }
+            continue;
+        }
+        if (res != SHM_MQ_SUCCESS) {
+            erlang_pool_detach();
+            ereport(ERROR, (errmsg("erlang_cnode connection pool worker went away")));
+        }
+        if (nbytes < sizeof(ErlangPoolResponse)) {
+            continue;
+        }
+        response = (ErlangPoolResponse *) data;
+        if (response->seq != seq) {
+            // Stale response for a request we stopped waiting for
+            continue;
+        }
+        if (response->status == ERLANG_POOL_OK) {
+            if (reply != NULL) {
+                ei_x_append_buf(reply, (char *) data + sizeof(ErlangPoolResponse),
+                                nbytes - sizeof(ErlangPoolResponse));
+            }
+        } else if (errmsg_out != NULL) {
+            *errmsg_out = pnstrdup((char *) data + sizeof(ErlangPoolResponse),
+                                   nbytes - sizeof(ErlangPoolResponse));
+        }
+        return response->status;
+    }
+}
+
+// Ask the worker to connect to a node (no-op if it already is)
+static void erlang_pool_connect(const char *node_name, const char *cookie) {
+    char *error = NULL;
+
+    if (erlang_pool_request(ERLANG_POOL_CONNECT, node_name, cookie, NULL, NULL, ERLANG_POOL_CONNECT_TIMEOUT_MS,
+                            NULL, &error) != ERLANG_POOL_OK) {
+        ereport(ERROR, (errmsg("Pooled connection to %s failed: %s", node_name, error ? error : "unknown error")));
+    }
+}
+
+// Encode {call, Module, Function, ...} up to Args; the worker adds the $gen_call envelope
+static void erlang_pool_begin_call(ei_x_buff *body, const char *module, const char *function) {
+    ei_x_new(body);
+    erlang_encode_call_header(body, module, function);
+}
+
+/*
+ * Send a finished request body to a registered process through the worker
+ * and wait for the {Ref, Reply} message, without raising an error when the
+ * node fails or does not answer. Statistics go under module:function; on a
+ * status other than ERLANG_POOL_OK the reply is freed and *error is set.
+ */
+static int erlang_pool_try_call_to(const char *node_name, const char *regname,
+                                   const char *module, const char *function,
+                                   ei_x_buff *body, int timeout_ms, ei_x_buff *reply, char **error) {
+    int status;
+    int bytes_sent = body->index;
+    TimestampTz started;
+
+    *error = NULL;
+    ei_x_new(reply);
+    started = GetCurrentTimestamp();
+    status = erlang_pool_request(ERLANG_POOL_CALL, node_name, NULL, regname, body, timeout_ms, reply, error);
+    ei_x_free(body);
+
+    if (status == ERLANG_POOL_TIMEOUT) {
+        erlang_stats_record(node_name, module, function, ERLANG_STATS_TIMEOUT, bytes_sent, 0, started);
+        ei_x_free(reply);
+    } else if (status != ERLANG_POOL_OK) {
+        erlang_stats_record(node_name, module, function, ERLANG_STATS_ERROR, bytes_sent, 0, started);
+        ei_x_free(reply);
+    } else {
+        erlang_stats_record(node_name, module, function,
+                            erlang_stats_is_badrpc(reply) ? ERLANG_STATS_ERROR : ERLANG_STATS_OK,
+                            bytes_sent, reply->index, started);
+    }
+    return status;
+}
+
+// As erlang_pool_try_call_to, raising an error unless the call succeeded
+static void erlang_pool_call_to(const char *node_name, const char *regname,
+                                const char *module, const char *function,
+                                ei_x_buff *body, int timeout_ms, ei_x_buff *reply) {
+    char *error;
+    int status;
+
+    status = erlang_pool_try_call_to(node_name, regname, module, function, body, timeout_ms, reply, &error);
+    if (status == ERLANG_POOL_TIMEOUT) {
+        ereport(ERROR, (errmsg("Pooled RPC to %s timed out after %dms", node_name, timeout_ms)));
+    } else if (status != ERLANG_POOL_OK) {
+        ereport(ERROR, (errmsg("Pooled RPC to %s failed: %s", node_name, error ? error : "unknown error")));
+    }
+}
+
+// Close a {call, ...} body with the group leader and call rex with it
+static void erlang_pool_call_body(const char *node_name, const char *module, const char *function,
+                                  ei_x_buff *body, int timeout_ms, ei_x_buff *reply) {
+    ei_x_encode_atom(body, "user");
+    erlang_pool_call_to(node_name, "rex", module, function, body, timeout_ms, reply);
+}
+
+// Synchronous RPC through the pool worker; the raw reply is left in reply
+static void erlang_pool_call_reply(const char *node_name, const char *module, const char *function,
+                                   Jsonb *args_json, int timeout_ms, ei_x_buff *reply) {
+    ei_x_buff body;
+
+    erlang_pool_begin_call(&body, module, function);
+    if (jsonb_to_erlang_args(&body, args_json) < 0) {
+        ei_x_free(&body);
+        ereport(ERROR, (errmsg("Failed to encode function arguments")));
+    }
+    erlang_pool_call_body(node_name, module, function, &body, timeout_ms, reply);
+}
+
+// Synchronous RPC through the pool worker, decoded to JSONB
+static Jsonb *erlang_pool_call(const char *node_name, const char *module, const char *function,
+                               Jsonb *args_json, int timeout_ms) {
+    ei_x_buff reply;
+    Jsonb *result;
+
+    erlang_pool_call_reply(node_name, module, function, args_json, timeout_ms, &reply);
+    result = erlang_term_to_jsonb(&reply);
+    ei_x_free(&reply);
+    return result;
+}
+
+/*
+ * Synchronous RPC through the pool worker for callers that report a failed
+ * node instead of aborting: returns the ERLANG_POOL_* status and, on
+ * ERLANG_POOL_OK, the decoded reply in *result.
+ */
+static int erlang_pool_try_call(const char *node_name, const char *module, const char *function,
+                                Jsonb *args_json, int timeout_ms, Jsonb **result) {
+    ei_x_buff body;
+    ei_x_buff reply;
+    char *error;
+    int status;
+
+    erlang_pool_begin_call(&body, module, function);
+    if (jsonb_to_erlang_args(&body, args_json) < 0) {
+        ei_x_free(&body);
+        ereport(ERROR, (errmsg("Failed to encode function arguments")));
+    }
+    ei_x_encode_atom(&body, "user");
+    status = erlang_pool_try_call_to(node_name, "rex", module, function, &body, timeout_ms, &reply, &error);
+    if (status == ERLANG_POOL_OK) {
+        *result = erlang_term_to_jsonb(&reply);
+        ei_x_free(&reply);
+    } else if (error != NULL) {
+        elog(DEBUG1, "pooled RPC to %s failed: %s", node_name, error);
+    }
+    return status;
+}
+
+// Hand a finished message to the worker for a registered process
+static void erlang_pool_send_to(const char *node_name, const char *regname,
+                                const char *module, const char *function, ei_x_buff *body) {
+    char *error = NULL;
+
+    if (erlang_pool_request(ERLANG_POOL_CAST, node_name, NULL, regname, body, 0, NULL, &error) != ERLANG_POOL_OK) {
+        ei_x_free(body);
+        ereport(ERROR, (errmsg("Failed to send message to %s: %s", regname, error ? error : "unknown error")));
+    }
+    erlang_stats_record(node_name, module, function, ERLANG_STATS_CAST, body->index, 0, 0);
+    ei_x_free(body);
+}
+
+// Hand a finished cast body to the worker
+static void erlang_pool_cast_body(const char *node_name, const char *module, const char *function,
+                                  ei_x_buff *body) {
+    erlang_pool_send_to(node_name, "rex", module, function, body);
+}
+
+// Fire-and-forget cast through the pool worker
+static void erlang_pool_cast(const char *node_name, const char *module, const char *function,
+                             Jsonb *args_json) {
+    ei_x_buff body;
+
+    ei_x_new(&body);
+    erlang_encode_cast_header(&body, module, function);
+    if (jsonb_to_erlang_args(&body, args_json) < 0) {
+        ei_x_free(&body);
+        ereport(ERROR, (errmsg("Failed to encode function arguments")));
+    }
+    erlang_pool_cast_body(node_name, module, function, &body);
+}
+
+/*
+ * Worker side
+ */
+
+// Try to push queued responses into the backend's queue without blocking
+static void erlang_pool_flush(ErlangPoolClient *client) {
+    while (client->outbox != NIL) {
+        ErlangPoolMessage *message = (ErlangPoolMessage *) linitial(client->outbox);
+        shm_mq_result res;
+
+        res = shm_mq_send(client->outq, message->len, message->data, true, true);
+        if (res == SHM_MQ_WOULD_BLOCK) {
+            return;
+        }
+        // Sent, or the backend is gone and the message is moot
+        client->outbox = list_delete_first(client->outbox);
+        pfree(message->data);
+        pfree(message);
+        if (res == SHM_MQ_DETACHED) {
+            return;
+        }
+    }
+}
+
+// Queue a response for a backend
+static void erlang_pool_respond(int slot, uint32 generation, uint64 seq, int status,
+                                const char *payload, Size len) {
+    ErlangPoolClient *client = &erlang_pool_clients[slot];
+    ErlangPoolResponse header;
+    ErlangPoolMessage *message;
+
+    if (client->seg == NULL || client->generation != generation) {
+        return;
+    }
+
+    header.seq = seq;
+    header.status = status;
+
+    message = palloc(sizeof(ErlangPoolMessage));
+    message->len = sizeof(header) + len;
+    message->data = palloc(message->len);
+    memcpy(message->data, &header, sizeof(header));
+    if (len > 0) {
+        memcpy(message->data + sizeof(header), payload, len);
+    }
+    client->outbox = lappend(client->outbox, message);
+    erlang_pool_flush(client);
+}
+
+static void erlang_pool_respond_error(int slot, uint32 generation, uint64 seq, const char *error) {
+    erlang_pool_respond(slot, generation, seq, ERLANG_POOL_ERROR, error, strlen(error));
+}
+
+// Fail every in-flight call routed to a node
+static void erlang_pool_fail_node(const char *node_name, const char *error) {
+    HASH_SEQ_STATUS seq;
+    ErlangPoolCall *call;
+
+    hash_seq_init(&seq, erlang_pool_calls);
+    while ((call = (ErlangPoolCall *) hash_seq_search(&seq)) != NULL) {
+        if (strcmp(call->node_name, node_name) == 0) {
+            erlang_pool_respond_error(call->slot, call->generation, call->seq, error);
+            hash_search(erlang_pool_calls, &call->key, HASH_REMOVE, NULL);
+        }
+    }
+}
+
+// Close a broken distribution connection
+static void erlang_pool_drop_connection(ErlangConnection *conn, const char *error) {
+    char node_name[MAX_NODE_NAME];
+
+    strlcpy(node_name, conn->node_name, MAX_NODE_NAME);
+    elog(LOG, "erlang_cnode pool: connection to %s lost: %s", node_name, error);
+    close(conn->fd);
+    erlang_frame_reset(&conn->reader);
+    erlang_frame_writer_reset(&conn->writer);
+    hash_search(connection_map, node_name, HASH_REMOVE, NULL);
+    erlang_pool_fail_node(node_name, error);
+}
+
+// Write what the socket will take; false if the connection failed and was dropped
+static bool erlang_pool_write(ErlangConnection *conn) {
+    char error[256];
+
+    if (erlang_frame_flush(conn) >= 0) {
+        return true;
+    }
+    snprintf(error, sizeof(error), "send failed: %s", strerror(errno));
+    erlang_pool_drop_connection(conn, error);
+    return false;
+}
+
+/*
+ * Every backend shares the worker's authenticated channel to a node, so a
+ * request may only use it with the cookie the connection was opened with.
+ */
+static bool erlang_pool_cookie_matches(const char *stored, const char *cookie) {
+    return strncmp(stored, cookie, MAX_COOKIE) == 0;
+}
+
+/*
+ * Body of the forked connect helper: run the blocking handshake, pass the
+ * socket back over sock and exit. Only ei and libc are used here; the
+ * process shares our memory image but must not touch PostgreSQL state.
+ */
+static void erlang_pool_connect_helper(ei_cnode *ec, const char *node_name, int sock) {
+    ErlangPoolConnectResult result;
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    int fd;
+
+    pqsignal(SIGTERM, SIG_DFL);
+    pqsignal(SIGINT, SIG_DFL);
+    pqsignal(SIGHUP, SIG_DFL);
+
+    fd = ei_connect_tmo(ec, (char *) node_name, ERLANG_POOL_CONNECT_TIMEOUT_MS);
+    result.status = fd < 0 ? -1 : 0;
+    result.err = fd < 0 ? errno : 0;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &result;
+    iov.iov_len = sizeof(result);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        struct cmsghdr *cmsg;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    (void) sendmsg(sock, &msg, 0);
+    _exit(0);
+}
+
+// Start connecting to a node in a helper process; false with error filled in if it could not start
+static bool erlang_pool_start_connect(ErlangPoolConnect *pending, char *error, size_t errlen) {
+    char cnode_name[MAX_NODE_NAME];
+    int socks[2];
+    pid_t pid;
+
+    snprintf(cnode_name, sizeof(cnode_name), "pgpool_%d@127.0.1.1", MyProcPid);
+    memset(&pending->ec, 0, sizeof(ei_cnode));
+    // An empty cookie means ~/.erlang.cookie
+    if (ei_connect_xinit(&pending->ec, "127.0.1.1", "pgpool", cnode_name, NULL,
+                         pending->cookie[0] != '\0' ? pending->cookie : NULL, 0) < 0) {
+        snprintf(error, errlen, "ei_connect_xinit failed: %s", strerror(errno));
+        return false;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0) {
+        snprintf(error, errlen, "socketpair failed: %s", strerror(errno));
+        return false;
+    }
+    pid = fork();
+    if (pid < 0) {
+        snprintf(error, errlen, "fork failed: %s", strerror(errno));
+        close(socks[0]);
+        close(socks[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(socks[0]);
+        erlang_pool_connect_helper(&pending->ec, pending->node_name, socks[1]);
+    }
+
+    close(socks[1]);
+    pending->pid = pid;
+    pending->sock = socks[0];
+    pending->deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+                                                    ERLANG_POOL_CONNECT_TIMEOUT_MS + ERLANG_POOL_GRACE_MS);
+    return true;
+}
+
+// Take over the socket of a finished handshake
+static void erlang_pool_add_connection(ErlangPoolConnect *pending, int fd) {
+    ErlangConnection *conn;
+    bool found;
+
+    conn = (ErlangConnection *) hash_search(connection_map, pending->node_name, HASH_ENTER, &found);
+    strlcpy(conn->node_name, pending->node_name, MAX_NODE_NAME);
+    strlcpy(conn->cookie, pending->cookie, MAX_COOKIE);
+    conn->fd = fd;
+    conn->pooled = false;
+    memset(&conn->reader, 0, sizeof(ErlangFrameReader));
+    memset(&conn->writer, 0, sizeof(ErlangFrameWriter));
+    conn->writer.queued = true;
+    memcpy(&conn->ec, &pending->ec, sizeof(ei_cnode));
+    elog(LOG, "erlang_cnode pool: connected to %s", pending->node_name);
+}
+
+/*
+ * Collect the outcome of a connection attempt once its helper has reported
+ * or overrun its deadline, and answer everyone waiting for it. Returns
+ * false while the attempt is still running.
+ */
+static bool erlang_pool_finish_connect(ErlangPoolConnect *pending) {
+    ErlangPoolConnectResult result;
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    char error[256];
+    ssize_t n;
+    int fd = -1;
+    ListCell *lc;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &result;
+    iov.iov_len = sizeof(result);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    n = recvmsg(pending->sock, &msg, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        if (GetCurrentTimestamp() < pending->deadline) {
+            return false;
+        }
+        kill(pending->pid, SIGKILL);
+        snprintf(error, sizeof(error), "connect timed out after %dms", ERLANG_POOL_CONNECT_TIMEOUT_MS);
+    } else if (n != sizeof(result)) {
+        snprintf(error, sizeof(error), "connect helper exited without a result");
+    } else if (result.status != 0) {
+        snprintf(error, sizeof(error), "ei_connect failed: %s", strerror(result.err));
+    } else {
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        } else {
+            snprintf(error, sizeof(error), "connect helper did not pass the socket");
+        }
+    }
+
+    close(pending->sock);
+    (void) waitpid(pending->pid, NULL, 0);
+
+    if (fd >= 0) {
+        erlang_pool_add_connection(pending, fd);
+    } else {
+        elog(LOG, "erlang_cnode pool: connection to %s failed: %s", pending->node_name, error);
+    }
+    foreach(lc, pending->waiters) {
+        ErlangPoolWaiter *waiter = (ErlangPoolWaiter *) lfirst(lc);
+
+        if (fd >= 0) {
+            erlang_pool_respond(waiter->slot, waiter->generation, waiter->seq, ERLANG_POOL_OK, NULL, 0);
+        } else {
+            erlang_pool_respond_error(waiter->slot, waiter->generation, waiter->seq, error);
+        }
+    }
+    list_free_deep(pending->waiters);
+    return true;
+}
+
+// Collect every connection attempt that has finished or run out of time
+static void erlang_pool_poll_connects(void) {
+    HASH_SEQ_STATUS seq;
+    ErlangPoolConnect *pending;
+
+    hash_seq_init(&seq, erlang_pool_connects);
+    while ((pending = (ErlangPoolConnect *) hash_seq_search(&seq)) != NULL) {
+        if (erlang_pool_finish_connect(pending)) {
+            hash_search(erlang_pool_connects, pending->node_name, HASH_REMOVE, NULL);
+        }
+    }
+}
+
+/*
+ * Answer a CONNECT: at once if the node is connected, otherwise once the
+ * connection attempt for it (started now or already running) is over.
+ */
+static void erlang_pool_handle_connect(int slot, ErlangPoolRequest *request) {
+    ErlangPoolClient *client = &erlang_pool_clients[slot];
+    ErlangConnection *conn;
+    ErlangPoolConnect *pending;
+    ErlangPoolWaiter *waiter;
+    char error[256];
+    bool found;
+
+    conn = (ErlangConnection *) hash_search(connection_map, request->node_name, HASH_FIND, &found);
+    if (found) {
+        if (!erlang_pool_cookie_matches(conn->cookie, request->cookie)) {
+            snprintf(error, sizeof(error), "%s is already connected with a different cookie", request->node_name);
+            erlang_pool_respond_error(slot, client->generation, request->seq, error);
+        } else {
+            erlang_pool_respond(slot, client->generation, request->seq, ERLANG_POOL_OK, NULL, 0);
+        }
+        return;
+    }
+
+    pending = (ErlangPoolConnect *) hash_search(erlang_pool_connects, request->node_name, HASH_ENTER, &found);
+    if (found) {
+        if (!erlang_pool_cookie_matches(pending->cookie, request->cookie)) {
+            snprintf(error, sizeof(error), "%s is being connected with a different cookie", request->node_name);
+            erlang_pool_respond_error(slot, client->generation, request->seq, error);
+            return;
+        }
+    } else {
+        strlcpy(pending->cookie, request->cookie, MAX_COOKIE);
+        pending->waiters = NIL;
+        if (!erlang_pool_start_connect(pending, error, sizeof(error))) {
+            hash_search(erlang_pool_connects, request->node_name, HASH_REMOVE, NULL);
+            erlang_pool_respond_error(slot, client->generation, request->seq, error);
+            return;
+        }
+    }
+
+    waiter = palloc(sizeof(ErlangPoolWaiter));
+    waiter->slot = slot;
+    waiter->generation = client->generation;
+    waiter->seq = request->seq;
+    pending->waiters = lappend(pending->waiters, waiter);
+}
+
+// Handle one request read from a backend queue
+static void erlang_pool_handle_request(int slot, ErlangPoolRequest *request,
+                                       const char *body, Size body_len) {
+    ErlangPoolClient *client = &erlang_pool_clients[slot];
+    ErlangConnection *conn;
+    const char *regname;
+    ei_x_buff msg;
+    char error[256];
+    bool found;
+
+    if (request->kind == ERLANG_POOL_CONNECT) {
+        erlang_pool_handle_connect(slot, request);
+        return;
+    }
+
+    regname = request->regname[0] != '\0' ? request->regname : "rex";
+    conn = (ErlangConnection *) hash_search(connection_map, request->node_name, HASH_FIND, &found);
+    if (!found) {
+        snprintf(error, sizeof(error), "No connection to node: %s", request->node_name);
+        erlang_pool_respond_error(slot, client->generation, request->seq, error);
+        return;
+    }
+    if (!erlang_pool_cookie_matches(conn->cookie, request->cookie)) {
+        snprintf(error, sizeof(error), "%s is connected with a different cookie", request->node_name);
+        erlang_pool_respond_error(slot, client->generation, request->seq, error);
+        return;
+    }
+
+    if (request->kind == ERLANG_POOL_CALL) {
+        erlang_ref ref;
+        ErlangRefKey key;
+        ErlangPoolCall *call;
+
+        // {'$gen_call', {FromPid, Ref}, Body}
+        ei_make_ref(&conn->ec, &ref);
+        ei_x_new_with_version(&msg);
+        erlang_encode_gen_call_head(&msg);
+        ei_x_encode_pid(&msg, ei_self(&conn->ec));
+        ei_x_encode_ref(&msg, &ref);
+        ei_x_append_buf(&msg, body, body_len);
+
+        // Registered first, so a failed send answers it through erlang_pool_fail_node
+        erlang_ref_key(&ref, &key);
+        call = (ErlangPoolCall *) hash_search(erlang_pool_calls, &key, HASH_ENTER, &found);
+        call->slot = slot;
+        call->generation = client->generation;
+        call->seq = request->seq;
+        strlcpy(call->node_name, request->node_name, MAX_NODE_NAME);
+        call->deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), request->timeout_ms);
+
+        if (!erlang_frame_queue_reg_send(conn, regname, msg.buff, msg.index)) {
+            snprintf(error, sizeof(error), "send failed: %s", strerror(errno));
+            erlang_pool_drop_connection(conn, error);
+        } else {
+            (void) erlang_pool_write(conn);
+        }
+        ei_x_free(&msg);
+    } else if (request->kind == ERLANG_POOL_CAST) {
+        ei_x_new_with_version(&msg);
+        ei_x_append_buf(&msg, body, body_len);
+        if (!erlang_frame_queue_reg_send(conn, regname, msg.buff, msg.index)) {
+            ei_x_free(&msg);
+            snprintf(error, sizeof(error), "send failed: %s", strerror(errno));
+            erlang_pool_respond_error(slot, client->generation, request->seq, error);
+            erlang_pool_drop_connection(conn, error);
+            return;
+        }
+        ei_x_free(&msg);
+        // Accepted for sending; like erlang:send/2 a cast is not confirmed
+        erlang_pool_respond(slot, client->generation, request->seq, ERLANG_POOL_OK, NULL, 0);
+        (void) erlang_pool_write(conn);
+    } else {
+        snprintf(error, sizeof(error), "unknown request kind %d", request->kind);
+        erlang_pool_respond_error(slot, client->generation, request->seq, error);
+    }
+}
+
+// Forget a backend whose queues are gone
+static void erlang_pool_detach_client(int slot) {
+    ErlangPoolClient *client = &erlang_pool_clients[slot];
+    ListCell *lc;
+
+    foreach(lc, client->outbox) {
+        ErlangPoolMessage *message = (ErlangPoolMessage *) lfirst(lc);
+        pfree(message->data);
+    }
+    list_free_deep(client->outbox);
+    client->outbox = NIL;
+    if (client->seg != NULL) {
+        dsm_detach(client->seg);
+    }
+    client->seg = NULL;
+    client->inq = NULL;
+    client->outq = NULL;
+}
+
+// Attach to newly registered backend queues, drop ones whose slot was released
+static void erlang_pool_attach_clients(void) {
+    int i;
+
+    for (i = 0; i < erlang_pool->nslots; i++) {
+        ErlangPoolClient *client = &erlang_pool_clients[i];
+        pid_t backend_pid;
+        uint32 generation;
+        dsm_handle handle;
+
+        SpinLockAcquire(&erlang_pool->mutex);
+        backend_pid = erlang_pool->slots[i].backend_pid;
+        generation = erlang_pool->slots[i].generation;
+        handle = erlang_pool->slots[i].handle;
+        SpinLockRelease(&erlang_pool->mutex);
+
+        if (client->seg != NULL && (backend_pid == 0 || client->generation != generation)) {
+            erlang_pool_detach_client(i);
+        }
+        if (client->seg == NULL && backend_pid != 0) {
+            MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+            dsm_segment *seg = dsm_attach(handle);
+            char *base;
+            shm_mq *to_worker;
+            shm_mq *from_worker;
+
+            if (seg == NULL) {
+                MemoryContextSwitchTo(oldcontext);
+                continue;
+            }
+            dsm_pin_mapping(seg);
+            base = dsm_segment_address(seg);
+            to_worker = (shm_mq *) base;
+            from_worker = (shm_mq *) (base + ERLANG_POOL_QUEUE_SIZE);
+            shm_mq_set_receiver(to_worker, MyProc);
+            shm_mq_set_sender(from_worker, MyProc);
+            client->seg = seg;
+            client->generation = generation;
+            client->inq = shm_mq_attach(to_worker, seg, NULL);
+            client->outq = shm_mq_attach(from_worker, seg, NULL);
+            client->outbox = NIL;
+            MemoryContextSwitchTo(oldcontext);
+        }
+    }
+}
+
+// Read every complete request waiting in the backend queues
+static void erlang_pool_drain_clients(void) {
+    int i;
+
+    for (i = 0; i < erlang_pool->nslots; i++) {
+        ErlangPoolClient *client = &erlang_pool_clients[i];
+
+        if (client->seg == NULL) {
+            continue;
+        }
+        erlang_pool_flush(client);
+
+        for (;;) {
+            Size nbytes;
+            void *data;
+            shm_mq_result res;
+
+            res = shm_mq_receive(client->inq, &nbytes, &data, true);
+            if (res == SHM_MQ_WOULD_BLOCK) {
+                break;
+            }
+            if (res == SHM_MQ_DETACHED) {
+                erlang_pool_detach_client(i);
+                break;
+            }
+            if (nbytes < sizeof(ErlangPoolRequest)) {
+                continue;
+            }
+            erlang_pool_handle_request(i, (ErlangPoolRequest *) data,
+                                       (char *) data + sizeof(ErlangPoolRequest),
+                                       nbytes - sizeof(ErlangPoolRequest));
+            if (client->seg == NULL) {
+                break;
+            }
+        }
+    }
+}
+
+// Read every complete message from a node and route each {Ref, Reply} to its caller
+static void erlang_pool_read(ErlangConnection *conn) {
+    for (;;) {
+        ei_x_buff buf;
+        int status;
+        int index = 0;
+        int version;
+        int arity;
+        erlang_ref ref;
+        ErlangRefKey key;
+        ErlangPoolCall *call;
+        bool found;
+
+        status = erlang_frame_read(conn, &buf);
+        if (status == ERL_TICK) {
+            continue;
+        }
+        if (status == ERL_TIMEOUT) {
+            return;
+        }
+        if (status == ERL_ERROR) {
+            erlang_pool_drop_connection(conn, "receive failed");
+            return;
+        }
+
+        if (ei_decode_version(buf.buff, &index, &version) < 0 ||
+            ei_decode_tuple_header(buf.buff, &index, &arity) < 0 || arity != 2 ||
+            ei_decode_ref(buf.buff, &index, &ref) < 0) {
+            // Not a reply to one of our calls
+            ei_x_free(&buf);
+            continue;
+        }
+
+        erlang_ref_key(&ref, &key);
+        call = (ErlangPoolCall *) hash_search(erlang_pool_calls, &key, HASH_FIND, &found);
+        if (found) {
+            erlang_pool_respond(call->slot, call->generation, call->seq, ERLANG_POOL_OK, buf.buff, buf.index);
+            hash_search(erlang_pool_calls, &key, HASH_REMOVE, NULL);
+        }
+        ei_x_free(&buf);
+    }
+}
+
+// Time out overdue calls; returns milliseconds until the next deadline
+static long erlang_pool_expire_calls(void) {
+    HASH_SEQ_STATUS seq;
+    ErlangPoolCall *call;
+    TimestampTz now = GetCurrentTimestamp();
+    long next = 1000;
+
+    hash_seq_init(&seq, erlang_pool_calls);
+    while ((call = (ErlangPoolCall *) hash_seq_search(&seq)) != NULL) {
+        if (call->deadline <= now) {
+            erlang_pool_respond(call->slot, call->generation, call->seq, ERLANG_POOL_TIMEOUT, NULL, 0);
+            hash_search(erlang_pool_calls, &call->key, HASH_REMOVE, NULL);
+        } else {
+            long remaining = TimestampDifferenceMilliseconds(now, call->deadline);
+            if (remaining < next) {
+                next = remaining;
+            }
+        }
+    }
+    return next;
+}
+
+// Background worker entry point
+void erlang_pool_main(Datum main_arg) {
+    HASHCTL ctl;
+    int i;
+
+    pqsignal(SIGHUP, SignalHandlerForConfigReload);
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+
+    if (erlang_pool == NULL) {
+        elog(FATAL, "erlang_cnode connection pool shared memory is not initialized");
+    }
+
+    // Any slots left from a previous incarnation point at queues we can no longer use
+    SpinLockAcquire(&erlang_pool->mutex);
+    for (i = 0; i < erlang_pool->nslots; i++) {
+        erlang_pool->slots[i].backend_pid = 0;
+    }
+    erlang_pool->worker_latch = MyLatch;
+    erlang_pool->worker_pid = MyProcPid;
+    SpinLockRelease(&erlang_pool->mutex);
+
+    erlang_pool_clients = MemoryContextAllocZero(TopMemoryContext,
+                                                 sizeof(ErlangPoolClient) * erlang_pool->nslots);
+
+    MemSet(&ctl, 0, sizeof(ctl));
+    ctl.keysize = sizeof(ErlangRefKey);
+    ctl.entrysize = sizeof(ErlangPoolCall);
+    ctl.hcxt = TopMemoryContext;
+    erlang_pool_calls = hash_create("ErlangPoolCalls", 256, &ctl, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+    MemSet(&ctl, 0, sizeof(ctl));
+    ctl.keysize = MAX_NODE_NAME;
+    ctl.entrysize = sizeof(ErlangPoolConnect);
+    ctl.hcxt = TopMemoryContext;
+    erlang_pool_connects = hash_create("ErlangPoolConnects", 16, &ctl, HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+
+    elog(LOG, "erlang_cnode connection pool started");
+
+    for (;;) {
+        WaitEventSet *set;
+        WaitEvent events[64];
+        HASH_SEQ_STATUS seq;
+        ErlangConnection *conn;
+        ErlangPoolConnect *pending;
+        long timeout;
+        int nevents;
+
+        timeout = erlang_pool_expire_calls();
+
+        set = erlang_create_wait_event_set(2 + hash_get_num_entries(connection_map) +
+                                           hash_get_num_entries(erlang_pool_connects));
+        AddWaitEventToSet(set, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+        AddWaitEventToSet(set, WL_EXIT_ON_PM_DEATH, PGINVALID_SOCKET, NULL, NULL);
+        hash_seq_init(&seq, connection_map);
+        while ((conn = (ErlangConnection *) hash_seq_search(&seq)) != NULL) {
+            AddWaitEventToSet(set, WL_SOCKET_READABLE | (erlang_frame_pending(conn) ? WL_SOCKET_WRITEABLE : 0),
+                              conn->fd, NULL, conn);
+        }
+        // Helpers report on their socketpair; erlang_pool_poll_connects looks at every one
+        hash_seq_init(&seq, erlang_pool_connects);
+        while ((pending = (ErlangPoolConnect *) hash_seq_search(&seq)) != NULL) {
+            AddWaitEventToSet(set, WL_SOCKET_READABLE, pending->sock, NULL, NULL);
+        }
+        nevents = WaitEventSetWait(set, timeout, events, lengthof(events), PG_WAIT_EXTENSION);
+        FreeWaitEventSet(set);
+
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+
+        if (ConfigReloadPending) {
+            ConfigReloadPending = false;
+            ProcessConfigFile(PGC_SIGHUP);
+        }
+
+        for (i = 0; i < nevents; i++) {
+            conn = (ErlangConnection *) events[i].user_data;
+            if (conn == NULL) {
+                continue;
+            }
+            if ((events[i].events & WL_SOCKET_WRITEABLE) && !erlang_pool_write(conn)) {
+                continue;
+            }
+            if (events[i].events & WL_SOCKET_READABLE) {
+                erlang_pool_read(conn);
+            }
+        }
+
+        erlang_pool_poll_connects();
+        erlang_pool_attach_clients();
+        erlang_pool_drain_clients();
+    }
+}
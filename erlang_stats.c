@@ -0,0 +1,298 @@
+/*
+ * Call statistics (pg_stat_erlang_calls)
+ * A shared hash keyed by node and Module:Function accumulates call, cast,
+ * error and timeout counts, bytes on the wire and a log2 latency histogram.
+ * Lookups take the LWLock shared and update an entry under its own spinlock;
+ * only the first call of a new Module:Function takes the lock exclusively.
+ * Requires erlang_cnode in shared_preload_libraries; otherwise nothing is
+ * recorded.
+ */
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "port/pg_bitutils.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#include "erlang_cnode.h"
+#include <math.h>
+
+// Histogram bucket b counts latencies in [2^(b-1), 2^b) microseconds; bucket 0 is < 1us
+#define ERLANG_STATS_BUCKETS 32
+
+typedef enum {
+    ERLANG_STATS_OK,
+    ERLANG_STATS_ERROR,
+    ERLANG_STATS_TIMEOUT,
+    ERLANG_STATS_CAST
+} ErlangStatsOutcome;
+
+typedef struct {
+    char node_name[MAX_NODE_NAME];
+    char module[MAX_MFA_NAME];
+    char function[MAX_MFA_NAME];
+} ErlangStatsKey;
+
+typedef struct {
+    ErlangStatsKey key;
+    slock_t mutex;
+    int64 calls;
+    int64 casts;
+    int64 errors;
+    int64 timeouts;
+    int64 bytes_sent;
+    int64 bytes_received;
+    double total_time_ms;
+    int64 histogram[ERLANG_STATS_BUCKETS];
+} ErlangStatsEntry;
+
+typedef struct {
+    LWLock *lock;
+} ErlangStatsShared;
+
+static int erlang_stats_max = 1000;
+static ErlangStatsShared *erlang_stats = NULL;
+static HTAB *erlang_stats_hash = NULL;
+
+static Size erlang_stats_shmem_size(void) {
+    return add_size(MAXALIGN(sizeof(ErlangStatsShared)),
+                    hash_estimate_size(erlang_stats_max, sizeof(ErlangStatsEntry)));
+}
+
+static void erlang_stats_shmem_request(void) {
+    RequestAddinShmemSpace(erlang_stats_shmem_size());
+    RequestNamedLWLockTranche("erlang_cnode stats", 1);
+}
+
+// Called from the shmem startup hook with AddinShmemInitLock held
+static void erlang_stats_shmem_init(void) {
+    HASHCTL info;
+    bool found;
+
+    erlang_stats = ShmemInitStruct("erlang_cnode stats", sizeof(ErlangStatsShared), &found);
+    if (!found) {
+        erlang_stats->lock = &(GetNamedLWLockTranche("erlang_cnode stats"))->lock;
+    }
+
+    memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(ErlangStatsKey);
+    info.entrysize = sizeof(ErlangStatsEntry);
+    erlang_stats_hash = ShmemInitHash("erlang_cnode stats hash", erlang_stats_max, erlang_stats_max,
+                                      &info, HASH_ELEM | HASH_BLOBS);
+}
+
+// True if a received {Ref, Reply} message carries {badrpc, Reason}
+static bool erlang_stats_is_badrpc(ei_x_buff *buf) {
+    int index = 0;
+    int version;
+    int arity;
+    int type;
+    int size;
+    char atom[MAXATOMLEN];
+
+    if (ei_decode_version(buf->buff, &index, &version) < 0) {
+        index = 0;
+    }
+    if (ei_decode_tuple_header(buf->buff, &index, &arity) < 0 || arity != 2 ||
+        ei_skip_term(buf->buff, &index) < 0) {
+        return false;
+    }
+    if (ei_decode_tuple_header(buf->buff, &index, &arity) < 0 || arity != 2) {
+        return false;
+    }
+    if (ei_get_type(buf->buff, &index, &type, &size) < 0 || size >= MAXATOMLEN) {
+        return false;
+    }
+    return ei_decode_atom(buf->buff, &index, atom) == 0 && strcmp(atom, "badrpc") == 0;
+}
+
+// Add one call (or cast) to the statistics
+static void erlang_stats_record(const char *node_name, const char *module, const char *function,
+                                ErlangStatsOutcome outcome, int64 bytes_sent, int64 bytes_received,
+                                TimestampTz started) {
+    ErlangStatsKey key;
+    ErlangStatsEntry *entry;
+    bool timed = outcome != ERLANG_STATS_CAST && started != 0;
+    int64 us = 0;
+    int bucket = 0;
+
+    if (erlang_stats == NULL) {
+        return;
+    }
+
+    // Read the clock before taking any lock; the spinlock covers only the counter updates
+    if (timed) {
+        TimestampTz now = GetCurrentTimestamp();
+
+        us = now > started ? now - started : 0;
+        bucket = us == 0 ? 0 : Min(pg_leftmost_one_pos64((uint64) us) + 1, ERLANG_STATS_BUCKETS - 1);
+    }
+
+    memset(&key, 0, sizeof(key));
+    strlcpy(key.node_name, node_name, MAX_NODE_NAME);
+    strlcpy(key.module, module, MAX_MFA_NAME);
+    strlcpy(key.function, function, MAX_MFA_NAME);
+
+    LWLockAcquire(erlang_stats->lock, LW_SHARED);
+    entry = (ErlangStatsEntry *) hash_search(erlang_stats_hash, &key, HASH_FIND, NULL);
+    if (entry == NULL) {
+        bool found;
+
+        // First call of this Module:Function; the table is full when HASH_ENTER_NULL fails
+        LWLockRelease(erlang_stats->lock);
+        LWLockAcquire(erlang_stats->lock, LW_EXCLUSIVE);
+        entry = (ErlangStatsEntry *) hash_search(erlang_stats_hash, &key, HASH_ENTER_NULL, &found);
+        if (entry == NULL) {
+            LWLockRelease(erlang_stats->lock);
+            return;
+        }
+        if (!found) {
+            memset((char *) entry + sizeof(ErlangStatsKey), 0, sizeof(ErlangStatsEntry) - sizeof(ErlangStatsKey));
+            SpinLockInit(&entry->mutex);
+        }
+    }
+
+    SpinLockAcquire(&entry->mutex);
+    entry->bytes_sent += bytes_sent;
+    entry->bytes_received += bytes_received;
+    if (outcome == ERLANG_STATS_CAST) {
+        entry->casts++;
+    } else {
+        entry->calls++;
+        if (outcome == ERLANG_STATS_ERROR) {
+            entry->errors++;
+        } else if (outcome == ERLANG_STATS_TIMEOUT) {
+            entry->timeouts++;
+        }
+        if (timed) {
+            entry->total_time_ms += us / 1000.0;
+            entry->histogram[bucket]++;
+        }
+    }
+    SpinLockRelease(&entry->mutex);
+
+    LWLockRelease(erlang_stats->lock);
+}
+
+// Estimate a latency percentile (in ms), interpolating within the log2 bucket
+static double erlang_stats_percentile(const int64 *histogram, int64 total, double fraction) {
+    double target;
+    int64 seen = 0;
+    int b;
+
+    if (total == 0) {
+        return 0;
+    }
+    target = ceil(fraction * total);
+    for (b = 0; b < ERLANG_STATS_BUCKETS; b++) {
+        if (histogram[b] > 0 && seen + histogram[b] >= target) {
+            double lower = b == 0 ? 0 : (double) ((uint64) 1 << (b - 1));
+            double upper = (double) ((uint64) 1 << b);
+
+            return (lower + (upper - lower) * (target - seen) / histogram[b]) / 1000.0;
+        }
+        seen += histogram[b];
+    }
+    return (double) ((uint64) 1 << (ERLANG_STATS_BUCKETS - 1)) / 1000.0;
+}
+
+// Rows behind the pg_stat_erlang_calls view
+PG_FUNCTION_INFO_V1(erlang_stat_calls);
+Datum erlang_stat_calls(PG_FUNCTION_ARGS) {
+    ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    TupleDesc tupdesc;
+    Tuplestorestate *tupstore;
+    MemoryContext oldcontext;
+    HASH_SEQ_STATUS seq;
+    ErlangStatsEntry *entry;
+
+    if (erlang_stats == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("erlang_cnode must be loaded via shared_preload_libraries to collect call statistics")));
+    }
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo) || !(rsinfo->allowedModes & SFRM_Materialize)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("erlang_stat_calls must be called in a context that accepts a set")));
+    }
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+        ereport(ERROR, (errmsg("return type must be a row type")));
+    }
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    LWLockAcquire(erlang_stats->lock, LW_SHARED);
+    hash_seq_init(&seq, erlang_stats_hash);
+    while ((entry = (ErlangStatsEntry *) hash_seq_search(&seq)) != NULL) {
+        ErlangStatsEntry snapshot;
+        Datum values[14];
+        bool nulls[14];
+        int64 timed = 0;
+        int b;
+
+        SpinLockAcquire(&entry->mutex);
+        snapshot = *entry;
+        SpinLockRelease(&entry->mutex);
+
+        for (b = 0; b < ERLANG_STATS_BUCKETS; b++) {
+            timed += snapshot.histogram[b];
+        }
+
+        memset(nulls, 0, sizeof(nulls));
+        values[0] = CStringGetTextDatum(snapshot.key.node_name);
+        values[1] = CStringGetTextDatum(snapshot.key.module);
+        values[2] = CStringGetTextDatum(snapshot.key.function);
+        values[3] = Int64GetDatum(snapshot.calls);
+        values[4] = Int64GetDatum(snapshot.casts);
+        values[5] = Int64GetDatum(snapshot.errors);
+        values[6] = Int64GetDatum(snapshot.timeouts);
+        values[7] = Int64GetDatum(snapshot.bytes_sent);
+        values[8] = Int64GetDatum(snapshot.bytes_received);
+        values[9] = Float8GetDatum(snapshot.total_time_ms);
+        if (timed > 0) {
+            values[10] = Float8GetDatum(snapshot.total_time_ms / timed);
+            values[11] = Float8GetDatum(erlang_stats_percentile(snapshot.histogram, timed, 0.5));
+            values[12] = Float8GetDatum(erlang_stats_percentile(snapshot.histogram, timed, 0.99));
+            values[13] = Float8GetDatum(erlang_stats_percentile(snapshot.histogram, timed, 0.999));
+        } else {
+            nulls[10] = nulls[11] = nulls[12] = nulls[13] = true;
+        }
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+    LWLockRelease(erlang_stats->lock);
+
+    return (Datum) 0;
+}
+
+// Discard all call statistics
+PG_FUNCTION_INFO_V1(erlang_stat_reset);
+Datum erlang_stat_reset(PG_FUNCTION_ARGS) {
+    HASH_SEQ_STATUS seq;
+    ErlangStatsEntry *entry;
+
+    if (erlang_stats == NULL) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("erlang_cnode must be loaded via shared_preload_libraries to collect call statistics")));
+    }
+
+    LWLockAcquire(erlang_stats->lock, LW_EXCLUSIVE);
+    hash_seq_init(&seq, erlang_stats_hash);
+    while ((entry = (ErlangStatsEntry *) hash_seq_search(&seq)) != NULL) {
+        hash_search(erlang_stats_hash, &entry->key, HASH_REMOVE, NULL);
+    }
+    LWLockRelease(erlang_stats->lock);
+
+    PG_RETURN_VOID();
+}
@@ -0,0 +1,1439 @@
+/*
+ * The erlang_term type
+ * A value is stored exactly as term_to_binary/1 returns it, a version byte
+ * followed by an uncompressed term, so it casts to bytea as is and goes back
+ * to Erlang byte for byte. The accessor operators find a subterm by skipping
+ * over its siblings; nothing else is decoded. The text form is Erlang literal
+ * syntax.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "common/shortest_dec.h"
+#include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "mb/pg_wchar.h"
+#include "utils/builtins.h"
+#include "utils/jsonb.h"
+#include "utils/numeric.h"
+#include "erlang_cnode.h"
+#include <ei.h>
+#include <ctype.h>
+#include <math.h>
+
+#define PG_GETARG_ERLANG_TERM_PP(n) PG_GETARG_BYTEA_PP(n)
+#define PG_RETURN_ERLANG_TERM_P(x) PG_RETURN_BYTEA_P(x)
+
+// Erlang atoms hold at most this many characters
+#define ERLANG_TERM_MAX_ATOM 255
+
+static void erlang_term_print(EtfDecoder *d, StringInfo out);
+
+// Characters of an atom that needs no quotes, after its leading lowercase letter
+static inline bool erlang_term_atom_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '@';
+}
+
+// Start decoding an erlang_term just past its version byte
+static void erlang_term_decoder(EtfDecoder *d, bytea *term) {
+    d->buf = VARDATA_ANY(term);
+    d->len = VARSIZE_ANY_EXHDR(term);
+    d->index = 1;
+    d->state = NULL;
+}
+
+// An erlang_term holding a copy of len bytes of unversioned term
+static bytea *erlang_term_make(const char *term, int len) {
+    bytea *result = (bytea *) palloc(VARHDRSZ + 1 + len);
+
+    SET_VARSIZE(result, VARHDRSZ + 1 + len);
+    VARDATA(result)[0] = (char) ETF_VERSION_MAGIC;
+    memcpy(VARDATA(result) + 1, term, len);
+    return result;
+}
+
+// Check that data[0..len) is exactly one versioned term; a compressed one is stored inflated
+static bytea *erlang_term_from_buf(const char *data, int len) {
+    EtfDecoder d;
+    bytea *result;
+
+    if (len < 2 || (uint8) data[0] != ETF_VERSION_MAGIC) {
+        etf_truncated();
+    }
+
+    if ((uint8) data[1] == ETF_COMPRESSED_EXT) {
+        uint32 size;
+
+        if (len < 6) {
+            etf_truncated();
+        }
+        memcpy(&size, data + 2, 4);
+        size = pg_ntoh32(size);
+        if (size > MaxAllocSize - VARHDRSZ - 1) {
+            etf_truncated();
+        }
+        result = (bytea *) palloc(VARHDRSZ + 1 + size);
+        SET_VARSIZE(result, VARHDRSZ + 1 + size);
+        VARDATA(result)[0] = (char) ETF_VERSION_MAGIC;
+        if (etf_inflate(data + 6, len - 6, VARDATA(result) + 1, size) != len - 6) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                     errmsg("corrupt compressed Erlang external term")));
+        }
+    } else {
+        result = erlang_term_make(data + 1, len - 1);
+    }
+
+    erlang_term_decoder(&d, result);
+    etf_skip(&d);
+    if (d.index != d.len) {
+        etf_truncated();
+    }
+    return result;
+}
+
+/*
+ * Text output
+ * Terms are written the way io:format("~w") writes them, except that lists
+ * of printable characters are written as strings and printable binaries as
+ * <<"...">>, as ~p does. Pids, ports, references and funs have no literal
+ * syntax; they are written in ei's display form and cannot be read back.
+ */
+
+// Characters written inside a string literal rather than as a list of integers
+static inline bool erlang_term_printable(uint32 c) {
+    return c == '\n' || c == '\t' || c == '\r' ||
+           (c >= 32 && c < 127) || (c >= 160 && c < 0xD800) || (c > 0xDFFF && c < 0x110000);
+}
+
+// Append one character of a quoted atom or string, escaped the way Erlang reads it back
+static void erlang_term_print_char(StringInfo out, uint32 c, char quote) {
+    unsigned char utf8[8];
+
+    if (c == '\n') {
+        appendStringInfoString(out, "\\n");
+    } else if (c == '\t') {
+        appendStringInfoString(out, "\\t");
+    } else if (c == '\r') {
+        appendStringInfoString(out, "\\r");
+    } else if (c == '\\' || c == (uint32) quote) {
+        appendStringInfoChar(out, '\\');
+        appendStringInfoChar(out, (char) c);
+    } else if (c < 32 || (c >= 127 && c < 160)) {
+        appendStringInfo(out, "\\x{%X}", c);
+    } else if (c < 128) {
+        appendStringInfoChar(out, (char) c);
+    } else {
+        unicode_to_utf8(c, utf8);
+        appendBinaryStringInfo(out, (char *) utf8, pg_utf_mblen(utf8));
+    }
+}
+
+// Atoms that are keywords, and so must be quoted
+static bool erlang_term_reserved(const char *s, int len) {
+    static const char *const reserved[] = {
+        "after", "and", "andalso", "band", "begin", "bnot", "bor", "bsl", "bsr", "bxor",
+        "case", "catch", "cond", "div", "else", "end", "fun", "if", "let", "maybe", "not",
+        "of", "or", "orelse", "receive", "rem", "try", "when", "xor"
+    };
+    int i;
+
+    for (i = 0; i < lengthof(reserved); i++) {
+        if (strlen(reserved[i]) == (size_t) len && memcmp(reserved[i], s, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Append an atom's name, as UTF-8 whatever its encoding in the term
+static void erlang_term_atom_name(StringInfo out, const char *s, int len, bool latin1) {
+    int i;
+
+    for (i = 0; i < len; i++) {
+        uint8 c = (uint8) s[i];
+
+        if (latin1 && c >= 128) {
+            appendStringInfoChar(out, (char) (0xC0 | (c >> 6)));
+            appendStringInfoChar(out, (char) (0x80 | (c & 0x3F)));
+        } else {
+            appendStringInfoChar(out, (char) c);
+        }
+    }
+}
+
+// Append an atom, quoted unless it reads back as a bare word
+static void erlang_term_print_atom(StringInfo out, const char *s, int len, bool latin1) {
+    bool bare = len > 0 && s[0] >= 'a' && s[0] <= 'z' && !erlang_term_reserved(s, len);
+    int i;
+
+    for (i = 1; bare && i < len; i++) {
+        bare = erlang_term_atom_char(s[i]);
+    }
+    if (bare) {
+        appendBinaryStringInfo(out, s, len);
+        return;
+    }
+
+    appendStringInfoChar(out, '\'');
+    for (i = 0; i < len; i++) {
+        uint8 c = (uint8) s[i];
+
+        // Multibyte UTF-8 passes through unchanged
+        if (c >= 128 && !latin1) {
+            appendStringInfoChar(out, (char) c);
+        } else {
+            erlang_term_print_char(out, c, '\'');
+        }
+    }
+    appendStringInfoChar(out, '\'');
+}
+
+/*
+ * If the term at d->index is a non-empty proper list of printable characters
+ * (packed as STRING_EXT or spelled out as a list of integers), step over it
+ * and append its characters, quoted or raw. Otherwise leave d as it is and
+ * return false.
+ */
+static bool erlang_term_print_string(EtfDecoder *d, StringInfo out, bool quoted) {
+    EtfDecoder scan = *d;
+    uint8 tag = etf_u8(&scan);
+    uint32 count;
+    uint32 i;
+
+    if (tag == ERL_STRING_EXT) {
+        count = etf_u16(&scan);
+        etf_need(&scan, count);
+        for (i = 0; i < count; i++) {
+            if (!erlang_term_printable((uint8) scan.buf[scan.index + i])) {
+                return false;
+            }
+        }
+    } else if (tag == ERL_LIST_EXT) {
+        count = etf_u32(&scan);
+        for (i = 0; i < count; i++) {
+            uint8 elem = etf_u8(&scan);
+            uint32 c;
+
+            if (elem == ERL_SMALL_INTEGER_EXT) {
+                c = etf_u8(&scan);
+            } else if (elem == ERL_INTEGER_EXT) {
+                c = etf_u32(&scan);
+            } else {
+                return false;
+            }
+            if (!erlang_term_printable(c)) {
+                return false;
+            }
+        }
+        if (etf_u8(&scan) != ERL_NIL_EXT) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    if (count == 0) {
+        return false;
+    }
+
+    // Second pass writes the characters
+    d->index++;
+    if (tag == ERL_STRING_EXT) {
+        d->index += 2;
+    } else {
+        d->index += 4;
+    }
+    if (quoted) {
+        appendStringInfoChar(out, '"');
+    }
+    for (i = 0; i < count; i++) {
+        uint32 c;
+
+        if (tag == ERL_STRING_EXT) {
+            c = (uint8) d->buf[d->index++];
+        } else {
+            c = etf_u8(d) == ERL_SMALL_INTEGER_EXT ? etf_u8(d) : etf_u32(d);
+        }
+        if (quoted) {
+            erlang_term_print_char(out, c, '"');
+        } else {
+            unsigned char utf8[8];
+
+            unicode_to_utf8(c, utf8);
+            appendBinaryStringInfo(out, (char *) utf8, pg_utf_mblen(utf8));
+        }
+    }
+    if (tag == ERL_LIST_EXT) {
+        d->index++;
+    }
+    if (quoted) {
+        appendStringInfoChar(out, '"');
+    }
+    return true;
+}
+
+// Whether len bytes are UTF-8 made of printable characters; *ascii says whether all were ASCII
+static bool erlang_term_printable_utf8(const char *s, int len, bool *ascii) {
+    int i = 0;
+
+    *ascii = true;
+    while (i < len) {
+        const unsigned char *p = (const unsigned char *) s + i;
+        int l = pg_utf_mblen(p);
+
+        if (l > len - i || !pg_utf8_islegal(p, l) || !erlang_term_printable(utf8_to_unicode(p))) {
+            return false;
+        }
+        if (l > 1) {
+            *ascii = false;
+        }
+        i += l;
+    }
+    return true;
+}
+
+// Append a binary or bitstring; bits is the number of used bits in the last byte
+static void erlang_term_print_binary(StringInfo out, const char *s, uint32 len, int bits) {
+    bool ascii;
+    uint32 i;
+
+    appendStringInfoString(out, "<<");
+    if (bits == 8 && len > 0 && erlang_term_printable_utf8(s, len, &ascii)) {
+        appendStringInfoChar(out, '"');
+        for (i = 0; i < len; i++) {
+            uint8 c = (uint8) s[i];
+
+            if (c >= 128) {
+                appendStringInfoChar(out, (char) c);
+            } else {
+                erlang_term_print_char(out, c, '"');
+            }
+        }
+        appendStringInfoString(out, ascii ? "\"" : "\"/utf8");
+    } else {
+        for (i = 0; i < len; i++) {
+            if (i > 0) {
+                appendStringInfoChar(out, ',');
+            }
+            if (i == len - 1 && bits != 8) {
+                appendStringInfo(out, "%u:%d", (uint8) s[i] >> (8 - bits), bits);
+            } else {
+                appendStringInfo(out, "%u", (uint8) s[i]);
+            }
+        }
+    }
+    appendStringInfoString(out, ">>");
+}
+
+// Floats always carry a fraction so they read back as floats, not integers
+static void erlang_term_print_float(StringInfo out, double val) {
+    char digits[DOUBLE_SHORTEST_DECIMAL_LEN];
+    char *exponent;
+
+    double_to_shortest_decimal_buf(val, digits);
+    exponent = strchr(digits, 'e');
+    if (strchr(digits, '.') != NULL) {
+        appendStringInfoString(out, digits);
+    } else if (exponent != NULL) {
+        appendBinaryStringInfo(out, digits, exponent - digits);
+        appendStringInfoString(out, ".0");
+        appendStringInfoString(out, exponent);
+    } else {
+        appendStringInfoString(out, digits);
+        appendStringInfoString(out, ".0");
+    }
+}
+
+// Append the term at d->index in literal syntax
+static void erlang_term_print(EtfDecoder *d, StringInfo out) {
+    int start = d->index;
+    uint8 tag;
+    uint32 count;
+    uint32 i;
+
+    check_stack_depth();
+
+    if (erlang_term_print_string(d, out, true)) {
+        return;
+    }
+
+    tag = etf_u8(d);
+    switch (tag) {
+        case ERL_SMALL_INTEGER_EXT:
+            appendStringInfo(out, "%u", etf_u8(d));
+            return;
+
+        case ERL_INTEGER_EXT:
+            appendStringInfo(out, "%d", (int32) etf_u32(d));
+            return;
+
+        case ERL_SMALL_BIG_EXT:
+        case ERL_LARGE_BIG_EXT:
+            count = tag == ERL_SMALL_BIG_EXT ? etf_u8(d) : etf_u32(d);
+            appendStringInfoString(out, DatumGetCString(DirectFunctionCall1(numeric_out,
+                                                                            NumericGetDatum(etf_big_to_numeric(d, count)))));
+            return;
+
+        case NEW_FLOAT_EXT:
+            {
+                uint64 bits;
+                double val;
+
+                etf_need(d, 8);
+                memcpy(&bits, d->buf + d->index, 8);
+                d->index += 8;
+                bits = pg_ntoh64(bits);
+                memcpy(&val, &bits, sizeof(val));
+                erlang_term_print_float(out, val);
+                return;
+            }
+
+        case ERL_FLOAT_EXT:
+            {
+                char digits[32];
+
+                etf_need(d, 31);
+                memcpy(digits, d->buf + d->index, 31);
+                digits[31] = '\0';
+                d->index += 31;
+                erlang_term_print_float(out, strtod(digits, NULL));
+                return;
+            }
+
+        case ERL_ATOM_EXT:
+        case ERL_ATOM_UTF8_EXT:
+        case ERL_SMALL_ATOM_EXT:
+        case ERL_SMALL_ATOM_UTF8_EXT:
+            count = tag == ERL_ATOM_EXT || tag == ERL_ATOM_UTF8_EXT ? etf_u16(d) : etf_u8(d);
+            etf_need(d, count);
+            erlang_term_print_atom(out, d->buf + d->index, count,
+                                   tag == ERL_ATOM_EXT || tag == ERL_SMALL_ATOM_EXT);
+            d->index += count;
+            return;
+
+        case ERL_BINARY_EXT:
+            count = etf_u32(d);
+            etf_need(d, count);
+            erlang_term_print_binary(out, d->buf + d->index, count, 8);
+            d->index += count;
+            return;
+
+        case ERL_BIT_BINARY_EXT:
+            {
+                int bits;
+
+                count = etf_u32(d);
+                bits = etf_u8(d);
+                if (bits < 1 || bits > 8 || count == 0) {
+                    etf_truncated();
+                }
+                etf_need(d, count);
+                erlang_term_print_binary(out, d->buf + d->index, count, bits);
+                d->index += count;
+                return;
+            }
+
+        case ERL_NIL_EXT:
+            appendStringInfoString(out, "[]");
+            return;
+
+        case ERL_STRING_EXT:
+            // Not printable, so the bytes are written as integers
+            count = etf_u16(d);
+            etf_need(d, count);
+            appendStringInfoChar(out, '[');
+            for (i = 0; i < count; i++) {
+                if (i > 0) {
+                    appendStringInfoChar(out, ',');
+                }
+                appendStringInfo(out, "%u", (uint8) d->buf[d->index++]);
+            }
+            appendStringInfoChar(out, ']');
+            return;
+
+        case ERL_SMALL_TUPLE_EXT:
+        case ERL_LARGE_TUPLE_EXT:
+            count = tag == ERL_SMALL_TUPLE_EXT ? etf_u8(d) : etf_u32(d);
+            appendStringInfoChar(out, '{');
+            for (i = 0; i < count; i++) {
+                if (i > 0) {
+                    appendStringInfoChar(out, ',');
+                }
+                erlang_term_print(d, out);
+            }
+            appendStringInfoChar(out, '}');
+            return;
+
+        case ERL_LIST_EXT:
+            count = etf_u32(d);
+            appendStringInfoChar(out, '[');
+            for (i = 0; i < count; i++) {
+                if (i > 0) {
+                    appendStringInfoChar(out, ',');
+                }
+                erlang_term_print(d, out);
+            }
+            etf_need(d, 1);
+            if ((uint8) d->buf[d->index] == ERL_NIL_EXT) {
+                d->index++;
+            } else {
+                appendStringInfoChar(out, '|');
+                erlang_term_print(d, out);
+            }
+            appendStringInfoChar(out, ']');
+            return;
+
+        case ERL_MAP_EXT:
+            count = etf_u32(d);
+            appendStringInfoString(out, "#{");
+            for (i = 0; i < count; i++) {
+                if (i > 0) {
+                    appendStringInfoChar(out, ',');
+                }
+                erlang_term_print(d, out);
+                appendStringInfoString(out, " => ");
+                erlang_term_print(d, out);
+            }
+            appendStringInfoChar(out, '}');
+            return;
+
+        default:
+            {
+                EtfDecoder check = *d;
+                char *s = NULL;
+
+                // ei reads lengths unchecked, so only hand it a term that has been walked within bounds
+                check.index = start;
+                etf_skip(&check);
+                d->index = start;
+                if (ei_s_print_term(&s, d->buf, &d->index) < 0 || d->index != check.index) {
+                    free(s);
+                    etf_truncated();
+                }
+                appendStringInfoString(out, s);
+                free(s);
+                return;
+            }
+    }
+}
+
+/*
+ * Text input
+ * A recursive descent parser for Erlang literals: integers (with Base#Digits
+ * and $c forms), floats, atoms, strings, binaries, tuples, lists and maps.
+ * The term is written straight into the result varlena.
+ */
+
+typedef struct {
+    const char *input;          // Whole input, for error messages
+    const char *p;              // Current position
+    StringInfoData out;         // varlena header, version byte, then the term
+} ErlangTermParser;
+
+static void erlang_term_parse(ErlangTermParser *ps);
+
+static void erlang_term_syntax_error(ErlangTermParser *ps, const char *detail) {
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_TEXT_REPRESENTATION),
+             errmsg("invalid input syntax for type %s: \"%s\"", "erlang_term", ps->input),
+             errdetail("%s at offset %d.", detail, (int) (ps->p - ps->input))));
+}
+
+static void erlang_term_skip_space(ErlangTermParser *ps) {
+    for (;;) {
+        while (isspace((uint8) *ps->p)) {
+            ps->p++;
+        }
+        if (*ps->p != '%') {
+            return;
+        }
+        // Comments run to the end of the line
+        while (*ps->p != '\0' && *ps->p != '\n') {
+            ps->p++;
+        }
+    }
+}
+
+// Consume token (after optional white space) if it comes next
+static bool erlang_term_accept(ErlangTermParser *ps, const char *token) {
+    size_t len = strlen(token);
+
+    erlang_term_skip_space(ps);
+    if (strncmp(ps->p, token, len) != 0) {
+        return false;
+    }
+    ps->p += len;
+    return true;
+}
+
+static void erlang_term_expect(ErlangTermParser *ps, const char *token) {
+    if (!erlang_term_accept(ps, token)) {
+        erlang_term_syntax_error(ps, psprintf("expected \"%s\"", token));
+    }
+}
+
+static void erlang_term_put_u8(ErlangTermParser *ps, uint8 v) {
+    appendStringInfoChar(&ps->out, (char) v);
+}
+
+static void erlang_term_put_u32(ErlangTermParser *ps, uint32 v) {
+    v = pg_hton32(v);
+    appendBinaryStringInfo(&ps->out, (char *) &v, 4);
+}
+
+// Overwrite a count reserved earlier with erlang_term_put_u32
+static void erlang_term_patch_u32(ErlangTermParser *ps, int at, uint32 v) {
+    v = pg_hton32(v);
+    memcpy(ps->out.data + at, &v, 4);
+}
+
+// Encode an integer from its little-endian base-256 magnitude, as compactly as term_to_binary/1 does
+static void erlang_term_put_integer(ErlangTermParser *ps, const uint8 *mag, int n, bool neg) {
+    uint64 v = 0;
+    int i;
+
+    while (n > 0 && mag[n - 1] == 0) {
+        n--;
+    }
+    if (n <= 4) {
+        for (i = 0; i < n; i++) {
+            v |= (uint64) mag[i] << (8 * i);
+        }
+        if (!neg && v <= 255) {
+            erlang_term_put_u8(ps, ERL_SMALL_INTEGER_EXT);
+            erlang_term_put_u8(ps, (uint8) v);
+            return;
+        }
+        if ((!neg && v <= (uint64) PG_INT32_MAX) || (neg && v <= (uint64) PG_INT32_MAX + 1)) {
+            erlang_term_put_u8(ps, ERL_INTEGER_EXT);
+            erlang_term_put_u32(ps, neg ? (uint32) (0 - v) : (uint32) v);
+            return;
+        }
+    }
+    if (n <= 255) {
+        erlang_term_put_u8(ps, ERL_SMALL_BIG_EXT);
+        erlang_term_put_u8(ps, (uint8) n);
+    } else {
+        erlang_term_put_u8(ps, ERL_LARGE_BIG_EXT);
+        erlang_term_put_u32(ps, (uint32) n);
+    }
+    erlang_term_put_u8(ps, neg ? 1 : 0);
+    appendBinaryStringInfo(&ps->out, (const char *) mag, n);
+}
+
+// Value of c as a digit in any base up to 36, or 36 if it is not one
+static int erlang_term_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'z') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'Z') {
+        return c - 'A' + 10;
+    }
+    return 36;
+}
+
+// Read digits in base into a little-endian base-256 magnitude; returns its length
+static int erlang_term_parse_digits(ErlangTermParser *ps, int base, uint8 **mag) {
+    int cap = 8;
+    int n = 0;
+    int digits = 0;
+
+    *mag = palloc0(cap);
+    for (;;) {
+        int digit = erlang_term_digit(*ps->p);
+        uint32 carry;
+        int i;
+
+        // Underscores may separate digits, as in 1_000_000
+        if (*ps->p == '_' && digits > 0 && erlang_term_digit(ps->p[1]) < base) {
+            ps->p++;
+            continue;
+        }
+        if (digit >= base) {
+            break;
+        }
+        ps->p++;
+        digits++;
+
+        carry = digit;
+        for (i = 0; i < n; i++) {
+            carry += (uint32) (*mag)[i] * base;
+            (*mag)[i] = (uint8) carry;
+            carry >>= 8;
+        }
+        while (carry > 0) {
+            if (n == cap) {
+                *mag = repalloc(*mag, cap * 2);
+                cap *= 2;
+            }
+            (*mag)[n++] = (uint8) carry;
+            carry >>= 8;
+        }
+    }
+    if (digits == 0) {
+        erlang_term_syntax_error(ps, "expected digits");
+    }
+    return n;
+}
+
+// Integers and floats, with an optional sign
+static void erlang_term_parse_number(ErlangTermParser *ps) {
+    const char *start = ps->p;
+    bool neg = false;
+    uint8 *mag;
+    int n;
+
+    if (*ps->p == '-' || *ps->p == '+') {
+        neg = *ps->p == '-';
+        ps->p++;
+    }
+
+    n = erlang_term_parse_digits(ps, 10, &mag);
+
+    if (*ps->p == '#') {
+        uint32 base = n == 1 ? mag[0] : 0;
+
+        if (base < 2 || base > 36) {
+            erlang_term_syntax_error(ps, "the base must be between 2 and 36");
+        }
+        ps->p++;
+        n = erlang_term_parse_digits(ps, base, &mag);
+    } else if (*ps->p == '.' && isdigit((uint8) ps->p[1])) {
+        char *copy;
+        char *end;
+        char *w;
+        double val;
+        uint64 bits;
+
+        // A float; strtod reads the same syntax once underscores are removed
+        ps->p++;
+        while (isdigit((uint8) *ps->p) || (*ps->p == '_' && isdigit((uint8) ps->p[1]))) {
+            ps->p++;
+        }
+        if ((*ps->p == 'e' || *ps->p == 'E') &&
+            (isdigit((uint8) ps->p[1]) || ((ps->p[1] == '-' || ps->p[1] == '+') && isdigit((uint8) ps->p[2])))) {
+            ps->p += 2;
+            while (isdigit((uint8) *ps->p)) {
+                ps->p++;
+            }
+        }
+        copy = pnstrdup(start, ps->p - start);
+        for (w = end = copy; *end != '\0'; end++) {
+            if (*end != '_') {
+                *w++ = *end;
+            }
+        }
+        *w = '\0';
+        errno = 0;
+        val = strtod(copy, &end);
+        if (errno != 0 || *end != '\0' || isinf(val)) {
+            erlang_term_syntax_error(ps, "float out of range");
+        }
+        pfree(copy);
+        memcpy(&bits, &val, sizeof(bits));
+        bits = pg_hton64(bits);
+        erlang_term_put_u8(ps, NEW_FLOAT_EXT);
+        appendBinaryStringInfo(&ps->out, (char *) &bits, 8);
+        return;
+    }
+
+    erlang_term_put_integer(ps, mag, n, neg);
+}
+
+// One character of a string, quoted atom or $c literal, with Erlang's escapes
+static uint32 erlang_term_parse_char(ErlangTermParser *ps) {
+    const unsigned char *p = (const unsigned char *) ps->p;
+    uint32 c;
+    int l;
+
+    if (*p == '\0') {
+        erlang_term_syntax_error(ps, "unterminated literal");
+    }
+    if (*p != '\\') {
+        l = pg_utf_mblen(p);
+        if (l > 1 && (strnlen((const char *) p, l) < (size_t) l || !pg_utf8_islegal(p, l))) {
+            erlang_term_syntax_error(ps, "invalid UTF-8");
+        }
+        ps->p += l;
+        return l > 1 ? utf8_to_unicode(p) : *p;
+    }
+
+    ps->p += 2;
+    switch (p[1]) {
+        case 'b': return '\b';
+        case 'd': return 127;
+        case 'e': return 27;
+        case 'f': return '\f';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 's': return ' ';
+        case 't': return '\t';
+        case 'v': return '\v';
+        case '^':
+            if (ps->p[0] == '\0') {
+                erlang_term_syntax_error(ps, "unterminated literal");
+            }
+            return *ps->p++ & 31;
+        case 'x':
+            c = 0;
+            if (*ps->p == '{') {
+                ps->p++;
+                while (erlang_term_digit(*ps->p) < 16 && c <= 0x10FFFF) {
+                    c = c * 16 + erlang_term_digit(*ps->p++);
+                }
+                if (*ps->p != '}' || c > 0x10FFFF) {
+                    erlang_term_syntax_error(ps, "invalid \\x{...} escape");
+                }
+                ps->p++;
+            } else {
+                for (l = 0; l < 2; l++) {
+                    if (erlang_term_digit(*ps->p) >= 16) {
+                        erlang_term_syntax_error(ps, "invalid \\x escape");
+                    }
+                    c = c * 16 + erlang_term_digit(*ps->p++);
+                }
+            }
+            return c;
+        case '\0':
+            erlang_term_syntax_error(ps, "unterminated literal");
+            return 0;
+        default:
+            if (p[1] >= '0' && p[1] <= '7') {
+                // Up to three octal digits
+                c = p[1] - '0';
+                for (l = 0; l < 2 && *ps->p >= '0' && *ps->p <= '7'; l++) {
+                    c = c * 8 + (*ps->p++ - '0');
+                }
+                return c;
+            }
+            // Any other escaped character stands for itself
+            if (p[1] < 128) {
+                return p[1];
+            }
+            ps->p--;
+            return erlang_term_parse_char(ps);
+    }
+}
+
+// The characters of a quoted literal, up to the closing quote
+static uint32 *erlang_term_parse_quoted(ErlangTermParser *ps, char quote, int *count) {
+    int cap = 16;
+    uint32 *chars = palloc(sizeof(uint32) * cap);
+
+    *count = 0;
+    ps->p++;
+    while (*ps->p != quote) {
+        if (*count == cap) {
+            cap *= 2;
+            chars = repalloc(chars, sizeof(uint32) * cap);
+        }
+        chars[(*count)++] = erlang_term_parse_char(ps);
+    }
+    ps->p++;
+    return chars;
+}
+
+// Encode an atom given as UTF-8
+static void erlang_term_put_atom(ErlangTermParser *ps, const char *name, int len) {
+    if (len <= 255) {
+        erlang_term_put_u8(ps, ERL_SMALL_ATOM_UTF8_EXT);
+        erlang_term_put_u8(ps, (uint8) len);
+    } else {
+        uint16 len16 = pg_hton16((uint16) len);
+
+        erlang_term_put_u8(ps, ERL_ATOM_UTF8_EXT);
+        appendBinaryStringInfo(&ps->out, (char *) &len16, 2);
+    }
+    appendBinaryStringInfo(&ps->out, name, len);
+}
+
+static void erlang_term_parse_atom(ErlangTermParser *ps) {
+    StringInfoData name;
+    uint32 *chars;
+    int count;
+    int i;
+
+    if (*ps->p != '\'') {
+        const char *start = ps->p;
+
+        while (erlang_term_atom_char(*ps->p)) {
+            ps->p++;
+        }
+        if (ps->p - start > ERLANG_TERM_MAX_ATOM) {
+            erlang_term_syntax_error(ps, "atom is longer than 255 characters");
+        }
+        erlang_term_put_atom(ps, start, ps->p - start);
+        return;
+    }
+
+    chars = erlang_term_parse_quoted(ps, '\'', &count);
+    if (count > ERLANG_TERM_MAX_ATOM) {
+        erlang_term_syntax_error(ps, "atom is longer than 255 characters");
+    }
+    initStringInfo(&name);
+    for (i = 0; i < count; i++) {
+        unsigned char utf8[8];
+
+        unicode_to_utf8(chars[i], utf8);
+        appendBinaryStringInfo(&name, (char *) utf8, pg_utf_mblen(utf8));
+    }
+    erlang_term_put_atom(ps, name.data, name.len);
+}
+
+// A string is a list of characters; packed one byte each when they all fit, as term_to_binary/1 does
+static void erlang_term_parse_string(ErlangTermParser *ps) {
+    int count;
+    uint32 *chars = erlang_term_parse_quoted(ps, '"', &count);
+    bool packed = count <= PG_UINT16_MAX;
+    int i;
+
+    if (count == 0) {
+        erlang_term_put_u8(ps, ERL_NIL_EXT);
+        return;
+    }
+    for (i = 0; packed && i < count; i++) {
+        packed = chars[i] <= 255;
+    }
+    if (packed) {
+        uint16 len16 = pg_hton16((uint16) count);
+
+        erlang_term_put_u8(ps, ERL_STRING_EXT);
+        appendBinaryStringInfo(&ps->out, (char *) &len16, 2);
+        for (i = 0; i < count; i++) {
+            erlang_term_put_u8(ps, (uint8) chars[i]);
+        }
+        return;
+    }
+    erlang_term_put_u8(ps, ERL_LIST_EXT);
+    erlang_term_put_u32(ps, (uint32) count);
+    for (i = 0; i < count; i++) {
+        uint8 mag[4];
+
+        mag[0] = (uint8) chars[i];
+        mag[1] = (uint8) (chars[i] >> 8);
+        mag[2] = (uint8) (chars[i] >> 16);
+        mag[3] = 0;
+        erlang_term_put_integer(ps, mag, 4, false);
+    }
+    erlang_term_put_u8(ps, ERL_NIL_EXT);
+}
+
+// Value of a byte-sized binary segment: an integer or a $c character
+static uint32 erlang_term_parse_segment_value(ErlangTermParser *ps) {
+    uint32 v = 0;
+
+    if (*ps->p == '$') {
+        ps->p++;
+        return erlang_term_parse_char(ps);
+    }
+    if (!isdigit((uint8) *ps->p)) {
+        erlang_term_syntax_error(ps, "expected a byte value or a string");
+    }
+    while (isdigit((uint8) *ps->p) && v <= 255) {
+        v = v * 10 + (*ps->p++ - '0');
+    }
+    return v;
+}
+
+// <<"text", "text"/utf8, 1, 2, $c, ..., V:Bits>>; only the last segment may be shorter than a byte
+static void erlang_term_parse_binary(ErlangTermParser *ps) {
+    int header = ps->out.len;
+    int bits = 8;
+
+    erlang_term_put_u8(ps, ERL_BINARY_EXT);
+    erlang_term_put_u32(ps, 0);
+
+    if (!erlang_term_accept(ps, ">>")) {
+        do {
+            if (bits != 8) {
+                erlang_term_syntax_error(ps, "only the last segment of a binary may have a bit size");
+            }
+            erlang_term_skip_space(ps);
+            if (*ps->p == '"') {
+                int count;
+                uint32 *chars = erlang_term_parse_quoted(ps, '"', &count);
+                bool utf8 = erlang_term_accept(ps, "/utf8");
+                int i;
+
+                for (i = 0; i < count; i++) {
+                    if (utf8) {
+                        unsigned char bytes[8];
+
+                        unicode_to_utf8(chars[i], bytes);
+                        appendBinaryStringInfo(&ps->out, (char *) bytes, pg_utf_mblen(bytes));
+                    } else if (chars[i] > 255) {
+                        erlang_term_syntax_error(ps, "characters above 255 need /utf8");
+                    } else {
+                        erlang_term_put_u8(ps, (uint8) chars[i]);
+                    }
+                }
+            } else {
+                uint32 v = erlang_term_parse_segment_value(ps);
+
+                if (*ps->p == ':') {
+                    ps->p++;
+                    if (*ps->p < '1' || *ps->p > '8' || isdigit((uint8) ps->p[1])) {
+                        erlang_term_syntax_error(ps, "segment sizes must be between 1 and 8 bits");
+                    }
+                    bits = *ps->p++ - '0';
+                }
+                if (v >= (1U << bits)) {
+                    erlang_term_syntax_error(ps, "segment value does not fit its size");
+                }
+                erlang_term_put_u8(ps, (uint8) (v << (8 - bits)));
+            }
+        } while (erlang_term_accept(ps, ","));
+        erlang_term_expect(ps, ">>");
+    }
+
+    erlang_term_patch_u32(ps, header + 1, ps->out.len - header - 5);
+    if (bits != 8) {
+        // BIT_BINARY_EXT carries the bit count of the last byte after the length
+        char last_bits = (char) bits;
+
+        ps->out.data[header] = (char) ERL_BIT_BINARY_EXT;
+        appendStringInfoChar(&ps->out, '\0');
+        memmove(ps->out.data + header + 6, ps->out.data + header + 5, ps->out.len - header - 6);
+        ps->out.data[header + 5] = last_bits;
+    }
+}
+
+// {Elem, ...}: written as LARGE_TUPLE_EXT, then shrunk to SMALL_TUPLE_EXT if it fits
+static void erlang_term_parse_tuple(ErlangTermParser *ps) {
+    int header = ps->out.len;
+    uint32 count = 0;
+
+    erlang_term_put_u8(ps, ERL_LARGE_TUPLE_EXT);
+    erlang_term_put_u32(ps, 0);
+    if (!erlang_term_accept(ps, "}")) {
+        do {
+            erlang_term_parse(ps);
+            count++;
+        } while (erlang_term_accept(ps, ","));
+        erlang_term_expect(ps, "}");
+    }
+
+    if (count <= 255) {
+        ps->out.data[header] = (char) ERL_SMALL_TUPLE_EXT;
+        ps->out.data[header + 1] = (char) count;
+        memmove(ps->out.data + header + 2, ps->out.data + header + 5, ps->out.len - header - 5);
+        ps->out.len -= 3;
+        ps->out.data[ps->out.len] = '\0';
+    } else {
+        erlang_term_patch_u32(ps, header + 1, count);
+    }
+}
+
+// [Elem, ... | Tail]; a proper list of bytes is packed into STRING_EXT as term_to_binary/1 does
+static void erlang_term_parse_list(ErlangTermParser *ps) {
+    int header = ps->out.len;
+    uint32 count = 0;
+    bool proper;
+    int i;
+
+    if (erlang_term_accept(ps, "]")) {
+        erlang_term_put_u8(ps, ERL_NIL_EXT);
+        return;
+    }
+
+    erlang_term_put_u8(ps, ERL_LIST_EXT);
+    erlang_term_put_u32(ps, 0);
+    do {
+        erlang_term_parse(ps);
+        count++;
+    } while (erlang_term_accept(ps, ","));
+    proper = !erlang_term_accept(ps, "|");
+    if (proper) {
+        erlang_term_put_u8(ps, ERL_NIL_EXT);
+    } else {
+        erlang_term_parse(ps);
+    }
+    erlang_term_expect(ps, "]");
+    erlang_term_patch_u32(ps, header + 1, count);
+
+    if (!proper || count > PG_UINT16_MAX || ps->out.len - header - 6 != (int) count * 2) {
+        return;
+    }
+    for (i = 0; i < (int) count; i++) {
+        if ((uint8) ps->out.data[header + 5 + 2 * i] != ERL_SMALL_INTEGER_EXT) {
+            return;
+        }
+    }
+    ps->out.data[header] = (char) ERL_STRING_EXT;
+    ps->out.data[header + 1] = (char) (count >> 8);
+    ps->out.data[header + 2] = (char) count;
+    for (i = 0; i < (int) count; i++) {
+        ps->out.data[header + 3 + i] = ps->out.data[header + 6 + 2 * i];
+    }
+    ps->out.len = header + 3 + count;
+    ps->out.data[ps->out.len] = '\0';
+}
+
+// #{Key => Value, ...}
+static void erlang_term_parse_map(ErlangTermParser *ps) {
+    int header = ps->out.len;
+    uint32 count = 0;
+
+    erlang_term_put_u8(ps, ERL_MAP_EXT);
+    erlang_term_put_u32(ps, 0);
+    if (!erlang_term_accept(ps, "}")) {
+        do {
+            erlang_term_parse(ps);
+            erlang_term_expect(ps, "=>");
+            erlang_term_parse(ps);
+            count++;
+        } while (erlang_term_accept(ps, ","));
+        erlang_term_expect(ps, "}");
+    }
+    erlang_term_patch_u32(ps, header + 1, count);
+}
+
+// Parse one term at ps->p and append its encoding
+static void erlang_term_parse(ErlangTermParser *ps) {
+    char c;
+
+    check_stack_depth();
+
+    erlang_term_skip_space(ps);
+    c = *ps->p;
+    if (c == '{') {
+        ps->p++;
+        erlang_term_parse_tuple(ps);
+    } else if (c == '[') {
+        ps->p++;
+        erlang_term_parse_list(ps);
+    } else if (c == '#' && ps->p[1] == '{') {
+        ps->p += 2;
+        erlang_term_parse_map(ps);
+    } else if (c == '<' && ps->p[1] == '<') {
+        ps->p += 2;
+        erlang_term_parse_binary(ps);
+    } else if (c == '"') {
+        erlang_term_parse_string(ps);
+    } else if (c == '\'' || (c >= 'a' && c <= 'z')) {
+        erlang_term_parse_atom(ps);
+    } else if (c == '$') {
+        uint32 v;
+        uint8 mag[4];
+
+        ps->p++;
+        v = erlang_term_parse_char(ps);
+        mag[0] = (uint8) v;
+        mag[1] = (uint8) (v >> 8);
+        mag[2] = (uint8) (v >> 16);
+        mag[3] = 0;
+        erlang_term_put_integer(ps, mag, 4, false);
+    } else if (isdigit((uint8) c) || ((c == '-' || c == '+') && isdigit((uint8) ps->p[1]))) {
+        erlang_term_parse_number(ps);
+    } else if (c == '\0') {
+        erlang_term_syntax_error(ps, "unexpected end of input");
+    } else if (c == '<' || c == '#') {
+        erlang_term_syntax_error(ps, "pids, ports, references and funs cannot be written as literals");
+    } else {
+        erlang_term_syntax_error(ps, "unexpected character");
+    }
+}
+
+PG_FUNCTION_INFO_V1(erlang_term_in);
+Datum erlang_term_in(PG_FUNCTION_ARGS) {
+    char *str = PG_GETARG_CSTRING(0);
+    ErlangTermParser ps;
+
+    ps.input = str;
+    ps.p = str;
+    initStringInfo(&ps.out);
+    appendStringInfoSpaces(&ps.out, VARHDRSZ);
+    erlang_term_put_u8(&ps, ETF_VERSION_MAGIC);
+
+    erlang_term_parse(&ps);
+    erlang_term_skip_space(&ps);
+    if (*ps.p != '\0') {
+        erlang_term_syntax_error(&ps, "unexpected text after the term");
+    }
+
+    SET_VARSIZE(ps.out.data, ps.out.len);
+    PG_RETURN_ERLANG_TERM_P((bytea *) ps.out.data);
+}
+
+PG_FUNCTION_INFO_V1(erlang_term_out);
+Datum erlang_term_out(PG_FUNCTION_ARGS) {
+    bytea *term = PG_GETARG_ERLANG_TERM_PP(0);
+    EtfDecoder d;
+    StringInfoData out;
+
+    erlang_term_decoder(&d, term);
+    initStringInfo(&out);
+    erlang_term_print(&d, &out);
+    PG_RETURN_CSTRING(out.data);
+}
+
+// Binary I/O is the external term format itself, with its version byte
+PG_FUNCTION_INFO_V1(erlang_term_recv);
+Datum erlang_term_recv(PG_FUNCTION_ARGS) {
+    StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+    bytea *result = erlang_term_from_buf(buf->data + buf->cursor, buf->len - buf->cursor);
+
+    buf->cursor = buf->len;
+    PG_RETURN_ERLANG_TERM_P(result);
+}
+
+PG_FUNCTION_INFO_V1(erlang_term_send);
+Datum erlang_term_send(PG_FUNCTION_ARGS) {
+    PG_RETURN_BYTEA_P(PG_GETARG_BYTEA_P_COPY(0));
+}
+
+// bytea (term_to_binary/1 output, compressed or not) to erlang_term
+PG_FUNCTION_INFO_V1(erlang_term_from_etf);
+Datum erlang_term_from_etf(PG_FUNCTION_ARGS) {
+    bytea *etf = PG_GETARG_BYTEA_PP(0);
+
+    PG_RETURN_ERLANG_TERM_P(erlang_term_from_buf(VARDATA_ANY(etf), VARSIZE_ANY_EXHDR(etf)));
+}
+
+// erlang_term to jsonb, with the same mapping as RPC results
+PG_FUNCTION_INFO_V1(erlang_term_jsonb);
+Datum erlang_term_jsonb(PG_FUNCTION_ARGS) {
+    bytea *term = PG_GETARG_ERLANG_TERM_PP(0);
+
+    PG_RETURN_JSONB_P(etf_decode_jsonb(VARDATA_ANY(term), VARSIZE_ANY_EXHDR(term), 1));
+}
+
+// jsonb to erlang_term, with the same mapping as RPC arguments
+PG_FUNCTION_INFO_V1(erlang_term_from_jsonb);
+Datum erlang_term_from_jsonb(PG_FUNCTION_ARGS) {
+    Jsonb *json = PG_GETARG_JSONB_P(0);
+    ei_x_buff buf;
+    bytea *result;
+
+    ei_x_new_with_version(&buf);
+    if (jsonb_to_erlang_term(&buf, json) < 0) {
+        ei_x_free(&buf);
+        ereport(ERROR, (errmsg("Failed to encode JSONB as an Erlang term")));
+    }
+    result = erlang_term_make(buf.buff + 1, buf.index - 1);
+    ei_x_free(&buf);
+    PG_RETURN_ERLANG_TERM_P(result);
+}
+
+/*
+ * Accessors
+ * Each walks to the requested subterm, skipping the ones before it, and
+ * copies out just that subterm. A missing element or key gives NULL.
+ */
+
+// Whether the map key at d->index is the integer n; steps over the key
+static bool erlang_term_key_is_integer(EtfDecoder *d, int64 n) {
+    int start = d->index;
+    uint8 tag = etf_u8(d);
+
+    if (tag == ERL_SMALL_INTEGER_EXT) {
+        return etf_u8(d) == n;
+    } else if (tag == ERL_INTEGER_EXT) {
+        return (int32) etf_u32(d) == n;
+    }
+    d->index = start;
+    etf_skip(d);
+    return false;
+}
+
+// Whether the map key at d->index is an atom, binary or string spelled name; steps over the key
+static bool erlang_term_key_is_name(EtfDecoder *d, const char *name, int len) {
+    int start = d->index;
+    uint8 tag = etf_u8(d);
+    int64 key_len;
+
+    switch (tag) {
+        case ERL_ATOM_EXT:
+        case ERL_ATOM_UTF8_EXT:
+        case ERL_STRING_EXT:
+            key_len = etf_u16(d);
+            break;
+        case ERL_SMALL_ATOM_EXT:
+        case ERL_SMALL_ATOM_UTF8_EXT:
+            key_len = etf_u8(d);
+            break;
+        case ERL_BINARY_EXT:
+            key_len = etf_u32(d);
+            break;
+        case ERL_NIL_EXT:
+            return len == 0;
+        default:
+            d->index = start;
+            etf_skip(d);
+            return false;
+    }
+    etf_need(d, key_len);
+    d->index += key_len;
+    return key_len == len && memcmp(d->buf + d->index - key_len, name, len) == 0;
+}
+
+/*
+ * Element n (from 1, as element/2 and lists:nth/2 count) of a tuple or list,
+ * or the value under integer key n of a map. On success d->index is at the
+ * subterm; a byte of a packed string is copied out to *byte instead.
+ */
+static bool erlang_term_find_element(EtfDecoder *d, int64 n, char *byte) {
+    uint8 tag = etf_u8(d);
+    uint32 count;
+    uint32 i;
+
+    switch (tag) {
+        case ERL_SMALL_TUPLE_EXT:
+        case ERL_LARGE_TUPLE_EXT:
+        case ERL_LIST_EXT:
+            count = tag == ERL_SMALL_TUPLE_EXT ? etf_u8(d) : etf_u32(d);
+            if (n < 1 || n > count) {
+                return false;
+            }
+            for (i = 1; i < n; i++) {
+                etf_skip(d);
+            }
+            return true;
+
+        case ERL_STRING_EXT:
+            count = etf_u16(d);
+            if (n < 1 || n > count) {
+                return false;
+            }
+            etf_need(d, count);
+            byte[0] = (char) ERL_SMALL_INTEGER_EXT;
+            byte[1] = d->buf[d->index + n - 1];
+            d->buf = byte;
+            d->len = 2;
+            d->index = 0;
+            return true;
+
+        case ERL_MAP_EXT:
+            count = etf_u32(d);
+            for (i = 0; i < count; i++) {
+                if (erlang_term_key_is_integer(d, n)) {
+                    return true;
+                }
+                etf_skip(d);
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+// The value under an atom, binary or string key of a map
+static bool erlang_term_find_field(EtfDecoder *d, const char *name, int len) {
+    uint32 count;
+    uint32 i;
+
+    if (etf_u8(d) != ERL_MAP_EXT) {
+        return false;
+    }
+    count = etf_u32(d);
+    for (i = 0; i < count; i++) {
+        if (erlang_term_key_is_name(d, name, len)) {
+            return true;
+        }
+        etf_skip(d);
+    }
+    return false;
+}
+
+// Copy the subterm at d->index out as an erlang_term
+static bytea *erlang_term_subterm(EtfDecoder *d) {
+    int start = d->index;
+
+    etf_skip(d);
+    return erlang_term_make(d->buf + start, d->index - start);
+}
+
+/*
+ * The subterm at d->index as text: the characters of atoms, UTF-8 binaries
+ * and printable strings, and the literal syntax of anything else.
+ */
+static text *erlang_term_subterm_text(EtfDecoder *d) {
+    StringInfoData out;
+    uint8 tag;
+    uint32 len;
+
+    initStringInfo(&out);
+    if (erlang_term_print_string(d, &out, false)) {
+        return cstring_to_text_with_len(out.data, out.len);
+    }
+
+    etf_need(d, 1);
+    tag = (uint8) d->buf[d->index];
+    if (tag == ERL_BINARY_EXT) {
+        d->index++;
+        len = etf_u32(d);
+        etf_need(d, len);
+        if (pg_verifymbstr(d->buf + d->index, len, true)) {
+            return cstring_to_text_with_len(d->buf + d->index, len);
+        }
+        d->index -= 5;
+    } else if (tag == ERL_ATOM_EXT || tag == ERL_ATOM_UTF8_EXT ||
+               tag == ERL_SMALL_ATOM_EXT || tag == ERL_SMALL_ATOM_UTF8_EXT) {
+        d->index++;
+        len = tag == ERL_ATOM_EXT || tag == ERL_ATOM_UTF8_EXT ? etf_u16(d) : etf_u8(d);
+        etf_need(d, len);
+        erlang_term_atom_name(&out, d->buf + d->index, len, tag == ERL_ATOM_EXT || tag == ERL_SMALL_ATOM_EXT);
+        return cstring_to_text_with_len(out.data, out.len);
+    }
+
+    erlang_term_print(d, &out);
+    return cstring_to_text_with_len(out.data, out.len);
+}
+
+// erlang_term -> integer
+PG_FUNCTION_INFO_V1(erlang_term_element);
+Datum erlang_term_element(PG_FUNCTION_ARGS) {
+    bytea *term = PG_GETARG_ERLANG_TERM_PP(0);
+    char byte[2];
+    EtfDecoder d;
+
+    erlang_term_decoder(&d, term);
+    if (!erlang_term_find_element(&d, PG_GETARG_INT32(1), byte)) {
+        PG_RETURN_NULL();
+    }
+    PG_RETURN_ERLANG_TERM_P(erlang_term_subterm(&d));
+}
+
+// erlang_term ->> integer
+PG_FUNCTION_INFO_V1(erlang_term_element_text);
+Datum erlang_term_element_text(PG_FUNCTION_ARGS) {
+    bytea *term = PG_GETARG_ERLANG_TERM_PP(0);
+    char byte[2];
+    EtfDecoder d;
+
+    erlang_term_decoder(&d, term);
+    if (!erlang_term_find_element(&d, PG_GETARG_INT32(1), byte)) {
+        PG_RETURN_NULL();
+    }
+    PG_RETURN_TEXT_P(erlang_term_subterm_text(&d));
+}
+
+// erlang_term -> text
+PG_FUNCTION_INFO_V1(erlang_term_field);
+Datum erlang_term_field(PG_FUNCTION_ARGS) {
+    bytea *term = PG_GETARG_ERLANG_TERM_PP(0);
+    text *key = PG_GETARG_TEXT_PP(1);
+    EtfDecoder d;
+
+    erlang_term_decoder(&d, term);
+    if (!erlang_term_find_field(&d, VARDATA_ANY(key), VARSIZE_ANY_EXHDR(key))) {
+        PG_RETURN_NULL();
+    }
+    PG_RETURN_ERLANG_TERM_P(erlang_term_subterm(&d));
+}
+
+// erlang_term ->> text
+PG_FUNCTION_INFO_V1(erlang_term_field_text);
+Datum erlang_term_field_text(PG_FUNCTION_ARGS) {
+    bytea *term = PG_GETARG_ERLANG_TERM_PP(0);
+    text *key = PG_GETARG_TEXT_PP(1);
+    EtfDecoder d;
+
+    erlang_term_decoder(&d, term);
+    if (!erlang_term_find_field(&d, VARDATA_ANY(key), VARSIZE_ANY_EXHDR(key))) {
+        PG_RETURN_NULL();
+    }
+    PG_RETURN_TEXT_P(erlang_term_subterm_text(&d));
+}
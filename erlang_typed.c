@@ -0,0 +1,463 @@
+/*
+ * Typed call variants
+ * erlang_call_int8, _float8, _text and _bool, and the int8[], float8[] and
+ * bytea[] variants, convert the reply straight from the external term format
+ * into the Postgres type: no JsonbValue tree and no numeric detour. Arrays
+ * are written directly into the array's data area. A list of numbers is
+ * read element by element; a binary of packed 64-bit big-endian numbers
+ * (<< <<X:64>> || X <- L >>, the Erlang default byte order) is converted
+ * with one byte-swap loop.
+ */
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "catalog/pg_type.h"
+#include "port/pg_bswap.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/jsonb.h"
+#include "erlang_cnode.h"
+#include <ei.h>
+
+// Longest reply shown in a type mismatch error
+#define ERLANG_TYPED_MAX_DETAIL 1000
+
+typedef Datum (*ErlangTypedDecoder) (EtfDecoder *d);
+
+// Report a reply, or one element of it, that does not have the requested type
+static void erlang_typed_mismatch(EtfDecoder *d, int start, const char *expected) {
+    StringInfoData term;
+
+    d->index = start;
+    initStringInfo(&term);
+    erlang_term_print(d, &term);
+    if (term.len > ERLANG_TYPED_MAX_DETAIL) {
+        term.len = ERLANG_TYPED_MAX_DETAIL;
+        term.data[term.len] = '\0';
+        appendStringInfoString(&term, "...");
+    }
+    ereport(ERROR,
+            (errcode(ERRCODE_DATATYPE_MISMATCH),
+             errmsg("Erlang result is not %s", expected),
+             errdetail("Result: %s", term.data)));
+}
+
+// Read an integer that fits in int64; false (with d unchanged) for anything else
+static bool erlang_typed_int64(EtfDecoder *d, int64 *value) {
+    int start = d->index;
+    uint8 tag = etf_u8(d);
+    uint64 mag = 0;
+    uint32 n;
+    bool neg;
+    uint32 i;
+
+    switch (tag) {
+        case ERL_SMALL_INTEGER_EXT:
+            *value = etf_u8(d);
+            return true;
+        case ERL_INTEGER_EXT:
+            *value = (int32) etf_u32(d);
+            return true;
+        case ERL_SMALL_BIG_EXT:
+            n = etf_u8(d);
+            neg = etf_u8(d) != 0;
+            etf_need(d, n);
+            for (i = 0; i < n; i++) {
+                uint8 byte = (uint8) d->buf[d->index + i];
+
+                if (i >= 8 && byte != 0) {
+                    d->index = start;
+                    return false;
+                }
+                if (i < 8) {
+                    mag |= (uint64) byte << (8 * i);
+                }
+            }
+            if ((!neg && mag > (uint64) PG_INT64_MAX) || (neg && mag > (uint64) PG_INT64_MAX + 1)) {
+                d->index = start;
+                return false;
+            }
+            d->index += n;
+            *value = neg ? (int64) (0 - mag) : (int64) mag;
+            return true;
+        default:
+            d->index = start;
+            return false;
+    }
+}
+
+// Read a float, or an integer as a float; false (with d unchanged) for anything else
+static bool erlang_typed_float8(EtfDecoder *d, float8 *value) {
+    int64 integer;
+    uint64 bits;
+
+    etf_need(d, 1);
+    switch ((uint8) d->buf[d->index]) {
+        case NEW_FLOAT_EXT:
+            d->index++;
+            etf_need(d, 8);
+            memcpy(&bits, d->buf + d->index, 8);
+            d->index += 8;
+            bits = pg_ntoh64(bits);
+            memcpy(value, &bits, sizeof(bits));
+            return true;
+        case ERL_FLOAT_EXT:
+            {
+                char digits[32];
+
+                d->index++;
+                etf_need(d, 31);
+                memcpy(digits, d->buf + d->index, 31);
+                digits[31] = '\0';
+                d->index += 31;
+                *value = strtod(digits, NULL);
+                return true;
+            }
+        default:
+            if (erlang_typed_int64(d, &integer)) {
+                *value = (float8) integer;
+                return true;
+            }
+            return false;
+    }
+}
+
+/*
+ * Copy count packed 64-bit big-endian values to dst in host order. A plain
+ * loop over fixed-size loads and stores, which compilers turn into vector
+ * byte shuffles; on big-endian hosts it is a memcpy.
+ */
+static void erlang_typed_bswap64(char *dst, const char *src, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        uint64 v;
+
+        memcpy(&v, src + (size_t) i * 8, 8);
+        v = pg_ntoh64(v);
+        memcpy(dst + (size_t) i * 8, &v, 8);
+    }
+}
+
+// A one-dimensional array of count fixed-width elements, zeroed, to be filled in place
+static ArrayType *erlang_typed_array(Oid elemtype, int elemlen, int count) {
+    Size nbytes = ARR_OVERHEAD_NONULLS(1) + (Size) elemlen * count;
+    ArrayType *array;
+
+    if (!AllocSizeIsValid(nbytes)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("Erlang result has too many elements for an array")));
+    }
+    array = (ArrayType *) palloc0(nbytes);
+    SET_VARSIZE(array, nbytes);
+    array->ndim = 1;
+    array->dataoffset = 0;
+    array->elemtype = elemtype;
+    ARR_DIMS(array)[0] = count;
+    ARR_LBOUND(array)[0] = 1;
+    return array;
+}
+
+/*
+ * Fill a fixed-width numeric array from the list, packed string or packed
+ * binary at d->index. read converts one list element into dst.
+ */
+static ArrayType *erlang_typed_number_array(EtfDecoder *d, Oid elemtype, const char *expected,
+                                            bool (*read) (EtfDecoder *d, char *dst)) {
+    int start = d->index;
+    uint8 tag = etf_u8(d);
+    ArrayType *array;
+    char *data;
+    uint32 count;
+    uint32 i;
+
+    switch (tag) {
+        case ERL_NIL_EXT:
+            return construct_empty_array(elemtype);
+
+        case ERL_BINARY_EXT:
+            count = etf_u32(d);
+            etf_need(d, count);
+            if (count % 8 != 0) {
+                erlang_typed_mismatch(d, start, expected);
+            }
+            array = erlang_typed_array(elemtype, 8, count / 8);
+            erlang_typed_bswap64(ARR_DATA_PTR(array), d->buf + d->index, count / 8);
+            d->index += count;
+            return array;
+
+        case ERL_STRING_EXT:
+            {
+                // A list of integers 0..255, one byte each
+                EtfDecoder element;
+                char small[2];
+
+                count = etf_u16(d);
+                etf_need(d, count);
+                array = erlang_typed_array(elemtype, 8, count);
+                data = ARR_DATA_PTR(array);
+                small[0] = (char) ERL_SMALL_INTEGER_EXT;
+                element.buf = small;
+                element.len = 2;
+                element.state = NULL;
+                for (i = 0; i < count; i++) {
+                    small[1] = d->buf[d->index + i];
+                    element.index = 0;
+                    read(&element, data + (size_t) i * 8);
+                }
+                d->index += count;
+                return array;
+            }
+
+        case ERL_LIST_EXT:
+            count = etf_u32(d);
+            // Every element takes at least two bytes
+            etf_need(d, (int64) count * 2);
+            array = erlang_typed_array(elemtype, 8, count);
+            data = ARR_DATA_PTR(array);
+            for (i = 0; i < count; i++) {
+                int element = d->index;
+
+                if (!read(d, data + (size_t) i * 8)) {
+                    erlang_typed_mismatch(d, element, psprintf("%s (element %u)", expected, i + 1));
+                }
+            }
+            if (etf_u8(d) != ERL_NIL_EXT) {
+                erlang_typed_mismatch(d, start, expected);
+            }
+            return array;
+
+        default:
+            erlang_typed_mismatch(d, start, expected);
+            return NULL;
+    }
+}
+
+static bool erlang_typed_read_int8(EtfDecoder *d, char *dst) {
+    int64 value;
+
+    if (!erlang_typed_int64(d, &value)) {
+        return false;
+    }
+    memcpy(dst, &value, sizeof(value));
+    return true;
+}
+
+static bool erlang_typed_read_float8(EtfDecoder *d, char *dst) {
+    float8 value;
+
+    if (!erlang_typed_float8(d, &value)) {
+        return false;
+    }
+    memcpy(dst, &value, sizeof(value));
+    return true;
+}
+
+static Datum erlang_typed_decode_int8(EtfDecoder *d) {
+    int64 value;
+
+    if (!erlang_typed_int64(d, &value)) {
+        erlang_typed_mismatch(d, d->index, "an integer in the bigint range");
+    }
+    return Int64GetDatum(value);
+}
+
+static Datum erlang_typed_decode_float8(EtfDecoder *d) {
+    float8 value;
+
+    if (!erlang_typed_float8(d, &value)) {
+        erlang_typed_mismatch(d, d->index, "a number");
+    }
+    return Float8GetDatum(value);
+}
+
+// Atoms, UTF-8 binaries and strings give their characters, anything else its literal syntax (as ->>)
+static Datum erlang_typed_decode_text(EtfDecoder *d) {
+    return PointerGetDatum(erlang_term_subterm_text(d));
+}
+
+static Datum erlang_typed_decode_bool(EtfDecoder *d) {
+    int start = d->index;
+    uint8 tag = etf_u8(d);
+    uint32 len;
+
+    if (tag == ERL_SMALL_ATOM_EXT || tag == ERL_SMALL_ATOM_UTF8_EXT ||
+        tag == ERL_ATOM_EXT || tag == ERL_ATOM_UTF8_EXT) {
+        len = tag == ERL_ATOM_EXT || tag == ERL_ATOM_UTF8_EXT ? etf_u16(d) : etf_u8(d);
+        etf_need(d, len);
+        if (len == 4 && memcmp(d->buf + d->index, "true", 4) == 0) {
+            return BoolGetDatum(true);
+        }
+        if (len == 5 && memcmp(d->buf + d->index, "false", 5) == 0) {
+            return BoolGetDatum(false);
+        }
+    }
+    erlang_typed_mismatch(d, start, "true or false");
+    return (Datum) 0;
+}
+
+static Datum erlang_typed_decode_int8_array(EtfDecoder *d) {
+    return PointerGetDatum(erlang_typed_number_array(d, INT8OID, "a list of integers in the bigint range",
+                                                     erlang_typed_read_int8));
+}
+
+static Datum erlang_typed_decode_float8_array(EtfDecoder *d) {
+    return PointerGetDatum(erlang_typed_number_array(d, FLOAT8OID, "a list of numbers",
+                                                     erlang_typed_read_float8));
+}
+
+// Length of a binary element of a bytea[] result (strings and [] are taken as bytes too), or -1
+static int64 erlang_typed_bytes(EtfDecoder *d, const char **bytes) {
+    uint8 tag = etf_u8(d);
+    int64 len;
+
+    if (tag == ERL_NIL_EXT) {
+        *bytes = NULL;
+        return 0;
+    }
+    if (tag != ERL_BINARY_EXT && tag != ERL_STRING_EXT) {
+        return -1;
+    }
+    len = tag == ERL_BINARY_EXT ? etf_u32(d) : etf_u16(d);
+    etf_need(d, len);
+    *bytes = d->buf + d->index;
+    d->index += len;
+    return len;
+}
+
+// A list of binaries, sized in one pass and copied into the array in a second
+static Datum erlang_typed_decode_bytea_array(EtfDecoder *d) {
+    int start = d->index;
+    uint8 tag = etf_u8(d);
+    Size nbytes = ARR_OVERHEAD_NONULLS(1);
+    ArrayType *array;
+    const char *bytes;
+    char *data;
+    int first;
+    uint32 count;
+    uint32 i;
+
+    if (tag == ERL_NIL_EXT) {
+        return PointerGetDatum(construct_empty_array(BYTEAOID));
+    }
+    if (tag != ERL_LIST_EXT) {
+        erlang_typed_mismatch(d, start, "a list of binaries");
+    }
+    count = etf_u32(d);
+    first = d->index;
+    for (i = 0; i < count; i++) {
+        int element = d->index;
+        int64 len = erlang_typed_bytes(d, &bytes);
+
+        if (len < 0) {
+            erlang_typed_mismatch(d, element, psprintf("a list of binaries (element %u)", i + 1));
+        }
+        nbytes += INTALIGN(VARHDRSZ + len);
+        if (!AllocSizeIsValid(nbytes)) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                     errmsg("Erlang result is too large for a bytea array")));
+        }
+    }
+    if (etf_u8(d) != ERL_NIL_EXT) {
+        erlang_typed_mismatch(d, start, "a list of binaries");
+    }
+
+    array = (ArrayType *) palloc0(nbytes);
+    SET_VARSIZE(array, nbytes);
+    array->ndim = 1;
+    array->dataoffset = 0;
+    array->elemtype = BYTEAOID;
+    ARR_DIMS(array)[0] = count;
+    ARR_LBOUND(array)[0] = 1;
+
+    d->index = first;
+    data = ARR_DATA_PTR(array);
+    for (i = 0; i < count; i++) {
+        int64 len = erlang_typed_bytes(d, &bytes);
+
+        SET_VARSIZE(data, VARHDRSZ + len);
+        if (len > 0) {
+            memcpy(VARDATA(data), bytes, len);
+        }
+        data += INTALIGN(VARHDRSZ + len);
+    }
+    return PointerGetDatum(array);
+}
+
+/*
+ * Shared body of the typed variants: (node_name, module, function, args,
+ * timeout_ms) in, the reply converted by decode out. Calls go through the
+ * same connection, pool and retry path as erlang_call; the result cache,
+ * which holds JSONB, is not consulted.
+ */
+static Datum erlang_call_typed(FunctionCallInfo fcinfo, ErlangTypedDecoder decode) {
+    char *node_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    char *module = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    char *function = text_to_cstring(PG_GETARG_TEXT_PP(2));
+    Jsonb *args_json = PG_GETARG_JSONB_P(3);
+    int timeout_ms = erlang_effective_timeout(PG_GETARG_INT32(4));
+    ei_x_buff reply;
+    EtfDecoder d;
+    volatile Datum result = (Datum) 0;
+
+    erlang_call_reply(node_name, module, function, args_json, timeout_ms, &reply);
+
+    // The reply is malloc'd by ei; free it whether or not it converts
+    PG_TRY();
+    {
+        d.buf = reply.buff;
+        d.len = reply.index;
+        d.index = etf_reply_index(&reply);
+        d.state = NULL;
+        result = decode(&d);
+    }
+    PG_CATCH();
+    {
+        ei_x_free(&reply);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+    ei_x_free(&reply);
+
+    pfree(node_name);
+    pfree(module);
+    pfree(function);
+    return result;
+}
+
+PG_FUNCTION_INFO_V1(erlang_call_int8);
+Datum erlang_call_int8(PG_FUNCTION_ARGS) {
+    return erlang_call_typed(fcinfo, erlang_typed_decode_int8);
+}
+
+PG_FUNCTION_INFO_V1(erlang_call_float8);
+Datum erlang_call_float8(PG_FUNCTION_ARGS) {
+    return erlang_call_typed(fcinfo, erlang_typed_decode_float8);
+}
+
+PG_FUNCTION_INFO_V1(erlang_call_text);
+Datum erlang_call_text(PG_FUNCTION_ARGS) {
+    return erlang_call_typed(fcinfo, erlang_typed_decode_text);
+}
+
+PG_FUNCTION_INFO_V1(erlang_call_bool);
+Datum erlang_call_bool(PG_FUNCTION_ARGS) {
+    return erlang_call_typed(fcinfo, erlang_typed_decode_bool);
+}
+
+PG_FUNCTION_INFO_V1(erlang_call_int8_array);
+Datum erlang_call_int8_array(PG_FUNCTION_ARGS) {
+    return erlang_call_typed(fcinfo, erlang_typed_decode_int8_array);
+}
+
+PG_FUNCTION_INFO_V1(erlang_call_float8_array);
+Datum erlang_call_float8_array(PG_FUNCTION_ARGS) {
+    return erlang_call_typed(fcinfo, erlang_typed_decode_float8_array);
+}
+
+PG_FUNCTION_INFO_V1(erlang_call_bytea_array);
+Datum erlang_call_bytea_array(PG_FUNCTION_ARGS) {
+    return erlang_call_typed(fcinfo, erlang_typed_decode_bytea_array);
+}
@@ -24,6 +24,7 @@
             pkgs.erlang
             pkgs.gcc
             pkgs.clang
+            pkgs.zlib
           ];
           buildPhase = ''
             export ERL_INTERFACE_INCLUDE_DIR=${pkgs.erlang}/lib/erlang/usr/include
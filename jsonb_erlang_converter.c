@@ -8,463 +8,1119 @@
 #include "utils/json.h"
 #include "utils/numeric.h"
 #include "utils/builtins.h"
+#include "miscadmin.h"
+#include "mb/pg_wchar.h"
+#include "port/pg_bswap.h"
 #include "erlang_cnode.h"
 #include <ei.h>
 #include <math.h>
+#include <zlib.h>
 #ifndef MAXATOMLEN
 #define MAXATOMLEN 256
 #endif
 
-// Forward declarations
-static int encode_special_erlang_object(ei_x_buff *buf, JsonbValue *obj);
-static int encode_special_erlang_type(ei_x_buff *buf, const char *type_str);
-
-// Convert JSONB value to Erlang term
-static int jsonb_value_to_erlang_term(ei_x_buff *buf, JsonbValue *jbv) {
-    switch (jbv->type) {
-        case jbvNull:
-            return ei_x_encode_atom(buf, "null");
-            
-        case jbvString:
-            // Check for special Erlang type encoding
-            if (jbv->val.string.len > 7 && strncmp(jbv->val.string.val, "{\"$type\":", 9) == 0) {
-                // This is a special type object, parse it
-                return encode_special_erlang_type(buf, jbv->val.string.val);
-            }
-            return ei_x_encode_string(buf, jbv->val.string.val);
-            
-        case jbvNumeric:
-            // Convert numeric to double (Erlang can handle both int and float as numbers)
-            {
-                double val = DatumGetFloat8(DirectFunctionCall1(numeric_float8, NumericGetDatum(jbv->val.numeric)));
-                // Check if it's a whole number
-                if (val == floor(val) && val >= INT64_MIN && val <= INT64_MAX) {
-                    // It's an integer-like value, encode as long
-                    return ei_x_encode_longlong(buf, (int64)val);
-                } else {
-                    // It's a float
-                    return ei_x_encode_double(buf, val);
-                }
-            }
-            
-        case jbvBool:
-            return ei_x_encode_atom(buf, jbv->val.boolean ? "true" : "false");
-            
-        case jbvArray:
-            // Convert array to Erlang list
-            if (ei_x_encode_list_header(buf, jbv->val.array.nElems) < 0) {
-                return -1;
-            }
-            
-            // Iterate through array elements
-            JsonbIterator *it;
-            JsonbValue v;
-            int type;
-            
-            it = JsonbIteratorInit(&jbv->val.array.elems);
-            while ((type = JsonbIteratorNext(&it, &v, false)) != WJB_DONE) {
-                if (type == WJB_ELEM) {
-                    if (jsonb_value_to_erlang_term(buf, &v) < 0) {
-                        return -1;
-                    }
-                }
-            }
-            
-            return ei_x_encode_empty_list(buf);
-            
-        case jbvObject:
-            // Check if this is a special type object
-            JsonbValue *type_val = findJsonbValueFromContainer(&jbv->val.object, JB_FOBJECT, &(JsonbValue){.type = jbvString, .val.string.val = "$type", .val.string.len = 5});
-            if (type_val && type_val->type == jbvString) {
-                return encode_special_erlang_object(buf, jbv);
-            }
-            
-            // Convert regular object to Erlang map
-            if (ei_x_encode_map_header(buf, jbv->val.object.nPairs) < 0) {
-                return -1;
-            }
-            
-            // Iterate through object pairs
-            JsonbIterator *obj_it;
-            JsonbValue key, value;
-            int obj_type;
-            
-            obj_it = JsonbIteratorInit(&jbv->val.object.pairs);
-            while ((obj_type = JsonbIteratorNext(&obj_it, &key, false)) != WJB_DONE) {
-                if (obj_type == WJB_KEY) {
-                    // Encode key
-                    if (jsonb_value_to_erlang_term(buf, &key) < 0) {
-                        return -1;
-                    }
-                } else if (obj_type == WJB_VALUE) {
-                    // Encode value
-                    if (jsonb_value_to_erlang_term(buf, &value) < 0) {
-                        return -1;
-                    }
-                }
-            }
-            
-            return 0;
-            
-        case jbvBinary:
-            return ei_x_encode_binary(buf, jbv->val.binary.data, jbv->val.binary.len);
-            
-        default:
-            return -1;
+/*
+ * Single-pass ETF encoder.
+ * The jsonb container is read in its binary layout: element counts come from
+ * the container header and each child is located through its JEntry, so
+ * nothing is counted twice, no iterators are built, and "$type" objects are
+ * recognised while their keys are being encoded.
+ */
+
+static int etf_encode_container(ei_x_buff *buf, const JsonbContainer *jc);
+
+// Length of a child whose data starts offset bytes into the container data
+static inline uint32 etf_entry_length(JEntry entry, uint32 offset) {
+    return JBE_HAS_OFF(entry) ? JBE_OFFLENFLD(entry) - offset : JBE_OFFLENFLD(entry);
+}
+
+/*
+ * Numerics are read in their on-disk form (see utils/adt/numeric.c): a uint16
+ * header holding the sign and display scale, plus an int16 weight in the long
+ * form, followed by base-10000 digits, most significant first, with trailing
+ * zero digits stripped.
+ */
+#define ETF_NBASE 10000
+#define ETF_NUMERIC_SIGN_MASK 0xC000
+#define ETF_NUMERIC_NEG 0x4000
+#define ETF_NUMERIC_SHORT 0x8000
+#define ETF_NUMERIC_SPECIAL 0xC000
+#define ETF_NUMERIC_DSCALE_MASK 0x3FFF
+#define ETF_NUMERIC_SHORT_SIGN_MASK 0x2000
+#define ETF_NUMERIC_SHORT_DSCALE_MASK 0x1F80
+#define ETF_NUMERIC_SHORT_DSCALE_SHIFT 7
+#define ETF_NUMERIC_SHORT_WEIGHT_SIGN_MASK 0x0040
+#define ETF_NUMERIC_SHORT_WEIGHT_MASK 0x003F
+
+typedef struct {
+    bool neg;
+    int weight;              // power of NBASE of the first digit
+    int dscale;              // decimal digits shown after the point
+    int ndigits;
+    const char *digits;      // unaligned int16s
+} EtfNumericDigits;
+
+// Unpack a numeric; false for NaN and infinities
+static bool etf_numeric_digits(Numeric num, EtfNumericDigits *nd) {
+    const char *data = VARDATA_ANY(num);
+    int len = VARSIZE_ANY_EXHDR(num);
+    uint16 header;
+
+    memcpy(&header, data, sizeof(header));
+    if ((header & ETF_NUMERIC_SIGN_MASK) == ETF_NUMERIC_SPECIAL) {
+        return false;
     }
+    if ((header & ETF_NUMERIC_SIGN_MASK) == ETF_NUMERIC_SHORT) {
+        nd->neg = (header & ETF_NUMERIC_SHORT_SIGN_MASK) != 0;
+        nd->dscale = (header & ETF_NUMERIC_SHORT_DSCALE_MASK) >> ETF_NUMERIC_SHORT_DSCALE_SHIFT;
+        nd->weight = ((header & ETF_NUMERIC_SHORT_WEIGHT_SIGN_MASK) ? ~ETF_NUMERIC_SHORT_WEIGHT_MASK : 0) |
+                     (header & ETF_NUMERIC_SHORT_WEIGHT_MASK);
+        nd->digits = data + sizeof(uint16);
+    } else {
+        int16 weight;
+
+        memcpy(&weight, data + sizeof(uint16), sizeof(weight));
+        nd->neg = (header & ETF_NUMERIC_SIGN_MASK) == ETF_NUMERIC_NEG;
+        nd->dscale = header & ETF_NUMERIC_DSCALE_MASK;
+        nd->weight = weight;
+        nd->digits = data + 2 * sizeof(uint16);
+    }
+    nd->ndigits = (len - (nd->digits - data)) / sizeof(int16);
+    return true;
 }
 
-// Helper function to encode special Erlang types from JSON objects
-static int encode_special_erlang_object(ei_x_buff *buf, JsonbValue *obj) {
-    JsonbValue *type_val = findJsonbValueFromContainer(&obj->val.object, JB_FOBJECT, &(JsonbValue){.type = jbvString, .val.string.val = "$type", .val.string.len = 5});
-    
-    if (!type_val || type_val->type != jbvString) {
+static inline uint32 etf_numeric_digit(const EtfNumericDigits *nd, int i) {
+    int16 digit;
+
+    if (i >= nd->ndigits) {
+        return 0;
+    }
+    memcpy(&digit, nd->digits + i * sizeof(int16), sizeof(digit));
+    return (uint32) digit;
+}
+
+// Encode an integer too large for int64 as SMALL_BIG_EXT/LARGE_BIG_EXT
+static int etf_encode_big(ei_x_buff *buf, const EtfNumericDigits *nd) {
+    int places = nd->weight + 1;
+    uint8 *mag = palloc0(places * 2 + 1);  // NBASE < 2^14: under two bytes per place
+    char header[6];
+    int header_len;
+    int nbytes = 0;
+    int i;
+    int j;
+    int rc;
+
+    // mag = mag * NBASE + digit, little-endian base 256
+    for (i = 0; i < places; i++) {
+        uint32 carry = etf_numeric_digit(nd, i);
+
+        for (j = 0; j < nbytes; j++) {
+            uint32 v = (uint32) mag[j] * ETF_NBASE + carry;
+
+            mag[j] = (uint8) (v & 0xFF);
+            carry = v >> 8;
+        }
+        while (carry != 0) {
+            mag[nbytes++] = (uint8) (carry & 0xFF);
+            carry >>= 8;
+        }
+    }
+
+    if (nbytes <= 255) {
+        header[0] = ERL_SMALL_BIG_EXT;
+        header[1] = (char) nbytes;
+        header_len = 2;
+    } else {
+        uint32 n = pg_hton32(nbytes);
+
+        header[0] = ERL_LARGE_BIG_EXT;
+        memcpy(header + 1, &n, sizeof(n));
+        header_len = 5;
+    }
+    header[header_len++] = nd->neg ? 1 : 0;
+
+    rc = ei_x_append_buf(buf, header, header_len);
+    if (rc == 0) {
+        rc = ei_x_append_buf(buf, (const char *) mag, nbytes);
+    }
+    pfree(mag);
+    return rc;
+}
+
+/*
+ * Encode a jsonb number. Numbers written without a decimal point are encoded
+ * exactly, as an integer or a bignum, straight from the numeric digits; any
+ * number written with one (1.0 as well as 1.5) goes through float8, so it
+ * stays a float in Erlang.
+ */
+static int etf_encode_numeric(ei_x_buff *buf, Numeric num) {
+    EtfNumericDigits nd;
+    uint64 mag = 0;
+    int i;
+
+    if (!etf_numeric_digits(num, &nd)) {
         return -1;
     }
-    
-    if (strncmp(type_val->val.string.val, "atom", 4) == 0) {
-        // Encode as atom: {"$type": "atom", "value": "atom_name"}
-        JsonbValue *value_val = findJsonbValueFromContainer(&obj->val.object, JB_FOBJECT, &(JsonbValue){.type = jbvString, .val.string.val = "value", .val.string.len = 5});
-        if (value_val && value_val->type == jbvString) {
-            return ei_x_encode_atom(buf, value_val->val.string.val);
+    if (nd.dscale > 0 || nd.ndigits > nd.weight + 1) {
+        return ei_x_encode_double(buf, DatumGetFloat8(DirectFunctionCall1(numeric_float8, NumericGetDatum(num))));
+    }
+    if (nd.ndigits == 0) {
+        return ei_x_encode_long(buf, 0);
+    }
+
+    for (i = 0; i <= nd.weight; i++) {
+        uint32 digit = etf_numeric_digit(&nd, i);
+
+        if (mag > (PG_UINT64_MAX - digit) / ETF_NBASE) {
+            return etf_encode_big(buf, &nd);
+        }
+        mag = mag * ETF_NBASE + digit;
+    }
+    if (!nd.neg && mag <= (uint64) PG_INT64_MAX) {
+        return ei_x_encode_longlong(buf, (int64) mag);
+    }
+    if (nd.neg && mag <= (uint64) PG_INT64_MAX + 1) {
+        return ei_x_encode_longlong(buf, (int64) (0 - mag));
+    }
+    return etf_encode_big(buf, &nd);
+}
+
+// Encode one child given its JEntry and the location of its data
+static int etf_encode_entry(ei_x_buff *buf, JEntry entry, const char *base, uint32 offset, uint32 len) {
+    if (JBE_ISSTRING(entry)) {
+        return ei_x_encode_string_len(buf, base + offset, len);
+    } else if (JBE_ISNUMERIC(entry)) {
+        return etf_encode_numeric(buf, (Numeric) (base + INTALIGN(offset)));
+    } else if (JBE_ISBOOL_TRUE(entry)) {
+        return ei_x_encode_atom_len(buf, "true", 4);
+    } else if (JBE_ISBOOL_FALSE(entry)) {
+        return ei_x_encode_atom_len(buf, "false", 5);
+    } else if (JBE_ISNULL(entry)) {
+        return ei_x_encode_atom_len(buf, "null", 4);
+    }
+    return etf_encode_container(buf, (const JsonbContainer *) (base + INTALIGN(offset)));
+}
+
+// Encode the elements of an array container back to back (for lists and tuples)
+static int etf_encode_elements(ei_x_buff *buf, const JsonbContainer *jc) {
+    uint32 count = JsonContainerSize(jc);
+    const char *base = (const char *) &jc->children[count];
+    uint32 offset = 0;
+    uint32 i;
+
+    for (i = 0; i < count; i++) {
+        uint32 len = etf_entry_length(jc->children[i], offset);
+
+        if (etf_encode_entry(buf, jc->children[i], base, offset, len) < 0) {
+            return -1;
+        }
+        offset += len;
+    }
+    return 0;
+}
+
+// Look up a field of a "$type" object
+static JsonbValue *etf_special_field(const JsonbContainer *jc, const char *name) {
+    JsonbValue key;
+
+    key.type = jbvString;
+    key.val.string.val = (char *) name;
+    key.val.string.len = strlen(name);
+    return findJsonbValueFromContainer((JsonbContainer *) jc, JB_FOBJECT, &key);
+}
+
+static bool etf_special_is(const char *type, uint32 type_len, const char *name) {
+    return type_len == strlen(name) && memcmp(type, name, type_len) == 0;
+}
+
+static int64 etf_special_int(JsonbValue *v) {
+    return DatumGetInt64(DirectFunctionCall1(numeric_int8, NumericGetDatum(v->val.numeric)));
+}
+
+/*
+ * Encode an object tagged with "$type":
+ *   {"$type": "atom", "value": "name"}
+ *   {"$type": "tuple", "elements": [...]}
+ *   {"$type": "binary", "data": "..."}
+ *   {"$type": "pid", "node": "n@h", "id": 1, "serial": 0, "creation": 1}
+ */
+static int etf_encode_special(ei_x_buff *buf, const JsonbContainer *jc, const char *type, uint32 type_len) {
+    JsonbValue *v;
+
+    if (etf_special_is(type, type_len, "atom")) {
+        v = etf_special_field(jc, "value");
+        if (v && v->type == jbvString) {
+            return ei_x_encode_atom_len(buf, v->val.string.val, v->val.string.len);
         }
-    } else if (strncmp(type_val->val.string.val, "tuple", 5) == 0) {
-        // Encode as tuple: {"$type": "tuple", "elements": [...]}
-        JsonbValue *elements_val = findJsonbValueFromContainer(&obj->val.object, JB_FOBJECT, &(JsonbValue){.type = jbvString, .val.string.val = "elements", .val.string.len = 8});
-        if (elements_val && elements_val->type == jbvArray) {
-            if (ei_x_encode_tuple_header(buf, elements_val->val.array.nElems) < 0) {
+    } else if (etf_special_is(type, type_len, "tuple")) {
+        v = etf_special_field(jc, "elements");
+        if (v && v->type == jbvBinary && JsonContainerIsArray(v->val.binary.data)) {
+            if (ei_x_encode_tuple_header(buf, JsonContainerSize(v->val.binary.data)) < 0) {
                 return -1;
             }
-            
-            JsonbIterator *it;
-            JsonbValue v;
-            int type;
-            
-            it = JsonbIteratorInit(&elements_val->val.array.elems);
-            while ((type = JsonbIteratorNext(&it, &v, false)) != WJB_DONE) {
-                if (type == WJB_ELEM) {
-                    if (jsonb_value_to_erlang_term(buf, &v) < 0) {
-                        return -1;
-                    }
-                }
-            }
-            return 0;
+            return etf_encode_elements(buf, v->val.binary.data);
         }
-    } else if (strncmp(type_val->val.string.val, "binary", 6) == 0) {
-        // Encode as binary: {"$type": "binary", "data": "base64_encoded_data"}
-        JsonbValue *data_val = findJsonbValueFromContainer(&obj->val.object, JB_FOBJECT, &(JsonbValue){.type = jbvString, .val.string.val = "data", .val.string.len = 4});
-        if (data_val && data_val->type == jbvString) {
-            // For simplicity, treat as string for now
-            return ei_x_encode_binary(buf, data_val->val.string.val, data_val->val.string.len);
+    } else if (etf_special_is(type, type_len, "binary")) {
+        v = etf_special_field(jc, "data");
+        if (v && v->type == jbvString) {
+            return ei_x_encode_binary(buf, v->val.string.val, v->val.string.len);
         }
-    } else if (strncmp(type_val->val.string.val, "pid", 3) == 0) {
-        // Encode PID: {"$type": "pid", "node": "node@host", "id": 123, "serial": 456, "creation": 1}
-        // For now, we'll encode as a special tuple format that Erlang can understand
-        JsonbValue *node_val = findJsonbValueFromContainer(&obj->val.object, JB_FOBJECT, &(JsonbValue){.type = jbvString, .val.string.val = "node", .val.string.len = 4});
-        JsonbValue *id_val = findJsonbValueFromContainer(&obj->val.object, JB_FOBJECT, &(JsonbValue){.type = jbvString, .val.string.val = "id", .val.string.len = 2});
-        JsonbValue *serial_val = findJsonbValueFromContainer(&obj->val.object, JB_FOBJECT, &(JsonbValue){.type = jbvString, .val.string.val = "serial", .val.string.len = 6});
-        JsonbValue *creation_val = findJsonbValueFromContainer(&obj->val.object, JB_FOBJECT, &(JsonbValue){.type = jbvString, .val.string.val = "creation", .val.string.len = 8});
-        
-        if (node_val && id_val && serial_val && creation_val) {
+    } else if (etf_special_is(type, type_len, "pid")) {
+        JsonbValue *node_val = etf_special_field(jc, "node");
+        JsonbValue *id_val = etf_special_field(jc, "id");
+        JsonbValue *serial_val = etf_special_field(jc, "serial");
+        JsonbValue *creation_val = etf_special_field(jc, "creation");
+
+        if (node_val && node_val->type == jbvString &&
+            id_val && id_val->type == jbvNumeric &&
+            serial_val && serial_val->type == jbvNumeric &&
+            creation_val && creation_val->type == jbvNumeric) {
             erlang_pid pid;
-            strncpy(pid.node, node_val->val.string.val, MAXATOMLEN);
-            pid.node[MAXATOMLEN-1] = '\0';
-            pid.num = (int)DatumGetInt64(DirectFunctionCall1(numeric_int8, NumericGetDatum(id_val->val.numeric)));
-            pid.serial = (int)DatumGetInt64(DirectFunctionCall1(numeric_int8, NumericGetDatum(serial_val->val.numeric)));
-            pid.creation = (int)DatumGetInt64(DirectFunctionCall1(numeric_int8, NumericGetDatum(creation_val->val.numeric)));
-            
+            int node_len = Min(node_val->val.string.len, MAXATOMLEN - 1);
+
+            memset(&pid, 0, sizeof(pid));
+            memcpy(pid.node, node_val->val.string.val, node_len);
+            pid.node[node_len] = '\0';
+            pid.num = (unsigned int) etf_special_int(id_val);
+            pid.serial = (unsigned int) etf_special_int(serial_val);
+            pid.creation = (unsigned int) etf_special_int(creation_val);
             return ei_x_encode_pid(buf, &pid);
         }
     }
-    
-    // Fallback: encode as regular map
+
+    // Unknown type or missing fields
     return -1;
 }
 
-// Helper function for parsing special type strings (deprecated, use objects instead)
-static int encode_special_erlang_type(ei_x_buff *buf, const char *type_str) {
-    // This is for backward compatibility with string-based special types
-    // Format: {"$type": "atom", "value": "atom_name"}
-    // For now, just return error and require object format
-    return -1;
+// Encode an array as a list and an object as a map (or as its "$type")
+static int etf_encode_container(ei_x_buff *buf, const JsonbContainer *jc) {
+    uint32 count = JsonContainerSize(jc);
+    const char *base;
+    uint32 key_offset;
+    uint32 value_offset;
+    int start;
+    uint32 i;
+
+    check_stack_depth();
+
+    if (JsonContainerIsScalar(jc)) {
+        base = (const char *) &jc->children[1];
+        return etf_encode_entry(buf, jc->children[0], base, 0, etf_entry_length(jc->children[0], 0));
+    }
+
+    if (JsonContainerIsArray(jc)) {
+        if (count == 0) {
+            return ei_x_encode_empty_list(buf);
+        }
+        if (ei_x_encode_list_header(buf, count) < 0 || etf_encode_elements(buf, jc) < 0) {
+            return -1;
+        }
+        return ei_x_encode_empty_list(buf);
+    }
+
+    // Objects hold all keys first, then all values, in matching order
+    base = (const char *) &jc->children[count * 2];
+    start = buf->index;
+    if (ei_x_encode_map_header(buf, count) < 0) {
+        return -1;
+    }
+    key_offset = 0;
+    value_offset = count > 0 ? getJsonbOffset(jc, count) : 0;
+    for (i = 0; i < count; i++) {
+        JEntry key = jc->children[i];
+        JEntry value = jc->children[i + count];
+        uint32 key_len = etf_entry_length(key, key_offset);
+        uint32 value_len = etf_entry_length(value, value_offset);
+
+        if (key_len == 5 && JBE_ISSTRING(value) && memcmp(base + key_offset, "$type", 5) == 0) {
+            // Drop the pairs encoded so far and encode the tagged term instead
+            buf->index = start;
+            return etf_encode_special(buf, jc, base + value_offset, value_len);
+        }
+
+        if (ei_x_encode_string_len(buf, base + key_offset, key_len) < 0 ||
+            etf_encode_entry(buf, value, base, value_offset, value_len) < 0) {
+            return -1;
+        }
+        key_offset += key_len;
+        value_offset += value_len;
+    }
+    return 0;
+}
+
+// Convert any JSONB document to a single Erlang term
+int jsonb_to_erlang_term(ei_x_buff *buf, Jsonb *json) {
+    return etf_encode_container(buf, &json->root);
 }
 
 // Convert JSONB to Erlang term list (for function arguments)
 int jsonb_to_erlang_args(ei_x_buff *buf, Jsonb *args_json) {
-    JsonbIterator *it;
-    JsonbValue v;
-    int type;
-    int count = 0;
-    
-    // Check if this is an array at the root
-    it = JsonbIteratorInit(&args_json->root);
-    type = JsonbIteratorNext(&it, &v, false);
-    
-    if (type != WJB_BEGIN_ARRAY) {
+    if (!JB_ROOT_IS_ARRAY(args_json) || JB_ROOT_IS_SCALAR(args_json)) {
         // Not an array, encode as empty list
         return ei_x_encode_empty_list(buf);
     }
-    
-    // Count elements in the array
-    while ((type = JsonbIteratorNext(&it, &v, false)) != WJB_DONE) {
-        if (type == WJB_ELEM) {
-            count++;
-        }
+    return etf_encode_container(buf, &args_json->root);
+}
+
+/*
+ * Encode JSONB arguments followed by one extra binary argument. The binary
+ * is written straight from the caller's bytes into the send buffer.
+ */
+int jsonb_to_erlang_args_with_binary(ei_x_buff *buf, Jsonb *args_json, const char *data, long len) {
+    uint32 count = 0;
+
+    if (JB_ROOT_IS_ARRAY(args_json) && !JB_ROOT_IS_SCALAR(args_json)) {
+        count = JB_ROOT_COUNT(args_json);
     }
-    
-    // If no elements, encode as empty list
-    if (count == 0) {
-        return ei_x_encode_empty_list(buf);
+    if (ei_x_encode_list_header(buf, count + 1) < 0) {
+        return -1;
     }
-    
-    // Reset iterator and encode as list
-    it = JsonbIteratorInit(&args_json->root);
-    JsonbIteratorNext(&it, &v, false); // Skip WJB_BEGIN_ARRAY
-    
-    if (ei_x_encode_list_header(buf, count) < 0) {
+    if (count > 0 && etf_encode_elements(buf, &args_json->root) < 0) {
         return -1;
     }
-    
-    while ((type = JsonbIteratorNext(&it, &v, false)) != WJB_DONE) {
-        if (type == WJB_ELEM) {
-            if (jsonb_value_to_erlang_term(buf, &v) < 0) {
-                return -1;
-            }
-        }
+    if (ei_x_encode_binary(buf, data, len) < 0) {
+        return -1;
     }
-    
     return ei_x_encode_empty_list(buf);
 }
 
-// Forward declaration for recursive decoding
-static JsonbValue *decode_erlang_term_recursive(char *buf, int *index);
+/*
+ * Single-pass ETF decoder.
+ * The external term format is walked once and every value is pushed straight
+ * into one shared JsonbParseState; atom and binary strings point into the
+ * source buffer, which only has to outlive the final JsonbValueToJsonb call.
+ */
 
-// Convert Erlang term to JSONB with full type support
-static Jsonb *erlang_term_to_jsonb(ei_x_buff *buf) {
-    int index = 0;
-    int type, size;
-    JsonbValue *result;
-    
-    // Skip version byte if present
-    if (buf->buff[0] == 131) {
-        index = 1;
+// ETF tags not named by ei.h on every release
+#define ETF_VERSION_MAGIC 131
+#define ETF_NEWER_REFERENCE_EXT 90
+#define ETF_NEW_PID_EXT 88
+#define ETF_NEW_PORT_EXT 89
+#define ETF_V4_PORT_EXT 120
+#define ETF_COMPRESSED_EXT 80
+
+typedef struct {
+    const char *buf;
+    int len;
+    int index;
+    JsonbParseState *state;
+} EtfDecoder;
+
+static JsonbValue *etf_push_term(EtfDecoder *d, JsonbIteratorToken token);
+
+/*
+ * COMPRESSED terms, as from term_to_binary(T, [compressed]): tag 80, the
+ * uncompressed size as a uint32, then a zlib stream of the term without its
+ * version byte. Inflate the stream at src into exactly size bytes at dst;
+ * returns the number of compressed bytes used, or -1 if it is corrupt.
+ */
+static int etf_inflate(const char *src, int src_len, char *dst, uint32 size) {
+    z_stream zs;
+    int rc;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK) {
+        return -1;
     }
-    
-    // Get the type of the response
-    if (ei_get_type(buf->buff, &index, &type, &size) < 0) {
-        JsonbValue jbv;
-        jbv.type = jbvString;
-        jbv.val.string.val = "decode_error";
-        jbv.val.string.len = strlen("decode_error");
-        return JsonbValueToJsonb(&jbv);
+    zs.next_in = (Bytef *) src;
+    zs.avail_in = src_len;
+    zs.next_out = (Bytef *) dst;
+    zs.avail_out = size;
+    rc = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (rc != Z_STREAM_END || zs.total_out != size) {
+        return -1;
     }
-    
-    // Handle tuple response from manual RPC
-    if (type == ERL_SMALL_TUPLE_EXT || type == ERL_LARGE_TUPLE_EXT) {
-        int arity;
-        if (ei_decode_tuple_header(buf->buff, &index, &arity) < 0) {
-            JsonbValue jbv;
-            jbv.type = jbvString;
-            jbv.val.string.val = "tuple_decode_error";
-            jbv.val.string.len = strlen("tuple_decode_error");
-            return JsonbValueToJsonb(&jbv);
-        } else if (arity == 2) {
-            // This is a 2-tuple response from $gen_call: {Ref, Result}
-            // Skip first element (reference)
-            ei_skip_term(buf->buff, &index);
-            
-            // Decode the actual result (second element)
-            result = decode_erlang_term_recursive(buf->buff, &index);
-            return JsonbValueToJsonb(result);
-        } else {
-            // This is a regular tuple, decode it as an array
-            result = decode_erlang_term_recursive(buf->buff, &index);
-            return JsonbValueToJsonb(result);
-        }
-    } else {
-        // Direct response, decode it
-        result = decode_erlang_term_recursive(buf->buff, &index);
-        return JsonbValueToJsonb(result);
+    return (int) zs.total_in;
+}
+
+// term_to_binary(T, [compressed]) of the unversioned term at term[0..len); NULL if it would not shrink
+static bytea *etf_compress(const char *term, int len) {
+    uLongf compressed_len = compressBound(len);
+    bytea *result = (bytea *) palloc(VARHDRSZ + 6 + compressed_len);
+    char *out = VARDATA(result);
+    uint32 size = pg_hton32((uint32) len);
+
+    out[0] = (char) ETF_VERSION_MAGIC;
+    out[1] = (char) ETF_COMPRESSED_EXT;
+    memcpy(out + 2, &size, 4);
+    if (compress2((Bytef *) out + 6, &compressed_len, (const Bytef *) term, len, Z_DEFAULT_COMPRESSION) != Z_OK ||
+        6 + compressed_len >= (uLongf) len + 1) {
+        pfree(result);
+        return NULL;
     }
+    SET_VARSIZE(result, VARHDRSZ + 6 + compressed_len);
+    return result;
+}
+
+static void etf_truncated(void) {
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+             errmsg("malformed Erlang external term format")));
+}
+
+// Make sure n more bytes are available
+static inline void etf_need(EtfDecoder *d, int64 n) {
+    if (n < 0 || n > d->len - d->index) {
+        etf_truncated();
+    }
+}
+
+static inline uint8 etf_u8(EtfDecoder *d) {
+    etf_need(d, 1);
+    return (uint8) d->buf[d->index++];
+}
+
+static inline uint16 etf_u16(EtfDecoder *d) {
+    uint16 v;
+
+    etf_need(d, 2);
+    memcpy(&v, d->buf + d->index, 2);
+    d->index += 2;
+    return pg_ntoh16(v);
+}
+
+static inline uint32 etf_u32(EtfDecoder *d) {
+    uint32 v;
+
+    etf_need(d, 4);
+    memcpy(&v, d->buf + d->index, 4);
+    d->index += 4;
+    return pg_ntoh32(v);
 }
 
-// Recursive function to decode any Erlang term into JsonbValue
-static JsonbValue *decode_erlang_term_recursive(char *buf, int *index) {
-    JsonbValue *jbv;
-    char *string_buffer;
-    int type, size, arity;
+// Point a string value at len bytes of the source buffer
+static inline void etf_string(EtfDecoder *d, JsonbValue *v, int64 len) {
+    etf_need(d, len);
+    v->type = jbvString;
+    v->val.string.val = (char *) d->buf + d->index;
+    v->val.string.len = (int) len;
+    d->index += len;
+}
+
+/*
+ * As etf_string, for the bytes of a binary or a string key. JSONB holds only
+ * text in the database encoding, so anything else (a NUL, invalid UTF-8) is
+ * refused rather than stored as an invalid jsonb string.
+ */
+static void etf_text(EtfDecoder *d, JsonbValue *v, int64 len) {
+    etf_string(d, v, len);
+    if (!pg_verifymbstr(v->val.string.val, v->val.string.len, true)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNTRANSLATABLE_CHARACTER),
+                 errmsg("Erlang binary is not valid text in the database encoding and cannot be converted to JSONB"),
+                 errhint("Use erlang_call_etf or erlang_call_bytea_array to receive raw binaries.")));
+    }
+}
+
+/*
+ * As etf_string, for the name of an atom. Names are Latin-1 or UTF-8 by tag;
+ * anything but plain ASCII is converted to the database encoding, which
+ * also rejects bytes that are not valid in the atom's own encoding.
+ */
+static void etf_atom(EtfDecoder *d, JsonbValue *v, int64 len, bool latin1) {
     int i;
-    JsonbParseState *state = NULL;
-    JsonbValue *result;
-    JsonbValue key;
-    
-    // Allocate in PostgreSQL memory context
-    jbv = (JsonbValue *) palloc(sizeof(JsonbValue));
-    string_buffer = (char *) palloc(1024);
-    
-    if (ei_get_type(buf, index, &type, &size) < 0) {
-        jbv->type = jbvString;
-        jbv->val.string.val = pstrdup("type_error");
-        jbv->val.string.len = 10;
-        return jbv;
+
+    etf_string(d, v, len);
+    for (i = 0; i < v->val.string.len; i++) {
+        uint8 c = (uint8) v->val.string.val[i];
+
+        if (c == 0 || c >= 128) {
+            v->val.string.val = pg_any_to_server(v->val.string.val, v->val.string.len,
+                                                 latin1 ? PG_LATIN1 : PG_UTF8);
+            v->val.string.len = strlen(v->val.string.val);
+            return;
+        }
     }
-    
-    switch (type) {
+}
+
+// Step over n bytes
+static inline void etf_skip_bytes(EtfDecoder *d, int64 n) {
+    etf_need(d, n);
+    d->index += n;
+}
+
+// Step over the atom naming the node of a pid, port or reference, or a fun's module
+static void etf_skip_atom(EtfDecoder *d) {
+    switch (etf_u8(d)) {
         case ERL_ATOM_EXT:
+        case ERL_ATOM_UTF8_EXT:
+            etf_skip_bytes(d, etf_u16(d));
+            return;
         case ERL_SMALL_ATOM_EXT:
+        case ERL_SMALL_ATOM_UTF8_EXT:
+            etf_skip_bytes(d, etf_u8(d));
+            return;
+        default:
+            etf_truncated();
+    }
+}
+
+/*
+ * Step over one term without decoding it. Unlike ei_skip_term, every length
+ * is checked against the buffer before it is used, so this is safe on bytes
+ * from a client; once it has passed, ei's own decoders may read the term.
+ */
+static void etf_skip(EtfDecoder *d) {
+    uint8 tag;
+    uint32 count;
+    uint32 i;
+
+    check_stack_depth();
+
+    tag = etf_u8(d);
+    switch (tag) {
+        case ERL_SMALL_INTEGER_EXT:
+            etf_skip_bytes(d, 1);
+            return;
+        case ERL_INTEGER_EXT:
+            etf_skip_bytes(d, 4);
+            return;
+        case NEW_FLOAT_EXT:
+            etf_skip_bytes(d, 8);
+            return;
+        case ERL_FLOAT_EXT:
+            etf_skip_bytes(d, 31);
+            return;
+        case ERL_ATOM_EXT:
         case ERL_ATOM_UTF8_EXT:
+            etf_skip_bytes(d, etf_u16(d));
+            return;
+        case ERL_SMALL_ATOM_EXT:
         case ERL_SMALL_ATOM_UTF8_EXT:
-            if (ei_decode_atom(buf, index, string_buffer) == 0) {
-                jbv->type = jbvString;
-                jbv->val.string.val = pstrdup(string_buffer);
-                jbv->val.string.len = strlen(string_buffer);
-            } else {
-                jbv->type = jbvString;
-                jbv->val.string.val = pstrdup("atom_error");
-                jbv->val.string.len = 10;
-            }
-            return jbv;
-            
+            etf_skip_bytes(d, etf_u8(d));
+            return;
+        case ERL_SMALL_BIG_EXT:
+            etf_skip_bytes(d, (int64) etf_u8(d) + 1);
+            return;
+        case ERL_LARGE_BIG_EXT:
+            etf_skip_bytes(d, (int64) etf_u32(d) + 1);
+            return;
         case ERL_BINARY_EXT:
+            etf_skip_bytes(d, etf_u32(d));
+            return;
+        case ERL_BIT_BINARY_EXT:
+            etf_skip_bytes(d, (int64) etf_u32(d) + 1);
+            return;
+        case ERL_STRING_EXT:
+            etf_skip_bytes(d, etf_u16(d));
+            return;
+        case ERL_NIL_EXT:
+            return;
+        case ERL_SMALL_TUPLE_EXT:
+        case ERL_LARGE_TUPLE_EXT:
+            count = tag == ERL_SMALL_TUPLE_EXT ? etf_u8(d) : etf_u32(d);
+            for (i = 0; i < count; i++) {
+                etf_skip(d);
+            }
+            return;
+        case ERL_LIST_EXT:
+            // The elements, then the tail
+            count = etf_u32(d);
+            for (i = 0; i <= count; i++) {
+                etf_skip(d);
+            }
+            return;
+        case ERL_MAP_EXT:
+            count = etf_u32(d);
+            for (i = 0; i < count; i++) {
+                etf_skip(d);
+                etf_skip(d);
+            }
+            return;
+        case ERL_PID_EXT:
+            // Node, ID, serial, creation
+            etf_skip_atom(d);
+            etf_skip_bytes(d, 4 + 4 + 1);
+            return;
+        case ETF_NEW_PID_EXT:
+            etf_skip_atom(d);
+            etf_skip_bytes(d, 4 + 4 + 4);
+            return;
+        case ERL_PORT_EXT:
+            // Node, ID, creation
+            etf_skip_atom(d);
+            etf_skip_bytes(d, 4 + 1);
+            return;
+        case ETF_NEW_PORT_EXT:
+            etf_skip_atom(d);
+            etf_skip_bytes(d, 4 + 4);
+            return;
+        case ETF_V4_PORT_EXT:
+            etf_skip_atom(d);
+            etf_skip_bytes(d, 8 + 4);
+            return;
+        case ERL_REFERENCE_EXT:
+            etf_skip_atom(d);
+            etf_skip_bytes(d, 4 + 1);
+            return;
+        case ERL_NEW_REFERENCE_EXT:
+        case ETF_NEWER_REFERENCE_EXT:
+            // ID word count, node, creation, ID words
+            count = etf_u16(d);
+            etf_skip_atom(d);
+            etf_skip_bytes(d, (tag == ERL_NEW_REFERENCE_EXT ? 1 : 4) + 4 * (int64) count);
+            return;
+        case ERL_EXPORT_EXT:
+            // Module, function, arity
+            etf_skip_atom(d);
+            etf_skip_atom(d);
+            if (etf_u8(d) != ERL_SMALL_INTEGER_EXT) {
+                etf_truncated();
+            }
+            etf_skip_bytes(d, 1);
+            return;
+        case ERL_NEW_FUN_EXT:
             {
-                char *binary_data;
-                long binary_len;
-                if (ei_decode_binary(buf, index, (void**)&binary_data, &binary_len) == 0) {
-                    int copy_len = binary_len < 1023 ? binary_len : 1023;
-                    memcpy(string_buffer, binary_data, copy_len);
-                    string_buffer[copy_len] = '\0';
-                    free(binary_data);
-                    jbv->type = jbvString;
-                    jbv->val.string.val = pstrdup(string_buffer);
-                    jbv->val.string.len = copy_len;
-                } else {
-                    jbv->type = jbvString;
-                    jbv->val.string.val = pstrdup("binary_error");
-                    jbv->val.string.len = 12;
+                int start = d->index;
+                uint32 size = etf_u32(d);
+
+                // Arity, uniq, index, then the free variable count
+                etf_skip_bytes(d, 1 + 16 + 4);
+                count = etf_u32(d);
+                etf_skip_atom(d);
+                // Old index, old uniq and creator pid, then the free variables
+                for (i = 0; i < 3 + count; i++) {
+                    etf_skip(d);
                 }
+                // The size covers everything from the size field on
+                if ((uint32) (d->index - start) != size) {
+                    etf_truncated();
+                }
+                return;
+            }
+        default:
+            etf_truncated();
+    }
+}
+
+// Push a scalar, or hand it back as the result when it is the whole term
+static inline JsonbValue *etf_push_scalar(EtfDecoder *d, JsonbIteratorToken token, JsonbValue *v) {
+    if (d->state == NULL) {
+        JsonbValue *copy = palloc(sizeof(JsonbValue));
+
+        *copy = *v;
+        return copy;
+    }
+    return pushJsonbValue(&d->state, token, v);
+}
+
+// Build a Numeric from a little-endian base-256 magnitude of n bytes
+static Numeric etf_numeric_from_magnitude(const uint8 *mag, uint32 n, bool neg) {
+    uint8 *work = palloc(Max(n, 1));
+    int16 *digits = palloc(sizeof(int16) * (n + 1));  // NBASE > 256: at most one digit per byte
+    int ndigits = 0;
+    int nlow = 0;
+    int weight;
+    uint32 len = n;
+    uint32 i;
+    Numeric result;
+    char *data;
+    uint16 sign_dscale;
+    int16 weight16;
+
+    // Big-endian copy, divided by NBASE repeatedly; remainders come out low digit first
+    for (i = 0; i < n; i++) {
+        work[i] = mag[n - 1 - i];
+    }
+    while (len > 0) {
+        uint32 rem = 0;
+        uint32 first = 0;
+
+        for (i = 0; i < len; i++) {
+            uint32 cur = (rem << 8) | work[i];
+
+            work[i] = (uint8) (cur / ETF_NBASE);
+            rem = cur % ETF_NBASE;
+        }
+        while (first < len && work[first] == 0) {
+            first++;
+        }
+        memmove(work, work + first, len - first);
+        len -= first;
+        digits[ndigits++] = (int16) rem;
+    }
+    pfree(work);
+
+    if (ndigits == 0) {
+        pfree(digits);
+        return int64_to_numeric(0);
+    }
+    weight = ndigits - 1;
+    if (weight > PG_INT16_MAX) {
+        ereport(ERROR,
+                (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+                 errmsg("Erlang integer is too large for numeric")));
+    }
+
+    // Low-order zero digits are implied by the weight
+    while (nlow < ndigits && digits[nlow] == 0) {
+        nlow++;
+    }
+
+    // The long form is valid for any value
+    result = (Numeric) palloc(VARHDRSZ + 2 * sizeof(uint16) + (ndigits - nlow) * sizeof(int16));
+    SET_VARSIZE(result, VARHDRSZ + 2 * sizeof(uint16) + (ndigits - nlow) * sizeof(int16));
+    data = VARDATA(result);
+    sign_dscale = neg ? ETF_NUMERIC_NEG : 0;
+    weight16 = (int16) weight;
+    memcpy(data, &sign_dscale, sizeof(sign_dscale));
+    memcpy(data + sizeof(uint16), &weight16, sizeof(weight16));
+    for (i = 0; i < (uint32) (ndigits - nlow); i++) {
+        int16 digit = digits[ndigits - 1 - i];
+
+        memcpy(data + 2 * sizeof(uint16) + i * sizeof(int16), &digit, sizeof(digit));
+    }
+    pfree(digits);
+    return result;
+}
+
+// Decode a bignum of n magnitude bytes (sign byte first) into a Numeric
+static Numeric etf_big_to_numeric(EtfDecoder *d, uint32 n) {
+    bool neg = etf_u8(d) != 0;
+    const uint8 *mag;
+    uint64 small = 0;
+    uint32 i;
+
+    etf_need(d, n);
+    mag = (const uint8 *) d->buf + d->index;
+    d->index += n;
+
+    // Trim high-order zero bytes
+    while (n > 0 && mag[n - 1] == 0) {
+        n--;
+    }
+
+    if (n <= 8) {
+        for (i = 0; i < n; i++) {
+            small |= (uint64) mag[i] << (8 * i);
+        }
+        if (!neg && small <= (uint64) PG_INT64_MAX) {
+            return int64_to_numeric((int64) small);
+        }
+        if (neg && small <= (uint64) PG_INT64_MAX + 1) {
+            return int64_to_numeric((int64) (0 - small));
+        }
+    }
+
+    return etf_numeric_from_magnitude(mag, n, neg);
+}
+
+// Push a map key; only atoms, binaries and strings name a key directly
+static void etf_push_key(EtfDecoder *d, int i) {
+    JsonbValue key;
+    uint8 tag;
+
+    etf_need(d, 1);
+    tag = (uint8) d->buf[d->index];
+    switch (tag) {
+        case ERL_ATOM_EXT:
+        case ERL_ATOM_UTF8_EXT:
+            d->index++;
+            etf_atom(d, &key, etf_u16(d), tag == ERL_ATOM_EXT);
+            break;
+        case ERL_SMALL_ATOM_EXT:
+        case ERL_SMALL_ATOM_UTF8_EXT:
+            d->index++;
+            etf_atom(d, &key, etf_u8(d), tag == ERL_SMALL_ATOM_EXT);
+            break;
+        case ERL_BINARY_EXT:
+        case ERL_STRING_EXT:
+            d->index++;
+            if (tag == ERL_BINARY_EXT) {
+                etf_text(d, &key, etf_u32(d));
+            } else {
+                etf_text(d, &key, etf_u16(d));
             }
-            return jbv;
-            
+            break;
+        default:
+            // Non-string keys are named by position
+            etf_skip(d);
+            key.type = jbvString;
+            key.val.string.val = psprintf("key_%d", i);
+            key.val.string.len = strlen(key.val.string.val);
+            break;
+    }
+    pushJsonbValue(&d->state, WJB_KEY, &key);
+}
+
+// Inflate a COMPRESSED term and decode it in place of the tag
+static JsonbValue *etf_push_compressed(EtfDecoder *d, JsonbIteratorToken token) {
+    uint32 size = etf_u32(d);
+    EtfDecoder inner;
+    JsonbValue *result;
+    char *plain;
+    int used;
+
+    if (size > MaxAllocSize) {
+        etf_truncated();
+    }
+    // Strings point into the inflated copy, so it stays until the context is reset
+    plain = palloc(size);
+    used = etf_inflate(d->buf + d->index, d->len - d->index, plain, size);
+    if (used < 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+                 errmsg("corrupt compressed Erlang external term")));
+    }
+    d->index += used;
+
+    inner.buf = plain;
+    inner.len = (int) size;
+    inner.index = 0;
+    inner.state = d->state;
+    result = etf_push_term(&inner, token);
+    d->state = inner.state;
+    return result;
+}
+
+// Decode one term at d->index; containers become arrays/objects in d->state
+static JsonbValue *etf_push_term(EtfDecoder *d, JsonbIteratorToken token) {
+    JsonbValue v;
+    uint8 tag;
+    uint32 count;
+    uint32 i;
+    int start;
+
+    check_stack_depth();
+
+    start = d->index;
+    tag = etf_u8(d);
+    switch (tag) {
         case ERL_SMALL_INTEGER_EXT:
+            v.type = jbvNumeric;
+            v.val.numeric = int64_to_numeric(etf_u8(d));
+            return etf_push_scalar(d, token, &v);
+
         case ERL_INTEGER_EXT:
+            v.type = jbvNumeric;
+            v.val.numeric = int64_to_numeric((int32) etf_u32(d));
+            return etf_push_scalar(d, token, &v);
+
+        case ERL_SMALL_BIG_EXT:
+        case ERL_LARGE_BIG_EXT:
+            count = tag == ERL_SMALL_BIG_EXT ? etf_u8(d) : etf_u32(d);
+            v.type = jbvNumeric;
+            v.val.numeric = etf_big_to_numeric(d, count);
+            return etf_push_scalar(d, token, &v);
+
+        case NEW_FLOAT_EXT:
             {
-                long val_long;
-                if (ei_decode_long(buf, index, &val_long) == 0) {
-                    jbv->type = jbvNumeric;
-                    jbv->val.numeric = DatumGetNumeric(DirectFunctionCall1(int8_numeric, Int64GetDatum(val_long)));
-                } else {
-                    jbv->type = jbvString;
-                    jbv->val.string.val = pstrdup("integer_error");
-                    jbv->val.string.len = 13;
-                }
+                uint64 bits;
+                double val;
+
+                etf_need(d, 8);
+                memcpy(&bits, d->buf + d->index, 8);
+                d->index += 8;
+                bits = pg_ntoh64(bits);
+                memcpy(&val, &bits, sizeof(val));
+                v.type = jbvNumeric;
+                v.val.numeric = DatumGetNumeric(DirectFunctionCall1(float8_numeric, Float8GetDatum(val)));
+                return etf_push_scalar(d, token, &v);
             }
-            return jbv;
-            
+
         case ERL_FLOAT_EXT:
-        case NEW_FLOAT_EXT:
             {
-                double val_double;
-                if (ei_decode_double(buf, index, &val_double) == 0) {
-                    jbv->type = jbvNumeric;
-                    jbv->val.numeric = DatumGetNumeric(DirectFunctionCall1(float8_numeric, Float8GetDatum(val_double)));
-                } else {
-                    jbv->type = jbvString;
-                    jbv->val.string.val = pstrdup("float_error");
-                    jbv->val.string.len = 11;
-                }
+                char digits[32];
+
+                // Old-style floats are a 31-byte printf("%.20e") string
+                etf_need(d, 31);
+                memcpy(digits, d->buf + d->index, 31);
+                digits[31] = '\0';
+                d->index += 31;
+                v.type = jbvNumeric;
+                v.val.numeric = DatumGetNumeric(DirectFunctionCall1(float8_numeric,
+                                                                    Float8GetDatum(strtod(digits, NULL))));
+                return etf_push_scalar(d, token, &v);
             }
-            return jbv;
-            
+
+        case ERL_ATOM_EXT:
+        case ERL_ATOM_UTF8_EXT:
+            etf_atom(d, &v, etf_u16(d), tag == ERL_ATOM_EXT);
+            return etf_push_scalar(d, token, &v);
+
+        case ERL_SMALL_ATOM_EXT:
+        case ERL_SMALL_ATOM_UTF8_EXT:
+            etf_atom(d, &v, etf_u8(d), tag == ERL_SMALL_ATOM_EXT);
+            return etf_push_scalar(d, token, &v);
+
+        case ERL_BINARY_EXT:
+            etf_text(d, &v, etf_u32(d));
+            return etf_push_scalar(d, token, &v);
+
         case ERL_SMALL_TUPLE_EXT:
         case ERL_LARGE_TUPLE_EXT:
-            if (ei_decode_tuple_header(buf, index, &arity) == 0) {
-                // Decode tuple as JSON array
-                pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
-                
-                for (i = 0; i < arity; i++) {
-                    JsonbValue *elem = decode_erlang_term_recursive(buf, index);
-                    pushJsonbValue(&state, WJB_ELEM, elem);
-                }
-                
-                result = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
-                return result;
-            } else {
-                jbv->type = jbvString;
-                jbv->val.string.val = pstrdup("tuple_error");
-                jbv->val.string.len = 11;
-                return jbv;
+            count = tag == ERL_SMALL_TUPLE_EXT ? etf_u8(d) : etf_u32(d);
+            pushJsonbValue(&d->state, WJB_BEGIN_ARRAY, NULL);
+            for (i = 0; i < count; i++) {
+                etf_push_term(d, WJB_ELEM);
             }
-            
-        case ERL_LIST_EXT:
+            return pushJsonbValue(&d->state, WJB_END_ARRAY, NULL);
+
         case ERL_NIL_EXT:
-            if (type == ERL_NIL_EXT) {
-                // Empty list
-                pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
-                result = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
-                return result;
-            } else {
-                // Non-empty list
-                if (ei_decode_list_header(buf, index, &arity) == 0) {
-                    pushJsonbValue(&state, WJB_BEGIN_ARRAY, NULL);
-                    
-                    for (i = 0; i < arity; i++) {
-                        JsonbValue *elem = decode_erlang_term_recursive(buf, index);
-                        pushJsonbValue(&state, WJB_ELEM, elem);
-                    }
-                    
-                    // Handle list tail (should be NIL for proper lists)
-                    // Skip the tail - we assume proper lists ending with NIL
-                    ei_skip_term(buf, index);
-                    
-                    result = pushJsonbValue(&state, WJB_END_ARRAY, NULL);
-                    return result;
-                } else {
-                    jbv->type = jbvString;
-                    jbv->val.string.val = pstrdup("list_error");
-                    jbv->val.string.len = 10;
-                    return jbv;
-                }
+            pushJsonbValue(&d->state, WJB_BEGIN_ARRAY, NULL);
+            return pushJsonbValue(&d->state, WJB_END_ARRAY, NULL);
+
+        case ERL_STRING_EXT:
+            // A list of small integers, packed one byte per element
+            count = etf_u16(d);
+            etf_need(d, count);
+            pushJsonbValue(&d->state, WJB_BEGIN_ARRAY, NULL);
+            for (i = 0; i < count; i++) {
+                v.type = jbvNumeric;
+                v.val.numeric = int64_to_numeric((uint8) d->buf[d->index++]);
+                pushJsonbValue(&d->state, WJB_ELEM, &v);
             }
-            
+            return pushJsonbValue(&d->state, WJB_END_ARRAY, NULL);
+
+        case ERL_LIST_EXT:
+            count = etf_u32(d);
+            pushJsonbValue(&d->state, WJB_BEGIN_ARRAY, NULL);
+            for (i = 0; i < count; i++) {
+                etf_push_term(d, WJB_ELEM);
+            }
+            // Proper lists end in NIL; an improper tail is dropped
+            etf_skip(d);
+            return pushJsonbValue(&d->state, WJB_END_ARRAY, NULL);
+
         case ERL_MAP_EXT:
-            if (ei_decode_map_header(buf, index, &arity) == 0) {
-                pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
-                
-                for (i = 0; i < arity; i++) {
-                    // Decode key
-                    JsonbValue *key_val = decode_erlang_term_recursive(buf, index);
-                    if (key_val->type == jbvString) {
-                        pushJsonbValue(&state, WJB_KEY, key_val);
-                    } else {
-                        // Convert non-string keys to strings
-                        snprintf(string_buffer, 1024, "key_%d", i);
-                        key.type = jbvString;
-                        key.val.string.val = pstrdup(string_buffer);
-                        key.val.string.len = strlen(string_buffer);
-                        pushJsonbValue(&state, WJB_KEY, &key);
-                    }
-                    
-                    // Decode value
-                    JsonbValue *val_val = decode_erlang_term_recursive(buf, index);
-                    pushJsonbValue(&state, WJB_VALUE, val_val);
-                }
-                
-                result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
-                return result;
-            } else {
-                jbv->type = jbvString;
-                jbv->val.string.val = pstrdup("map_error");
-                jbv->val.string.len = 9;
-                return jbv;
+            count = etf_u32(d);
+            pushJsonbValue(&d->state, WJB_BEGIN_OBJECT, NULL);
+            for (i = 0; i < count; i++) {
+                etf_push_key(d, i);
+                etf_push_term(d, WJB_VALUE);
             }
-            
+            return pushJsonbValue(&d->state, WJB_END_OBJECT, NULL);
+
+        case ETF_COMPRESSED_EXT:
+            return etf_push_compressed(d, token);
+
         default:
-            snprintf(string_buffer, 1024, "unsupported_type_%d", type);
-            jbv->type = jbvString;
-            jbv->val.string.val = pstrdup(string_buffer);
-            jbv->val.string.len = strlen(string_buffer);
-            return jbv;
+            d->index = start;
+            break;
+    }
+
+    // Pids, refs, funs and the like have no JSON form
+    etf_skip(d);
+    v.type = jbvString;
+    v.val.string.val = psprintf("unsupported_type_%d", tag);
+    v.val.string.len = strlen(v.val.string.val);
+    return etf_push_scalar(d, token, &v);
+}
+
+// Decode the term at index within buf[0..len) into a Jsonb datum
+static Jsonb *etf_decode_jsonb(const char *buf, int len, int index) {
+    EtfDecoder d;
+
+    d.buf = buf;
+    d.len = len;
+    d.index = index;
+    d.state = NULL;
+    return JsonbValueToJsonb(etf_push_term(&d, WJB_ELEM));
+}
+
+// Offset of the result within a received reply, past {Ref, ...} from $gen_call
+static int etf_reply_index(ei_x_buff *buf) {
+    int index = 0;
+    int len = buf->index;
+
+    // Skip version byte if present
+    if (len > 0 && (uint8) buf->buff[0] == ETF_VERSION_MAGIC) {
+        index = 1;
+    }
+
+    if (len - index >= 3 && (uint8) buf->buff[index] == ERL_SMALL_TUPLE_EXT &&
+        (uint8) buf->buff[index + 1] == 2) {
+        uint8 first = (uint8) buf->buff[index + 2];
+
+        if (first == ERL_NEW_REFERENCE_EXT || first == ETF_NEWER_REFERENCE_EXT ||
+            first == ERL_REFERENCE_EXT) {
+            index += 2;
+            if (ei_skip_term(buf->buff, &index) < 0 || index > len) {
+                etf_truncated();
+            }
+        }
+    }
+    return index;
+}
+
+// Convert a received reply to JSONB
+static Jsonb *erlang_term_to_jsonb(ei_x_buff *buf) {
+    return etf_decode_jsonb(buf->buff, buf->index, etf_reply_index(buf));
+}
+
+// Return a received reply's result as a standalone term_to_binary/1 bytea
+static bytea *erlang_term_to_etf(ei_x_buff *buf) {
+    int index = etf_reply_index(buf);
+    int len = buf->index - index;
+    bytea *result = (bytea *) palloc(VARHDRSZ + 1 + len);
+
+    SET_VARSIZE(result, VARHDRSZ + 1 + len);
+    VARDATA(result)[0] = (char) ETF_VERSION_MAGIC;
+    memcpy(VARDATA(result) + 1, buf->buff + index, len);
+    return result;
+}
+
+// Append a term_to_binary/1 argument list, checking it is exactly one list
+static int etf_append_args(ei_x_buff *buf, bytea *args_etf) {
+    const char *data = VARDATA_ANY(args_etf);
+    int len = VARSIZE_ANY_EXHDR(args_etf);
+    volatile EtfDecoder d;
+    MemoryContext oldcontext = CurrentMemoryContext;
+    uint8 tag;
+
+    if (len > 0 && (uint8) data[0] == ETF_VERSION_MAGIC) {
+        data++;
+        len--;
+    }
+    // Distribution messages cannot carry COMPRESSED terms, so send the list inflated
+    if (len >= 5 && (uint8) data[0] == ETF_COMPRESSED_EXT) {
+        uint32 plain_len;
+        char *plain;
+
+        memcpy(&plain_len, data + 1, 4);
+        plain_len = pg_ntoh32(plain_len);
+        if (plain_len > MaxAllocSize) {
+            return -1;
+        }
+        plain = palloc(plain_len);
+        if (etf_inflate(data + 5, len - 5, plain, plain_len) < 0) {
+            return -1;
+        }
+        data = plain;
+        len = (int) plain_len;
+    }
+    if (len < 1) {
+        return -1;
+    }
+    tag = (uint8) data[0];
+    if (tag != ERL_LIST_EXT && tag != ERL_NIL_EXT && tag != ERL_STRING_EXT) {
+        return -1;
+    }
+    /*
+     * The bytes come from the caller, so walk them within bounds before ei
+     * ever sees them. A malformed term is reported as -1, leaving the caller
+     * to free its buffer and raise its own error.
+     */
+    d.buf = data;
+    d.len = len;
+    d.index = 0;
+    d.state = NULL;
+    PG_TRY();
+    {
+        etf_skip((EtfDecoder *) &d);
+    }
+    PG_CATCH();
+    {
+        MemoryContextSwitchTo(oldcontext);
+        FlushErrorState();
+        d.index = -1;
+    }
+    PG_END_TRY();
+    if (d.index != len) {
+        return -1;
     }
+    return ei_x_append_buf(buf, data, len);
 }
 
 // Helper function to encode a simple list of arguments
@@ -101,6 +101,148 @@ SELECT assert_equals(
     '2.5 - Call with 1 second timeout'
 );
 
+-- Test 2.6: Batched calls return results in call order
+DO $$
+DECLARE
+    result jsonb;
+BEGIN
+    result := erlang_call_batch('testnode@127.0.1.1', '[
+        {"module": "erlang", "function": "node"},
+        ["erlang", "date", []],
+        {"module": "lists", "function": "seq", "args": [1, 3]}
+    ]'::jsonb, 5000);
+    
+    IF jsonb_array_length(result) = 3 AND
+       result->>0 = 'testnode@127.0.1.1' AND
+       jsonb_array_length(result->1) = 3 AND
+       result->2 = '[1, 2, 3]'::jsonb THEN
+        RAISE NOTICE 'Test 2.6 - Batched calls passed: %', result;
+    ELSE
+        RAISE EXCEPTION 'Test 2.6 - Batched calls failed: %', result;
+    END IF;
+END $$;
+
+-- Test 2.7: Multicall returns one row per node
+DO $$
+DECLARE
+    ok_count int;
+    missing_status text;
+BEGIN
+    SELECT count(*) INTO ok_count
+    FROM erlang_multicall(ARRAY['testnode@127.0.1.1'], 'erlang', 'node', '[]'::jsonb, 5000)
+    WHERE status = 'ok' AND result::text = '"testnode@127.0.1.1"';
+    
+    SELECT status INTO missing_status
+    FROM erlang_multicall(ARRAY['nonexistent@127.0.1.1'], 'erlang', 'node', '[]'::jsonb, 1000);
+    
+    IF ok_count = 1 AND missing_status = 'not_connected' THEN
+        RAISE NOTICE 'Test 2.7 - Multicall passed';
+    ELSE
+        RAISE EXCEPTION 'Test 2.7 - Multicall failed: ok=% missing=%', ok_count, missing_status;
+    END IF;
+END $$;
+
+-- Test 2.8: Raw ETF call and cast
+SELECT assert_equals(
+    erlang_etf_to_jsonb(erlang_call_etf(:'node_name', 'lists', 'reverse', erlang_jsonb_to_etf('[[1, 2, 3]]'), 5000)),
+    '[3, 2, 1]'::jsonb,
+    '2.8 - Raw ETF call'
+);
+
+-- A list whose pid claims a node name longer than the input is refused
+DO $$
+BEGIN
+    PERFORM erlang_call_etf('testnode@127.0.1.1', 'erlang', 'is_pid', '\x836c00000001676400ff'::bytea, 5000);
+    RAISE EXCEPTION 'Test 2.8 - truncated args_etf was accepted';
+EXCEPTION WHEN invalid_parameter_value THEN
+    RAISE NOTICE 'Test 2.8 - Truncated args_etf rejected';
+END $$;
+
+SELECT assert_equals(
+    erlang_cast_etf(:'node_name', 'erlang', 'garbage_collect', '\x836a'::bytea)::text,
+    'true',
+    '2.9 - Raw ETF cast'
+);
+
+-- Test 2.10: Binary payloads go out and come back without truncation
+SELECT assert_equals(
+    erlang_call_with_binary(:'node_name', 'erlang', 'byte_size', '[]'::jsonb, convert_to(repeat('x', 100000), 'UTF8'), 5000),
+    '100000'::jsonb,
+    '2.10 - Binary argument'
+);
+
+SELECT assert_equals(
+    length(erlang_call(:'node_name', 'binary', 'copy',
+                       '[{"$type": "binary", "data": "ab"}, 50000]'::jsonb, 5000) #>> '{}'),
+    100000,
+    '2.11 - Binary result is not truncated'
+);
+
+-- Test 2.12: gen_server call straight to a registered process
+DO $$
+DECLARE
+    result jsonb;
+BEGIN
+    result := erlang_gen_call('testnode@127.0.1.1', 'application_controller',
+                              '{"$type": "atom", "value": "which_applications"}'::jsonb, 5000);
+    IF EXISTS (SELECT 1 FROM jsonb_array_elements(result) app WHERE app->>0 = 'kernel') THEN
+        RAISE NOTICE 'Test 2.12 - gen_call passed';
+    ELSE
+        RAISE EXCEPTION 'Test 2.12 - gen_call failed: %', result;
+    END IF;
+END $$;
+
+-- Test 2.13: Per-row calls through the pipelining aggregate keep input order
+SELECT assert_equals(
+    (SELECT erlang_call_agg(:'node_name', 'erlang', 'abs', jsonb_build_array(-g), 16 ORDER BY g)
+     FROM generate_series(1, 100) g),
+    (SELECT jsonb_agg(g ORDER BY g) FROM generate_series(1, 100) g),
+    '2.13 - Call aggregate'
+);
+SELECT assert_equals(
+    (SELECT erlang_call_agg(:'node_name', 'erlang', 'abs', jsonb_build_array(-g), 4, 1000 ORDER BY g)
+     FROM generate_series(1, 10) g),
+    (SELECT jsonb_agg(g ORDER BY g) FROM generate_series(1, 10) g),
+    '2.13b - Call aggregate with timeout'
+);
+
+-- Test 2.13c: The aggregate over a pooled connection (needs shared_preload_libraries)
+SELECT erlang_disconnect(:'node_name');
+SET erlang_cnode.use_pool = on;
+SELECT erlang_connect(:'node_name', :'cookie');
+SELECT assert_equals(
+    (SELECT erlang_call_agg(:'node_name', 'erlang', 'abs', jsonb_build_array(-g), 4 ORDER BY g)
+     FROM generate_series(1, 20) g),
+    (SELECT jsonb_agg(g ORDER BY g) FROM generate_series(1, 20) g),
+    '2.13c - Call aggregate over a pooled connection'
+);
+SELECT erlang_disconnect(:'node_name');
+RESET erlang_cnode.use_pool;
+SELECT erlang_connect(:'node_name', :'cookie');
+
+-- Test 2.14: Typed calls decode results without JSONB
+SELECT assert_equals(erlang_call_int8(:'node_name', 'erlang', 'length', '[[1, 2, 3]]'), 3::bigint, '2.14a - int8 result');
+SELECT assert_equals(erlang_call_float8(:'node_name', 'math', 'sqrt', '[4]'), 2::float8, '2.14b - float8 result');
+SELECT assert_equals(erlang_call_text(:'node_name', 'erlang', 'node', '[]'), :'node_name', '2.14c - text result');
+SELECT assert_equals(erlang_call_bool(:'node_name', 'erlang', 'is_list', '[[]]'), true, '2.14d - bool result');
+SELECT assert_equals(erlang_call_int8_array(:'node_name', 'lists', 'seq', '[1, 5]'),
+                     ARRAY[1, 2, 3, 4, 5]::bigint[], '2.14e - int8[] from a list');
+SELECT assert_equals(erlang_call_int8_array(:'node_name', 'erlang', 'list_to_binary',
+                                            '[[[0, 0, 0, 0, 0, 0, 0, 7], [255, 255, 255, 255, 255, 255, 255, 255]]]'),
+                     ARRAY[7, -1]::bigint[], '2.14f - int8[] from a packed binary');
+SELECT assert_equals(erlang_call_float8_array(:'node_name', 'lists', 'seq', '[1, 3]'),
+                     ARRAY[1, 2, 3]::float8[], '2.14g - float8[] from integers');
+SELECT assert_equals(erlang_call_bytea_array(:'node_name', 'binary', 'split',
+                                             '[{"$type": "binary", "data": "a,b"}, {"$type": "binary", "data": ","}]'),
+                     ARRAY['\x61', '\x62']::bytea[], '2.14h - bytea[] result');
+DO $$
+BEGIN
+    PERFORM erlang_call_int8('testnode@127.0.1.1', 'erlang', 'node', '[]');
+    RAISE EXCEPTION 'Test 2.14i - non-integer result was accepted';
+EXCEPTION WHEN datatype_mismatch THEN
+    RAISE NOTICE 'Test 2.14i - Type mismatch rejected';
+END $$;
+
 \echo ''
 \echo '=== Test 3: Asynchronous RPC Calls ==='
 
@@ -179,6 +321,45 @@ BEGIN
     END IF;
 END $$;
 
+-- Test 3.5: Replies collected in reverse send order are matched by reference
+DO $$
+DECLARE
+    req1 bigint;
+    req2 bigint;
+    res1 jsonb;
+    res2 jsonb;
+BEGIN
+    req1 := erlang_send_async('testnode@127.0.1.1', 'erlang', 'node', '[]'::jsonb);
+    req2 := erlang_send_async('testnode@127.0.1.1', 'erlang', 'date', '[]'::jsonb);
+    
+    res2 := erlang_receive_async(req2, 5000);
+    res1 := erlang_receive_async(req1, 5000);
+    
+    IF res1::text = '"testnode@127.0.1.1"' AND jsonb_array_length(res2) = 3 THEN
+        RAISE NOTICE 'Test 3.5 - Out-of-order receive passed';
+    ELSE
+        RAISE EXCEPTION 'Test 3.5 - Out-of-order receive failed: % / %', res1, res2;
+    END IF;
+END $$;
+
+-- Test 3.6: receive_any hands back the fast reply first, then the slow one
+DO $$
+DECLARE
+    slow bigint := erlang_send_async('testnode@127.0.1.1', 'timer', 'sleep', '[300]'::jsonb);
+    fast bigint := erlang_send_async('testnode@127.0.1.1', 'erlang', 'node', '[]'::jsonb);
+    first_ids bigint[];
+    rest_ids bigint[];
+BEGIN
+    SELECT array_agg(request_id) INTO first_ids FROM erlang_receive_any(ARRAY[slow, fast], 5000);
+    SELECT array_agg(request_id) INTO rest_ids FROM erlang_receive_any(ARRAY[slow, fast], 5000);
+    IF first_ids = ARRAY[fast] AND rest_ids = ARRAY[slow]
+       AND NOT EXISTS (SELECT 1 FROM erlang_receive_any(ARRAY[slow, fast], 0)) THEN
+        RAISE NOTICE 'Test 3.6 - Receive any passed';
+    ELSE
+        RAISE EXCEPTION 'Test 3.6 - Receive any failed: % / %', first_ids, rest_ids;
+    END IF;
+END $$;
+
 \echo ''
 \echo '=== Test 4: Fire-and-forget Cast ==='
 
@@ -189,6 +370,13 @@ SELECT assert_equals(
     '4.1 - Cast message'
 );
 
+-- Test 4.2: Send to a registered name (dropped by the node if nobody is registered)
+SELECT assert_equals(
+    erlang_send(:'node_name', 'pg_erl_test_sink', '{"$type": "tuple", "elements": ["hello", 1]}'::jsonb)::text,
+    'true',
+    '4.2 - Send to registered name'
+);
+
 \echo ''
 \echo '=== Test 5: Monitoring Functions ==='
 
@@ -235,6 +423,51 @@ EXCEPTION
         RAISE NOTICE 'Test 6.2 - Invalid request ID error handling passed';
 END $$;
 
+-- Test 6.3: statement_timeout interrupts a call stuck waiting for its reply,
+-- and the cancelled call is not left pending
+SET statement_timeout = '200ms';
+DO $$
+DECLARE
+    started timestamptz := clock_timestamp();
+    pending_before int := erlang_pending_requests();
+BEGIN
+    PERFORM erlang_call('testnode@127.0.1.1', 'timer', 'sleep', '[10000]'::jsonb, 30000);
+    RAISE EXCEPTION 'Test 6.3 should have been cancelled';
+EXCEPTION
+    WHEN query_canceled THEN
+        IF clock_timestamp() - started < interval '2 seconds' AND
+           erlang_pending_requests() = pending_before THEN
+            RAISE NOTICE 'Test 6.3 - Cancel during call passed';
+        ELSE
+            RAISE EXCEPTION 'Test 6.3 - Cancel took %, % requests pending',
+                clock_timestamp() - started, erlang_pending_requests();
+        END IF;
+END $$;
+RESET statement_timeout;
+
+-- Test 6.4: The async request cap is enforced and collected replies are forgotten
+SET erlang_cnode.max_async_requests = 2;
+DO $$
+DECLARE
+    req1 bigint := erlang_send_async('testnode@127.0.1.1', 'timer', 'sleep', '[200]'::jsonb);
+    req2 bigint := erlang_send_async('testnode@127.0.1.1', 'timer', 'sleep', '[200]'::jsonb);
+BEGIN
+    BEGIN
+        PERFORM erlang_send_async('testnode@127.0.1.1', 'erlang', 'node', '[]'::jsonb);
+        RAISE EXCEPTION 'Test 6.4 - third request should have been refused';
+    EXCEPTION
+        WHEN configuration_limit_exceeded THEN
+            NULL;
+    END;
+    PERFORM erlang_receive_async(req1, 5000);
+    PERFORM erlang_receive_async(req2, 5000);
+    IF EXISTS (SELECT 1 FROM erlang_async_requests() WHERE request_id IN (req1, req2)) THEN
+        RAISE EXCEPTION 'Test 6.4 - collected requests still held';
+    END IF;
+    RAISE NOTICE 'Test 6.4 - Async request cap passed';
+END $$;
+RESET erlang_cnode.max_async_requests;
+
 \echo ''
 \echo '=== Test 7: Data Type Support ==='
 
@@ -273,6 +506,103 @@ BEGIN
     END IF;
 END $$;
 
+-- Test 7.3: Raw ETF decoding (no node needed)
+-- [1, 256, {ok, <<"hi">>}, #{a => "xy"}, -5, 1.5]
+SELECT assert_equals(
+    erlang_etf_to_jsonb('\x836c0000000661016200000100680277026f6b6d00000002686974000000017701616b0002787962fffffffb463ff80000000000006a'::bytea),
+    '[1, 256, ["ok", "hi"], {"a": [120, 121]}, -5, 1.5]'::jsonb,
+    '7.3 - ETF decoding'
+);
+
+-- Test 7.3a: A binary that is not text is refused instead of producing invalid JSONB (<<255, 0>>)
+DO $$
+BEGIN
+    PERFORM erlang_etf_to_jsonb('\x836d00000002ff00'::bytea);
+    RAISE EXCEPTION 'Test 7.3a - non-text binary was accepted';
+EXCEPTION WHEN untranslatable_character THEN
+    RAISE NOTICE 'Test 7.3a - Non-text binary rejected';
+END $$;
+
+-- Test 7.3b: Exact numeric round trip, including 64-bit IDs and bignums
+SELECT assert_equals(
+    erlang_etf_to_jsonb(erlang_jsonb_to_etf(
+        '[9007199254740993, -9223372036854775808, 18446744073709551616, -123456789012345678901234567890, 100000000, 0, 1.5]'::jsonb)),
+    '[9007199254740993, -9223372036854775808, 18446744073709551616, -123456789012345678901234567890, 100000000, 0, 1.5]'::jsonb,
+    '7.3b - Exact numeric round trip'
+);
+
+SELECT assert_equals(
+    erlang_jsonb_to_etf('[1.0, 2.00, 0.0, 2]'::jsonb),
+    '\x836c00000004463ff000000000000046400000000000000046000000000000000061026a'::bytea,
+    '7.3b - Numbers written with a decimal point stay floats'
+);
+
+-- Test 7.3c: Compressed terms, as term_to_binary(T, [compressed]) produces them
+SET erlang_cnode.compress_threshold = 64;
+SELECT assert_equals(
+    get_byte(erlang_jsonb_to_etf((SELECT jsonb_agg(i % 10) FROM generate_series(1, 1000) i)), 1),
+    80,
+    '7.3c - Large terms are compressed'
+);
+
+SELECT assert_equals(
+    erlang_etf_to_jsonb(erlang_jsonb_to_etf((SELECT jsonb_agg(i % 10) FROM generate_series(1, 1000) i))),
+    (SELECT jsonb_agg(i % 10) FROM generate_series(1, 1000) i),
+    '7.3c - Compressed ETF decoding'
+);
+
+SELECT assert_equals(
+    erlang_call_with_binary(:'node_name', 'erlang', 'binary_to_term', '[]'::jsonb,
+                            erlang_jsonb_to_etf((SELECT jsonb_agg(i % 10) FROM generate_series(1, 1000) i))),
+    (SELECT jsonb_agg(i % 10) FROM generate_series(1, 1000) i),
+    '7.3c - Erlang decodes compressed terms'
+);
+
+SELECT assert_equals(
+    erlang_etf_to_jsonb(erlang_call_etf(:'node_name', 'lists', 'sum',
+        erlang_jsonb_to_etf((SELECT jsonb_build_array(jsonb_agg(i % 10)) FROM generate_series(1, 1000) i)))),
+    '4500'::jsonb,
+    '7.3c - Compressed arguments are inflated before sending'
+);
+RESET erlang_cnode.compress_threshold;
+
+-- Test 7.3d: Lengths inside pids, refs and funs are checked against the input (pid with a 65535-byte node name)
+DO $$
+BEGIN
+    PERFORM erlang_etf_to_jsonb('\x836764ffff41'::bytea);
+    RAISE EXCEPTION 'Test 7.3d - truncated pid was accepted';
+EXCEPTION WHEN invalid_binary_representation THEN
+    RAISE NOTICE 'Test 7.3d - Truncated pid rejected';
+END $$;
+
+-- Test 7.3e: Latin-1 atoms ('é' as ATOM_EXT) come out as text in the database encoding
+SELECT assert_equals(
+    erlang_etf_to_jsonb('\x83640001e9'::bytea),
+    '"é"'::jsonb,
+    '7.3e - Latin-1 atom'
+);
+
+-- Test 7.4: Nested arguments, maps and $type objects round-trip through the encoder
+SELECT assert_equals(
+    erlang_call(:'node_name', 'lists', 'reverse',
+                '[[1, [2, 3], {"$type": "atom", "value": "x"}]]'::jsonb, 5000),
+    '["x", [2, 3], 1]'::jsonb,
+    '7.4 - Nested argument encoding'
+);
+
+SELECT assert_equals(
+    erlang_call(:'node_name', 'erlang', 'map_size', '[{"a": 1, "b": [], "c": {"d": null}}]'::jsonb, 5000),
+    '3'::jsonb,
+    '7.5 - Map argument encoding'
+);
+
+SELECT assert_equals(
+    erlang_call(:'node_name', 'erlang', 'element',
+                '[2, {"$type": "tuple", "elements": [{"$type": "atom", "value": "a"}, true]}]'::jsonb, 5000),
+    '"true"'::jsonb,
+    '7.6 - Tuple argument encoding'
+);
+
 \echo ''
 \echo '=== Test 8: Connection Lifecycle ==='
 
@@ -297,6 +627,83 @@ SELECT assert_equals(
     '8.3 - Reconnect after disconnect'
 );
 
+-- Test 8.4: Nodes listed in erlang_cnode.nodes connect on first use
+SELECT erlang_disconnect(:'node_name');
+SET erlang_cnode.nodes = :'node_name';
+SET erlang_cnode.cookie = :'cookie';
+SELECT assert_equals(
+    erlang_call(:'node_name', 'erlang', 'node', '[]'::jsonb, 5000)::text,
+    '"testnode@127.0.1.1"',
+    '8.4 - Lazy connect from erlang_cnode.nodes'
+);
+
+-- Test 8.5: Connect with the configured cookie
+SELECT erlang_disconnect(:'node_name');
+SELECT assert_equals(
+    erlang_connect(:'node_name')::text,
+    'true',
+    '8.5 - Connect with configured cookie'
+);
+
+-- Test 8.6: A node group fails over past an unreachable member
+SET erlang_cnode.node_groups = 'replicas=nosuchnode@127.0.1.1|testnode@127.0.1.1';
+SELECT assert_equals(
+    erlang_call('replicas', 'erlang', 'node', '[]'::jsonb, 5000)::text,
+    '"testnode@127.0.1.1"',
+    '8.6 - Node group skips unreachable member'
+);
+RESET erlang_cnode.node_groups;
+RESET erlang_cnode.nodes;
+RESET erlang_cnode.cookie;
+
+-- Test 8.7: Cached results are served until invalidated (needs shared_preload_libraries)
+SET erlang_cnode.cache_functions = 'erlang:node=60s';
+SELECT erlang_cache_invalidate();
+SELECT erlang_call(:'node_name', 'erlang', 'node', '[]'::jsonb, 5000);
+SELECT assert_equals(
+    erlang_call(:'node_name', 'erlang', 'node', '[]'::jsonb, 5000)::text,
+    '"testnode@127.0.1.1"',
+    '8.7 - Cached result'
+);
+SELECT assert_equals(
+    (SELECT hits >= 1 FROM erlang_cache_stats()),
+    true,
+    '8.7 - Cache hit counted'
+);
+SELECT assert_equals(
+    erlang_cache_invalidate('erlang', 'node'),
+    1::bigint,
+    '8.7 - Invalidate drops the entry'
+);
+RESET erlang_cnode.cache_functions;
+
+-- Test 8.8: A parallel worker connects on its own to a node the leader connected to
+SET max_parallel_workers_per_gather = 2;
+SET debug_parallel_query = on;
+SELECT assert_equals(
+    erlang_call(:'node_name', 'erlang', 'node', '[]'::jsonb, 5000)::text,
+    '"testnode@127.0.1.1"',
+    '8.8 - Call from a parallel worker'
+);
+
+-- Test 8.9: A rolled-back erlang_connect still reaches parallel workers, and no setting holds the cookie
+SELECT erlang_disconnect(:'node_name');
+BEGIN;
+SELECT erlang_connect(:'node_name', :'cookie');
+ROLLBACK;
+SELECT assert_equals(
+    erlang_call(:'node_name', 'erlang', 'node', '[]'::jsonb, 5000)::text,
+    '"testnode@127.0.1.1"',
+    '8.9 - Parallel call after rolled-back connect'
+);
+SELECT assert_equals(
+    current_setting('erlang_cnode.session_segment') LIKE '%' || :'cookie' || '%',
+    false,
+    '8.9 - Cookie not exposed through a setting'
+);
+RESET debug_parallel_query;
+RESET max_parallel_workers_per_gather;
+
 \echo ''
 \echo '=== Test 9: Ping Test ==='
 
@@ -359,6 +766,116 @@ BEGIN
     END IF;
 END $$;
 
+\echo ''
+\echo '=== Test 11: Foreign Tables ==='
+
+-- Test 11.1: An ETS table read in small pages returns every row
+CREATE SERVER erlang_test_server FOREIGN DATA WRAPPER erlang_fdw
+    OPTIONS (node 'testnode@127.0.1.1', page_size '5');
+CREATE FOREIGN TABLE erlang_ac_tab (key jsonb, value jsonb)
+    SERVER erlang_test_server OPTIONS (table 'ac_tab');
+SELECT assert_equals(
+    (SELECT count(*) FROM erlang_ac_tab),
+    (erlang_call(:'node_name', 'ets', 'info',
+                 '[{"$type": "atom", "value": "ac_tab"}, {"$type": "atom", "value": "size"}]'::jsonb))::text::bigint,
+    '11.1 - Paged foreign scan'
+);
+
+-- Test 11.2: Filters are applied whether or not they were pushed down
+SELECT assert_equals(
+    (SELECT count(*) > 0 FROM erlang_ac_tab WHERE key->>0 = 'loaded' AND key->>1 = 'kernel'),
+    true,
+    '11.2 - Filtered foreign scan'
+);
+
+-- Test 11.3: Pushed guards keep map rows and tuples wider than the table
+SELECT assert_equals(
+    erlang_call(:'node_name', 'file', 'write_file', jsonb_build_array('/tmp/pg_fdw_rows.erl',
+        '-module(pg_fdw_rows). -export([select/3]). '
+        'select(_, MS, _) -> {ets:match_spec_run([#{id => 1, name => a}, #{id => 2, name => b}, {3, c, extra}], '
+        'ets:match_spec_compile(MS)), ''$end_of_table''}.')),
+    '"ok"'::jsonb,
+    '11.3 - Write row module'
+);
+SELECT erlang_call(:'node_name', 'c', 'c',
+                   '["/tmp/pg_fdw_rows.erl", [{"$type": "tuple", "elements": [{"$type": "atom", "value": "outdir"}, "/tmp"]}]]');
+CREATE FOREIGN TABLE erlang_mixed_rows (id bigint, name text)
+    SERVER erlang_test_server OPTIONS (table 'rows', module 'pg_fdw_rows', function 'select');
+SELECT assert_equals((SELECT name FROM erlang_mixed_rows WHERE id = 2), 'b', '11.3 - Map row with pushed guard');
+SELECT assert_equals((SELECT name FROM erlang_mixed_rows WHERE id = 3), 'c', '11.3 - Wide tuple with pushed guard');
+SELECT assert_equals((SELECT count(*) FROM erlang_mixed_rows WHERE name <> 'a'), 2::bigint, '11.3 - Text guard');
+DROP SERVER erlang_test_server CASCADE;
+
+\echo ''
+\echo '=== Test 12: erlang_term ==='
+
+-- Test 12.1: Erlang literal syntax reads back as written
+SELECT assert_equals(
+    '{ok,[1,2,3],"hi",<<"bin">>,<<1,2>>,-5,1.5,18446744073709551616,''quoted atom'',#{a => []}}'::erlang_term::text,
+    '{ok,[1,2,3],"hi",<<"bin">>,<<1,2>>,-5,1.5,18446744073709551616,''quoted atom'',#{a => []}}',
+    '12.1 - erlang_term text round trip'
+);
+
+-- Test 12.2: Accessors on tuples, maps and lists
+SELECT assert_equals(
+    '{ok,#{id => 42,name => <<"ada">>}}'::erlang_term -> 2 ->> 'name',
+    'ada',
+    '12.2 - Tuple element and map field'
+);
+
+SELECT assert_equals(
+    ('{ok,#{id => 42,name => <<"ada">>}}'::erlang_term -> 2 -> 'id')::text,
+    '42',
+    '12.2 - Map field as erlang_term'
+);
+
+SELECT assert_equals(
+    '[a,b,c]'::erlang_term ->> 3,
+    'c',
+    '12.2 - List element'
+);
+
+SELECT assert_equals(
+    ('{a}'::erlang_term -> 5) IS NULL,
+    true,
+    '12.2 - Missing element'
+);
+
+-- Test 12.3: Casts to and from jsonb and bytea
+SELECT assert_equals(
+    '{ok,[1,2]}'::erlang_term::jsonb,
+    '["ok", [1, 2]]'::jsonb,
+    '12.3 - erlang_term to jsonb'
+);
+
+SELECT assert_equals(
+    erlang_jsonb_to_etf('[1, {"a": 2}]')::erlang_term::text,
+    '[1,#{"a" => 2}]',
+    '12.3 - bytea to erlang_term'
+);
+
+-- Test 12.4: Calls on erlang_term values
+SELECT assert_equals(
+    erlang_call_term(:'node_name', 'lists', 'keyfind', '[b, 1, [{a, 1}, {b, 2}]]')::text,
+    '{b,2}',
+    '12.4 - erlang_call_term'
+);
+
+-- Test 12.5: Pids, refs and funs are checked within bounds before they are stored or printed
+DO $$
+BEGIN
+    PERFORM '\x836764ffff41'::bytea::erlang_term;
+    RAISE EXCEPTION 'Test 12.5 - truncated pid was accepted';
+EXCEPTION WHEN invalid_binary_representation THEN
+    RAISE NOTICE 'Test 12.5 - Truncated pid rejected';
+END $$;
+
+SELECT assert_equals(
+    erlang_call_term(:'node_name', 'erlang', 'make_ref', '[]')::text <> '',
+    true,
+    '12.5 - Reference from a node prints'
+);
+
 \echo ''
 \echo '=== Cleanup ==='
 